@@ -0,0 +1,422 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "grokpatternset.hpp"
+#include "grokregex.hpp"
+#include "grokmatch.hpp"
+
+/* Benchmarks for the pieces grok spends its time in: compiling patterns,
+ * GrokRegex::Search for each pattern in 'patterns', ExpandString and
+ * ToJSON, predicates, and the grok binary end to end.
+ *
+ * Every benchmark takes a number of samples and reports the median and
+ * slowest (max) time per operation. With -b, results are compared with
+ * a baseline written earlier with -o, and any benchmark whose median got
+ * more than -t percent slower is reported; the exit status is then 1. */
+
+#define BENCH_DEFAULT_SAMPLES 50
+#define BENCH_DEFAULT_THRESHOLD 10.0
+#define BENCH_CORPUS_LINES 20000
+
+struct BenchResult {
+  string name;
+  double median; /* nanoseconds per op */
+  double max;
+};
+
+double Now() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec / 1e6;
+}
+
+/* 'samples' are seconds for 'ops' operations each */
+BenchResult Summarize(const string &name, vector<double> &samples, long ops) {
+  BenchResult result;
+  sort(samples.begin(), samples.end());
+  result.name = name;
+  result.median = samples[samples.size() / 2] * 1e9 / ops;
+  result.max = samples.back() * 1e9 / ops;
+  return result;
+}
+
+/* A mix of syslog (sshd, cron, postfix) and apache lines. Deterministic,
+ * so runs compare; use -c to benchmark with real logs instead. */
+void GenerateCorpus(vector<string> &lines) {
+  static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  static const char *users[] = { "root", "admin", "jls", "test", "oracle" };
+  char buf[512];
+
+  srandom(1);
+  for (int i = 0; i < BENCH_CORPUS_LINES; i++) {
+    const char *month = months[random() % 12];
+    int day = random() % 28 + 1;
+    int hour = random() % 24, min = random() % 60, sec = random() % 60;
+    int a = random() % 256, b = random() % 256, c = random() % 256;
+    const char *user = users[random() % 5];
+
+    switch (random() % 5) {
+      case 0:
+      case 1:
+        snprintf(buf, sizeof(buf), "%s %2d %02d:%02d:%02d myhost sshd[%ld]: "
+                 "Failed password for %s from 10.%d.%d.%d port %ld ssh2",
+                 month, day, hour, min, sec, random() % 30000, user, a, b, c,
+                 random() % 65536);
+        break;
+      case 2:
+        snprintf(buf, sizeof(buf), "%s %2d %02d:%02d:%02d myhost "
+                 "postfix/smtpd[%ld]: connect from mail%d.example.com"
+                 "[192.168.%d.%d]", month, day, hour, min, sec,
+                 random() % 30000, a, b, c);
+        break;
+      case 3:
+        snprintf(buf, sizeof(buf), "%s %2d %02d:%02d:%02d myhost "
+                 "CRON[%ld]: (%s) CMD (run-parts /etc/cron.hourly)",
+                 month, day, hour, min, sec, random() % 30000, user);
+        break;
+      default:
+        snprintf(buf, sizeof(buf), "172.16.%d.%d - - [%02d/%s/2008:%02d:%02d"
+                 ":%02d -0700] \"GET /a/b%d.html?x=%d HTTP/1.1\" %d %ld "
+                 "\"http://example.com/\" \"Mozilla/5.0 (X11; U; Linux)\"",
+                 a, b, day, month, hour, min, sec, c, a, (b % 2 ? 200 : 404),
+                 random() % 100000);
+    }
+    lines.push_back(buf);
+  }
+}
+
+/* Does a prefix given on the command line pick benchmark 'name'? None
+ * picks everything. */
+bool Wanted(const vector<string> &prefixes, const string &name) {
+  if (prefixes.empty())
+    return true;
+  for (unsigned int i = 0; i < prefixes.size(); i++) {
+    if (name.compare(0, prefixes[i].size(), prefixes[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Could any benchmark in 'group' ("search" for search/...) be wanted?
+ * True for a prefix of the group name or of a name in it. */
+bool GroupWanted(const vector<string> &prefixes, const string &group) {
+  if (prefixes.empty())
+    return true;
+  for (unsigned int i = 0; i < prefixes.size(); i++) {
+    if (group.compare(0, prefixes[i].size(), prefixes[i]) == 0
+        || prefixes[i].compare(0, group.size() + 1, group + "/") == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Time GrokRegex::Search of 'pattern' over every line, per line */
+BenchResult BenchSearch(const string &name, const string &pattern,
+                        const GrokPatternSet<grok_regex_type> &pset,
+                        const vector<string> &lines, int samples) {
+  GrokRegex<grok_regex_type> gre;
+  GrokMatch<grok_regex_type> gm;
+  vector<double> times;
+  vector<string>::const_iterator iter;
+
+  gre.AddPatternSet(pset);
+  gre.SetRegex(pattern);
+  for (int i = 0; i < samples; i++) {
+    double start = Now();
+    for (iter = lines.begin(); iter != lines.end(); iter++)
+      gre.Search((*iter).begin(), (*iter).end(), gm);
+    times.push_back(Now() - start);
+  }
+  return Summarize(name, times, lines.size());
+}
+
+void BenchCompile(const GrokPatternSet<grok_regex_type> &pset, int samples,
+                  const vector<string> &prefixes,
+                  vector<BenchResult> &results) {
+  GrokPatternSet<grok_regex_type>::pattern_set_type::const_iterator iter;
+
+  for (iter = pset.patterns.begin(); iter != pset.patterns.end(); iter++) {
+    vector<double> times;
+    if (!Wanted(prefixes, "compile/" + (*iter).first))
+      continue;
+    for (int i = 0; i < samples; i++) {
+      double start = Now();
+      GrokRegex<grok_regex_type> gre;
+      gre.AddPatternSet(pset);
+      gre.SetRegex("%" + (*iter).first + "%");
+      times.push_back(Now() - start);
+    }
+    results.push_back(Summarize("compile/" + (*iter).first, times, 1));
+  }
+}
+
+void BenchSearchPatterns(const GrokPatternSet<grok_regex_type> &pset,
+                         const vector<string> &lines, int samples,
+                         const vector<string> &prefixes,
+                         vector<BenchResult> &results) {
+  GrokPatternSet<grok_regex_type>::pattern_set_type::const_iterator iter;
+
+  for (iter = pset.patterns.begin(); iter != pset.patterns.end(); iter++) {
+    if (!Wanted(prefixes, "search/" + (*iter).first))
+      continue;
+    results.push_back(BenchSearch("search/" + (*iter).first,
+                                  "%" + (*iter).first + "%", pset, lines,
+                                  samples));
+  }
+}
+
+/* A predicate's cost is the difference from the same search without it */
+void BenchPredicates(const GrokPatternSet<grok_regex_type> &pset,
+                     const vector<string> &lines, int samples,
+                     const vector<string> &prefixes,
+                     vector<BenchResult> &results) {
+  const char *patterns[][2] = {
+    { "predicate/none", "port %INT:port%" },
+    { "predicate/int", "port %INT:port>1024%" },
+    { "predicate/string", "for %WORD:user==root%" },
+    { "predicate/regex", "from %IP:ip=~^10\\.%" },
+    { NULL, NULL },
+  };
+
+  for (int i = 0; patterns[i][0] != NULL; i++) {
+    if (Wanted(prefixes, patterns[i][0]))
+      results.push_back(BenchSearch(patterns[i][0], patterns[i][1], pset,
+                                    lines, samples));
+  }
+}
+
+void BenchExpand(const GrokPatternSet<grok_regex_type> &pset,
+                 const vector<string> &lines, int samples,
+                 const vector<string> &prefixes,
+                 vector<BenchResult> &results) {
+  GrokRegex<grok_regex_type> gre;
+  GrokMatch<grok_regex_type> gm;
+  vector<double> expand_times, json_times;
+  string expand = "%SYSLOGPROG% %IP% user=%WORD:user% %=LINE%";
+  string out;
+  unsigned int i;
+
+  gre.AddPatternSet(pset);
+  gre.SetRegex("%SYSLOGBASE% Failed password for %WORD:user% from %IP%");
+  for (i = 0; i < lines.size(); i++) {
+    if (gre.Search(lines[i], gm))
+      break;
+  }
+  if (i == lines.size()) {
+    cerr << "No sshd line in the corpus; skipping expandstring/tojson" << endl;
+    return;
+  }
+
+  for (int n = 0; n < samples; n++) {
+    double start = Now();
+    for (int j = 0; j < 1000; j++)
+      gm.ExpandString(expand, out);
+    expand_times.push_back(Now() - start);
+
+    start = Now();
+    for (int j = 0; j < 1000; j++)
+      gm.ToJSON(out);
+    json_times.push_back(Now() - start);
+  }
+  if (Wanted(prefixes, "expandstring"))
+    results.push_back(Summarize("expandstring", expand_times, 1000));
+  if (Wanted(prefixes, "tojson"))
+    results.push_back(Summarize("tojson", json_times, 1000));
+}
+
+/* The grok binary over the corpus, per line */
+void BenchEndToEnd(const string &grok, const vector<string> &lines,
+                   int samples, const vector<string> &prefixes,
+                   vector<BenchResult> &results) {
+  const char *runs[][3] = {
+    { "endtoend/sshd", "Failed password for %WORD:user% from %IP%",
+      "%user% %IP%" },
+    { "endtoend/syslogbase", "%SYSLOGBASE% %DATA%", "%PROG% %=LINE%" },
+    { "endtoend/apache", "%IP% - - \\[%HTTPDATE%\\] \"%WORD% %URIPATHPARAM%",
+      "%IP% %URIPATHPARAM%" },
+    { NULL, NULL, NULL },
+  };
+  char corpus[] = "/tmp/grokbench.XXXXXX";
+  int fd = mkstemp(corpus);
+  FILE *fp;
+
+  if (fd == -1) {
+    cerr << "mkstemp failed: " << strerror(errno) << endl;
+    return;
+  }
+  fp = fdopen(fd, "w");
+  for (unsigned int i = 0; i < lines.size(); i++)
+    fprintf(fp, "%s\n", lines[i].c_str());
+  fclose(fp);
+
+  /* fewer samples; each is a whole run */
+  samples = (samples + 4) / 5;
+  for (int i = 0; runs[i][0] != NULL; i++) {
+    vector<double> times;
+    if (!Wanted(prefixes, runs[i][0]))
+      continue;
+    string cmd = grok + " -m '" + runs[i][1] + "' -r '" + runs[i][2]
+                 + "' < " + corpus + " > /dev/null 2>&1";
+    for (int j = 0; j < samples; j++) {
+      double start = Now();
+      if (system(cmd.c_str()) != 0) {
+        cerr << "Failed: " << cmd << endl;
+        break;
+      }
+      times.push_back(Now() - start);
+    }
+    if (times.size() > 0)
+      results.push_back(Summarize(runs[i][0], times, lines.size()));
+  }
+  unlink(corpus);
+}
+
+void LoadBaseline(const string &filename, map<string, BenchResult> &baseline) {
+  ifstream in(filename.c_str());
+  string line;
+
+  while (getline(in, line)) {
+    stringstream ss(line);
+    BenchResult result;
+    if (line.size() == 0 || line[0] == '#')
+      continue;
+    if (ss >> result.name >> result.median >> result.max)
+      baseline[result.name] = result;
+  }
+}
+
+void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [options] [benchmark prefix ...]" << endl
+       << "  -p FILE    patterns file (default ../patterns)" << endl
+       << "  -c FILE    corpus, one line per line (default: generated)" << endl
+       << "  -g GROK    grok binary for end-to-end runs (default: skip them)"
+       << endl
+       << "  -n N       samples per benchmark (default "
+       << BENCH_DEFAULT_SAMPLES << ")" << endl
+       << "  -o FILE    write results to FILE, for use as a baseline" << endl
+       << "  -b FILE    compare with baseline FILE" << endl
+       << "  -t PCT     report medians more than PCT% slower (default "
+       << BENCH_DEFAULT_THRESHOLD << ")" << endl
+       << "Prefixes of benchmark names (compile, search/IP, predicate/int, "
+       << "endtoend, ...) pick benchmarks; default is all." << endl;
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  string patterns_file = "../patterns";
+  string corpus_file, grok, output_file, baseline_file;
+  int samples = BENCH_DEFAULT_SAMPLES;
+  double threshold = BENCH_DEFAULT_THRESHOLD;
+  vector<string> prefixes;
+  vector<string> lines;
+  vector<BenchResult> results;
+  map<string, BenchResult> baseline;
+  int regressions = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:c:g:n:o:b:t:h")) != -1) {
+    switch (opt) {
+      case 'p': patterns_file = optarg; break;
+      case 'c': corpus_file = optarg; break;
+      case 'g': grok = optarg; break;
+      case 'n': samples = atoi(optarg); break;
+      case 'o': output_file = optarg; break;
+      case 'b': baseline_file = optarg; break;
+      case 't': threshold = atof(optarg); break;
+      default: Usage(argv[0]);
+    }
+  }
+  for (int i = optind; i < argc; i++)
+    prefixes.push_back(argv[i]);
+  if (samples < 1)
+    Usage(argv[0]);
+
+  GrokPatternSet<grok_regex_type> pset;
+  pset.LoadFromFile(patterns_file);
+  if (pset.patterns.empty()) {
+    cerr << "No patterns loaded from " << patterns_file << endl;
+    return 2;
+  }
+
+  if (corpus_file.size() > 0) {
+    ifstream in(corpus_file.c_str());
+    string line;
+    while (getline(in, line))
+      lines.push_back(line);
+    if (lines.empty()) {
+      cerr << "No lines in corpus " << corpus_file << endl;
+      return 2;
+    }
+  } else {
+    GenerateCorpus(lines);
+  }
+
+  if (GroupWanted(prefixes, "compile"))
+    BenchCompile(pset, samples, prefixes, results);
+  if (GroupWanted(prefixes, "search"))
+    BenchSearchPatterns(pset, lines, (samples + 9) / 10, prefixes, results);
+  if (GroupWanted(prefixes, "predicate"))
+    BenchPredicates(pset, lines, samples, prefixes, results);
+  if (GroupWanted(prefixes, "expandstring") || GroupWanted(prefixes, "tojson"))
+    BenchExpand(pset, lines, samples, prefixes, results);
+  if (grok.size() > 0 && GroupWanted(prefixes, "endtoend"))
+    BenchEndToEnd(grok, lines, samples, prefixes, results);
+  if (results.empty()) {
+    cerr << "No benchmarks picked" << endl;
+    return 2;
+  }
+
+  if (baseline_file.size() > 0)
+    LoadBaseline(baseline_file, baseline);
+
+  printf("%-32s %12s %12s %9s\n", "# benchmark", "median ns", "max ns",
+         baseline.empty() ? "" : "vs base");
+  for (unsigned int i = 0; i < results.size(); i++) {
+    const BenchResult &result = results[i];
+    map<string, BenchResult>::const_iterator base;
+
+    printf("%-32s %12.1f %12.1f", result.name.c_str(), result.median,
+           result.max);
+    base = baseline.find(result.name);
+    if (base != baseline.end() && (*base).second.median > 0) {
+      double change = (result.median / (*base).second.median - 1) * 100;
+      printf(" %+8.1f%%", change);
+      if (change > threshold) {
+        printf("  SLOWER");
+        regressions++;
+      }
+    }
+    printf("\n");
+  }
+
+  if (output_file.size() > 0) {
+    ofstream out(output_file.c_str());
+    out << "# benchmark median_ns max_ns" << endl;
+    for (unsigned int i = 0; i < results.size(); i++) {
+      out << results[i].name << " " << results[i].median << " "
+          << results[i].max << endl;
+    }
+  }
+
+  if (regressions > 0) {
+    cerr << regressions << " benchmark(s) more than " << threshold
+         << "% slower than " << baseline_file << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,301 @@
+#ifndef __DNSRESOLVER_HPP
+#define __DNSRESOLVER_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include <iostream>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+using namespace std;
+
+enum dns_query_type { DNS_Q_A, DNS_Q_AAAA, DNS_Q_PTR };
+
+/* What the dns filter yields when a lookup fails */
+#define DNS_ERROR_VALUE "error_in_dns"
+
+/* Blocking lookup of 'name'. A and AAAA give a numeric address, PTR gives
+ * a host name. Returns false (and DNS_ERROR_VALUE) on failure. */
+bool DNSLookup(int qtype, const string &name, string &result) {
+  struct addrinfo *res;
+  struct addrinfo hints;
+  int dns_error;
+  char hostaddr[NI_MAXHOST];
+  int getname_flags = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = (qtype == DNS_Q_AAAA ? PF_INET6 : PF_INET);
+  if (qtype == DNS_Q_PTR)
+    hints.ai_flags = AI_NUMERICHOST;
+  dns_error = getaddrinfo(name.c_str(), NULL, &hints, &res);
+  if (dns_error) {
+    cerr << "dns error: " << gai_strerror(dns_error) << endl;
+    cerr << "query was " << name << "(type: " << qtype << ")" << endl;
+    result = DNS_ERROR_VALUE;
+    return false;
+  }
+
+  memset(hostaddr, 0, sizeof(hostaddr));
+  if (qtype != DNS_Q_PTR)
+    getname_flags = NI_NUMERICHOST;
+  dns_error = getnameinfo(res->ai_addr, res->ai_addrlen, hostaddr,
+                          sizeof(hostaddr), NULL, 0, getname_flags);
+  freeaddrinfo(res);
+  if (dns_error) {
+    result = DNS_ERROR_VALUE;
+    return false;
+  }
+  result = hostaddr;
+  return true;
+}
+
+/* Resolves names on a few worker threads so a slow lookup doesn't stall
+ * the read/match loop, and keeps answers in a bounded LRU cache.
+ *
+ * Lookup() answers from the cache or starts a lookup and says it's
+ * pending. When lookups finish, GetFd() becomes readable; ProcessResults()
+ * then moves the answers into the cache and says which keys are done, so
+ * the caller can retry whatever was waiting on them. Answers are kept for
+ * 'positive_ttl' seconds, failures for 'negative_ttl'. */
+class DNSResolver {
+  public:
+    enum lookup_status { DNS_DONE, DNS_PENDING };
+
+    DNSResolver(unsigned int threads=4, unsigned long max_entries=10000,
+                float positive_ttl=300, float negative_ttl=30)
+      : num_threads(threads), max_entries(max_entries),
+        positive_ttl(positive_ttl), negative_ttl(negative_ttl),
+        hits(0), misses(0), stopping(false) {
+      pthread_mutex_init(&this->lock, NULL);
+      pthread_cond_init(&this->cond, NULL);
+      if (pipe(this->notify_fds) == 0) {
+        fcntl(this->notify_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(this->notify_fds[1], F_SETFL, O_NONBLOCK);
+      } else {
+        cerr << "DNSResolver: pipe failed: " << strerror(errno) << endl;
+        this->notify_fds[0] = this->notify_fds[1] = -1;
+      }
+    }
+
+    ~DNSResolver() {
+      vector<pthread_t>::iterator iter;
+
+      pthread_mutex_lock(&this->lock);
+      this->stopping = true;
+      pthread_cond_broadcast(&this->cond);
+      pthread_mutex_unlock(&this->lock);
+      for (iter = this->threads.begin(); iter != this->threads.end(); iter++)
+        pthread_join(*iter, NULL);
+
+      close(this->notify_fds[0]);
+      close(this->notify_fds[1]);
+      pthread_cond_destroy(&this->cond);
+      pthread_mutex_destroy(&this->lock);
+    }
+
+    /* Answer from the cache (DNS_DONE, 'result' set) or make sure a lookup
+     * is under way (DNS_PENDING). 'key' names the lookup either way. */
+    lookup_status Lookup(int qtype, const string &name, string &result,
+                         string &key) {
+      cache_map_type::iterator iter;
+
+      key.clear();
+      key += (char)('0' + qtype);
+      key += name;
+
+      iter = this->cache.find(key);
+      if (iter != this->cache.end()) {
+        CacheEntry &entry = (*iter).second;
+        if (entry.expires > Now()) {
+          /* Most recently used goes to the front */
+          this->lru.splice(this->lru.begin(), this->lru, entry.lru_iter);
+          result = entry.value;
+          this->hits++;
+          return DNS_DONE;
+        }
+        this->lru.erase(entry.lru_iter);
+        this->cache.erase(iter);
+      }
+
+      this->misses++;
+      if (this->in_flight.count(key) > 0)
+        return DNS_PENDING;
+
+      pthread_mutex_lock(&this->lock);
+      if (this->notify_fds[0] != -1
+          && this->threads.size() < this->num_threads)
+        this->StartThread();
+      if (this->threads.empty()) {
+        /* No worker to answer, or no way to hear back; do it the slow way */
+        pthread_mutex_unlock(&this->lock);
+        bool ok = DNSLookup(qtype, name, result);
+        this->CacheInsert(key, result, ok);
+        return DNS_DONE;
+      }
+
+      this->in_flight.insert(key);
+      Request req;
+      req.qtype = qtype;
+      req.name = name;
+      req.key = key;
+      this->requests.push_back(req);
+      pthread_cond_signal(&this->cond);
+      pthread_mutex_unlock(&this->lock);
+      return DNS_PENDING;
+    }
+
+    /* Readable when finished lookups are waiting for ProcessResults() */
+    int GetFd() const {
+      return this->notify_fds[0];
+    }
+
+    /* Cache finished lookups; append their keys to 'done_keys' */
+    void ProcessResults(vector<string> &done_keys) {
+      list<Request> done;
+      list<Request>::iterator iter;
+      char buf[256];
+
+      while (read(this->notify_fds[0], buf, sizeof(buf)) > 0)
+        ;
+
+      pthread_mutex_lock(&this->lock);
+      done.swap(this->results);
+      pthread_mutex_unlock(&this->lock);
+
+      for (iter = done.begin(); iter != done.end(); iter++) {
+        this->CacheInsert((*iter).key, (*iter).result, (*iter).ok);
+        this->in_flight.erase((*iter).key);
+        done_keys.push_back((*iter).key);
+      }
+    }
+
+    /* Lookups started but not yet through ProcessResults() */
+    unsigned long Pending() const {
+      return this->in_flight.size();
+    }
+
+    unsigned long GetHits() const {
+      return this->hits;
+    }
+
+    unsigned long GetMisses() const {
+      return this->misses;
+    }
+
+  private:
+    struct Request {
+      int qtype;
+      string name;
+      string key;
+      string result;
+      bool ok;
+    };
+
+    struct CacheEntry {
+      string value;
+      double expires;
+      list<string>::iterator lru_iter;
+    };
+    typedef tr1::unordered_map < string, CacheEntry > cache_map_type;
+
+    unsigned int num_threads;
+    unsigned long max_entries;
+    float positive_ttl;
+    float negative_ttl;
+
+    /* Main thread only */
+    cache_map_type cache;
+    list<string> lru; /* cache keys, most recently used first */
+    std::set<string> in_flight;
+    unsigned long hits;
+    unsigned long misses;
+
+    /* Shared with the workers, under 'lock' */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    list<Request> requests;
+    list<Request> results;
+    vector<pthread_t> threads;
+    bool stopping;
+    int notify_fds[2];
+
+    static double Now() {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      return now.tv_sec + now.tv_usec / 1e6;
+    }
+
+    void CacheInsert(const string &key, const string &value, bool ok) {
+      cache_map_type::iterator iter = this->cache.find(key);
+
+      if (iter == this->cache.end()) {
+        iter = this->cache.insert(
+          cache_map_type::value_type(key, CacheEntry())).first;
+        this->lru.push_front(key);
+        (*iter).second.lru_iter = this->lru.begin();
+      } else {
+        this->lru.splice(this->lru.begin(), this->lru, (*iter).second.lru_iter);
+      }
+
+      CacheEntry &entry = (*iter).second;
+      entry.value = value;
+      entry.expires = Now() + (ok ? this->positive_ttl : this->negative_ttl);
+
+      while (this->cache.size() > this->max_entries) {
+        this->cache.erase(this->lru.back());
+        this->lru.pop_back();
+      }
+    }
+
+    /* Called with 'lock' held. On failure, Lookup() falls back to
+     * resolving inline while no worker is running. */
+    void StartThread() {
+      pthread_t thread;
+      int ret = pthread_create(&thread, NULL, DNSResolver::Worker, this);
+      if (ret != 0) {
+        cerr << "DNSResolver: pthread_create failed: " << strerror(ret)
+          << endl;
+        return;
+      }
+      this->threads.push_back(thread);
+    }
+
+    static void *Worker(void *arg) {
+      DNSResolver *self = (DNSResolver *)arg;
+
+      pthread_mutex_lock(&self->lock);
+      while (true) {
+        while (!self->stopping && self->requests.empty())
+          pthread_cond_wait(&self->cond, &self->lock);
+        if (self->stopping)
+          break;
+
+        Request req = self->requests.front();
+        self->requests.pop_front();
+        pthread_mutex_unlock(&self->lock);
+
+        req.ok = DNSLookup(req.qtype, req.name, req.result);
+
+        pthread_mutex_lock(&self->lock);
+        self->results.push_back(req);
+        /* Full pipe means a wakeup is already waiting */
+        if (write(self->notify_fds[1], "", 1) == -1 && errno != EAGAIN)
+          cerr << "DNSResolver: notify failed: " << strerror(errno) << endl;
+      }
+      pthread_mutex_unlock(&self->lock);
+      return NULL;
+    }
+};
+
+#endif /* ifndef __DNSRESOLVER_HPP */
@@ -3,11 +3,12 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
 #include <unistd.h>
-#include <sys/select.h>
 
 #include <iostream>
 #include <vector>
@@ -15,26 +16,40 @@
 
 using namespace std;
 
+/* Bytes asked of read() at a time */
+#define FILEOBSERVER_READ_SIZE (64 << 10)
+
+/* Most readiness events handled per ReadLines() call */
+#define FILEOBSERVER_MAX_EVENTS 64
+
+/* epoll data for descriptors from AddWakeupFd() */
+#define FILEOBSERVER_WAKEUP_ID 0xffffffffU
+
 struct DataInput {
   FILE *fd;
   string data;
+  unsigned int id; /* index in the FileObserver's inputs */
 
   bool is_command; /* is the 'filename' actually a command? */
   string shell;    /* only set if is_command == true */
   bool follow;     /* Only valid on files (when is_command == false) */
+  bool polled;     /* read every round; epoll can't watch regular files */
   struct timeval ignore_until_time; /* Ignore this file until ...
                                      *   ignore_until_time >= time_in_epoch */
 
+  /* Data read but not yet handed out as lines starts at buffer[consumed] */
+  string buffer;
+  string::size_type consumed;
+
   void SetIgnoreDuration(float duration) {
     struct timeval now;
+    long usec = (long)((duration - (long)duration) * 1000000L);
 
     /* Add 'duration' to the current time */
     gettimeofday(&now, NULL);
-    this->ignore_until_time.tv_sec = now.tv_sec + (long)duration;
-    this->ignore_until_time.tv_usec = \
-      now.tv_usec + ((long)(duration - (long)duration) * 1000000L);
-
-    //cerr << " Ignoring: " << this->ignore_until_time.tv_sec << "." << this->ignore_until_time.tv_usec << endl;
+    this->ignore_until_time.tv_sec = now.tv_sec + (long)duration
+                                     + (now.tv_usec + usec) / 1000000L;
+    this->ignore_until_time.tv_usec = (now.tv_usec + usec) % 1000000L;
   }
 
   bool IsValid() {
@@ -46,9 +61,6 @@ struct DataInput {
      * Maybe we should pass the timeval into this method? */
     struct timeval now;
     gettimeofday(&now, NULL);
-    //cerr << "CanRead: " << (timerisset(&(this->ignore_until_time))) 
-      //<< " / " << timercmp(&now, &(this->ignore_until_time), <) << endl;
-    //cerr << " --> " << this->ignore_until_time.tv_sec << "." << this->ignore_until_time.tv_usec << endl;
     if (timerisset(&(this->ignore_until_time)) &&
         timercmp(&now, &(this->ignore_until_time), <)) {
       return false;
@@ -60,19 +72,35 @@ struct DataInput {
   void clear() {
     this->fd = NULL;
     this->data = "";
+    this->id = 0;
     this->is_command = false;
     this->shell = "";
     this->follow = false;
+    this->polled = false;
     timerclear(&this->ignore_until_time);
+    this->buffer.clear();
+    this->consumed = 0;
+  }
+};
+
+/* One line of input, without its newline. begin and end point into the
+ * input's read buffer, so they are only good until the next ReadLines(). */
+struct DataLine {
+  unsigned int input_id;
+  string::const_iterator begin;
+  string::const_iterator end;
+
+  string str() const {
+    return string(this->begin, this->end);
   }
 };
 
 class FileObserver {
   public:
-    typedef pair < DataInput, string > data_pair_type;
-    typedef vector < data_pair_type > data_input_vector_type;
+    typedef vector < DataLine > data_line_vector_type;
 
-    FileObserver() : inputs(), old_buffers(), buffer_size_limit(5U<<20)
+    FileObserver() : inputs(), buffer_size_limit(5U<<20), epoll_fd(-1),
+                     open_inputs(0)
       { }
 
     void SetBufferLimit(string::size_type size_limit) {
@@ -87,7 +115,7 @@ class FileObserver {
       di.shell = "/bin/sh";
 
       cerr << "Adding cmd: " << command << endl;
-      this->inputs.push_back(di);
+      this->AddInput(di);
     }
 
     void AddFile(string filename, bool follow=true) {
@@ -99,7 +127,7 @@ class FileObserver {
       di.follow = follow;
       cerr << "Adding file: " << filename << endl;
 
-      this->inputs.push_back(di);
+      this->AddInput(di);
     }
 
     void AddFileCommand(string command) {
@@ -113,34 +141,51 @@ class FileObserver {
       }
     }
 
-    void Merge(FileObserver fo) {
-      vector<DataInput>::iterator di_iter;
+    /* Take on another observer's inputs. They are renumbered in order
+     * after ours. */
+    void Merge(const FileObserver &fo) {
+      vector<DataInput>::const_iterator di_iter;
       for (di_iter = fo.inputs.begin(); di_iter != fo.inputs.end(); di_iter++) {
-        this->inputs.push_back(*di_iter);
+        this->AddInput(*di_iter);
       }
+    }
 
-      map <int, string>::const_iterator buffer_iter;
-      for (buffer_iter = fo.old_buffers.begin(); 
-           buffer_iter != fo.old_buffers.end();
-           buffer_iter++) {
-        this->old_buffers[ (*buffer_iter).first ] = (*buffer_iter).second;
-      }
+    /* Have ReadLines() return early when 'fd' becomes readable. The
+     * caller reads it; we never do. */
+    void AddWakeupFd(int fd) {
+      struct epoll_event ev;
+
+      if (!this->CreateEpoll())
+        return;
+
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.u32 = FILEOBSERVER_WAKEUP_ID;
+      if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        cerr << "epoll_ctl failed on wakeup fd: " << strerror(errno) << endl;
     }
 
     void OpenAll() {
       vector<DataInput>::iterator iter;
-      vector<DataInput> inputs_copy = this->inputs;
-      this->inputs.clear();
-      for (iter = inputs_copy.begin(); iter != inputs_copy.end(); iter++) {
-        DataInput di = *iter;
+
+      if (!this->CreateEpoll())
+        return;
+
+      for (iter = this->inputs.begin(); iter != this->inputs.end(); iter++) {
+        DataInput &di = *iter;
+        if (di.IsValid())
+          continue;
+
         if (di.is_command) {
           this->OpenCommand(di);
         } else {
           this->OpenFile(di);
         }
-        cerr << "openall fd: " << di.fd << endl;
-        /* Hack to store the modified DataInput object back */
-        this->inputs.push_back(di);
+
+        if (di.IsValid()) {
+          this->Watch(di);
+          this->open_inputs++;
+        }
       }
     }
 
@@ -166,155 +211,203 @@ class FileObserver {
       cerr << "OpenCommand success on command: '" << di.data << "'" << endl;
     }
 
-    void ReadLines(float timeout, data_input_vector_type &data) {
-      int ret;
+    /* Wait up to 'timeout' seconds for input, then read what's ready in
+     * large blocks and replace 'lines' with the complete lines found.
+     * Lines point into our buffers and are good until the next call. */
+    void ReadLines(float timeout, data_line_vector_type &lines) {
+      struct epoll_event events[FILEOBSERVER_MAX_EVENTS];
       vector<DataInput>::iterator iter;
-      struct timeval tv;
-      fd_set in_fdset;
-      fd_set err_fdset;
+      bool polled_ready = false;
+      int wait_ms = (int)(timeout * 1000);
+      int ret;
 
-      tv.tv_sec = (long)timeout;
-      tv.tv_usec = (long)(timeout - (tv.tv_sec)) * 1000000L;
+      lines.clear();
 
-      /* Come up with a descriptor set that includes all of the inputs */
-      FD_ZERO(&in_fdset);
-      FD_ZERO(&err_fdset);
+      /* Drop what we handed out last time; find polled inputs to read and
+       * how long we may sleep before one of them wants reading */
       for (iter = this->inputs.begin(); iter != this->inputs.end(); iter++) {
-        DataInput di = *iter;
-        
+        DataInput &di = *iter;
+
+        di.buffer.erase(0, di.consumed);
+        di.consumed = 0;
+        if (!di.IsValid() || !di.polled)
+          continue;
+
         if (di.CanRead()) {
-          //cerr << "File: " << di.fd << "(" << di.data  << ")" << endl;
-          FD_SET(fileno(di.fd), &in_fdset);
-          FD_SET(fileno(di.fd), &err_fdset);
+          polled_ready = true;
         } else {
-          if (!di.IsValid() || !di.follow) {
-            cerr << "Removing no-longer-valid file entry: " << di.data << endl;
-            this->inputs.erase(iter);
-          } else {
-            cerr << "Ignoring file (can't read right now): " << di.data << endl;
-          }
+          struct timeval now, left;
+          gettimeofday(&now, NULL);
+          timersub(&di.ignore_until_time, &now, &left);
+          int left_ms = left.tv_sec * 1000 + left.tv_usec / 1000 + 1;
+          if (left_ms < wait_ms)
+            wait_ms = left_ms;
         }
       }
 
-      ret = select(FD_SETSIZE, &in_fdset, NULL, &err_fdset, &tv);
-      if (ret == -1) {
-        cerr << "Error in select() call" << endl;
+      ret = epoll_wait(this->epoll_fd, events, FILEOBSERVER_MAX_EVENTS,
+                       polled_ready ? 0 : wait_ms);
+      if (ret == -1 && errno != EINTR) {
+        cerr << "Error in epoll_wait() call: " << strerror(errno) << endl;
         return;
-      } else if (ret == 0) {
-        return; /* Nothing to read */
-      }
-      //cerr << "Select returned " << ret << endl;
-
-      /* else, ret > 0, read data from the inputs */
-      //cerr << "Input size: " << this->inputs.size() << endl;
-      for (iter = this->inputs.begin(); 
-           (!this->inputs.empty()) && (iter != this->inputs.end());
-           iter++) {
-        DataInput *di = &(*iter);
-
-        cerr << "Checking for input: " << di->data << "(" << di->fd << ")" << endl;
-        if (FD_ISSET(fileno(di->fd), &in_fdset)) {
-          ReadLinesFromInput(data, *di);
-        } else if (FD_ISSET(fileno(di->fd), &err_fdset)) {
-          cerr << "Error condition on " << di->data << " (removing this input now)" << endl;
-          fclose(di->fd);
-          this->inputs.erase(iter);
-        }
-
-        if (feof(di->fd)) {
-          if (di->follow) {
-            /* Ignore this file for at least one iteration */
-            cerr << "No data left in file; ignoring for " << timeout 
-                 << " secs: " << di->data << endl;
-            di->SetIgnoreDuration(timeout);
-          } else {
-            this->inputs.erase(iter);
-          }
-        } 
       }
-    }
 
-    void ReadLinesFromInput(data_input_vector_type &data, DataInput &di) {
-      fd_set fdset;
-      bool done = false;
-      struct timeval tv;
-      int ret;
-      string buffer = this->old_buffers[fileno(di.fd)];
-      char readbuf[4096];
-
-      cerr << "Reading from: " << di.data << endl;
-      //cerr << "fd: " << di.fd << endl;
-      //cerr << "fn: " << fileno(di.fd) << endl;
-
-      //setlinebuf(di.fd);
-
-      while (!done) {
-        FD_ZERO(&fdset);
-        FD_SET(fileno(di.fd), &fdset);
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
-        //cerr << "Waiting for data" << endl;
-        ret = select(FD_SETSIZE, &fdset, NULL, &fdset, &tv);
-        //cerr << "Finished waiting for data" << endl;
-
-        /* XXX: Handle '< 0' and '== 0' cases separately */
-        if (ret <= 0) {
-          done = true;
+      for (int i = 0; i < ret; i++) {
+        if (events[i].data.u32 == FILEOBSERVER_WAKEUP_ID)
           continue;
-        }
-
-        int bytes;
-        char *fgets_ret;
-
-        //cerr << "Starting read" << endl;
-        //bytes = fread(readbuf, 1, 4096, di.fd);
-        fgets_ret = fgets(readbuf, 4096, di.fd);
-        bytes = strlen(readbuf);
-        //cerr << "Finished read" << endl;
-        if (fgets_ret == NULL)
-          done = true;
-        else
-          buffer.append(readbuf, bytes);
-
-        /* Cut this short if the buffer is big enough */
-        if (buffer.size() > this->buffer_size_limit)
-          done = true;
+        this->ReadInput(this->inputs[events[i].data.u32], timeout, lines);
       }
 
-      /* Look for full lines of text, push them into the data vector */
-      string::size_type pos = 0;
-      string::size_type last_pos = 0;
-      while ((pos = buffer.find("\n", last_pos)) != string::npos) {
-        data_pair_type p;
-        p.first = di;
-        p.second = buffer.substr(last_pos, (pos - last_pos));
-        //cerr << "Found line: " << p.second.size() << endl;
-        //cerr << "data: " << last_pos << " / " << buffer.length() << endl;
-        data.push_back(p);
-        last_pos = pos + 1;
+      if (polled_ready) {
+        for (iter = this->inputs.begin(); iter != this->inputs.end(); iter++) {
+          DataInput &di = *iter;
+          if (di.IsValid() && di.polled && di.CanRead())
+            this->ReadInput(di, timeout, lines);
+        }
       }
-      
-      string remainder;
-      if (last_pos <= buffer.size() - 1)
-         remainder = buffer.substr(last_pos, buffer.size() - last_pos);
-      old_buffers[fileno(di.fd)] = remainder;
-
-      if (data.size() > 0)
-        cerr << "Read " << data.size() << " lines" << endl;
     }
 
     bool DoneReading() {
-      return this->inputs.empty();
+      return this->open_inputs == 0;
     }
 
     const vector<DataInput>& GetDataInputs() const {
       return this->inputs;
     }
 
+    const DataInput& GetDataInput(unsigned int id) const {
+      return this->inputs[id];
+    }
+
   protected:
     vector<DataInput> inputs;
-    map <int, string> old_buffers;
     string::size_type buffer_size_limit;
+    int epoll_fd;
+    unsigned int open_inputs;
+
+    bool CreateEpoll() {
+      if (this->epoll_fd == -1) {
+        this->epoll_fd = epoll_create(FILEOBSERVER_MAX_EVENTS);
+        if (this->epoll_fd == -1) {
+          cerr << "epoll_create failed: " << strerror(errno) << endl;
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void AddInput(DataInput di) {
+      di.id = this->inputs.size();
+      this->inputs.push_back(di);
+    }
+
+    /* Register with epoll. Regular files are always 'ready' as far as
+     * epoll is concerned (it refuses them), so those get polled. */
+    void Watch(DataInput &di) {
+      struct epoll_event ev;
+      int fd = fileno(di.fd);
+
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.u32 = di.id;
+      if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        di.polled = false;
+      } else if (errno == EPERM) {
+        di.polled = true;
+      } else {
+        cerr << "epoll_ctl failed on '" << di.data << "': "
+             << strerror(errno) << endl;
+        di.polled = true;
+      }
+    }
+
+    /* Read until the input would block, hits EOF or fills the buffer
+     * limit, then split off complete lines in place. */
+    void ReadInput(DataInput &di, float timeout, data_line_vector_type &lines) {
+      string &buffer = di.buffer;
+      int fd = fileno(di.fd);
+      bool eof = false;
+      ssize_t bytes;
+
+      while (buffer.size() < this->buffer_size_limit) {
+        string::size_type old_size = buffer.size();
+        buffer.resize(old_size + FILEOBSERVER_READ_SIZE);
+        bytes = read(fd, &buffer[old_size], FILEOBSERVER_READ_SIZE);
+        buffer.resize(old_size + (bytes > 0 ? bytes : 0));
+
+        if (bytes > 0)
+          continue;
+        if (bytes == 0) {
+          eof = true;
+        } else if (errno == EINTR) {
+          continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          cerr << "Error reading '" << di.data << "': " << strerror(errno)
+               << " (removing this input now)" << endl;
+          eof = true;
+          di.follow = false;
+        }
+        break;
+      }
+
+      const char *base = buffer.data();
+      string::size_type pos = di.consumed;
+      const char *newline;
+      while ((newline = (const char *)memchr(base + pos, '\n',
+                                             buffer.size() - pos)) != NULL) {
+        string::size_type end = newline - base;
+        this->PushLine(di, pos, end, lines);
+        pos = end + 1;
+      }
+
+      /* A line as big as the buffer limit is handed out as is */
+      if (pos == 0 && buffer.size() >= this->buffer_size_limit) {
+        this->PushLine(di, 0, buffer.size(), lines);
+        pos = buffer.size();
+      }
+      di.consumed = pos;
+
+      if (!eof)
+        return;
+
+      if (di.polled && di.follow) {
+        /* Ignore this file for a while; it may grow */
+        di.SetIgnoreDuration(timeout);
+        return;
+      }
+
+      /* The last line may lack a newline */
+      if (di.consumed < buffer.size()) {
+        this->PushLine(di, di.consumed, buffer.size(), lines);
+        di.consumed = buffer.size();
+      }
+      this->Close(di);
+    }
+
+    void PushLine(const DataInput &di, string::size_type begin,
+                  string::size_type end, data_line_vector_type &lines) {
+      DataLine line;
+      line.input_id = di.id;
+      line.begin = di.buffer.begin() + begin;
+      line.end = di.buffer.begin() + end;
+      lines.push_back(line);
+    }
+
+    /* The input's buffer lives on until the next ReadLines(), since lines
+     * handed out may point into it. */
+    void Close(DataInput &di) {
+      cerr << "Done reading: " << di.data << endl;
+      if (!di.polled)
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fileno(di.fd), NULL);
+      if (di.is_command)
+        pclose(di.fd);
+      else
+        fclose(di.fd);
+      di.fd = NULL;
+      this->open_inputs--;
+    }
 };
 
 #endif /* ifdef __FILEOBSERVER_HPP */
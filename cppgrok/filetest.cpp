@@ -18,9 +18,8 @@ int main() {
   //fo.AddFileCommand(lscmd);
   //fo.AddCommand(tailcmd);
 
-  FileObserver::data_input_vector_type input_vector;
-  FileObserver::data_pair_type input_pair;
-  FileObserver::data_input_vector_type::iterator iter;
+  FileObserver::data_line_vector_type lines;
+  FileObserver::data_line_vector_type::iterator iter;
   GrokRegex<sregex> gre;
   GrokMatch<sregex> gm;
   GrokPatternSet<sregex> pset;
@@ -30,12 +29,12 @@ int main() {
   gre.SetRegex("%SYSLOGBASE%");
 
   fo.OpenAll();
-  fo.ReadLines(30, input_vector);
-  for (iter = input_vector.begin(); iter != input_vector.end(); iter++) {
-    input_pair = *iter;
-    if (gre.Search(input_pair.second, gm)) {
+  fo.ReadLines(30, lines);
+  for (iter = lines.begin(); iter != lines.end(); iter++) {
+    if (gre.Search((*iter).begin, (*iter).end, gm)) {
       GrokMatch<sregex>::match_map_type gmap = gm.GetMatches();
-      cout << "(" << input_pair.first.data << ") " << input_pair.second << endl;
+      cout << "(" << fo.GetDataInput((*iter).input_id).data << ") "
+           << (*iter).str() << endl;
       cout << "date: " << gmap["SYSLOGDATE"] << endl;
       cout << "hostname: " << gmap["HOSTNAME"] << endl;
       cout << "prog: " << gmap["PROG"] << endl;
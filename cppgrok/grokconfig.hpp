@@ -2,6 +2,8 @@
 #ifndef __GROKCONFIG_HPP
 #define __GROKCONFIG_HPP
 
+#include <stdlib.h>
+
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -28,6 +30,13 @@ string StripQuotes(const string &str) {
   return str.substr(1, str.size() - 2);
 }
 
+/* Numbers may be given bare (3) or quoted ("3") */
+float ParseNumber(const string &str) {
+  if (str.size() > 0 && str[0] == '"')
+    return atof(StripQuotes(str).c_str());
+  return atof(str.c_str());
+}
+
 class GrokConfig {
   public:
     typedef vector<WatchFileEntry> watch_file_vector_type;
@@ -60,9 +69,9 @@ class GrokConfig {
       this->re_match = bos >> "match" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
       this->re_reaction = bos >> "reaction" >> R_EQ >> (s1=re_string | "json_output") >> R_TERMINATOR;
       this->re_reaction_print = bos >> "reaction_print" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
-      this->re_threshold = bos >> "threshold" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
+      this->re_threshold = bos >> "threshold" >> R_EQ >> (s1=re_string | re_number) >> R_TERMINATOR;
       //this->re_follow = bos >> "follow" >> R_EQ >> (s1=re_boolean) >> R_TERMINATOR;
-      this->re_interval = bos >> "interval" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
+      this->re_interval = bos >> "interval" >> R_EQ >> (s1=re_string | re_number) >> R_TERMINATOR;
       this->re_key = bos >> "key" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
       this->re_match_syslog = bos >> "match_syslog" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
       this->re_syslog_prog = bos >> "syslog_prog" >> R_EQ >> (s1=re_string) >> R_TERMINATOR;
@@ -196,17 +205,15 @@ class GrokConfig {
     void block_matchtype(string &input) {
       smatch m;
       bool done = false;
-      stringstream strconv(stringstream::in | stringstream::out);
       cerr << "Matchtype" << endl;
       while (!done) {
         if (this->consume(input, m, this->re_match)) {
           cerr << "Match: " << m.str(1) << endl;
-          GrokRegex<sregex> gre(StripQuotes(m.str(1)));
+          GrokRegex<grok_regex_type> gre(StripQuotes(m.str(1)));
           gre.AddPatternSet(this->patterns);
           current_match_type.match_strings.push_back(gre);
         } else if (this->consume(input, m, this->re_threshold)) {
-          strconv << m.str(1);
-          strconv >> current_match_type.threshold;
+          current_match_type.threshold = ParseNumber(m.str(1));
         } else if (this->consume(input, m, this->re_reaction)) {
           if (m.str(1) == "json_output") {
             current_match_type.reaction_type = WatchMatchType::JSON;
@@ -224,8 +231,7 @@ class GrokConfig {
           else
             current_match_type.follow = false;
         } else if (this->consume(input, m, this->re_interval)) {
-          strconv << m.str(1);
-          strconv >> current_match_type.interval;
+          current_match_type.interval = ParseNumber(m.str(1));
         } else if (this->consume(input, m, this->re_key)) {
           current_match_type.key = StripQuotes(m.str(1));
         } else if (this->consume(input, m, this->re_match_syslog)) {
@@ -291,7 +297,7 @@ class GrokConfig {
       //sregex re_follow;
       sregex re_boolean;
 
-    GrokPatternSet<sregex> patterns;
+    GrokPatternSet<grok_regex_type> patterns;
     watch_file_vector_type inputs;
     WatchFileEntry current_file_entry;
     WatchMatchType current_match_type;
@@ -3,12 +3,12 @@
 
 #include <sstream>
 
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
 #include <boost/xpressive/xpressive.hpp>
 using namespace boost::xpressive;
 
+#include "stringutils.hpp"
+#include "dnsresolver.hpp"
+
 void StringSlashEscape(string &value, const string &chars) {
   sregex re_chars = sregex::compile("[" + chars + "]");
   string format = "\\$&";
@@ -48,68 +48,152 @@ void ParseFuncArgs(const string &func, vector<string> &args) {
   }
 }
 
+/* A GrokMatch from GrokRegex::Search(begin, end, gm) is a view of that
+ * search. It refers to the searched text and to the GrokRegex's captures
+ * (positions in that text) rather than copying them, so it is only good
+ * until that text changes or the GrokRegex searches again. Searching a
+ * string, Search(data, gm), gives a match that owns a copy (see
+ * Detach()). Capture and meta values
+ * (=LINE, =MATCH, =LENGTH, =POSITION) only become strings when something
+ * asks for them. */
 template <typename regex_type>
 class GrokMatch {
 
   public:
-    typedef map<string, typename regex_type::string_type> match_map_type;
-    sregex pattern_expand_re;
-    mark_tag mark_pattern_name;
-    mark_tag mark_filters;
-
-    GrokMatch() : mark_pattern_name(1), mark_filters(2) { 
+    typedef typename regex_type::string_type string_type;
+    typedef map<string, string_type> match_map_type;
+    typedef vector< pair<string, string_type> > meta_vector_type;
+    typedef sub_match<typename regex_type::iterator_type> capture_type;
+    typedef vector<capture_type> capture_vector_type;
+    typedef vector<string> capture_name_vector_type;
+
+    /* Submatch numbers in ExpandRegex() */
+    enum { MARK_PATTERN_NAME = 1, MARK_FILTERS = 2 };
+
+    GrokMatch() : capture_names(NULL), captures(NULL), length(0),
+                  position(0), matches_valid(false), dns_pending(false) {
       /* nothing to do */
     }
 
-    void init(const typename regex_type::string_type &data, 
+    void init(typename regex_type::iterator_type line_begin,
+              typename regex_type::iterator_type line_end,
               const match_results<typename regex_type::iterator_type> &match,
-              const match_map_type &backref_map) {
-      stringstream strconv(stringstream::in | stringstream::out);
-      string tmp;
-
-      this->match_string = match.str(0);
-      this->matches = backref_map;
-      this->length = match.length();
-      this->position = match.position();
-
-      /* Set some default values */
-      //string match_key = "=MATCH";
-      //string line_key = "=LINE";
-      //this->matches[match_key] = this->match_string;
-      //this->matches[line_key] = data;
-      this->SetMatchMetaValue("MATCH", this->match_string);
-      this->SetMatchMetaValue("LINE", data);
-
-      strconv << this->length;
-      this->SetMatchMetaValue("LENGTH", strconv.str());
-      strconv.str(string());
-
-      strconv << this->position;
-      this->SetMatchMetaValue("POSITION", strconv.str());
-      strconv.str(string());
-
-      this->pattern_expand_re = 
+              const capture_name_vector_type &capture_names,
+              const capture_vector_type &captures) {
+      this->init(line_begin, line_end, match.position(), match.length(),
+                 capture_names, captures);
+    }
+
+    void init(typename regex_type::iterator_type line_begin,
+              typename regex_type::iterator_type line_end,
+              int position, int length,
+              const capture_name_vector_type &capture_names,
+              const capture_vector_type &captures) {
+      this->line_begin = line_begin;
+      this->line_end = line_end;
+      this->capture_names = &capture_names;
+      this->captures = &captures;
+      this->length = length;
+      this->position = position;
+      this->meta.clear();
+      this->matches_valid = false;
+    }
+
+    ~GrokMatch() {
+      /* Nothing to do */
+    };
+
+    /* Matches %NAME%, %NAME:ALIAS%, %=META% and %NAME|filter|filter(args)%.
+     * Compiled on first use and shared by every GrokMatch. */
+    static const sregex& ExpandRegex() {
+      static mark_tag mark_pattern_name(MARK_PATTERN_NAME);
+      static mark_tag mark_filters(MARK_FILTERS);
+      static const sregex pattern_expand_re =
         as_xpr('%')
-          >> (GrokMatch::mark_pattern_name =
+          >> (mark_pattern_name =
               !(as_xpr('=')) >> +(alnum | as_xpr('_'))
               >> !(as_xpr(':') >> +(alnum | as_xpr('_')))
              )
-          >> (GrokMatch::mark_filters =
+          >> (mark_filters =
               *('|' >> +(+alnum | '(' | ')' | ','))
              )
         >> as_xpr('%');
+      return pattern_expand_re;
     }
 
-    ~GrokMatch() {
-      /* Nothing to do */
-    };
-
+    /* Every capture and meta value, as a map. This is built (once per
+     * match) only when asked for; ExpandString() looks values up directly. */
     const match_map_type& GetMatches() const {
+      if (!this->matches_valid) {
+        typename meta_vector_type::const_iterator meta_iter;
+        static const char *builtin[] = { "LINE", "MATCH", "LENGTH", "POSITION" };
+
+        this->matches.clear();
+        for (unsigned int i = 0; i < this->captures->size(); i++) {
+          if ((*this->captures)[i].matched)
+            this->matches[(*this->capture_names)[i]] = (*this->captures)[i].str();
+        }
+        for (int i = 0; i < 4; i++) {
+          string key = "=";
+          key += builtin[i];
+          this->GetValue(key, this->matches[key]);
+        }
+        for (meta_iter = this->meta.begin(); meta_iter != this->meta.end();
+             meta_iter++) {
+          this->matches[(*meta_iter).first] = (*meta_iter).second;
+        }
+        this->matches_valid = true;
+      }
       return this->matches;
     };
 
+    /* Look up a capture ("IP") or meta value ("=LINE"). Returns false if
+     * there is no such value. */
+    bool GetValue(const string &name, string_type &value) const {
+      typename meta_vector_type::const_iterator meta_iter;
+
+      if (name.size() == 0 || name[0] != '=') {
+        for (unsigned int i = 0; i < this->capture_names->size(); i++) {
+          const capture_type &capture = (*this->captures)[i];
+          if ((*this->capture_names)[i] != name)
+            continue;
+          if (!capture.matched)
+            return false;
+          value.assign(capture.first, capture.second);
+          return true;
+        }
+        return false;
+      }
+
+      /* Values from SetMatchMetaValue() take precedence */
+      for (meta_iter = this->meta.begin(); meta_iter != this->meta.end();
+           meta_iter++) {
+        if ((*meta_iter).first == name) {
+          value = (*meta_iter).second;
+          return true;
+        }
+      }
+
+      if (name == "=LINE") {
+        value.assign(this->line_begin, this->line_end);
+      } else if (name == "=MATCH") {
+        value.assign(this->line_begin + this->position,
+                     this->line_begin + this->position + this->length);
+      } else if (name == "=LENGTH") {
+        value.clear();
+        StringUtils::AppendInt(value, this->length);
+      } else if (name == "=POSITION") {
+        value.clear();
+        StringUtils::AppendInt(value, this->position);
+      } else {
+        return false;
+      }
+      return true;
+    }
+
     typename regex_type::string_type GetMatchString() const {
-      return this->match_string;
+      return string_type(this->line_begin + this->position,
+                         this->line_begin + this->position + this->length);
     }
 
     int GetLength() {
@@ -122,27 +206,29 @@ class GrokMatch {
 
     void ExpandString(const string &src, string &dst) {
       regex_iterator<typename regex_type::iterator_type> cur(
-           src.begin(), src.end(), pattern_expand_re);
+           src.begin(), src.end(), ExpandRegex());
       regex_iterator<typename regex_type::iterator_type> end;
-      unsigned int last_pos = 0;
-      typename match_map_type::const_iterator map_iter;
+      string::size_type last_pos = 0;
+      string pattern_name;
+      string value;
       
-      dst = "";
+      dst.clear();
+      this->dns_pending = false;
 
       for (; cur != end; cur++) {
-        match_results<typename regex_type::iterator_type> match = *cur;
-        string pattern_name = match[this->mark_pattern_name].str();
-        string filter_str = match[this->mark_filters].str();
+        const match_results<typename regex_type::iterator_type> &match = *cur;
+        string::size_type match_pos = match.position();
 
-        if (match.position() > last_pos)
-          dst += src.substr(last_pos, match.position() - last_pos);
+        if (match_pos > last_pos)
+          dst.append(src, last_pos, match_pos - last_pos);
 
-        last_pos = match.position() + match.length();
+        last_pos = match_pos + match.length();
 
-        map_iter = this->matches.find(pattern_name);
-        if (map_iter != this->matches.end()) {
-          string value = (*map_iter).second;
-          this->Filter(value, filter_str);
+        pattern_name.assign(match[MARK_PATTERN_NAME].first,
+                            match[MARK_PATTERN_NAME].second);
+        if (this->GetValue(pattern_name, value)) {
+          if (match[MARK_FILTERS].length() > 0)
+            this->Filter(value, match[MARK_FILTERS].str());
           dst += value;
         } else {
           dst += "%" + pattern_name + "%";
@@ -150,15 +236,16 @@ class GrokMatch {
       }
 
       if (last_pos < src.size())
-        dst += src.substr(last_pos, src.size() - last_pos);
+        dst.append(src, last_pos, src.size() - last_pos);
     }
 
     void ToJSON(string &dst) {
+      const match_map_type &matches = this->GetMatches();
       typename match_map_type::const_iterator map_iter;
       dst = "{";
 
-      for (map_iter = this->matches.begin();
-           map_iter != this->matches.end();
+      for (map_iter = matches.begin();
+           map_iter != matches.end();
            /* no increment here, see bottom of loop */) {
         string key = (*map_iter).first;
         string val = (*map_iter).second;
@@ -168,7 +255,7 @@ class GrokMatch {
         dst += "\"" + val + "\"";
 
         map_iter++;
-        if (map_iter != this->matches.end())
+        if (map_iter != matches.end())
           dst += ", ";
       }
       dst += "}";
@@ -196,8 +283,11 @@ class GrokMatch {
         cerr << "Filter: " << *filter_iter << endl;
         if (*filter_iter == "shellescape")
           this->Filter_ShellEscape(*filter_iter, value);
-        else if ((*filter_iter).substr(0, 3) == "dns")
-          this->Filter_DNS(*filter_iter, value);
+        else if ((*filter_iter).substr(0, 3) == "dns") {
+          /* The rest of the filters wait for the lookup */
+          if (!this->Filter_DNS(*filter_iter, value))
+            break;
+        }
         else if (*filter_iter == "stripquotes")
           this->Filter_StripQuotes(*filter_iter, value);
       }
@@ -215,10 +305,17 @@ class GrokMatch {
       }
     }
 
-    void Filter_DNS(const string &func, string &value) {
+    /* dns, dns(A), dns(AAAA), dns(PTR), dns(PTR,A): look 'value' up,
+     * applying each query type in turn. With a resolver set (see
+     * SetDNSResolver) lookups don't block: a lookup still under way leaves
+     * 'value' empty, marks this expansion as pending on it and returns
+     * false. */
+    bool Filter_DNS(const string &func, string &value) {
       vector<string> args;
       vector<string>::const_iterator arg_iter;
-      enum { Q_A, Q_AAAA, Q_PTR, Q_MX, Q_TXT } qtype;
+      int qtype;
+      string result;
+      string key;
       ParseFuncArgs(func, args);
 
       if (args.empty()) {
@@ -228,46 +325,90 @@ class GrokMatch {
 
       for (arg_iter = args.begin(); arg_iter != args.end(); arg_iter++) {
         if (*arg_iter == "A")
-          qtype = Q_A;
+          qtype = DNS_Q_A;
         else if (*arg_iter == "AAAA") 
-          qtype = Q_AAAA;
+          qtype = DNS_Q_AAAA;
         else if (*arg_iter == "PTR")
-          qtype = Q_PTR;
+          qtype = DNS_Q_PTR;
         else {
           cerr << "Unknown query type: " << *arg_iter << endl;
-          qtype = Q_A;
+          qtype = DNS_Q_A;
         }
 
-        const char *addr = value.c_str();
-        struct addrinfo *res;
-        struct addrinfo hints;
-        int dns_error;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = (qtype == Q_AAAA ? PF_INET6 : PF_INET);
-        if (qtype == Q_PTR)
-          hints.ai_flags = AI_NUMERICHOST;
-        cerr << "DNS: " << addr << endl;
-        dns_error = getaddrinfo(addr, NULL, &hints, &res);
-        if (dns_error) {
-          value = "error_in_dns";
-          cerr << "dns error: " << dns_error << endl;
-          cerr << "query was " << addr << "(type: " << qtype  << endl;
-          return;
+        if (DNSResolverRef() == NULL) {
+          DNSLookup(qtype, value, result);
+        } else if (DNSResolverRef()->Lookup(qtype, value, result, key)
+                   == DNSResolver::DNS_PENDING) {
+          if (!this->dns_pending) {
+            this->dns_pending = true;
+            this->dns_pending_key = key;
+          }
+          value.clear();
+          return false;
         }
-        char hostaddr[255];
-        int getname_flags = 0;
-        memset(hostaddr, 0, 255);
-        if (qtype != Q_PTR)
-          getname_flags = NI_NUMERICHOST;
-        getnameinfo(res->ai_addr, res->ai_addrlen, hostaddr, 255,
-	NULL, 0, getname_flags);
-        value = hostaddr;
-        freeaddrinfo(res);
+
+        value = result;
+        if (value == DNS_ERROR_VALUE)
+          break;
       }
+      return true;
+    }
+
+    /* Use 'resolver' for the dns filter in every GrokMatch; NULL (the
+     * default) means blocking lookups */
+    static void SetDNSResolver(DNSResolver *resolver) {
+      DNSResolverRef() = resolver;
+    }
+
+    /* After ExpandString: did a dns filter have to wait for a lookup? */
+    bool DNSPending() const {
+      return this->dns_pending;
+    }
+
+    /* The DNSResolver key of the first lookup that ExpandString waited on */
+    const string& GetDNSPendingKey() const {
+      return this->dns_pending_key;
+    }
+
+    /* Stop being a view: copy the line and the captures so this match
+     * outlives the searched string and the next Search(). For reactions
+     * that have to wait. Copies made afterwards still point into this
+     * one, so detach the copy, not the original. */
+    void Detach() {
+      typename regex_type::iterator_type old_begin = this->line_begin;
+      capture_vector_type captures;
+
+      this->owned_line.assign(this->line_begin, this->line_end);
+      this->line_begin = this->owned_line.begin();
+      this->line_end = this->owned_line.end();
+
+      for (unsigned int i = 0; i < this->captures->size(); i++) {
+        capture_type capture = (*this->captures)[i];
+        if (capture.matched) {
+          capture.first = this->line_begin + (capture.first - old_begin);
+          capture.second = this->line_begin + (capture.second - old_begin);
+        }
+        captures.push_back(capture);
+      }
+      this->owned_captures.swap(captures);
+      this->owned_capture_names = *(this->capture_names);
+      this->captures = &this->owned_captures;
+      this->capture_names = &this->owned_capture_names;
     }
 
     void SetMatchMetaValue(string name, string value) {
-      this->matches["=" + name] = value;
+      typename meta_vector_type::iterator meta_iter;
+      string key = "=" + name;
+
+      this->matches_valid = false;
+      for (meta_iter = this->meta.begin(); meta_iter != this->meta.end();
+           meta_iter++) {
+        if ((*meta_iter).first == key) {
+          (*meta_iter).second = value;
+          return;
+        }
+      }
+      this->meta.push_back(make_pair(key, value));
     }
 
     void SetMatchMetaValue(const char * name, string value) {
@@ -276,10 +417,30 @@ class GrokMatch {
     }
 
   private:
-    match_map_type matches;
-    typename regex_type::string_type match_string;
+    typename regex_type::iterator_type line_begin;
+    typename regex_type::iterator_type line_end;
+    const capture_name_vector_type *capture_names;
+    const capture_vector_type *captures;
+    meta_vector_type meta; /* from SetMatchMetaValue() */
     int length;
     int position;
+
+    /* GetMatches() cache */
+    mutable match_map_type matches;
+    mutable bool matches_valid;
+
+    bool dns_pending;
+    string dns_pending_key;
+
+    /* Only used after Detach() */
+    string_type owned_line;
+    capture_name_vector_type owned_capture_names;
+    capture_vector_type owned_captures;
+
+    static DNSResolver *&DNSResolverRef() {
+      static DNSResolver *resolver = NULL;
+      return resolver;
+    }
 };
 
 #endif /* ifndef __GROKMATCH_HPP */
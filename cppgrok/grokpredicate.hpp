@@ -1,6 +1,7 @@
 #ifndef __GROKPREDICATE_HPP
 #define __GROKPREDICATE_HPP
 
+#include <stdlib.h>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -28,10 +29,10 @@ class GrokPredicate {
 
     GrokPredicate(string predicate) {
       local<unsigned int> flags(0);
-      match_results<typename regex_type::iterator_type> match;
+      smatch match;
 
       /* XXX: Should this just be a dispatch table? */
-      regex_type op_re = 
+      sregex op_re = 
         ( /* Test for < > <= >= */
           (as_xpr('>')  [ flags |= GROK_P_GREATER ]
            | as_xpr('<') [ flags |= GROK_P_LESS ]
@@ -125,7 +126,7 @@ class GrokPredicate {
     }
 
     int compare_int(const sub_match_t &match) const {
-      return this->value_int - as<int>(_);
+      return this->value_int - atoi(match.str().c_str());
     }
 
     bool result(int compare) const {
@@ -1,6 +1,8 @@
 #ifndef __GROKREGEX_HPP
 #define __GROKREGEX_HPP
 
+#include <ctype.h>
+#include <string.h>
 #include <iostream>
 #include <string>
 #include <boost/xpressive/xpressive.hpp>
@@ -8,6 +10,7 @@
 #include "grokpatternset.hpp"
 #include "grokmatch.hpp"
 #include "grokpredicate.hpp"
+#include "staticpatterns.hpp"
 
 using namespace std;
 using namespace boost::xpressive;
@@ -15,7 +18,9 @@ using namespace boost::xpressive;
 template <typename regex_type>
 class GrokRegex {
   public:
-    typedef map <string, typename regex_type::string_type> capture_map_t;
+    typedef typename GrokMatch<regex_type>::capture_type capture_type;
+    typedef typename GrokMatch<regex_type>::capture_vector_type capture_vector_t;
+    typedef typename GrokMatch<regex_type>::capture_name_vector_type capture_name_vector_t;
 
     GrokRegex(const string grok_pattern) 
     : pattern(grok_pattern) {
@@ -23,6 +28,7 @@ class GrokRegex {
       this->generated_string = NULL;
       this->re_compiler = NULL;
       this->track_matches = true;
+      this->use_static_patterns = true;
       this->GenerateRegex();
     }
 
@@ -32,6 +38,7 @@ class GrokRegex {
       this->pattern = "";
       this->re_compiler = NULL;
       this->track_matches = true;
+      this->use_static_patterns = true;
     }
     ~GrokRegex() { /* Nothing to do */ }
 
@@ -57,28 +64,71 @@ class GrokRegex {
       return this->pattern;
     }
 
+    /* Text every match must contain; empty if we couldn't find any */
+    const string& GetRequiredLiteral() const {
+      return this->required_literal;
+    }
+
+    /* A cheap check, done before running the regex: false means the
+     * regex cannot match [begin, end) */
+    bool MayMatch(typename regex_type::iterator_type begin,
+                  typename regex_type::iterator_type end) const {
+      const string &literal = this->required_literal;
+      if (literal.size() == 0)
+        return true;
+      if ((string::size_type)(end - begin) < literal.size())
+        return false;
+      return memmem(&*begin, end - begin, literal.data(), literal.size())
+             != NULL;
+    }
+
     const void SetTrackMatches(bool value) {
       this->track_matches = value;
     }
 
+    /* Use the static versions of built-in patterns (staticpatterns.hpp).
+     * Like SetTrackMatches(), this takes effect when the regex is next
+     * generated. */
+    void SetUseStaticPatterns(bool value) {
+      this->use_static_patterns = value;
+    }
+
     void AddPatternSet(const GrokPatternSet<regex_type> &pattern_set) {
       this->pattern_set.Merge(pattern_set);
       this->GenerateRegex();
     }
 
-    bool Search(const typename regex_type::string_type data, 
+    /* On success, 'gm' holds its own copy of 'data', so 'data' may be a
+     * temporary. The (begin, end) form below skips the copy. */
+    bool Search(const typename regex_type::string_type &data, 
+                GrokMatch<regex_type> &gm) {
+      if (!this->Search(data.begin(), data.end(), gm))
+        return false;
+      gm.Detach();
+      return true;
+    }
+
+    /* Search [begin, end), such as a DataLine from FileObserver. On
+     * success, 'gm' refers to [begin, end); see GrokMatch */
+    bool Search(typename regex_type::iterator_type begin,
+                typename regex_type::iterator_type end,
                 GrokMatch<regex_type> &gm) {
       match_results<typename regex_type::iterator_type> match;
       int ret;
 
+      if (!this->MayMatch(begin, end))
+        return false;
+
       /* Late binding with Boost.Xpressive. 
-       * Inject capture_map for placeholder_map. */
-      match.let(this->placeholder_map = this->capture_map);
-      ret = regex_search(data.begin(), data.end(), match, *(this->generated_regex));
+       * Inject captures for placeholder_captures. Each capture's action
+       * records where it matched; nothing is copied out of 'data'. */
+      this->captures.assign(this->capture_names.size(), capture_type());
+      match.let(this->placeholder_captures = this->captures);
+      ret = regex_search(begin, end, match, *(this->generated_regex));
       if (!ret)
         return false;
 
-      gm.init(data, match, this->capture_map);
+      gm.init(begin, end, match, this->capture_names, this->captures);
 
       return true;
     }
@@ -115,9 +165,12 @@ class GrokRegex {
     regex_compiler<typename regex_type::iterator_type> *re_compiler;
     regex_type *generated_regex;
     string *generated_string;
-    capture_map_t capture_map;
-    placeholder< capture_map_t > placeholder_map;
+    string required_literal;
+    capture_name_vector_t capture_names; /* alias for each capture index */
+    capture_vector_t captures;
+    placeholder< capture_vector_t > placeholder_captures;
     bool track_matches;
+    bool use_static_patterns;
 
     void GenerateRegex() {
       int backref = 0;
@@ -130,6 +183,8 @@ class GrokRegex {
         delete this->generated_string;
       this->generated_string = new string;
 
+      this->capture_names.clear();
+
       /* make a new compiler */
       if (this->re_compiler != NULL)
         delete this->re_compiler;
@@ -140,21 +195,210 @@ class GrokRegex {
                                    &this->generated_regex, 
                                    *this->generated_string);
       //cerr << "Regex str: " << *(this->generated_string) << endl;
+
+      this->required_literal = this->RequiredLiteral(this->pattern, 0);
     }
 
-    /* XXX: Split this into smaller functions */
-    void RecursiveGenerateRegex(string pattern, int &backref, regex_type **pregex, string &expanded_regex) {
-      //sregex not_percent = (!+(+~(as_xpr('%') | '\\') | "\\."))
-      /* not_percent == /([^\\%]+|\\.)+?/ */
-      sregex not_percent = -+(~(boost::xpressive::set='%','\\')
-                              | (as_xpr('\\') >> _));
-      int last_pos = 0;
-      string re_string;
-      //regex_type *re;
+    /* Find the longest run of plain characters that any match of 'pattern'
+     * must contain. Only the top level counts: groups, classes, escapes
+     * and quantified characters end a run, and a top-level '|' means
+     * nothing is required. %PATTERN%s at the top level are required too,
+     * so their literals are candidates. Anything we don't understand
+     * gives up with "", which only costs the precheck. */
+    string RequiredLiteral(const string &pattern, int depth) {
+      string best;
+      string run;
+      string::size_type i = 0;
+      string::size_type len = pattern.size();
+
+      if (depth > 20)
+        return "";
+
+      while (i < len) {
+        char c = pattern[i];
+
+        if (c == '%') {
+          /* %NAME%, %NAME:ALIAS% or %NAME<predicate>% */
+          string::size_type close = i + 1;
+          while (close < len && pattern[close] != '%') {
+            if (pattern[close] == '\\')
+              close++;
+            close++;
+          }
+          if (close >= len)
+            return "";
+          string::size_type name_end = i + 1;
+          while (name_end < close && (isalnum(pattern[name_end])
+                                      || pattern[name_end] == '_'))
+            name_end++;
+          string name = pattern.substr(i + 1, name_end - i - 1);
+          bool optional = (close + 1 < len
+                           && strchr("*?{", pattern[close + 1]) != NULL);
+          if (!optional && this->pattern_set.patterns.count(name) > 0) {
+            string sub = this->RequiredLiteral(
+              this->pattern_set.patterns[name].regex_str, depth + 1);
+            if (sub.size() > best.size())
+              best = sub;
+          }
+          this->EndRun(run, best);
+          i = this->SkipQuantifier(pattern, close + 1);
+          continue;
+        }
+
+        switch (c) {
+          case '|':
+            return "";
+          case '(':
+            /* Inline flags like (?i) change what the literal means */
+            if (i + 2 < len && pattern[i + 1] == '?'
+                && strchr("imsx-", pattern[i + 2]) != NULL)
+              return "";
+            this->EndRun(run, best);
+            i = this->SkipGroup(pattern, i);
+            if (i == string::npos)
+              return "";
+            continue;
+          case '[':
+            this->EndRun(run, best);
+            i = this->SkipClass(pattern, i);
+            if (i == string::npos)
+              return "";
+            continue;
+          case '.': case '^': case '$': case ')':
+            this->EndRun(run, best);
+            i++;
+            continue;
+          case '*': case '?': case '{':
+            /* The previous character is optional or repeated */
+            if (run.size() > 0)
+              run.erase(run.size() - 1);
+            this->EndRun(run, best);
+            i = this->SkipQuantifier(pattern, i);
+            continue;
+          case '+':
+            /* Needed at least once, but what follows may not be adjacent */
+            this->EndRun(run, best);
+            i = this->SkipQuantifier(pattern, i);
+            continue;
+          case '\\':
+            if (i + 1 >= len)
+              return "";
+            if (pattern[i + 1] == 'Q')
+              return "";
+            if (isalnum(pattern[i + 1])) {
+              /* \d, \b, \x41, \1 and friends */
+              this->EndRun(run, best);
+              i += 2;
+              while (i < len && isalnum(pattern[i]))
+                i++;
+              continue;
+            }
+            run += pattern[i + 1];
+            i += 2;
+            continue;
+          default:
+            run += c;
+            i++;
+        }
+      }
+      this->EndRun(run, best);
+      return best;
+    }
 
-      mark_tag mark_name(1), mark_alias(2), mark_predicate(3);
-      /* Match %foo(:bar)?% */
-      sregex pattern_expr_re(
+    void EndRun(string &run, string &best) {
+      if (run.size() > best.size())
+        best = run;
+      run.clear();
+    }
+
+    /* Return the position after the group starting at pattern[pos] */
+    string::size_type SkipGroup(const string &pattern, string::size_type pos) {
+      int nesting = 0;
+      while (pos < pattern.size()) {
+        switch (pattern[pos]) {
+          case '\\':
+            pos += 2;
+            continue;
+          case '[':
+            pos = this->SkipClass(pattern, pos);
+            if (pos == string::npos)
+              return pos;
+            continue;
+          case '(':
+            nesting++;
+            break;
+          case ')':
+            nesting--;
+            if (nesting == 0)
+              return this->SkipQuantifier(pattern, pos + 1);
+            break;
+        }
+        pos++;
+      }
+      return string::npos;
+    }
+
+    /* Return the position after the character class starting at pattern[pos] */
+    string::size_type SkipClass(const string &pattern, string::size_type pos) {
+      pos++; /* skip '[' */
+      if (pos < pattern.size() && pattern[pos] == '^')
+        pos++;
+      if (pos < pattern.size() && pattern[pos] == ']')
+        pos++;
+      while (pos < pattern.size() && pattern[pos] != ']') {
+        if (pattern[pos] == '\\')
+          pos++;
+        pos++;
+      }
+      if (pos >= pattern.size())
+        return string::npos;
+      return this->SkipQuantifier(pattern, pos + 1);
+    }
+
+    /* Return the position after any quantifier at pattern[pos] */
+    string::size_type SkipQuantifier(const string &pattern, string::size_type pos) {
+      if (pos >= pattern.size())
+        return pos;
+      if (pattern[pos] == '{') {
+        string::size_type close = pattern.find('}', pos);
+        if (close == string::npos)
+          return pos + 1;
+        pos = close + 1;
+      } else if (pattern[pos] == '*' || pattern[pos] == '+'
+                 || pattern[pos] == '?') {
+        pos++;
+      } else {
+        return pos;
+      }
+      /* lazy or possessive */
+      if (pos < pattern.size() && (pattern[pos] == '?' || pattern[pos] == '+'))
+        pos++;
+      return pos;
+    }
+
+    /* Captures are numbered once, here, rather than named on every match.
+     * An alias used twice shares one slot; the last match wins. */
+    int CaptureIndex(const string &alias) {
+      for (unsigned int i = 0; i < this->capture_names.size(); i++) {
+        if (this->capture_names[i] == alias)
+          return i;
+      }
+      this->capture_names.push_back(alias);
+      return this->capture_names.size() - 1;
+    }
+
+    /* Submatch numbers in PatternExprRegex() */
+    enum { MARK_NAME = 1, MARK_ALIAS = 2, MARK_PREDICATE = 3 };
+
+    /* Matches %NAME%, %NAME:ALIAS% and %NAME<predicate>% in a grok
+     * pattern. Compiled on first use and shared by every GrokRegex. */
+    static const sregex& PatternExprRegex() {
+      static mark_tag mark_name(MARK_NAME), mark_alias(MARK_ALIAS);
+      static mark_tag mark_predicate(MARK_PREDICATE);
+      /* not_percent == /([^\\%]+|\\.)+?/ */
+      static const sregex not_percent =
+        -+(~(boost::xpressive::set='%','\\') | (as_xpr('\\') >> _));
+      static const sregex pattern_expr_re(
          as_xpr('%')
          /* Pattern name and alias (FOO and FOO:BAR) */
          >> (mark_alias = 
@@ -169,18 +413,27 @@ class GrokRegex {
              )
          >> '%'
        );
+      return pattern_expr_re;
+    }
+
+    /* XXX: Split this into smaller functions */
+    void RecursiveGenerateRegex(string pattern, int &backref, regex_type **pregex, string &expanded_regex) {
+      int last_pos = 0;
+      string re_string;
+      regex_type *whole_re = NULL; /* set if 'pattern' is just one %PATTERN% */
+      //regex_type *re;
 
       //cerr << "pattern: " << pattern << endl;
 
       /* probaly should use regex_iterator<regex_type> here */
-      sregex_iterator cur(pattern.begin(), pattern.end(), pattern_expr_re);
+      sregex_iterator cur(pattern.begin(), pattern.end(), PatternExprRegex());
       sregex_iterator end;
 
       for (; cur != end; cur++) {
         smatch const &match = *cur;
-        string pattern_name = match[mark_name].str();
-        string pattern_alias = match[mark_alias].str();
-        string pattern_predicate = match[mark_predicate].str();
+        string pattern_name = match[MARK_NAME].str();
+        string pattern_alias = match[MARK_ALIAS].str();
+        string pattern_predicate = match[MARK_PREDICATE].str();
         //cerr << "P: " << pattern_name << " / " << pattern_alias << endl;
 
         if (match.position() > last_pos) {
@@ -210,19 +463,33 @@ class GrokRegex {
           regex_type backref_re;
           this->RecursiveGenerateRegex(sub_pattern, backref, &ptmp_re, expanded_regex);
           mark_tag backref_tag(backref);
-
-          /* Append predicate regex if we have one */
-          if (pattern_predicate.size() > 0) {
-            /* Need to track this memory and delete it when we destroy this object. */
-            GrokPredicate<regex_type> *pred = 
-              new GrokPredicate<regex_type>(pattern_predicate);
+          int capture_index = this->CaptureIndex(pattern_alias);
+
+          GrokPredicate<regex_type> *pred = NULL;
+
+          /* Need to track this memory and delete it when we destroy this object. */
+          if (pattern_predicate.size() > 0)
+            pred = new GrokPredicate<regex_type>(pattern_predicate);
+
+          /* The expansion above still numbered the captures inside it, and
+           * gave us the expanded text; a static version may replace the
+           * regex itself */
+          if (this->use_static_patterns
+              && StaticPatternRegex(pattern_name, this->pattern_set,
+                                    this->placeholder_captures,
+                                    this->capture_names,
+                                    (this->track_matches ? capture_index : -1),
+                                    pred, backref_re)) {
+            /* backref_re is complete */
+          } else if (pred != NULL) {
+            /* Append predicate regex if we have one */
             if (this->track_matches)
-              backref_re = (*ptmp_re) [ check(*pred) ] [ (this->placeholder_map)[pattern_alias] = as<string>(_) ];
+              backref_re = (*ptmp_re) [ check(*pred) ] [ (this->placeholder_captures)[capture_index] = _ ];
             else
               backref_re = (*ptmp_re) [ check(*pred) ];
           } else {
             if (this->track_matches)
-              backref_re = (*ptmp_re) [ (this->placeholder_map)[pattern_alias] = as<string>(_) ];
+              backref_re = (*ptmp_re) [ (this->placeholder_captures)[capture_index] = _ ];
             else
               backref_re = (*ptmp_re);
           }
@@ -234,6 +501,9 @@ class GrokRegex {
           (*this->re_compiler)[re_name.str()] = backref_re;
           re_string += "(?$"+ re_name.str() + ")";
 
+          if (match.position() == 0 && (size_t)match.length() == pattern.size())
+            whole_re = new regex_type(backref_re);
+
           re_string += ")";
           expanded_regex += ")";
           delete ptmp_re;
@@ -254,7 +524,22 @@ class GrokRegex {
       }
 
       //cerr << "String: " << re_string << endl;
-      *pregex = new regex_type(this->re_compiler->compile(re_string));
+      /* Going through a compiled "((?$NAME1))" just adds a layer of
+       * nesting around backref_re, which costs time on every match */
+      if (whole_re != NULL)
+        *pregex = whole_re;
+      else
+        *pregex = new regex_type(this->re_compiler->compile(re_string));
     }
 };
+
+/* The regex engine grok itself uses: Boost.Xpressive, or PCRE when built
+ * with -DGROK_PCRE (see pcreregex.hpp) */
+#ifdef GROK_PCRE
+#include "pcreregex.hpp"
+typedef PCRERegex grok_regex_type;
+#else
+typedef sregex grok_regex_type;
+#endif
+
 #endif /* ifndef __GROKREGEX_HPP */
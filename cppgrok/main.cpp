@@ -2,6 +2,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <list>
 #include <boost/xpressive/xpressive.hpp>
 
 #include <popt.h>
@@ -10,13 +11,14 @@
 #include "grokregex.hpp"
 #include "grokmatch.hpp"
 #include "grokconfig.hpp"
+#include "ratelimiter.hpp"
+#include "dnsresolver.hpp"
 
 using namespace std;
 using namespace boost::xpressive;
 
 #define CONFIG_BUFSIZE 4096
 
-typedef map < string, WatchFileEntry > watch_map_type;
 FILE *shell_fp;
 
 char *flag_match = NULL;
@@ -37,77 +39,189 @@ struct poptOption options_table[] = {
   POPT_TABLEEND
 };
 
-void grok_line(const FileObserver::data_pair_type &input_pair, 
-               watch_map_type &watchmap) {
-  const DataInput &di = input_pair.first;
-  watch_map_type::iterator map_entry = watchmap.find(di.data);
-  WatchFileEntry &wfe = (*map_entry).second;
-  const string &line = input_pair.second;
+/* One regex to try on a line, and the type section it came from */
+struct MatchStep {
+  WatchMatchType *wmt;
+  GrokRegex<grok_regex_type> *gre;
+  RateLimiter *limiter; /* NULL unless the section has a threshold */
+};
+
+/* Everything grok_line needs for lines from one input. Built once at
+ * startup and indexed by the input's FileObserver id. */
+struct MatchPlan {
+  const WatchFileEntry *wfe;
+  vector<MatchStep> steps;
+};
 
-  //cerr << "(" << di.data << ") " << line << endl;
+typedef vector < MatchPlan > match_plan_vector_type;
 
+/* Lay out the steps for one file entry, in config order, leaving out
+ * type sections that could never do anything. Sections with a threshold
+ * get a RateLimiter (from 'limiters'), shared by all their regexes. */
+void build_match_plan(WatchFileEntry &wfe, MatchPlan &plan,
+                      list<RateLimiter> &limiters) {
   vector<WatchMatchType>::iterator wmt_iter;
 
+  plan.wfe = &wfe;
+  plan.steps.clear();
   for (wmt_iter = wfe.match_types.begin();
        wmt_iter != wfe.match_types.end(); 
        wmt_iter++) {
     WatchMatchType &wmt = (*wmt_iter);
-    WatchMatchType::grok_regex_vector_type &gre_vector = wmt.match_strings;
     WatchMatchType::grok_regex_vector_type::iterator gre_iter;
+    RateLimiter *limiter = NULL;
+
+    if (wmt.match_strings.size() == 0) {
+      cerr << "No match strings in type section '" << wmt.type_name
+           << "'; ignoring it" << endl;
+      continue;
+    }
 
-    if (gre_vector.size() == 0) {
-      cerr << "Match by default." << endl;
+    if (wmt.reaction.size() == 0 
+        && wmt.reaction_type != WatchMatchType::JSON) {
+      cerr << "No reaction specified for type section '" << wmt.type_name 
+           << "'; ignoring it" <<  endl;
       continue;
     }
 
-    for (gre_iter = gre_vector.begin();
-         gre_iter != gre_vector.end();
+    if (wmt.threshold > 0) {
+      if (wmt.interval > 0) {
+        limiters.push_back(RateLimiter());
+        limiter = &limiters.back();
+        limiter->Configure(wmt.threshold, wmt.interval);
+      } else {
+        cerr << "Threshold without an interval in type section '" 
+             << wmt.type_name << "'; ignoring the threshold" << endl;
+      }
+    }
+
+    for (gre_iter = wmt.match_strings.begin();
+         gre_iter != wmt.match_strings.end();
          gre_iter++) {
-      /* XXX: gre.Search() modifies self, so we can't be const... blah */
-      GrokRegex<sregex> &gre = (*gre_iter);
-      GrokMatch<sregex> gm;
-      bool success = gre.Search(line, gm);
-      //cerr << "Line: " << line << endl;
-      //cerr << "Regex: " << gre.GetOriginalPattern() << " : " 
-           //<< gre.GetExpandedPattern() << endl;
-
-      //cerr << "Match return: " << success << endl;
-      if (!success)
-        continue;
+      MatchStep step;
+      step.wmt = &wmt;
+      step.gre = &(*gre_iter);
+      step.limiter = limiter;
+      if ((*gre_iter).GetRequiredLiteral().size() > 0) {
+        cerr << "Match '" << (*gre_iter).GetOriginalPattern() 
+             << "' requires '" << (*gre_iter).GetRequiredLiteral() << "'" 
+             << endl;
+      }
+      plan.steps.push_back(step);
+    }
+  }
+}
 
-      if (wmt.reaction.size() == 0 
-          && wmt.reaction_type != WatchMatchType::JSON) {
-        cerr << "No reaction specified for type section '" << wmt.type_name 
-             << "'" <<  endl;
-        continue;
+/* A reaction waiting for a DNS lookup, keyed by that lookup. Its match
+ * is detached, so it keeps its own copy of the line. */
+struct PendingReaction {
+  WatchMatchType *wmt;
+  GrokMatch<grok_regex_type> gm;
+};
+typedef map < string, list<PendingReaction> > pending_map_type;
+pending_map_type pending_reactions;
+unsigned long pending_count = 0;
+
+/* Run wmt's reaction for 'gm'. Returns false, having done nothing, if the
+ * reaction needs a DNS lookup that hasn't finished. */
+bool react(WatchMatchType &wmt, GrokMatch<grok_regex_type> &gm) {
+  string data;
+  switch (wmt.reaction_type) {
+    case WatchMatchType::SHELL:
+      gm.ExpandString(wmt.reaction, data);
+      if (gm.DNSPending())
+        return false;
+      //cerr << "Reaction: " << data << endl;
+      data += "\n";
+      fwrite(data.c_str(), data.size(), 1, shell_fp);
+      fflush(shell_fp);
+      break;
+    case WatchMatchType::JSON:
+      gm.ToJSON(data);
+      cout << data << endl;
+      break;
+    case WatchMatchType::PRINT:
+      gm.ExpandString(wmt.reaction, data);
+      if (gm.DNSPending())
+        return false;
+      cout << data << endl;
+      break;
+    default:
+      cerr << "UNKNOWN REACTION TYPE FOUND: " << wmt.reaction_type << endl;
+  } /* switch wmt.reaction_type */
+  return true;
+}
+
+void defer_reaction(WatchMatchType &wmt, const GrokMatch<grok_regex_type> &gm) {
+  list<PendingReaction> &waiting = pending_reactions[gm.GetDNSPendingKey()];
+  waiting.push_back(PendingReaction());
+  waiting.back().wmt = &wmt;
+  waiting.back().gm = gm;
+  waiting.back().gm.Detach();
+  pending_count++;
+}
+
+/* Retry the reactions that were waiting on lookups that just finished */
+void retry_reactions(DNSResolver &resolver) {
+  vector<string> done_keys;
+  vector<string>::iterator key_iter;
+
+  resolver.ProcessResults(done_keys);
+  for (key_iter = done_keys.begin(); key_iter != done_keys.end(); key_iter++) {
+    pending_map_type::iterator map_iter = pending_reactions.find(*key_iter);
+    list<PendingReaction> waiting;
+
+    if (map_iter == pending_reactions.end())
+      continue;
+    waiting.swap((*map_iter).second);
+    pending_reactions.erase(map_iter);
+
+    while (!waiting.empty()) {
+      PendingReaction &pr = waiting.front();
+      if (react(*pr.wmt, pr.gm)) {
+        waiting.pop_front();
+        pending_count--;
+      } else {
+        /* Now waiting on another lookup, like the A after a PTR */
+        list<PendingReaction> &next = pending_reactions[pr.gm.GetDNSPendingKey()];
+        next.splice(next.end(), waiting, waiting.begin());
       }
+    }
+  }
+}
+
+void grok_line(const DataLine &line, const MatchPlan &plan) {
+  vector<MatchStep>::const_iterator step_iter;
+  GrokMatch<grok_regex_type> gm;
+  string key;
+
+  for (step_iter = plan.steps.begin(); 
+       step_iter != plan.steps.end();
+       step_iter++) {
+    WatchMatchType &wmt = *((*step_iter).wmt);
+    /* XXX: gre.Search() modifies self, so we can't be const... blah */
+    GrokRegex<grok_regex_type> &gre = *((*step_iter).gre);
 
-      gm.SetMatchMetaValue("TYPE", wmt.type_name);
-      gm.SetMatchMetaValue("DATASOURCE", wfe.name);
-      /* XXX: keys not implemented yet */
-      //gm.SetMatchMetaValue("KEY", wmt.key);
-      string data;
-      switch (wmt.reaction_type) {
-        case WatchMatchType::SHELL:
-          gm.ExpandString(wmt.reaction, data);
-          //cerr << "Reaction: " << data << endl;
-          data += "\n";
-          fwrite(data.c_str(), data.size(), 1, shell_fp);
-          fflush(shell_fp);
-          break;
-        case WatchMatchType::JSON:
-          gm.ToJSON(data);
-          cout << data << endl;
-          break;
-        case WatchMatchType::PRINT:
-          gm.ExpandString(wmt.reaction, data);
-          cout << data << endl;
-          break;
-        default:
-          cerr << "UNKNOWN REACTION TYPE FOUND: " << wmt.reaction_type << endl;
-      } /* switch wmt.reaction_type */
-    } /* for ... gre_vector.begin() to .end() */
-  } /* for ... wfe.match_types.begin() to .end()  */
+    /* Search() does the required-literal precheck before the regex */
+    if (!gre.Search(line.begin, line.end, gm))
+      continue;
+
+    /* With a threshold, react only when this match takes its key over
+     * the threshold within the interval */
+    if ((*step_iter).limiter != NULL) {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      gm.ExpandString(wmt.key, key);
+      if (!(*step_iter).limiter->Hit(key, now.tv_sec + now.tv_usec / 1e6))
+        continue;
+      gm.SetMatchMetaValue("KEY", key);
+    }
+
+    gm.SetMatchMetaValue("TYPE", wmt.type_name);
+    gm.SetMatchMetaValue("DATASOURCE", plan.wfe->name);
+    if (!react(wmt, gm))
+      defer_reaction(wmt, gm);
+  } /* for ... plan.steps.begin() to .end() */
 }
 
 int main(int argc, const char **argv) {
@@ -164,35 +278,38 @@ int main(int argc, const char **argv) {
   GrokConfig::watch_file_vector_type watches;
 
   watches = config.GetFileEntries();
-  map < string, WatchFileEntry > watchmap;
+  match_plan_vector_type plans;
+  list<RateLimiter> limiters;
   FileObserver fo;
   for (watch_iter = watches.begin(); watch_iter != watches.end(); watch_iter++) {
-    const vector<DataInput> &di_vector = (*watch_iter).fo.GetDataInputs();
-    vector<DataInput>::const_iterator di_iter;
+    MatchPlan plan;
     cerr << "FileObserver name: " << (*watch_iter).name << endl;
-    for (di_iter = di_vector.begin(); di_iter != di_vector.end(); di_iter++) {
-      cerr << "File name: " << (*di_iter).data << endl;
-      watchmap[(*di_iter).data] = *watch_iter;
-    }
+    build_match_plan(*watch_iter, plan, limiters);
+
+    /* Merge() numbers the entry's inputs after the ones we have */
     fo.Merge((*watch_iter).fo);
+    while (plans.size() < fo.GetDataInputs().size()) {
+      cerr << "File name: " << fo.GetDataInput(plans.size()).data << endl;
+      plans.push_back(plan);
+    }
   }
 
-  FileObserver::data_input_vector_type input_vector;
-  FileObserver::data_pair_type input_pair;
-  FileObserver::data_input_vector_type::iterator input_iter;
+  FileObserver::data_line_vector_type lines;
+  FileObserver::data_line_vector_type::const_iterator line_iter;
+
+  /* The dns filter resolves in the background; reactions that need it
+   * wait while other lines go on being matched */
+  DNSResolver resolver;
+  GrokMatch<grok_regex_type>::SetDNSResolver(&resolver);
+  fo.AddWakeupFd(resolver.GetFd());
 
   fo.OpenAll();
-  while (!fo.DoneReading()) {
-    fo.ReadLines(30, input_vector);
-    for (input_iter = input_vector.begin(); 
-         input_iter != input_vector.end();
-         input_iter++) {
-      input_pair = *input_iter;
-      grok_line(input_pair, watchmap);
-      //cerr << "(" << input_pair.first.data << ") " << input_pair.second << endl;
-      //cerr << "watchmap: " << watchmap[input_pair.first.data].name << endl;
+  while (!fo.DoneReading() || pending_count > 0) {
+    fo.ReadLines(30, lines);
+    for (line_iter = lines.begin(); line_iter != lines.end(); line_iter++) {
+      grok_line(*line_iter, plans[(*line_iter).input_id]);
     }
-    input_vector.clear();
+    retry_reactions(resolver);
   }
   return 0;
 }
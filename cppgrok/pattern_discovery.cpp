@@ -1,13 +1,22 @@
 
+#include <pthread.h>
+#include <unistd.h>
+
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <list>
+#include <vector>
+#include <algorithm>
+#include <tr1/unordered_map>
 
 #include "grokpatternset.hpp"
 #include "grokregex.hpp"
 #include "grokmatch.hpp"
 
+/* Lines read and analyzed at a time; identical lines within a batch are
+ * only analyzed once */
+#define BATCH_SIZE 50000
+
 template <typename regex_type>
 class ExpandedPattern {
   public:
@@ -15,7 +24,8 @@ class ExpandedPattern {
     string pattern;
     GrokRegex<regex_type> gre;
 
-    ExpandedPattern(string name, GrokPatternSet<regex_type> pattern_set) {
+    ExpandedPattern(const string &name,
+                    const GrokPatternSet<regex_type> &pattern_set) {
       string gre_string = "%" + name + "=~[^A-z0-9_-]%";
       gre.SetTrackMatches(false);
 
@@ -23,6 +33,7 @@ class ExpandedPattern {
       this->gre.SetRegex(gre_string);
       this->name = name;
       this->pattern = gre.GetExpandedPattern();
+      this->complexity = this->ComputeComplexity();
     }
 
     ~ExpandedPattern() {
@@ -36,13 +47,23 @@ class ExpandedPattern {
     const string &GetName() const {
       return this->name;
     }
-    
-    int GetComplexity() {
-      sregex space_re, period_re, punctuation_re;
+
+    int GetComplexity() const {
+      return this->complexity;
+    }
+
+    bool operator<(const ExpandedPattern<regex_type> &other) const {
+      return this->complexity < other.complexity;
+    }
+
+  private:
+    int complexity;
+
+    int ComputeComplexity() const {
+      static const sregex space_re = _s >> "\\s"; // literal space or meta space
+      static const sregex period_re = as_xpr(".");
+      static const sregex punctuation_re = sregex::compile("['\":_.=+-]");
       int complexity(0);
-      space_re = _s >> "\\s"; // literal space or meta space
-      period_re = as_xpr(".");
-      punctuation_re = sregex::compile("['\":_.=+-]");
 
       sregex_iterator end;
       sregex_iterator space_iter(this->pattern.begin(), this->pattern.end(),
@@ -63,91 +84,188 @@ class ExpandedPattern {
 
       return complexity;
     }
-
-    bool operator<(ExpandedPattern<regex_type> &other) {
-      return (this->GetComplexity() - other.GetComplexity()) < 0;
-    }
 };
 
-void GetPatternNames(GrokPatternSet<sregex> &patterns, 
-                     list< ExpandedPattern<sregex> > &expanded_patterns) {
+typedef vector< ExpandedPattern<sregex> > expanded_pattern_vector;
+
+/* Most complex pattern first */
+bool MoreComplex(const ExpandedPattern<sregex> &a,
+                 const ExpandedPattern<sregex> &b) {
+  return b < a;
+}
+
+void GetPatternNames(const GrokPatternSet<sregex> &patterns,
+                     expanded_pattern_vector &expanded_patterns) {
   GrokPatternSet<sregex>::pattern_set_type::const_iterator iter;
   sregex bad_pattern = sregex::compile("^(DATA|GREEDYDATA|WORD|NOTSPACE|PID|PROG|YEAR)$");
   for (iter = patterns.patterns.begin(); iter != patterns.patterns.end(); iter++) {
-    ExpandedPattern<sregex> ep((*iter).first, patterns);
-    //cout << (*iter).first << endl;
     if (!regex_search((*iter).first, bad_pattern))
-      expanded_patterns.push_back(ep);
+      expanded_patterns.push_back(ExpandedPattern<sregex>((*iter).first, patterns));
   }
+  stable_sort(expanded_patterns.begin(), expanded_patterns.end(), MoreComplex);
 }
 
+/* One left-to-right pass over [pos, limit) of 'line', appending it to
+ * 'result' with matches replaced by %NAME%. Each pattern remembers where
+ * it next matches, and is only searched again once the pass has moved
+ * beyond that. At each point we start from the earliest match and give
+ * way to any more complex pattern whose match starts inside it, so the
+ * most complex pattern still wins where matches overlap; whatever that
+ * skips over gets a pass of its own, as if the match that won were
+ * already replaced. */
+void Analyze(const string &line, int pos, int limit,
+             expanded_pattern_vector &expanded_patterns, string &result) {
+  vector<int> starts(expanded_patterns.size(), -1);
+  vector<int> ends(expanded_patterns.size(), -1);
+  vector<bool> exhausted(expanded_patterns.size(), false);
+  GrokMatch<sregex> gm;
+
+  while (true) {
+    int best = -1;
 
-void Analyze(string &line, GrokPatternSet<sregex> &patterns, 
-             list< ExpandedPattern<sregex> > expanded_patterns) {
-  bool done = false;
-
-  sregex ignore_re = sregex::compile("QS|QUOTEDSTRING");
-  
-  while (!done) {
-    list< ExpandedPattern<sregex> >::iterator iter;
-    unsigned int replacement_count = 0;
-
-    for (iter = expanded_patterns.begin();
-         iter != expanded_patterns.end();
-         iter++) {
-      ExpandedPattern<sregex> ep = *iter;
-      GrokMatch<sregex> gm;
-      bool success;
-      string pattern = "%" + ep.GetName() + "%";
-      success = ep.gre.Search(line, gm);
-
-      //cout << "Testing " << pattern << " on " << line << endl;
-      if (success) {
-        int start = gm.GetPosition();
-        int end = start + gm.GetLength();
-        //cout << "Match: " << pattern << endl;
-
-        /* Skip already sections for certain patterns*/
-        if (gm.GetMatchString().find("%") != string::npos 
-            && (pattern == "%QS%" || pattern == "%QUOTEDSTRING%")) {
-          cout << "Skipping attempt with " << pattern << " becuase match has % in it" << endl;
+    for (unsigned int i = 0; i < expanded_patterns.size(); i++) {
+      if (exhausted[i])
+        continue;
+      if (starts[i] < pos) {
+        if (!expanded_patterns[i].gre.Search(line.begin() + pos,
+                                             line.begin() + limit, gm)) {
+          exhausted[i] = true;
           continue;
         }
-        /* Store the new generated line here.
-         * Subsequent matches will override this value, meaning that
-         * the least complex match will always result in the new line */
-        line = line.substr(0, start) 
-          + pattern
-          + line.substr(end, line.size() - end);
-        replacement_count++;
-        //cout << "New: " << line << endl;
-        break;
+        starts[i] = pos + gm.GetPosition();
+        ends[i] = starts[i] + gm.GetLength();
+      }
+      if (best == -1 || starts[i] < starts[best])
+        best = i;
+    }
+
+    if (best == -1)
+      break;
+
+    /* Patterns are most complex first */
+    for (int i = 0; i < best; i++) {
+      if (!exhausted[i] && starts[i] < ends[best]) {
+        best = i;
+        i = -1;
       }
     }
-    if (replacement_count == 0)
-      done = true;
+
+    if (starts[best] > pos)
+      Analyze(line, pos, starts[best], expanded_patterns, result);
+    result += "%" + expanded_patterns[best].GetName() + "%";
+    pos = ends[best];
   }
+  result.append(line, pos, limit - pos);
+}
 
-  cout << line << endl;
+/* Work shared with the analysis threads. Thread n analyzes every
+ * 'num_threads'th unique line, starting at n, with its own patterns,
+ * since GrokRegex::Search isn't safe to share. */
+struct AnalyzeJob {
+  const vector<const string *> *unique_lines;
+  vector<string> *results;
+  expanded_pattern_vector *expanded_patterns;
+  unsigned int thread_num;
+  unsigned int num_threads;
+};
+
+void *AnalyzeThread(void *arg) {
+  AnalyzeJob *job = (AnalyzeJob *)arg;
+  for (unsigned int i = job->thread_num; i < job->unique_lines->size();
+       i += job->num_threads) {
+    const string &line = *(*job->unique_lines)[i];
+    Analyze(line, 0, line.size(), *job->expanded_patterns,
+            (*job->results)[i]);
+  }
+  return NULL;
+}
+
+/* Analyze each distinct line in 'lines' once and print a result for
+ * every line, in order */
+void AnalyzeBatch(const vector<string> &lines,
+                  vector<expanded_pattern_vector> &thread_patterns) {
+  typedef tr1::unordered_map < string, unsigned int > line_index_map;
+  line_index_map line_index;
+  vector<const string *> unique_lines;
+  vector<unsigned int> result_index(lines.size());
+  vector<string> results;
+  vector<pthread_t> threads;
+  vector<AnalyzeJob> jobs(thread_patterns.size());
+
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    pair<line_index_map::iterator, bool> ins = line_index.insert(
+      line_index_map::value_type(lines[i], unique_lines.size()));
+    if (ins.second)
+      unique_lines.push_back(&lines[i]);
+    result_index[i] = (*ins.first).second;
+  }
+  results.resize(unique_lines.size());
+
+  for (unsigned int n = 0; n < jobs.size(); n++) {
+    jobs[n].unique_lines = &unique_lines;
+    jobs[n].results = &results;
+    jobs[n].expanded_patterns = &thread_patterns[n];
+    jobs[n].thread_num = n;
+    jobs[n].num_threads = jobs.size();
+  }
+
+  /* This thread takes the first share itself */
+  for (unsigned int n = 1; n < jobs.size(); n++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, AnalyzeThread, &jobs[n]) != 0) {
+      cerr << "pthread_create failed; analyzing in this thread" << endl;
+      AnalyzeThread(&jobs[n]);
+      continue;
+    }
+    threads.push_back(thread);
+  }
+  AnalyzeThread(&jobs[0]);
+  for (unsigned int n = 0; n < threads.size(); n++)
+    pthread_join(threads[n], NULL);
+
+  for (unsigned int i = 0; i < lines.size(); i++)
+    cout << results[result_index[i]] << endl;
 }
 
 int main(int argc, char **argv) {
   string line;
   GrokPatternSet<sregex> patterns;
-  list< ExpandedPattern<sregex> > expanded_patterns;
-  patterns.LoadFromFile("patterns");
-  GetPatternNames(patterns, expanded_patterns);
-  expanded_patterns.sort();
+  vector<expanded_pattern_vector> thread_patterns;
+  vector<string> lines;
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    switch (opt) {
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      default:
+        cerr << "Usage: " << argv[0] << " [-j threads] < logfile" << endl;
+        return 1;
+    }
+  }
+  if (num_threads < 1)
+    num_threads = 1;
 
-  /* We want the most complex pattern first */
-  expanded_patterns.reverse();
+  patterns.LoadFromFile("patterns");
+  thread_patterns.resize(num_threads);
+  for (long n = 0; n < num_threads; n++)
+    GetPatternNames(patterns, thread_patterns[n]);
 
-  //list< ExpandedPattern<sregex> >::iterator iter;
-  //for (iter = expanded_patterns.begin(); iter != expanded_patterns.end(); iter++) {
+  //expanded_pattern_vector::iterator iter;
+  //for (iter = thread_patterns[0].begin(); iter != thread_patterns[0].end(); iter++) {
     //cout << (*iter).GetName() << " = " << (*iter).GetExpandedPattern() << endl;
   //}
+  lines.reserve(BATCH_SIZE);
   while (getline(cin, line)) {
-    Analyze(line, patterns, expanded_patterns);
+    lines.push_back(line);
+    if (lines.size() == BATCH_SIZE) {
+      AnalyzeBatch(lines, thread_patterns);
+      lines.clear();
+    }
   }
+  if (lines.size() > 0)
+    AnalyzeBatch(lines, thread_patterns);
   return 0;
 }
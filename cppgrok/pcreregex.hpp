@@ -0,0 +1,367 @@
+#ifndef __PCREREGEX_HPP
+#define __PCREREGEX_HPP
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/xpressive/xpressive.hpp>
+
+using namespace std;
+using namespace boost::xpressive;
+
+/* A regex_type for GrokRegex, GrokMatch and GrokPredicate backed by PCRE2
+ * and, where the platform has it, PCRE2's JIT. Build with -DGROK_PCRE to
+ * make it grok's engine (see grok_regex_type in grokregex.hpp).
+ *
+ * Where the xpressive backend nests one compiled regex per %PATTERN%,
+ * this one expands a grok pattern into a single PCRE pattern, with a
+ * named group around each %PATTERN%. Before Compile(), CaptureGroup()
+ * says which GrokMatch capture a named group fills, and AddCheck() hangs
+ * a predicate off one; the predicate runs as a PCRE callout, so a failed
+ * predicate backtracks just like xpressive's check().
+ *
+ * Copies share the compiled pattern and its match data. */
+class PCRERegex {
+  public:
+    typedef string string_type;
+    typedef string::const_iterator iterator_type;
+    typedef sub_match<iterator_type> capture_type;
+    typedef vector<capture_type> capture_vector_type;
+    typedef boost::function<bool (const capture_type &)> check_type;
+
+    PCRERegex() : compiled_ok(false) {
+      /* nothing to do */
+    }
+
+    /* Like sregex::compile(); for predicate (=~) regexes */
+    static PCRERegex compile(const string &pattern) {
+      PCRERegex re;
+      re.Compile(pattern);
+      return re;
+    }
+
+    /* Before Compile(): record the group named 'name' in capture 'index'
+     * on every match */
+    void CaptureGroup(const string &name, int index) {
+      GroupSpec spec;
+      spec.name = name;
+      spec.capture_index = index;
+      this->groups.push_back(spec);
+    }
+
+    /* Before Compile(): 'check' must accept the text of the group named
+     * 'name' for a match to go on. Returns the callout number to put
+     * right after that group: "(?<name>...)(?C<number>)". */
+    int AddCheck(const string &name, check_type check) {
+      CheckSpec spec;
+      spec.name = name;
+      spec.check = check;
+      this->checks.push_back(spec);
+      return this->checks.size();
+    }
+
+    bool Compile(const string &pattern) {
+      int error;
+      PCRE2_SIZE error_offset;
+      pcre2_code *code;
+      uint32_t options = 0;
+
+      this->compiled_ok = false;
+      /* PCRE makes "[0-9]+" possessive when nothing after it could match
+       * a digit, but a failed check has to be able to backtrack into it */
+      if (this->checks.size() > 0)
+        options |= PCRE2_NO_AUTO_POSSESS;
+      code = pcre2_compile((PCRE2_SPTR)pattern.data(), pattern.size(),
+                           options, &error, &error_offset, NULL);
+      if (code == NULL) {
+        PCRE2_UCHAR message[256];
+        pcre2_get_error_message(error, message, sizeof(message));
+        cerr << "PCRE compile failed at offset " << error_offset << ": "
+             << message << endl;
+        cerr << "Regex was: " << pattern << endl;
+        return false;
+      }
+
+      /* Without JIT support pcre2_match() just interprets */
+      pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+
+      this->compiled.reset(new Compiled(code));
+      if (!this->ResolveNames(this->groups, this->compiled->groups)
+          || !this->ResolveNames(this->checks, this->compiled->checks))
+        return false;
+
+      this->compiled_ok = true;
+      return true;
+    }
+
+    bool Valid() const {
+      return this->compiled_ok;
+    }
+
+    /* Find the first match in [begin, end). Fills 'captures' from the
+     * groups given to CaptureGroup() and sets where the match is. */
+    bool Search(iterator_type begin, iterator_type end,
+                capture_vector_type &captures, int &position,
+                int &length) const {
+      vector<Group>::const_iterator iter;
+      PCRE2_SIZE *ovector;
+      int ret;
+
+      ret = this->Match(begin, end);
+      if (ret <= 0)
+        return false;
+
+      ovector = pcre2_get_ovector_pointer(this->compiled->match_data);
+      position = ovector[0];
+      length = ovector[1] - ovector[0];
+
+      /* Groups are in pattern order, so for a repeated alias the last
+       * one that took part wins */
+      for (iter = this->compiled->groups.begin();
+           iter != this->compiled->groups.end(); iter++) {
+        int number = (*iter).number;
+        if (number >= ret || ovector[2 * number] == PCRE2_UNSET)
+          continue;
+        captures[(*iter).capture_index] =
+          capture_type(begin + ovector[2 * number],
+                       begin + ovector[2 * number + 1], true);
+      }
+      return true;
+    }
+
+    bool Search(iterator_type begin, iterator_type end) const {
+      return this->Match(begin, end) > 0;
+    }
+
+  private:
+    struct GroupSpec {
+      string name;
+      int capture_index;
+    };
+
+    struct CheckSpec {
+      string name;
+      check_type check;
+    };
+
+    /* A spec with its name resolved to a group number */
+    struct Group {
+      int number;
+      int capture_index;
+      check_type check;
+    };
+
+    struct Compiled {
+      pcre2_code *code;
+      pcre2_match_data *match_data;
+      pcre2_match_context *match_context;
+      vector<Group> groups;
+      vector<Group> checks; /* by callout number - 1 */
+
+      Compiled(pcre2_code *code) : code(code) {
+        this->match_data = pcre2_match_data_create_from_pattern(code, NULL);
+        this->match_context = pcre2_match_context_create(NULL);
+      }
+
+      ~Compiled() {
+        pcre2_match_context_free(this->match_context);
+        pcre2_match_data_free(this->match_data);
+        pcre2_code_free(this->code);
+      }
+    };
+
+    /* What a callout needs to turn offsets back into iterators */
+    struct CalloutState {
+      const Compiled *compiled;
+      iterator_type begin;
+    };
+
+    vector<GroupSpec> groups;
+    vector<CheckSpec> checks;
+    boost::shared_ptr<Compiled> compiled;
+    bool compiled_ok;
+
+    int Match(iterator_type begin, iterator_type end) const {
+      CalloutState state;
+      const char *subject = (begin == end ? "" : &*begin);
+      int ret;
+
+      if (!this->compiled_ok)
+        return 0;
+
+      if (this->compiled->checks.size() > 0) {
+        state.compiled = this->compiled.get();
+        state.begin = begin;
+        pcre2_set_callout(this->compiled->match_context, PCRERegex::Callout,
+                          &state);
+      }
+
+      ret = pcre2_match(this->compiled->code, (PCRE2_SPTR)subject,
+                        end - begin, 0, 0, this->compiled->match_data,
+                        this->compiled->match_context);
+      if (ret < 0 && ret != PCRE2_ERROR_NOMATCH) {
+        PCRE2_UCHAR message[256];
+        pcre2_get_error_message(ret, message, sizeof(message));
+        cerr << "PCRE match failed: " << message << endl;
+      }
+      return ret;
+    }
+
+    /* Returning nonzero fails the match at this point, and PCRE
+     * backtracks */
+    static int Callout(pcre2_callout_block *block, void *data) {
+      CalloutState *state = (CalloutState *)data;
+      const vector<Group> &checks = state->compiled->checks;
+      unsigned int index = block->callout_number - 1;
+      int number;
+
+      if (index >= checks.size())
+        return 0;
+      number = checks[index].number;
+      if ((unsigned int)number >= block->capture_top
+          || block->offset_vector[2 * number] == PCRE2_UNSET)
+        return 1;
+
+      capture_type capture(state->begin + block->offset_vector[2 * number],
+                           state->begin + block->offset_vector[2 * number + 1],
+                           true);
+      return checks[index].check(capture) ? 0 : 1;
+    }
+
+    template <typename spec_type>
+    bool ResolveNames(const vector<spec_type> &specs, vector<Group> &resolved) {
+      typename vector<spec_type>::const_iterator iter;
+
+      resolved.clear();
+      for (iter = specs.begin(); iter != specs.end(); iter++) {
+        Group group;
+        group.number = pcre2_substring_number_from_name(
+          this->compiled->code, (PCRE2_SPTR)(*iter).name.c_str());
+        if (group.number < 0) {
+          cerr << "PCRE: no group named '" << (*iter).name << "'" << endl;
+          return false;
+        }
+        this->SetFromSpec(group, *iter);
+        resolved.push_back(group);
+      }
+      return true;
+    }
+
+    void SetFromSpec(Group &group, const GroupSpec &spec) {
+      group.capture_index = spec.capture_index;
+    }
+
+    void SetFromSpec(Group &group, const CheckSpec &spec) {
+      group.capture_index = -1;
+      group.check = spec.check;
+    }
+};
+
+/* For GrokPredicate's =~ and !~ */
+bool regex_search(const string &data, const PCRERegex &re) {
+  return re.Search(data.begin(), data.end());
+}
+
+#include "grokregex.hpp"
+
+/* GrokRegex's expansion and search for PCRE. Each %NAME% becomes
+ * "(?<NAMEn>...)", n counting up as in the xpressive names, with a
+ * callout after it if it has a predicate. */
+template <>
+void GrokRegex<PCRERegex>::RecursiveGenerateRegex(string pattern, int &backref,
+                                                  PCRERegex **pregex,
+                                                  string &expanded_regex) {
+  string::size_type last_pos = 0;
+
+  sregex_iterator cur(pattern.begin(), pattern.end(), PatternExprRegex());
+  sregex_iterator end;
+
+  for (; cur != end; cur++) {
+    smatch const &match = *cur;
+    string pattern_name = match[MARK_NAME].str();
+    string pattern_alias = match[MARK_ALIAS].str();
+    string pattern_predicate = match[MARK_PREDICATE].str();
+
+    string::size_type match_pos = match.position();
+
+    if (match_pos > last_pos)
+      expanded_regex += pattern.substr(last_pos, match_pos - last_pos);
+    last_pos = match_pos + match.length();
+
+    if (this->pattern_set.patterns.count(pattern_name) == 0) {
+      expanded_regex += "%" + pattern_name + "%";
+      continue;
+    }
+
+    stringstream re_name(stringstream::out);
+    backref++;
+    re_name << pattern_name << backref;
+
+    expanded_regex += "(?<" + re_name.str() + ">";
+    this->RecursiveGenerateRegex(
+      this->pattern_set.patterns[pattern_name].regex_str, backref, pregex,
+      expanded_regex);
+    expanded_regex += ")";
+
+    if (this->track_matches)
+      (*pregex)->CaptureGroup(re_name.str(),
+                              this->CaptureIndex(pattern_alias));
+    if (pattern_predicate.size() > 0) {
+      stringstream callout(stringstream::out);
+      callout << "(?C" << (*pregex)->AddCheck(
+        re_name.str(), GrokPredicate<PCRERegex>(pattern_predicate)) << ")";
+      expanded_regex += callout.str();
+    }
+  }
+
+  if (last_pos < pattern.size())
+    expanded_regex += pattern.substr(last_pos, pattern.size() - last_pos);
+}
+
+template <>
+void GrokRegex<PCRERegex>::GenerateRegex() {
+  int backref = 0;
+
+  if (this->generated_regex != NULL)
+    delete this->generated_regex;
+  this->generated_regex = new PCRERegex;
+
+  if (this->generated_string != NULL)
+    delete this->generated_string;
+  this->generated_string = new string;
+
+  this->capture_names.clear();
+
+  /* XXX: Enforce a max recursion depth */
+  this->RecursiveGenerateRegex(this->pattern, backref,
+                               &this->generated_regex,
+                               *this->generated_string);
+  this->generated_regex->Compile(*this->generated_string);
+
+  this->required_literal = this->RequiredLiteral(this->pattern, 0);
+}
+
+template <>
+bool GrokRegex<PCRERegex>::Search(PCRERegex::iterator_type begin,
+                                  PCRERegex::iterator_type end,
+                                  GrokMatch<PCRERegex> &gm) {
+  int position, length;
+
+  if (!this->MayMatch(begin, end))
+    return false;
+
+  this->captures.assign(this->capture_names.size(), capture_type());
+  if (!this->generated_regex->Search(begin, end, this->captures, position,
+                                     length))
+    return false;
+
+  gm.init(begin, end, position, length, this->capture_names, this->captures);
+  return true;
+}
+
+#endif /* ifndef __PCREREGEX_HPP */
@@ -0,0 +1,137 @@
+#ifndef __RATELIMITER_HPP
+#define __RATELIMITER_HPP
+
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+using namespace std;
+
+/* Slots in the timing wheel, and how many ticks one interval spans.
+ * With more slots than ticks per interval, every entry expires within
+ * one turn of the wheel. */
+#define RATELIMITER_SLOTS 128
+#define RATELIMITER_TICKS_PER_INTERVAL 64
+
+/* Counts hits per key and says when a key has gone over 'threshold' hits
+ * within 'interval' seconds. A key's window starts at its first hit; it
+ * fires once, on the hit that goes over, and is forgotten when the window
+ * ends, so a key fires at most once per interval.
+ *
+ * Keys are kept in a hash table and also on a hashed timing wheel: a ring
+ * of slots, each one tick (interval / 64) wide, holding the keys that
+ * expire in it. A hit is one hash lookup; moving the clock forward only
+ * visits the slots that have come due, so millions of keys cost nothing
+ * until they expire. */
+class RateLimiter {
+  public:
+    RateLimiter() : threshold(0), interval(0), tick_length(0),
+                    current_tick(-1), slots(RATELIMITER_SLOTS, (Entry *)NULL) {
+    }
+
+    void Configure(float threshold, float interval) {
+      this->threshold = threshold;
+      this->interval = interval;
+      this->tick_length = interval / RATELIMITER_TICKS_PER_INTERVAL;
+    }
+
+    /* Record a hit on 'key' at time 'now' (seconds). Returns true if this
+     * hit takes the key over the threshold. */
+    bool Hit(const string &key, double now) {
+      long tick = (long)(now / this->tick_length);
+      entry_map_type::iterator iter;
+
+      this->Advance(tick);
+
+      iter = this->entries.find(key);
+      if (iter == this->entries.end()) {
+        iter = this->entries.insert(
+          entry_map_type::value_type(key, Entry())).first;
+        Entry &entry = (*iter).second;
+        entry.key = &(*iter).first;
+        entry.count = 0;
+        entry.fired = false;
+        /* Round up so a window is never shorter than 'interval' */
+        entry.expire_tick = tick + RATELIMITER_TICKS_PER_INTERVAL + 1;
+        this->Link(entry);
+      }
+
+      Entry &entry = (*iter).second;
+      entry.count++;
+      if (!entry.fired && entry.count > this->threshold) {
+        entry.fired = true;
+        return true;
+      }
+      return false;
+    }
+
+    /* Number of keys being tracked */
+    unsigned long Size() const {
+      return this->entries.size();
+    }
+
+  private:
+    struct Entry {
+      const string *key; /* the hash table's copy */
+      unsigned long count;
+      bool fired;
+      long expire_tick;
+      Entry *prev;
+      Entry *next;
+    };
+    typedef tr1::unordered_map < string, Entry > entry_map_type;
+
+    float threshold;
+    float interval;
+    double tick_length;
+    long current_tick;
+    vector < Entry * > slots;
+    entry_map_type entries;
+
+    /* Move the clock to 'tick', dropping keys whose window has ended */
+    void Advance(long tick) {
+      long steps;
+
+      if (this->current_tick < 0 || tick < this->current_tick) {
+        this->current_tick = tick;
+        return;
+      }
+
+      steps = tick - this->current_tick;
+      if (steps > RATELIMITER_SLOTS)
+        steps = RATELIMITER_SLOTS;
+
+      for (long i = 1; i <= steps; i++) {
+        Entry *entry = this->slots[(this->current_tick + i) % RATELIMITER_SLOTS];
+        while (entry != NULL) {
+          Entry *next = entry->next;
+          if (entry->expire_tick <= tick) {
+            this->Unlink(*entry);
+            this->entries.erase(this->entries.find(*entry->key));
+          }
+          entry = next;
+        }
+      }
+      this->current_tick = tick;
+    }
+
+    void Link(Entry &entry) {
+      Entry *&head = this->slots[entry.expire_tick % RATELIMITER_SLOTS];
+      entry.prev = NULL;
+      entry.next = head;
+      if (head != NULL)
+        head->prev = &entry;
+      head = &entry;
+    }
+
+    void Unlink(Entry &entry) {
+      if (entry.prev != NULL)
+        entry.prev->next = entry.next;
+      else
+        this->slots[entry.expire_tick % RATELIMITER_SLOTS] = entry.next;
+      if (entry.next != NULL)
+        entry.next->prev = entry.prev;
+    }
+};
+
+#endif /* ifndef __RATELIMITER_HPP */
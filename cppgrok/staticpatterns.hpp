@@ -0,0 +1,241 @@
+#ifndef __STATICPATTERNS_HPP
+#define __STATICPATTERNS_HPP
+
+#include <string>
+#include <vector>
+#include <boost/xpressive/xpressive.hpp>
+#include <boost/xpressive/regex_actions.hpp>
+
+#include "grokpatternset.hpp"
+#include "grokpredicate.hpp"
+
+using namespace std;
+using namespace boost::xpressive;
+
+/* Static (expression template) versions of the built-in patterns that
+ * most configs spend their time in. A dynamic xpressive regex walks a
+ * chain of virtual matchers; these are compiled into inline code, and
+ * match roughly twice as fast.
+ *
+ * GrokRegex uses one in place of the dynamic regex when a %PATTERN% is
+ * one of these and its definition, and those of the patterns it uses,
+ * are still exactly the ones in 'patterns'. Patterns that contain others
+ * (SYSLOGBASE, HTTPDATE) record the same captures the dynamic expansion
+ * would. The pattern's own capture and predicate are built into the
+ * static regex too; wrapping it as an sregex would cost most of what we
+ * gained. */
+
+/* The definitions these were written from, as in 'patterns' */
+static const char *static_pattern_definitions[][2] = {
+  { "INT", "(?:[+-]?(?:[0-9]+))" },
+  { "NUMBER", "(?:[+-]?(?:(?:[0-9]+(?:\\.[0-9]*)?)|(?:\\.[0-9]+)))" },
+  { "WORD", "\\w+" },
+  { "IP", "(?<![0-9])(?:(?:25[0-5]|2[0-4][0-9]|[0-1]?[0-9]{1,2})[.]"
+          "(?:25[0-5]|2[0-4][0-9]|[0-1]?[0-9]{1,2})[.]"
+          "(?:25[0-5]|2[0-4][0-9]|[0-1]?[0-9]{1,2})[.]"
+          "(?:25[0-5]|2[0-4][0-9]|[0-1]?[0-9]{1,2}))(?![0-9])" },
+  { "HOSTNAME", "(?:[0-9A-z][0-9A-z-]{0,62})"
+                "(?:\\.(?:[0-9A-z][0-9A-z-]{0,62}))*\\.?" },
+  { "MONTH", "\\b(?:Jan(?:uary)?|Feb(?:ruary)?|Mar(?:ch)?|Apr(?:il)?|May"
+             "|Jun(?:e)?|Jul(?:y)?|Aug(?:ust)?|Sep(?:tember)?|Oct(?:ober)?"
+             "|Nov(?:ember)?|Dec(?:ember)?)\\b" },
+  { "MONTHDAY", "(?:(?:3[01]|[0-2]?[0-9]))" },
+  { "YEAR", "%INT%" },
+  { "TIME", "(?!<[0-9])(?:2[0123]|[01][0-9]):(?:[0-5][0-9])"
+            "(?::(?:[0-5][0-9])(?:\\.[0-9]+)?)?(?![0-9])" },
+  { "SYSLOGDATE", "%MONTH% +%MONTHDAY% %TIME%" },
+  { "PROG", "(?:[A-z][\\w-]+(?:\\/[\\w-]+)?)" },
+  { "PID", "%INT%" },
+  { "SYSLOGPROG", "%PROG%(?:\\[%PID%\\])?" },
+  { "HTTPDATE", "%MONTHDAY%/%MONTH%/%YEAR%:%TIME% %INT:ZONE%" },
+  { "SYSLOGBASE", "%SYSLOGDATE% %HOSTNAME% %SYSLOGPROG%:" },
+  { NULL, NULL },
+};
+
+/* Each static pattern and the patterns its definition depends on */
+static const char *static_pattern_uses[][12] = {
+  { "INT", NULL },
+  { "NUMBER", NULL },
+  { "WORD", NULL },
+  { "IP", NULL },
+  { "HTTPDATE", "MONTHDAY", "MONTH", "YEAR", "INT", "TIME", NULL },
+  { "SYSLOGBASE", "SYSLOGDATE", "MONTH", "MONTHDAY", "TIME", "HOSTNAME",
+    "SYSLOGPROG", "PROG", "PID", "INT", NULL },
+  { NULL },
+};
+
+/* Pieces of the definitions above. Macros rather than sregex objects:
+ * nesting one sregex in another costs a virtual call, which is what
+ * we're avoiding. */
+#define SP_DIGIT range('0', '9')
+#define SP_OCTET \
+  (as_xpr("25") >> range('0', '5') \
+   | '2' >> range('0', '4') >> SP_DIGIT \
+   | !range('0', '1') >> repeat<1, 2>(SP_DIGIT))
+#define SP_INT (!(boost::xpressive::set = '+', '-') >> +SP_DIGIT)
+#define SP_NUMBER \
+  (!(boost::xpressive::set = '+', '-') \
+   >> ((+SP_DIGIT >> !('.' >> *SP_DIGIT)) | ('.' >> +SP_DIGIT)))
+#define SP_IP \
+  (~after(SP_DIGIT) >> SP_OCTET >> '.' >> SP_OCTET >> '.' >> SP_OCTET \
+   >> '.' >> SP_OCTET >> ~before(SP_DIGIT))
+#define SP_HOSTPART \
+  (boost::xpressive::set[range('0', '9') | range('A', 'z')] \
+   >> repeat<0, 62>(boost::xpressive::set[range('0', '9') \
+                                          | range('A', 'z') | '-']))
+#define SP_HOSTNAME (SP_HOSTPART >> *('.' >> SP_HOSTPART) >> !as_xpr('.'))
+#define SP_MONTH \
+  (_b >> (as_xpr("Jan") >> !as_xpr("uary") | "Feb" >> !as_xpr("ruary") \
+          | "Mar" >> !as_xpr("ch") | "Apr" >> !as_xpr("il") | "May" \
+          | "Jun" >> !as_xpr('e') | "Jul" >> !as_xpr('y') \
+          | "Aug" >> !as_xpr("ust") | "Sep" >> !as_xpr("tember") \
+          | "Oct" >> !as_xpr("ober") | "Nov" >> !as_xpr("ember") \
+          | "Dec" >> !as_xpr("ember")) >> _b)
+#define SP_MONTHDAY \
+  ('3' >> (boost::xpressive::set = '0', '1') \
+   | !range('0', '2') >> SP_DIGIT)
+#define SP_TIME \
+  (~before('<' >> SP_DIGIT) \
+   >> ('2' >> range('0', '3') | range('0', '1') >> SP_DIGIT) \
+   >> ':' >> range('0', '5') >> SP_DIGIT \
+   >> !(':' >> range('0', '5') >> SP_DIGIT >> !('.' >> +SP_DIGIT)) \
+   >> ~before(SP_DIGIT))
+#define SP_PROGCHAR boost::xpressive::set[_w | '-']
+#define SP_PROG \
+  (range('A', 'z') >> +SP_PROGCHAR >> !('/' >> +SP_PROGCHAR))
+/* A piece that is a %PATTERN% of its own records its capture */
+#define SP_CAPTURE(expr, index) ((expr) [ captures[index] = _ ])
+
+/* Set 're' to 'expr' with the capture and predicate GrokRegex would add
+ * around a %PATTERN% */
+template <typename expr_type, typename capture_vector_t>
+void StaticPatternFinish(const expr_type &expr,
+                         placeholder<capture_vector_t> &captures,
+                         int capture_index, GrokPredicate<sregex> *pred,
+                         sregex &re) {
+  if (pred != NULL && capture_index >= 0)
+    re = expr [ check(*pred) ] [ captures[capture_index] = _ ];
+  else if (pred != NULL)
+    re = expr [ check(*pred) ];
+  else if (capture_index >= 0)
+    re = expr [ captures[capture_index] = _ ];
+  else
+    re = expr;
+}
+
+/* Are 'name' and everything it uses defined as we expect? */
+bool StaticPatternUsable(const string &name,
+                         const GrokPatternSet<sregex> &pattern_set) {
+  for (int i = 0; static_pattern_uses[i][0] != NULL; i++) {
+    if (name != static_pattern_uses[i][0])
+      continue;
+    for (int j = 0; static_pattern_uses[i][j] != NULL; j++) {
+      string used = static_pattern_uses[i][j];
+      GrokPatternSet<sregex>::pattern_set_type::const_iterator iter;
+      iter = pattern_set.patterns.find(used);
+      if (iter == pattern_set.patterns.end())
+        return false;
+      for (int k = 0; static_pattern_definitions[k][0] != NULL; k++) {
+        if (used == static_pattern_definitions[k][0]
+            && (*iter).second.regex_str != static_pattern_definitions[k][1])
+          return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+int StaticCaptureIndex(const vector<string> &capture_names,
+                       const string &name) {
+  for (unsigned int i = 0; i < capture_names.size(); i++) {
+    if (capture_names[i] == name)
+      return i;
+  }
+  return -1;
+}
+
+/* Set 're' to the static version of pattern 'name', recording it in
+ * capture 'capture_index' (unless that's -1) and checking 'pred' (unless
+ * that's NULL). Captures inside it go to the slots in 'capture_names',
+ * which must already hold them; the dynamic expansion puts them there.
+ * Returns false if there's no static version we can use. */
+template <typename capture_vector_t>
+bool StaticPatternRegex(const string &name,
+                        const GrokPatternSet<sregex> &pattern_set,
+                        placeholder<capture_vector_t> &captures,
+                        const vector<string> &capture_names,
+                        int capture_index, GrokPredicate<sregex> *pred,
+                        sregex &re) {
+  if (!StaticPatternUsable(name, pattern_set))
+    return false;
+
+  if (name == "INT") {
+    StaticPatternFinish(SP_INT, captures, capture_index, pred, re);
+  } else if (name == "NUMBER") {
+    StaticPatternFinish(SP_NUMBER, captures, capture_index, pred, re);
+  } else if (name == "WORD") {
+    StaticPatternFinish(+_w, captures, capture_index, pred, re);
+  } else if (name == "IP") {
+    StaticPatternFinish(SP_IP, captures, capture_index, pred, re);
+  } else if (name == "SYSLOGBASE") {
+    int month = StaticCaptureIndex(capture_names, "MONTH");
+    int monthday = StaticCaptureIndex(capture_names, "MONTHDAY");
+    int time = StaticCaptureIndex(capture_names, "TIME");
+    int syslogdate = StaticCaptureIndex(capture_names, "SYSLOGDATE");
+    int hostname = StaticCaptureIndex(capture_names, "HOSTNAME");
+    int prog = StaticCaptureIndex(capture_names, "PROG");
+    int int_ = StaticCaptureIndex(capture_names, "INT");
+    int pid = StaticCaptureIndex(capture_names, "PID");
+    int syslogprog = StaticCaptureIndex(capture_names, "SYSLOGPROG");
+    if (month < 0 || monthday < 0 || time < 0 || syslogdate < 0
+        || hostname < 0 || prog < 0 || int_ < 0 || pid < 0 || syslogprog < 0)
+      return false;
+
+    StaticPatternFinish(
+      SP_CAPTURE(SP_CAPTURE(SP_MONTH, month) >> +as_xpr(' ')
+                 >> SP_CAPTURE(SP_MONTHDAY, monthday) >> ' '
+                 >> SP_CAPTURE(SP_TIME, time), syslogdate)
+      >> ' ' >> SP_CAPTURE(SP_HOSTNAME, hostname)
+      >> ' ' >> SP_CAPTURE(SP_CAPTURE(SP_PROG, prog)
+                           >> !('[' >> SP_CAPTURE(SP_CAPTURE(SP_INT, int_),
+                                                  pid) >> ']'),
+                           syslogprog)
+      >> ':',
+      captures, capture_index, pred, re);
+  } else if (name == "HTTPDATE") {
+    int monthday = StaticCaptureIndex(capture_names, "MONTHDAY");
+    int month = StaticCaptureIndex(capture_names, "MONTH");
+    int int_ = StaticCaptureIndex(capture_names, "INT");
+    int year = StaticCaptureIndex(capture_names, "YEAR");
+    int time = StaticCaptureIndex(capture_names, "TIME");
+    int zone = StaticCaptureIndex(capture_names, "INT:ZONE");
+    if (monthday < 0 || month < 0 || int_ < 0 || year < 0 || time < 0
+        || zone < 0)
+      return false;
+
+    StaticPatternFinish(
+      SP_CAPTURE(SP_MONTHDAY, monthday) >> '/'
+      >> SP_CAPTURE(SP_MONTH, month) >> '/'
+      >> SP_CAPTURE(SP_CAPTURE(SP_INT, int_), year) >> ':'
+      >> SP_CAPTURE(SP_TIME, time) >> ' '
+      >> SP_CAPTURE(SP_INT, zone),
+      captures, capture_index, pred, re);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/* Only sregex has static patterns */
+template <typename regex_type, typename capture_vector_t>
+bool StaticPatternRegex(const string &name,
+                        const GrokPatternSet<regex_type> &pattern_set,
+                        placeholder<capture_vector_t> &captures,
+                        const vector<string> &capture_names,
+                        int capture_index, GrokPredicate<regex_type> *pred,
+                        regex_type &re) {
+  return false;
+}
+
+#endif /* ifndef __STATICPATTERNS_HPP */
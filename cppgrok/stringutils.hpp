@@ -1,4 +1,6 @@
 #ifndef __STRING_UTILS
+#define __STRING_UTILS
+#include <stdio.h>
 #include <iostream>
 #include <string>
 
@@ -25,6 +27,13 @@ namespace StringUtils {
 
     value = new_value;
   }
+
+  /* Append the decimal form of 'value' to 'dst' */
+  void AppendInt(string &dst, long value) {
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%ld", value);
+    dst.append(buf, len);
+  }
 };
 
 #endif /* ifdef __STRING_UTILS */
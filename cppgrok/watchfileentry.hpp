@@ -5,7 +5,7 @@
 #include "fileobserver.hpp"
 
 struct WatchMatchType {
-  typedef vector < GrokRegex<sregex> > grok_regex_vector_type;
+  typedef vector < GrokRegex<grok_regex_type> > grok_regex_vector_type;
   enum reaction_type { SHELL, PRINT, JSON };
   string type_name; /* "foo" from 'type "foo" {' in grok.conf  */
   grok_regex_vector_type match_strings;
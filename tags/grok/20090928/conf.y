@@ -6,6 +6,7 @@
 #include "grok_config.h"
 #include "grok_input.h"
 #include "grok_matchconf.h"
+#include "grok_table.h"
 
 int yylineno;
 void yyerror (YYLTYPE *loc, struct config *conf, char const *s) {
@@ -23,26 +24,37 @@ void yyerror (YYLTYPE *loc, struct config *conf, char const *s) {
 %token <str> QUOTEDSTRING
 %token <num> INTEGER
 %token CONF_DEBUG "debug"
+%token CONF_TABLE "table"
 
 %token PROGRAM "program"
 %token PROG_FILE "file"
 %token PROG_EXEC "exec"
+%token PROG_SYSLOG "syslog"
 %token PROG_MATCH "match"
 %token PROG_NOMATCH "no-match"
 %token PROG_LOADPATTERNS "load-patterns"
+%token PROG_CPUBUDGET "cpu-budget"
+%token PROG_OVERBUDGET "over-budget"
+%token PROG_SAMPLERATE "sample-rate"
+%token PROG_CATCHUPLINES "catch-up-lines"
 
 %token FILE_FOLLOW "follow"
+%token FILE_MAXOPEN "max-open-files"
 
 %token EXEC_RESTARTONFAIL "restart-on-failure"
 %token EXEC_MINRESTARTDELAY "minimum-restart-delay"
 %token EXEC_RUNINTERVAL "run-interval"
 %token EXEC_READSTDERR "read-stderr"
+%token EXEC_SPAWNHELPER "spawn-helper"
+
+%token SYSLOG_PROTOCOL "protocol"
 
 %token MATCH_PATTERN "pattern"
 %token MATCH_REACTION "reaction"
 %token MATCH_SHELL "shell"
 %token MATCH_FLUSH "flush"
 %token MATCH_BREAK_IF_MATCH "break-if-match"
+%token MATCH_LOWPRIORITY "low-priority"
 
 %token '{' '}' ';' ':' '\n'
 
@@ -64,6 +76,8 @@ config: config root
 
 root: root_program
     | "debug" ':' INTEGER { conf->logmask = DEBUGMASK($3); }
+    | "table" QUOTEDSTRING QUOTEDSTRING
+      { grok_table_name($2, $3); free($2); free($3); }
 
 root_program: PROGRAM '{' { conf_new_program(conf); }
                 program_block 
@@ -74,10 +88,18 @@ program_block: program_block program_block_statement
 
 program_block_statement: program_file 
                  | program_exec
+                 | program_syslog
                  | program_match
                  | program_nomatch
                  | program_load_patterns
                  | "debug" ':' INTEGER { CURPROGRAM.logmask = DEBUGMASK($3); }
+                 | "cpu-budget" ':' INTEGER { CURPROGRAM.budget.cpu_ms = $3; }
+                 | "over-budget" ':' QUOTEDSTRING
+                   { conf_program_over_budget(conf, $3); }
+                 | "sample-rate" ':' INTEGER
+                   { CURPROGRAM.budget.sample_rate = ($3 > 0) ? $3 : 1; }
+                 | "catch-up-lines" ':' INTEGER
+                   { CURPROGRAM.budget.catchup_max = $3; }
 
 program_load_patterns: "load-patterns" ':' QUOTEDSTRING 
                      { conf_new_patternfile(conf); CURPATTERNFILE = $3; }
@@ -88,10 +110,19 @@ program_file: "file" QUOTEDSTRING { conf_new_input_file(conf, $2); }
 program_file_optional_block: /*empty*/ | '{' file_block '}' 
 
 program_exec: "exec" QUOTEDSTRING { conf_new_input_process(conf, $2); } 
-            program_exec_optional_block
+            exec_args program_exec_optional_block
+
+/* exec "ping" "-c" "1" "host": an argv list, run without a shell */
+exec_args: /* empty */
+         | exec_args QUOTEDSTRING { conf_process_arg(conf, $2); }
 
 program_exec_optional_block: /* empty */ | '{' exec_block '}' 
 
+program_syslog: "syslog" QUOTEDSTRING { conf_new_input_syslog(conf, $2); }
+              program_syslog_optional_block
+
+program_syslog_optional_block: /* empty */ | '{' syslog_block '}'
+
 program_match: "match" '{' { conf_new_matchconf(conf); }
                  match_block
                '}' 
@@ -106,6 +137,8 @@ file_block: file_block file_block_statement
 
 file_block_statement: /*empty*/
           | "follow" ':' INTEGER { CURINPUT.source.file.follow = $3; }
+          | "max-open-files" ':' INTEGER
+             { CURINPUT.source.glob.max_open = ($3 > 0) ? $3 : 1; }
           | "debug" ':' INTEGER { CURINPUT.logmask = DEBUGMASK($3); }
 
 exec_block: exec_block exec_block_statement
@@ -120,17 +153,28 @@ exec_block_statement: /* empty */
              { CURINPUT.source.process.run_interval = $3; }
           | "read-stderr" ':' INTEGER
              { CURINPUT.source.process.read_stderr = $3; }
+          | "shell" ':' INTEGER { conf_process_shell(conf, $3); }
+          | "spawn-helper" ':' INTEGER
+             { CURINPUT.source.process.use_helper = $3; }
+          | "debug" ':' INTEGER { CURINPUT.logmask = DEBUGMASK($3); }
+
+syslog_block: syslog_block syslog_block_statement
+            | syslog_block_statement
+
+syslog_block_statement: /* empty */
+          | "protocol" ':' QUOTEDSTRING { conf_syslog_protocol(conf, $3); }
           | "debug" ':' INTEGER { CURINPUT.logmask = DEBUGMASK($3); }
 
 match_block: match_block match_block_statement
            | match_block_statement
 
 match_block_statement: /* empty */
-           | "pattern" ':' QUOTEDSTRING { grok_compile(&CURMATCH.grok, $3); }
+           | "pattern" ':' QUOTEDSTRING { CURMATCH.pattern = $3; }
            | "reaction" ':' QUOTEDSTRING { CURMATCH.reaction = $3; }
            | "shell" ':' QUOTEDSTRING { CURMATCH.shell = $3; }
            | "flush" ':' INTEGER { CURMATCH.flush = $3; }
            | "break-if-match" ':' INTEGER { CURMATCH.break_if_match = $3; }
+           | "low-priority" ':' INTEGER { CURMATCH.low_priority = $3; }
            | "debug" ':' INTEGER { CURMATCH.grok.logmask = DEBUGMASK($3); }
 
 
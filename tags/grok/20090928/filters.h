@@ -7,7 +7,7 @@
 struct filter {
   const char *name;
   int (*func)(grok_match_t *gm, char **value, int *value_len,
-              int *value_size);
+              int *value_size, const char *args, int args_len);
 };
 #endif
 
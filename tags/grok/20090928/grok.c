@@ -17,6 +17,7 @@ void grok_init(grok_t *grok) {
   pcre_callout = grok_pcre_callout;
 
   grok->re = NULL;
+  grok->re_extra = NULL;
   grok->full_pattern = NULL;
   grok->pcre_capture_vector = NULL;
   grok->pcre_num_captures = 0;
@@ -26,11 +27,9 @@ void grok_init(grok_t *grok) {
   grok->logmask = 0;
   grok->logdepth = 0;
 
-#ifndef GROK_TEST_NO_PATTERNS
-  db_create(&grok->patterns, NULL, 0);
-  grok->patterns->open(grok->patterns, NULL, NULL, "patterns",
-                       DB_BTREE, DB_CREATE, 0);
-#endif /* GROK_TEST_NO_PATTERNS */
+  /* Pattern libraries are created on first use, or shared via
+   * grok_patterns_use_files and grok_clone */
+  grok->patterns = NULL;
 
 #ifndef GROK_TEST_NO_CAPTURE
   db_create(&grok->captures_by_id, NULL, 0);
@@ -91,7 +90,7 @@ void grok_init(grok_t *grok) {
 
 void grok_clone(grok_t *dst, grok_t *src) {
   grok_init(dst);
-  dst->patterns = src->patterns;
+  dst->patterns = grok_patternlib_acquire(src->patterns);
   dst->logmask = src->logmask;
   dst->logdepth = src->logdepth + 1;
 }
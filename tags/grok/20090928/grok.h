@@ -5,6 +5,7 @@
 #include <db.h>
 
 typedef struct grok grok_t;
+struct grok_patternlib;
 
 typedef struct grok_pattern {
   const char *name;
@@ -12,10 +13,11 @@ typedef struct grok_pattern {
 } grok_pattern_t;
 
 struct grok {
-  DB *patterns;
+  struct grok_patternlib *patterns; /* shared, see grok_pattern.h */
   
   /* These are initialized when grok_compile is called */
   pcre *re;
+  pcre_extra *re_extra; /* from pcre_study; also carries the callout data */
   const char *pattern;
   char *full_pattern;
   int *pcre_capture_vector;
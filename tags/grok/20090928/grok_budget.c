@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <event.h>
+
+#include "grok.h"
+#include "grok_program.h"
+#include "grok_input.h"
+#include "grok_matchconf.h"
+#include "grok_logging.h"
+
+/* Per-program CPU budgets.
+ *
+ * All programs share one event loop, so one program with expensive
+ * patterns can keep every other program from seeing its lines. A program
+ * with 'cpu-budget: N' may spend N milliseconds per second matching. Time
+ * is measured around each line's trip through the match blocks. Once a
+ * second's budget is used up, the rest of the second's lines are handled
+ * according to 'over-budget':
+ *
+ *   "sample"            match 1 in 'sample-rate' lines, ignore the rest
+ *   "skip-low-priority" only try match blocks without 'low-priority: yes'
+ *   "defer"             queue lines (up to 'catch-up-lines') and match
+ *                       them, in order, in later seconds
+ *
+ * Counters for each are logged every second a program goes over budget,
+ * and when the program stops. */
+
+struct grok_budget_line {
+  grok_input_t *ginput;
+  char *text;
+  struct grok_budget_line *next;
+};
+
+static void _budget_roll(grok_program_t *gprog, const struct timespec *now);
+static void _budget_defer(grok_program_t *gprog, grok_input_t *ginput,
+                          const char *text);
+static void _budget_schedule_drain(grok_program_t *gprog,
+                                   const struct timespec *now);
+static void _budget_drain(int fd, short what, void *data);
+static void _budget_match(grok_program_t *gprog, grok_input_t *ginput,
+                          const char *text);
+static long _timespec_usec_since(const struct timespec *then,
+                                 const struct timespec *now);
+
+/* Decide how much of 'text' gets matched now; see BUDGET_MATCH_* */
+int grok_program_budget_admit(grok_program_t *gprog, grok_input_t *ginput,
+                              const char *text) {
+  grok_program_budget_t *budget = &gprog->budget;
+  struct timespec now;
+
+  if (budget->cpu_ms <= 0) {
+    return BUDGET_MATCH_ALL;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  _budget_roll(gprog, &now);
+
+  /* Keep lines in order: nothing jumps ahead of queued ones */
+  if (budget->queued > 0) {
+    _budget_defer(gprog, ginput, text);
+    return BUDGET_MATCH_NONE;
+  }
+
+  if (budget->used_usec < budget->cpu_ms * 1000L) {
+    return BUDGET_MATCH_ALL;
+  }
+
+  switch (budget->over_budget) {
+    case BUDGET_SKIP_LOW_PRIORITY:
+      budget->low_skipped++;
+      return BUDGET_MATCH_NORMAL;
+    case BUDGET_DEFER:
+      _budget_defer(gprog, ginput, text);
+      return BUDGET_MATCH_NONE;
+    case BUDGET_SAMPLE:
+    default:
+      if (budget->sample_count++ % budget->sample_rate == 0) {
+        return BUDGET_MATCH_ALL;
+      }
+      budget->sampled_out++;
+      return BUDGET_MATCH_NONE;
+  }
+}
+
+/* Add the time since 'start' to this second's budget */
+void grok_program_budget_charge(grok_program_t *gprog,
+                                const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  gprog->budget.used_usec += _timespec_usec_since(start, &now);
+}
+
+/* Take new options (from a reloaded config), keeping our state */
+void grok_program_budget_options(grok_program_t *gprog,
+                                 const grok_program_t *newprog) {
+  gprog->budget.cpu_ms = newprog->budget.cpu_ms;
+  gprog->budget.over_budget = newprog->budget.over_budget;
+  gprog->budget.sample_rate = newprog->budget.sample_rate;
+  gprog->budget.catchup_max = newprog->budget.catchup_max;
+
+  /* Without a budget, nothing would drain the queue later */
+  if (gprog->budget.cpu_ms <= 0 || gprog->budget.over_budget != BUDGET_DEFER) {
+    grok_program_budget_flush(gprog);
+  }
+}
+
+/* Match every queued line now, budget or not. Called before the match
+ * blocks are closed. */
+void grok_program_budget_flush(grok_program_t *gprog) {
+  grok_program_budget_t *budget = &gprog->budget;
+  struct grok_budget_line *line;
+
+  if (budget->drain_pending) {
+    event_del(&budget->drain_ev);
+    budget->drain_pending = 0;
+  }
+
+  if (budget->queued > 0) {
+    grok_log(gprog, LOG_PROGRAM, "Matching %d queued lines", budget->queued);
+  }
+
+  while ((line = budget->queue_head) != NULL) {
+    budget->queue_head = line->next;
+    budget->queued--;
+    grok_matchconfig_exec_blocks(gprog, line->ginput, line->text, 0);
+    free(line->text);
+    free(line);
+  }
+  budget->queue_tail = NULL;
+}
+
+/* The program is done or being replaced: finish queued lines and report */
+void grok_program_budget_stop(grok_program_t *gprog) {
+  grok_program_budget_t *budget = &gprog->budget;
+
+  grok_program_budget_flush(gprog);
+  if (budget->over_seconds > 0) {
+    grok_log(gprog, LOG_PROGRAM, "Over cpu budget for %lu seconds: "
+             "%lu lines sampled out, %lu skipped low-priority blocks, "
+             "%lu deferred, %lu dropped", budget->over_seconds,
+             budget->sampled_out, budget->low_skipped, budget->deferred,
+             budget->dropped);
+  }
+}
+
+/* Start a new second if the current one is over */
+static void _budget_roll(grok_program_t *gprog, const struct timespec *now) {
+  grok_program_budget_t *budget = &gprog->budget;
+
+  if (_timespec_usec_since(&budget->window, now) < 1000000) {
+    return;
+  }
+
+  if (budget->used_usec >= budget->cpu_ms * 1000L) {
+    budget->over_seconds++;
+    grok_log(gprog, LOG_PROGRAM, "Used %ldms of a %dms cpu budget; so far "
+             "%lu lines sampled out, %lu skipped low-priority blocks, "
+             "%lu deferred (%d queued), %lu dropped",
+             budget->used_usec / 1000, budget->cpu_ms, budget->sampled_out,
+             budget->low_skipped, budget->deferred, budget->queued,
+             budget->dropped);
+  }
+
+  budget->window = *now;
+  budget->used_usec = 0;
+}
+
+static void _budget_defer(grok_program_t *gprog, grok_input_t *ginput,
+                          const char *text) {
+  grok_program_budget_t *budget = &gprog->budget;
+  struct grok_budget_line *line;
+  struct timespec now;
+
+  if (budget->queued >= budget->catchup_max) {
+    budget->dropped++;
+    return;
+  }
+
+  line = malloc(sizeof(struct grok_budget_line));
+  line->ginput = ginput;
+  line->text = strdup(text);
+  line->next = NULL;
+  if (budget->queue_tail != NULL) {
+    budget->queue_tail->next = line;
+  } else {
+    budget->queue_head = line;
+  }
+  budget->queue_tail = line;
+  budget->queued++;
+  budget->deferred++;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  _budget_schedule_drain(gprog, &now);
+}
+
+/* Drain the queue when the next second starts */
+static void _budget_schedule_drain(grok_program_t *gprog,
+                                   const struct timespec *now) {
+  grok_program_budget_t *budget = &gprog->budget;
+  struct timeval delay = { 0, 0 };
+  long usec;
+
+  if (budget->drain_pending) {
+    return;
+  }
+
+  usec = 1000000 - _timespec_usec_since(&budget->window, now);
+  if (usec > 0) {
+    delay.tv_sec = usec / 1000000;
+    delay.tv_usec = usec % 1000000;
+  }
+
+  evtimer_set(&budget->drain_ev, _budget_drain, gprog);
+  evtimer_add(&budget->drain_ev, &delay);
+  budget->drain_pending = 1;
+}
+
+static void _budget_drain(int fd, short what, void *data) {
+  grok_program_t *gprog = (grok_program_t *)data;
+  grok_program_budget_t *budget = &gprog->budget;
+  struct grok_budget_line *line;
+  struct timespec now;
+
+  budget->drain_pending = 0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  _budget_roll(gprog, &now);
+
+  while ((line = budget->queue_head) != NULL
+         && budget->used_usec < budget->cpu_ms * 1000L) {
+    budget->queue_head = line->next;
+    if (budget->queue_head == NULL) {
+      budget->queue_tail = NULL;
+    }
+    budget->queued--;
+    _budget_match(gprog, line->ginput, line->text);
+    free(line->text);
+    free(line);
+  }
+
+  if (budget->queued > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    _budget_schedule_drain(gprog, &now);
+  }
+}
+
+static void _budget_match(grok_program_t *gprog, grok_input_t *ginput,
+                          const char *text) {
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  grok_matchconfig_exec_blocks(gprog, ginput, text, 0);
+  grok_program_budget_charge(gprog, &start);
+}
+
+static long _timespec_usec_since(const struct timespec *then,
+                                 const struct timespec *now) {
+  return (now->tv_sec - then->tv_sec) * 1000000L
+         + (now->tv_nsec - then->tv_nsec) / 1000;
+}
@@ -1,6 +1,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
 
 #include "grok_input.h"
 #include "grok_config.h"
@@ -36,11 +37,30 @@ void conf_new_program(struct config *conf) {
   CURPROGRAM.patternfile_size = 10;
   CURPROGRAM.patternfiles = calloc(CURPROGRAM.patternfile_size, sizeof(char *));
 
+  memset(&CURPROGRAM.budget, 0, sizeof(CURPROGRAM.budget));
+  CURPROGRAM.budget.over_budget = BUDGET_SAMPLE;
+  CURPROGRAM.budget.sample_rate = BUDGET_DEFAULT_SAMPLE_RATE;
+  CURPROGRAM.budget.catchup_max = BUDGET_DEFAULT_CATCHUP_MAX;
+
   //CURPROGRAM.logmask = ~0;
 
   SETLOG(*conf, CURPROGRAM);
 }
 
+void conf_program_over_budget(struct config *conf, char *action) {
+  if (!strcmp(action, "sample")) {
+    CURPROGRAM.budget.over_budget = BUDGET_SAMPLE;
+  } else if (!strcmp(action, "skip-low-priority")) {
+    CURPROGRAM.budget.over_budget = BUDGET_SKIP_LOW_PRIORITY;
+  } else if (!strcmp(action, "defer")) {
+    CURPROGRAM.budget.over_budget = BUDGET_DEFER;
+  } else {
+    fprintf(stderr, "Unknown over-budget action '%s' (expected sample, "
+            "skip-low-priority or defer), using sample\n", action);
+  }
+  free(action);
+}
+
 void conf_new_patternfile(struct config *conf) {
   CURPROGRAM.npatternfiles++;
   if (CURPROGRAM.npatternfiles == CURPROGRAM.patternfile_size) {
@@ -68,12 +88,86 @@ void conf_new_input_process(struct config *conf, char *cmd) {
   conf_new_input(conf);
   CURINPUT.type = I_PROCESS;
   CURINPUT.source.process.cmd = cmd;
+  CURINPUT.source.process.cmdlen = strlen(cmd);
+  CURINPUT.source.process.use_shell = 1;
+}
+
+/* Each further string after 'exec "cmd"' is an argument; the command is
+ * then run directly instead of through 'sh -c'. cmd becomes the whole
+ * command line, for logging. */
+void conf_process_arg(struct config *conf, char *arg) {
+  grok_input_process_t *gipt = &CURINPUT.source.process;
+  int argc = 0;
+
+  if (gipt->argv == NULL) {
+    gipt->argv = malloc(2 * sizeof(char *));
+    gipt->argv[0] = strdup(gipt->cmd);
+    gipt->argv[1] = NULL;
+  }
+  while (gipt->argv[argc] != NULL) {
+    argc++;
+  }
+  gipt->argv = realloc(gipt->argv, (argc + 2) * sizeof(char *));
+  gipt->argv[argc] = arg;
+  gipt->argv[argc + 1] = NULL;
+  gipt->use_shell = 0;
+
+  gipt->cmd = realloc(gipt->cmd, gipt->cmdlen + strlen(arg) + 2);
+  gipt->cmd[gipt->cmdlen++] = ' ';
+  strcpy(gipt->cmd + gipt->cmdlen, arg);
+  gipt->cmdlen += strlen(arg);
+}
+
+/* 'shell: no' splits the command into words ourselves; see
+ * grok_process_argv_parse */
+void conf_process_shell(struct config *conf, int use_shell) {
+  grok_input_process_t *gipt = &CURINPUT.source.process;
+
+  if (use_shell || gipt->argv != NULL) {
+    gipt->use_shell = use_shell && gipt->argv == NULL;
+    return;
+  }
+
+  gipt->argv = grok_process_argv_parse(gipt->cmd);
+  if (gipt->argv == NULL) {
+    fprintf(stderr, "Can't split '%s' into arguments (unterminated quote?), "
+            "running it with 'sh -c'\n", gipt->cmd);
+    return;
+  }
+  gipt->use_shell = 0;
 }
 
 void conf_new_input_file(struct config *conf, char *filename) {
   conf_new_input(conf);
-  CURINPUT.type = I_FILE;
   CURINPUT.source.file.filename = filename;
+
+  /* "/var/log/*.log" and friends are read by a single glob input */
+  if (strpbrk(filename, "*?[") != NULL) {
+    CURINPUT.type = I_GLOB;
+    CURINPUT.source.glob.max_open = GLOB_DEFAULT_MAX_OPEN;
+  } else {
+    CURINPUT.type = I_FILE;
+  }
+}
+
+void conf_new_input_syslog(struct config *conf, char *address) {
+  conf_new_input(conf);
+  CURINPUT.type = I_SYSLOG;
+  CURINPUT.source.syslog.address = address;
+  CURINPUT.source.syslog.protocol = SYSLOG_UDP;
+  CURINPUT.source.syslog.fd = -1;
+}
+
+void conf_syslog_protocol(struct config *conf, char *protocol) {
+  if (!strcmp(protocol, "tcp")) {
+    CURINPUT.source.syslog.protocol = SYSLOG_TCP;
+  } else if (!strcmp(protocol, "udp")) {
+    CURINPUT.source.syslog.protocol = SYSLOG_UDP;
+  } else {
+    fprintf(stderr, "Unknown syslog protocol '%s' (expected udp or tcp), "
+            "using udp\n", protocol);
+  }
+  free(protocol);
 }
 
 void conf_new_matchconf(struct config *conf) {
@@ -86,11 +180,9 @@ void conf_new_matchconf(struct config *conf) {
   }
 
   grok_matchconfig_init(&CURPROGRAM, &CURMATCH);
-  grok_init(&CURMATCH.grok);
 
-  int i = 0;
-  for (i = 0; i < CURPROGRAM.npatternfiles; i++) {
-    grok_patterns_import_from_file(&CURMATCH.grok, CURPROGRAM.patternfiles[i]);
-  }
+  /* Every match block loading the same pattern files shares one library */
+  grok_patterns_use_files(&CURMATCH.grok, CURPROGRAM.patternfiles,
+                          CURPROGRAM.npatternfiles);
   SETLOG(CURPROGRAM, CURMATCH.grok);
 }
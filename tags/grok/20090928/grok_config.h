@@ -19,8 +19,14 @@ struct config {
   int logdepth;
 };
 
+void conf_init(struct config *conf);
 void conf_new_program(struct config *conf);
+void conf_program_over_budget(struct config *conf, char *action);
 void conf_new_input(struct config *conf);
 void conf_new_input_process(struct config *conf, char *cmd);
+void conf_process_arg(struct config *conf, char *arg);
+void conf_process_shell(struct config *conf, int use_shell);
 void conf_new_input_file(struct config *conf, char *filename);
+void conf_new_input_syslog(struct config *conf, char *address);
+void conf_syslog_protocol(struct config *conf, char *protocol);
 
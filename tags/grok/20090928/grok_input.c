@@ -2,6 +2,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
 #include <event.h>
@@ -31,7 +32,9 @@ void _program_file_buferror(struct bufferevent *bev, short what, void *data);
 
 void grok_program_add_input(grok_program_t *gprog, grok_input_t *ginput) {
   grok_log(gprog, LOG_PROGRAM, "Adding input of type %s",
-         (ginput->type == I_FILE) ? "file" : "process");
+         (ginput->type == I_FILE) ? "file"
+         : (ginput->type == I_SYSLOG) ? "syslog"
+         : (ginput->type == I_GLOB) ? "glob" : "process");
 
   ginput->instance_match_count = 0;
   ginput->done = 0;
@@ -42,6 +45,12 @@ void grok_program_add_input(grok_program_t *gprog, grok_input_t *ginput) {
     case I_PROCESS:
       grok_program_add_input_process(gprog, ginput);
       break;
+    case I_SYSLOG:
+      grok_program_add_input_syslog(gprog, ginput);
+      break;
+    case I_GLOB:
+      grok_program_add_input_glob(gprog, ginput);
+      break;
   }
 }
 
@@ -76,6 +85,10 @@ void grok_program_add_input_process(grok_program_t *gprog,
     bufferevent_enable(bev, EV_READ);
   }
 
+  if (gipt->use_helper) {
+    grok_input_process_helper_start(ginput);
+  }
+
   grok_log(ginput, LOG_PROGRAMINPUT, "Scheduling start of: %s", gipt->cmd);
   event_once(-1, EV_TIMEOUT, _program_process_start, ginput, &now);
 }
@@ -104,8 +117,18 @@ void grok_program_add_input_file(grok_program_t *gprog,
     return;
   }
 
+  /* Resume where a previous instance of this input left off (this happens
+   * when the config is reloaded) if the file is still the same file. */
+  if (gift->offset > 0 && gift->st.st_ino == st.st_ino
+      && gift->offset <= st.st_size) {
+    grok_log(ginput, LOG_PROGRAMINPUT, "Resuming '%s' at offset %lld",
+             gift->filename, (long long)gift->offset);
+    lseek(gift->fd, gift->offset, SEEK_SET);
+  } else {
+    gift->offset = 0;
+  }
+
   safe_pipe(pipefd);
-  gift->offset = 0;
   gift->reader = pipefd[0];
   gift->writer = pipefd[1];
   memcpy(&(gift->st), &st, sizeof(st));
@@ -150,33 +173,19 @@ void _program_process_buferror(struct bufferevent *bev, short what,
 
 void _program_process_start(int fd, short what, void *data) {
   grok_input_t *ginput = (grok_input_t*)data;
-  grok_input_process_t *gipt = &(ginput->source.process);
-  grok_program_t *gprog = ginput->gprog;
-  int pid = 0;
+
+  if (ginput->done) {
+    return;
+  }
 
   /* reset the 'instance match count' since we're starting the process */
   ginput->instance_match_count = 0;
 
-  /* start the process */
-  pid = fork();
-  if (pid != 0) {
-    gipt->pid = pid;
-    gipt->pgid = getpgid(pid);
-    gettimeofday(&(gipt->start_time), NULL);
-    grok_log(ginput, LOG_PROGRAMINPUT,
-             "Starting process: '%s' (%d)", gipt->cmd, getpid());
-    return;
+  /* start the process; a command that cannot be started at all is treated
+   * like one that died immediately */
+  if (grok_input_process_spawn(ginput) != 0) {
+    grok_input_process_exited(ginput);
   }
-  dup2(gipt->c_stdin, 0);
-  dup2(gipt->c_stdout, 1);
-  if (gipt->read_stderr) {
-    dup2(gipt->c_stderr, 2);
-  }
-  execlp("sh", "sh", "-c", gipt->cmd, NULL);
-  grok_log(ginput, LOG_PROGRAM, 
-           "execlp(2) returned unexpectedly. Is 'sh' in your path?");
-  grok_log(ginput, LOG_PROGRAM, "execlp: %s", strerror(errno));
-  exit(-1); /* in case execlp fails */
 }
 
 void _program_file_read_buffer(struct bufferevent *bev, void *data) {
@@ -222,6 +231,10 @@ void _program_file_repair_event(int fd, short what, void *data) {
   struct bufferevent *bev = ginput->bev;
   struct stat st;
 
+  if (ginput->done) {
+    return;
+  }
+
   if (stat(gift->filename, &st) != 0) {
     grok_log(ginput, LOG_PROGRAM, "Failure stat(2)'ing file '%s': %s",
              gift->filename, strerror(errno));
@@ -280,6 +293,11 @@ void _program_file_read_real(int fd, short what, void *data) {
 
   int write_ret;
   int bytes = 0;
+
+  if (ginput->done) {
+    return;
+  }
+
   bytes = read(gift->fd, gift->readbuffer, gift->st.st_blksize);
   write_ret = write(gift->writer, gift->readbuffer, bytes);
 
@@ -321,6 +339,11 @@ void grok_input_eof_handler(int fd, short what, void *data) {
   grok_input_t *ginput = (grok_input_t *)data;
   grok_program_t *gprog = ginput->gprog;
 
+  /* Stopped by grok_input_stop (config reload); nothing left to do. */
+  if (ginput->done) {
+    return;
+  }
+
   if (ginput->instance_match_count == 0) {
     /* execute nomatch if there is one on this program */
     grok_matchconfig_exec_nomatch(gprog, ginput);
@@ -336,6 +359,7 @@ void grok_input_eof_handler(int fd, short what, void *data) {
         grok_log(ginput->gprog, LOG_PROGRAM, "Not restarting process: %s",
                  ginput->source.process.cmd);
         bufferevent_disable(ginput->bev, EV_READ);
+        grok_input_process_helper_stop(ginput);
         close(ginput->source.process.p_stdin);
         close(ginput->source.process.p_stdout);
         close(ginput->source.process.p_stderr);
@@ -357,6 +381,13 @@ void grok_input_eof_handler(int fd, short what, void *data) {
         ginput->done = 1;
       }
       break;
+    case I_GLOB:
+      /* Only called once every file was read (when not following) */
+      grok_log(ginput->gprog, LOG_PROGRAM, "Done reading files: %s",
+               ginput->source.glob.file.filename);
+      grok_input_glob_stop(ginput);
+      ginput->done = 1;
+      break;
   }
 
   /* If all inputs are now done, close the shell */
@@ -371,6 +402,7 @@ void grok_input_eof_handler(int fd, short what, void *data) {
   }
 
   if (still_open == 0) {
+    grok_program_budget_stop(gprog);
     for (i = 0; i < gprog->nmatchconfigs; i++) {
       grok_matchconfig_close(gprog, &gprog->matchconfigs[i]);
     }
@@ -378,3 +410,119 @@ void grok_input_eof_handler(int fd, short what, void *data) {
   }
 }
 
+
+/* Stop an input immediately, for example because a config reload removed
+ * it. Pending timers may still reference ginput, so it is only marked done,
+ * never freed. */
+void grok_input_stop(grok_input_t *ginput) {
+  if (ginput->done) {
+    return;
+  }
+
+  grok_log(ginput, LOG_PROGRAMINPUT, "Stopping input");
+  ginput->done = 1;
+  if (ginput->bev != NULL) {
+    bufferevent_disable(ginput->bev, EV_READ);
+  }
+
+  switch (ginput->type) {
+    case I_PROCESS:
+      {
+        grok_input_process_t *gipt = &(ginput->source.process);
+        gipt->restart_on_death = 0;
+        gipt->run_interval = 0;
+        if (gipt->pid > 0) {
+          grok_log(ginput, LOG_PROGRAMINPUT, "Killing pid %d: %s",
+                   gipt->pid, gipt->cmd);
+          kill(gipt->pid, SIGTERM);
+        }
+        grok_input_process_helper_stop(ginput);
+        close(gipt->p_stdin);
+        close(gipt->p_stdout);
+        close(gipt->p_stderr);
+        if (gipt->spawn_count > 0) {
+          grok_log(ginput, LOG_PROGRAMINPUT,
+                   "%d spawns of '%s': avg %ldus, max %ldus",
+                   gipt->spawn_count, gipt->cmd,
+                   gipt->spawn_usec_total / gipt->spawn_count,
+                   gipt->spawn_usec_max);
+        }
+      }
+      break;
+    case I_FILE:
+      close(ginput->source.file.reader);
+      close(ginput->source.file.writer);
+      close(ginput->source.file.fd);
+      break;
+    case I_SYSLOG:
+      grok_input_syslog_stop(ginput);
+      break;
+    case I_GLOB:
+      grok_input_glob_stop(ginput);
+      break;
+  }
+}
+
+static int _argv_equal(char **a, char **b) {
+  if (a == NULL || b == NULL) {
+    return a == b;
+  }
+  for (; *a != NULL && *b != NULL; a++, b++) {
+    if (strcmp(*a, *b)) {
+      return 0;
+    }
+  }
+  return *a == *b;
+}
+
+int grok_input_equal(const grok_input_t *a, const grok_input_t *b) {
+  if (a->type != b->type || a->logmask != b->logmask) {
+    return 0;
+  }
+
+  switch (a->type) {
+    case I_FILE:
+      return !strcmp(a->source.file.filename, b->source.file.filename)
+             && a->source.file.follow == b->source.file.follow;
+    case I_PROCESS:
+      return !strcmp(a->source.process.cmd, b->source.process.cmd)
+             && (a->source.process.restart_on_death
+                 == b->source.process.restart_on_death)
+             && (a->source.process.min_restart_delay
+                 == b->source.process.min_restart_delay)
+             && (a->source.process.run_interval
+                 == b->source.process.run_interval)
+             && (a->source.process.read_stderr
+                 == b->source.process.read_stderr)
+             && (a->source.process.use_shell
+                 == b->source.process.use_shell)
+             && (a->source.process.use_helper
+                 == b->source.process.use_helper)
+             && _argv_equal(a->source.process.argv, b->source.process.argv);
+    case I_SYSLOG:
+      return !strcmp(a->source.syslog.address, b->source.syslog.address)
+             && a->source.syslog.protocol == b->source.syslog.protocol;
+    case I_GLOB:
+      return !strcmp(a->source.glob.file.filename, b->source.glob.file.filename)
+             && a->source.glob.file.follow == b->source.glob.file.follow
+             && a->source.glob.max_open == b->source.glob.max_open;
+  }
+  return 0;
+}
+
+/* The file offset up to which lines have been handed to the matchconfs.
+ * Anything read from the file but still sitting in our pipe or in the
+ * bufferevent (a partial line) has not been processed yet. */
+off_t grok_input_file_consumed_offset(grok_input_t *ginput) {
+  grok_input_file_t *gift = &(ginput->source.file);
+  off_t offset = gift->offset;
+  int pending = 0;
+
+  if (ioctl(gift->reader, FIONREAD, &pending) == 0) {
+    offset -= pending;
+  }
+  if (ginput->bev != NULL) {
+    offset -= EVBUFFER_LENGTH(EVBUFFER_INPUT(ginput->bev));
+  }
+  return (offset < 0) ? 0 : offset;
+}
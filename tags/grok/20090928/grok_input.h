@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <time.h>
 #include <event.h>
 
@@ -13,12 +14,16 @@ struct grok_program;
 typedef struct grok_input grok_input_t;
 typedef struct grok_input_process grok_input_process_t;
 typedef struct grok_input_file grok_input_file_t;
+typedef struct grok_input_syslog grok_input_syslog_t;
+typedef struct grok_input_glob grok_input_glob_t;
+typedef struct grok_syslog_header grok_syslog_header_t;
 
 #define PROCESS_SHOULD_RESTART(gipt) ((gipt)->restart_on_death || (gipt)->run_interval)
 
 struct grok_input_process {
-  char *cmd;
+  char *cmd; /* for argv commands, only used for display */
   int cmdlen;
+  char **argv; /* NULL-terminated; NULL means run cmd with 'sh -c' */
   
   /* State information */
   int p_stdin; /* parent descriptors */
@@ -31,11 +36,24 @@ struct grok_input_process {
   int pgid;
   struct timeval start_time;
 
+  /* Spawn helper; see grok_input_process.c */
+  int helper_pid;
+  int helper_fd; /* send a byte to run the command once; reports come back */
+  int helper_busy;
+  struct event helper_ev;
+
+  /* Spawn latency: time from asking for the command to having its pid */
+  int spawn_count;
+  long spawn_usec_total;
+  long spawn_usec_max;
+
   /* Specific options */
   int restart_on_death;
   int min_restart_delay;
   int run_interval;
   int read_stderr;
+  int use_shell;
+  int use_helper;
 };
 
 struct grok_input_file {
@@ -54,11 +72,66 @@ struct grok_input_file {
   int follow;
 };
 
+/* A 'file' whose name is a glob pattern. All matching files share one
+ * reader; see grok_input_glob.c. */
+#define GLOB_DEFAULT_MAX_OPEN 256
+
+struct grok_glob_state;
+
+struct grok_input_glob {
+  /* file.filename is the pattern; file.follow applies to every file. This
+   * must be first, so the config parser can treat us as a file input. */
+  grok_input_file_t file;
+
+  /* Options */
+  int max_open; /* most descriptors to keep open at once */
+
+  /* State information */
+  struct grok_glob_state *state;
+};
+
+#define SYSLOG_UDP 0
+#define SYSLOG_TCP 1
+
+/* How many datagrams to receive per recvmmsg(2) call */
+#define SYSLOG_BATCH 32
+/* RFC3164 caps messages at 1024 bytes; be generous with what we accept */
+#define SYSLOG_MAXMSG 8192
+
+struct grok_syslog_conn;
+
+struct grok_input_syslog {
+  char *address; /* "host:port", ":port" or "[v6addr]:port" */
+
+  /* State information */
+  int fd; /* bound udp socket or listening tcp socket */
+  struct event ev;
+  char *recvbuffer; /* SYSLOG_BATCH * SYSLOG_MAXMSG bytes (udp) */
+  struct grok_syslog_conn *conns; /* accepted tcp connections */
+
+  /* Options */
+  int protocol; /* SYSLOG_UDP or SYSLOG_TCP */
+};
+
+/* The parsed RFC3164 header of one message. Pointers are into the message. */
+struct grok_syslog_header {
+  int pri; /* -1 if the message has no <PRI> */
+  int facility;
+  int severity;
+  const char *timestamp; /* "Mmm dd hh:mm:ss" or NULL if missing */
+  const char *host;
+  int host_len;
+  const char *text; /* everything after <PRI> */
+  int text_len;
+};
+
 struct grok_input {
-  enum { I_FILE, I_PROCESS } type;
+  enum { I_FILE, I_PROCESS, I_SYSLOG, I_GLOB } type;
   union {
     grok_input_file_t file;
     grok_input_process_t process;
+    grok_input_syslog_t syslog;
+    grok_input_glob_t glob;
   } source;
   struct grok_program *gprog; /* pointer back to our program */
 
@@ -73,6 +146,21 @@ struct grok_input {
 void grok_program_add_input(struct grok_program *gprog, grok_input_t *ginput);
 void grok_program_add_input_process(struct grok_program *gprog, grok_input_t *ginput);
 void grok_program_add_input_file(struct grok_program *gprog, grok_input_t *ginput);
+void grok_program_add_input_syslog(struct grok_program *gprog, grok_input_t *ginput);
+void grok_input_syslog_stop(grok_input_t *ginput);
+int grok_input_process_spawn(grok_input_t *ginput);
+void grok_input_process_exited(grok_input_t *ginput);
+void grok_input_process_helper_start(grok_input_t *ginput);
+void grok_input_process_helper_stop(grok_input_t *ginput);
+char **grok_process_argv_parse(const char *cmd);
+void grok_process_argv_free(char **argv);
+void grok_program_add_input_glob(struct grok_program *gprog, grok_input_t *ginput);
+void grok_input_glob_stop(grok_input_t *ginput);
+void grok_input_glob_takeover(grok_input_t *to, grok_input_t *from);
+int grok_syslog_parse(const char *msg, int len, grok_syslog_header_t *hdr);
 void grok_input_eof_handler(int fd, short what, void *data);
+void grok_input_stop(grok_input_t *ginput);
+int grok_input_equal(const grok_input_t *a, const grok_input_t *b);
+off_t grok_input_file_consumed_offset(grok_input_t *ginput);
 
 #endif /* _GROK_INPUT_H_ */
@@ -0,0 +1,734 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <event.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "grok.h"
+#include "grok_program.h"
+#include "grok_input.h"
+#include "grok_matchconf.h"
+#include "grok_logging.h"
+
+/* Inputs for 'file' stanzas whose name is a glob, such as
+ * "/var/log/tenants/*\/app.log".
+ *
+ * Every matching file is tracked by one grok_input, with one read buffer
+ * and at most max_open descriptors. Least recently read files are closed
+ * when the pool is full and reopened (at their saved offset) when they have
+ * data again.
+ *
+ * Files with pending data sit on a ready queue. Each turn reads one block
+ * from each of up to GLOB_FILES_PER_TURN files and puts any file that may
+ * have more at the back of the queue, so a busy file can't starve quiet
+ * ones. New data and new files are found through inotify directory
+ * watches where available. A periodic sweep (every second without
+ * inotify) re-globs and stats everything to catch what the watches miss. */
+
+#define GLOB_READSIZE 65536
+#define GLOB_FILES_PER_TURN 64
+#define GLOB_SWEEP_INTERVAL 1 /* seconds, when polling */
+#define GLOB_SWEEP_INTERVAL_INOTIFY 30
+
+struct grok_glob_file {
+  char *path;
+  int fd; /* -1 when closed */
+  ino_t inode;
+  off_t offset; /* file offset of the next read */
+
+  char *partial; /* incomplete last line */
+  int partial_len;
+  int partial_size;
+
+  int queued; /* on the ready queue */
+  int removed; /* no longer matches; free when it leaves the queue */
+  struct grok_glob_file *ready_next;
+  struct grok_glob_file *lru_prev; /* open files, most recently used first */
+  struct grok_glob_file *lru_next;
+};
+
+struct grok_glob_watch {
+  int wd;
+  char *dir;
+};
+
+struct grok_glob_state {
+  grok_input_t *ginput;
+
+  struct grok_glob_file **files; /* sorted by path (strcmp) */
+  int nfiles;
+  int files_size;
+
+  struct grok_glob_file *ready_head;
+  struct grok_glob_file *ready_tail;
+  struct grok_glob_file *lru_head;
+  struct grok_glob_file *lru_tail;
+  int nopen;
+
+  char *readbuffer; /* GLOB_READSIZE + 1 for a terminating NUL */
+
+  int inotify_fd; /* -1 if we poll */
+  struct grok_glob_watch *watches; /* sorted by wd */
+  int nwatches;
+  int watch_size;
+
+  struct event inotify_ev;
+  struct event turn_ev;
+  struct event sweep_ev;
+  int turn_pending;
+};
+
+static void _glob_rescan(struct grok_glob_state *gs);
+static void _glob_watch_dirs(struct grok_glob_state *gs);
+static void _glob_sweep(int fd, short what, void *data);
+static void _glob_sweep_once(struct grok_glob_state *gs, int rescan);
+static void _glob_turn(int fd, short what, void *data);
+static void _glob_inotify_read(int fd, short what, void *data);
+static void _glob_enqueue(struct grok_glob_state *gs,
+                          struct grok_glob_file *gf);
+static int _glob_read_block(struct grok_glob_state *gs,
+                            struct grok_glob_file *gf);
+static void _glob_file_close(struct grok_glob_state *gs,
+                             struct grok_glob_file *gf);
+static void _glob_file_free(struct grok_glob_file *gf);
+
+static int _glob_has_magic(const char *str, int len) {
+  int i;
+  for (i = 0; i < len; i++) {
+    if (str[i] == '*' || str[i] == '?' || str[i] == '[')
+      return 1;
+  }
+  return 0;
+}
+
+static int _glob_file_cmp(const void *a, const void *b) {
+  return strcmp((*(struct grok_glob_file **)a)->path,
+                (*(struct grok_glob_file **)b)->path);
+}
+
+static int _glob_path_cmp(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+static struct grok_glob_file *_glob_file_find(struct grok_glob_state *gs,
+                                              const char *path) {
+  struct grok_glob_file key, *keyp = &key, **found;
+  key.path = (char *)path;
+  found = bsearch(&keyp, gs->files, gs->nfiles, sizeof(*gs->files),
+                  _glob_file_cmp);
+  return (found == NULL) ? NULL : *found;
+}
+
+void grok_program_add_input_glob(grok_program_t *gprog,
+                                 grok_input_t *ginput) {
+  grok_input_glob_t *gig = &(ginput->source.glob);
+  struct grok_glob_state *gs = gig->state;
+  struct timeval sweep = { GLOB_SWEEP_INTERVAL, 0 };
+  struct timeval nodelay = { 0, 0 };
+  int i;
+
+  grok_log(ginput, LOG_PROGRAMINPUT, "Adding glob input: %s (max open %d)",
+           gig->file.filename, gig->max_open);
+
+  if (gs == NULL) {
+    gs = calloc(1, sizeof(struct grok_glob_state));
+    gs->readbuffer = malloc(GLOB_READSIZE + 1);
+    gs->inotify_fd = -1;
+#ifdef __linux__
+    if (gig->file.follow) {
+      gs->inotify_fd = inotify_init();
+      if (gs->inotify_fd < 0) {
+        grok_log(ginput, LOG_PROGRAM, "inotify_init failed (%s); polling '%s'",
+                 strerror(errno), gig->file.filename);
+      } else {
+        fcntl(gs->inotify_fd, F_SETFL, O_NONBLOCK);
+      }
+    }
+#endif
+    gig->state = gs;
+  }
+
+  /* A state taken over from a reloaded input keeps its files and offsets */
+  gs->ginput = ginput;
+  gs->turn_pending = 0;
+  evtimer_set(&gs->turn_ev, _glob_turn, gs);
+  evtimer_set(&gs->sweep_ev, _glob_sweep, gs);
+  if (gs->inotify_fd >= 0) {
+    event_set(&gs->inotify_ev, gs->inotify_fd, EV_READ | EV_PERSIST,
+              _glob_inotify_read, gs);
+    event_add(&gs->inotify_ev, NULL);
+    sweep.tv_sec = GLOB_SWEEP_INTERVAL_INOTIFY;
+  }
+
+  if (gs->files == NULL) {
+    _glob_rescan(gs);
+    /* Read everything that is already there */
+    for (i = 0; i < gs->nfiles; i++) {
+      _glob_enqueue(gs, gs->files[i]);
+    }
+  }
+
+  if (gig->file.follow) {
+    evtimer_add(&gs->sweep_ev, &sweep);
+  }
+
+  /* Always take a turn, so a glob matching nothing still reaches EOF */
+  if (!gs->turn_pending) {
+    gs->turn_pending = 1;
+    evtimer_add(&gs->turn_ev, &nodelay);
+  }
+}
+
+/* Stop all activity. The state is only freed if no other input took it. */
+void grok_input_glob_stop(grok_input_t *ginput) {
+  struct grok_glob_state *gs = ginput->source.glob.state;
+  int i;
+
+  if (gs == NULL) {
+    return;
+  }
+
+  if (gs->inotify_fd >= 0) {
+    event_del(&gs->inotify_ev);
+    close(gs->inotify_fd);
+  }
+  event_del(&gs->sweep_ev);
+  event_del(&gs->turn_ev);
+
+  /* files already dropped by a rescan may still be queued */
+  while (gs->ready_head != NULL) {
+    struct grok_glob_file *gf = gs->ready_head;
+    gs->ready_head = gf->ready_next;
+    if (gf->removed) {
+      _glob_file_free(gf);
+    }
+  }
+  for (i = 0; i < gs->nfiles; i++) {
+    _glob_file_close(gs, gs->files[i]);
+    _glob_file_free(gs->files[i]);
+  }
+  for (i = 0; i < gs->nwatches; i++) {
+    free(gs->watches[i].dir);
+  }
+  free(gs->watches);
+  free(gs->files);
+  free(gs->readbuffer);
+  free(gs);
+  ginput->source.glob.state = NULL;
+}
+
+/* Hand the running state of 'from' to 'to' (config reload) */
+void grok_input_glob_takeover(grok_input_t *to, grok_input_t *from) {
+  struct grok_glob_state *gs = from->source.glob.state;
+
+  if (gs == NULL) {
+    return;
+  }
+  if (gs->inotify_fd >= 0) {
+    event_del(&gs->inotify_ev);
+  }
+  event_del(&gs->sweep_ev);
+  event_del(&gs->turn_ev);
+  from->source.glob.state = NULL;
+  to->source.glob.state = gs;
+}
+
+/* Re-run the glob: add new files, drop ones that no longer match */
+static void _glob_rescan(struct grok_glob_state *gs) {
+  grok_input_t *ginput = gs->ginput;
+  struct grok_glob_file **files;
+  glob_t g;
+  int i = 0, j = 0, n = 0, ret;
+
+  ret = glob(ginput->source.glob.file.filename, GLOB_NOSORT, NULL, &g);
+  if (ret != 0 && ret != GLOB_NOMATCH) {
+    grok_log(ginput, LOG_PROGRAMINPUT, "glob(3) of '%s' failed: %d",
+             ginput->source.glob.file.filename, ret);
+    return;
+  }
+  if (ret == GLOB_NOMATCH) {
+    g.gl_pathc = 0;
+  }
+
+  /* glob(3) sorts with strcoll; we bsearch with strcmp */
+  qsort(g.gl_pathv, g.gl_pathc, sizeof(char *), _glob_path_cmp);
+
+  /* Merge the sorted old list with the sorted glob results */
+  files = malloc((gs->nfiles + g.gl_pathc + 1) * sizeof(*files));
+  while (i < gs->nfiles || j < g.gl_pathc) {
+    int cmp;
+    if (i == gs->nfiles) {
+      cmp = 1;
+    } else if (j == g.gl_pathc) {
+      cmp = -1;
+    } else {
+      cmp = strcmp(gs->files[i]->path, g.gl_pathv[j]);
+    }
+
+    if (cmp == 0) {
+      files[n++] = gs->files[i++];
+      j++;
+    } else if (cmp < 0) {
+      struct grok_glob_file *gf = gs->files[i++];
+      grok_log(ginput, LOG_PROGRAMINPUT, "No longer watching '%s'", gf->path);
+      _glob_file_close(gs, gf);
+      if (gf->queued) {
+        gf->removed = 1;
+      } else {
+        _glob_file_free(gf);
+      }
+    } else {
+      struct grok_glob_file *gf;
+      struct stat st;
+      const char *path = g.gl_pathv[j++];
+      if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      gf = calloc(1, sizeof(struct grok_glob_file));
+      gf->path = strdup(path);
+      gf->fd = -1;
+      gf->inode = st.st_ino;
+      grok_log(ginput, LOG_PROGRAMINPUT, "Now watching '%s'", gf->path);
+      files[n++] = gf;
+      if (gs->files != NULL) {
+        /* Found after startup: read it from the beginning */
+        _glob_enqueue(gs, gf);
+      }
+    }
+  }
+
+  free(gs->files);
+  gs->files = files;
+  gs->nfiles = n;
+  gs->files_size = gs->nfiles + g.gl_pathc + 1;
+  globfree(&g);
+
+  if (gs->inotify_fd >= 0) {
+    _glob_watch_dirs(gs);
+  }
+}
+
+#ifdef __linux__
+static int _glob_watch_cmp(const void *a, const void *b) {
+  return ((struct grok_glob_watch *)a)->wd - ((struct grok_glob_watch *)b)->wd;
+}
+
+static struct grok_glob_watch *_glob_watch_find(struct grok_glob_state *gs,
+                                                int wd) {
+  struct grok_glob_watch key;
+  key.wd = wd;
+  return bsearch(&key, gs->watches, gs->nwatches,
+                 sizeof(struct grok_glob_watch), _glob_watch_cmp);
+}
+
+static void _glob_watch_add(struct grok_glob_state *gs, const char *dir) {
+  struct grok_glob_watch *w;
+  int wd;
+
+  wd = inotify_add_watch(gs->inotify_fd, dir,
+                         IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_DELETE);
+  if (wd < 0) {
+    grok_log(gs->ginput, LOG_PROGRAMINPUT, "Unable to watch '%s': %s",
+             dir, strerror(errno));
+    return;
+  }
+  if (_glob_watch_find(gs, wd) != NULL) {
+    return; /* already watching */
+  }
+
+  if (gs->nwatches == gs->watch_size) {
+    gs->watch_size = (gs->watch_size == 0) ? 16 : gs->watch_size * 2;
+    gs->watches = realloc(gs->watches,
+                          gs->watch_size * sizeof(struct grok_glob_watch));
+  }
+  w = &gs->watches[gs->nwatches++];
+  w->wd = wd;
+  w->dir = strdup(dir);
+  /* wds are handed out in increasing order, so this rarely moves much */
+  qsort(gs->watches, gs->nwatches, sizeof(struct grok_glob_watch),
+        _glob_watch_cmp);
+}
+#endif
+
+/* Watch every directory where a new match could appear. For a pattern
+ * like /a/ * /b/ * /c.log (spaces added), that is /a, each /a/X/b and
+ * each /a/X/b/Y. */
+static void _glob_watch_dirs(struct grok_glob_state *gs) {
+#ifdef __linux__
+  const char *pattern = gs->ginput->source.glob.file.filename;
+  char *dir = malloc(strlen(pattern) + 2);
+  const char *comp = (*pattern == '/') ? pattern + 1 : pattern;
+
+  for (;;) {
+    const char *slash = strchr(comp, '/');
+    int complen = (slash == NULL) ? strlen(comp) : slash - comp;
+    glob_t g;
+    int i;
+
+    /* Only directories holding a glob component or the file itself */
+    if (slash == NULL || _glob_has_magic(comp, complen)) {
+      if (comp == pattern) {
+        strcpy(dir, ".");
+      } else if (comp - pattern == 1) {
+        strcpy(dir, "/");
+      } else {
+        memcpy(dir, pattern, comp - pattern - 1);
+        dir[comp - pattern - 1] = '\0';
+      }
+      if (glob(dir, GLOB_ONLYDIR, NULL, &g) == 0) {
+        for (i = 0; i < g.gl_pathc; i++) {
+          _glob_watch_add(gs, g.gl_pathv[i]);
+        }
+        globfree(&g);
+      }
+    }
+
+    if (slash == NULL)
+      break;
+    comp = slash + 1;
+  }
+  free(dir);
+#endif
+}
+
+static void _glob_inotify_read(int fd, short what, void *data) {
+#ifdef __linux__
+  struct grok_glob_state *gs = (struct grok_glob_state *)data;
+  char buf[65536];
+  char path[PATH_MAX];
+  int len, offset, rescan = 0;
+
+  if (gs->ginput->done) {
+    return;
+  }
+
+  while ((len = read(fd, buf, sizeof(buf))) > 0) {
+    for (offset = 0; offset < len; ) {
+      struct inotify_event *ie = (struct inotify_event *)(buf + offset);
+      struct grok_glob_watch *w = _glob_watch_find(gs, ie->wd);
+      offset += sizeof(struct inotify_event) + ie->len;
+
+      if (ie->mask & IN_IGNORED) {
+        /* directory went away */
+        if (w != NULL) {
+          free(w->dir);
+          memmove(w, w + 1, (gs->watches + gs->nwatches - w - 1) * sizeof(*w));
+          gs->nwatches--;
+        }
+        continue;
+      }
+      if (w == NULL || ie->len == 0) {
+        continue;
+      }
+
+      if (ie->mask & IN_MODIFY) {
+        struct grok_glob_file *gf;
+        if (!strcmp(w->dir, ".")) {
+          snprintf(path, sizeof(path), "%s", ie->name);
+        } else {
+          snprintf(path, sizeof(path), "%s/%s", w->dir, ie->name);
+        }
+        gf = _glob_file_find(gs, path);
+        if (gf != NULL) {
+          _glob_enqueue(gs, gf);
+        }
+      } else {
+        /* created, renamed into place, or deleted */
+        rescan = 1;
+      }
+    }
+  }
+
+  if (rescan) {
+    _glob_rescan(gs);
+    /* a recreated file (rotation) is caught by the stat in the sweep */
+    _glob_sweep_once(gs, 0);
+  }
+#endif
+}
+
+/* The periodic sweep timer. libevent calls timers with fd == -1, so this
+ * can't tell a timer from a direct call; it always reschedules. */
+static void _glob_sweep(int fd, short what, void *data) {
+  struct grok_glob_state *gs = (struct grok_glob_state *)data;
+  struct timeval interval = { GLOB_SWEEP_INTERVAL, 0 };
+
+  if (gs->ginput->done) {
+    return;
+  }
+
+  _glob_sweep_once(gs, 1);
+  if (gs->inotify_fd >= 0) {
+    interval.tv_sec = GLOB_SWEEP_INTERVAL_INOTIFY;
+  }
+  evtimer_add(&gs->sweep_ev, &interval);
+}
+
+/* Check every file for rotation, truncation or growth we were not told
+ * about, and (if 'rescan') look for new files. */
+static void _glob_sweep_once(struct grok_glob_state *gs, int rescan) {
+  grok_input_t *ginput = gs->ginput;
+  int i;
+
+  if (rescan) {
+    _glob_rescan(gs);
+  }
+
+  for (i = 0; i < gs->nfiles; i++) {
+    struct grok_glob_file *gf = gs->files[i];
+    struct stat st;
+    if (stat(gf->path, &st) != 0) {
+      continue;
+    }
+
+    if (st.st_ino != gf->inode) {
+      grok_log(ginput, LOG_PROGRAMINPUT,
+               "File inode changed. Reopening file '%s'", gf->path);
+      _glob_file_close(gs, gf);
+      gf->inode = st.st_ino;
+      gf->offset = 0;
+      gf->partial_len = 0;
+      _glob_enqueue(gs, gf);
+    } else if (st.st_size < gf->offset) {
+      grok_log(ginput, LOG_PROGRAMINPUT,
+               "File size shrank. Seeking to beginning of file '%s'", gf->path);
+      gf->offset = 0;
+      gf->partial_len = 0;
+      if (gf->fd >= 0) {
+        lseek(gf->fd, 0, SEEK_SET);
+      }
+      _glob_enqueue(gs, gf);
+    } else if (st.st_size > gf->offset) {
+      _glob_enqueue(gs, gf);
+    }
+  }
+}
+
+static void _glob_enqueue(struct grok_glob_state *gs,
+                          struct grok_glob_file *gf) {
+  struct timeval nodelay = { 0, 0 };
+
+  if (!gf->queued) {
+    gf->queued = 1;
+    gf->ready_next = NULL;
+    if (gs->ready_tail == NULL) {
+      gs->ready_head = gf;
+    } else {
+      gs->ready_tail->ready_next = gf;
+    }
+    gs->ready_tail = gf;
+  }
+
+  if (!gs->turn_pending) {
+    gs->turn_pending = 1;
+    evtimer_add(&gs->turn_ev, &nodelay);
+  }
+}
+
+/* Read one block from each of up to GLOB_FILES_PER_TURN ready files, then
+ * go back to the event loop. */
+static void _glob_turn(int fd, short what, void *data) {
+  struct grok_glob_state *gs = (struct grok_glob_state *)data;
+  grok_input_t *ginput = gs->ginput;
+  struct timeval nodelay = { 0, 0 };
+  int turns = 0;
+
+  gs->turn_pending = 0;
+  if (ginput->done) {
+    return;
+  }
+
+  while (gs->ready_head != NULL && turns < GLOB_FILES_PER_TURN
+         && !ginput->done) {
+    struct grok_glob_file *gf = gs->ready_head;
+    gs->ready_head = gf->ready_next;
+    if (gs->ready_head == NULL) {
+      gs->ready_tail = NULL;
+    }
+    gf->queued = 0;
+
+    if (gf->removed) {
+      _glob_file_free(gf);
+      continue;
+    }
+
+    turns++;
+    if (_glob_read_block(gs, gf) > 0) {
+      _glob_enqueue(gs, gf); /* there may be more; back of the line */
+    }
+  }
+
+  if (gs->ready_head != NULL) {
+    if (!gs->turn_pending) {
+      gs->turn_pending = 1;
+      evtimer_add(&gs->turn_ev, &nodelay);
+    }
+  } else if (!ginput->source.glob.file.follow && !ginput->done) {
+    /* Everything has been read once */
+    grok_input_eof_handler(0, 0, ginput);
+  }
+}
+
+static int _glob_file_open(struct grok_glob_state *gs,
+                           struct grok_glob_file *gf) {
+  int max_open = gs->ginput->source.glob.max_open;
+
+  if (gf->fd >= 0) {
+    /* move to the front of the LRU */
+    if (gs->lru_head != gf) {
+      gf->lru_prev->lru_next = gf->lru_next;
+      if (gf->lru_next != NULL) {
+        gf->lru_next->lru_prev = gf->lru_prev;
+      } else {
+        gs->lru_tail = gf->lru_prev;
+      }
+      gf->lru_prev = NULL;
+      gf->lru_next = gs->lru_head;
+      gs->lru_head->lru_prev = gf;
+      gs->lru_head = gf;
+    }
+    return 0;
+  }
+
+  while (gs->nopen >= max_open && gs->lru_tail != NULL) {
+    _glob_file_close(gs, gs->lru_tail);
+  }
+
+  gf->fd = open(gf->path, O_RDONLY);
+  if (gf->fd < 0) {
+    grok_log(gs->ginput, LOG_PROGRAMINPUT,
+             "Failure open(2)'ing file for read '%s': %s",
+             gf->path, strerror(errno));
+    return -1;
+  }
+  if (gf->offset > 0) {
+    lseek(gf->fd, gf->offset, SEEK_SET);
+  }
+
+  gs->nopen++;
+  gf->lru_prev = NULL;
+  gf->lru_next = gs->lru_head;
+  if (gs->lru_head != NULL) {
+    gs->lru_head->lru_prev = gf;
+  }
+  gs->lru_head = gf;
+  if (gs->lru_tail == NULL) {
+    gs->lru_tail = gf;
+  }
+  return 0;
+}
+
+static void _glob_file_close(struct grok_glob_state *gs,
+                             struct grok_glob_file *gf) {
+  if (gf->fd < 0) {
+    return;
+  }
+
+  close(gf->fd);
+  gf->fd = -1;
+  gs->nopen--;
+
+  if (gf->lru_prev != NULL) {
+    gf->lru_prev->lru_next = gf->lru_next;
+  } else {
+    gs->lru_head = gf->lru_next;
+  }
+  if (gf->lru_next != NULL) {
+    gf->lru_next->lru_prev = gf->lru_prev;
+  } else {
+    gs->lru_tail = gf->lru_prev;
+  }
+  gf->lru_prev = gf->lru_next = NULL;
+}
+
+static void _glob_file_free(struct grok_glob_file *gf) {
+  free(gf->path);
+  free(gf->partial);
+  free(gf);
+}
+
+/* Append data to the file's partial line buffer */
+static void _glob_partial_add(struct grok_glob_file *gf,
+                              const char *data, int len) {
+  if (gf->partial_len + len + 1 > gf->partial_size) {
+    gf->partial_size = (gf->partial_len + len + 1) * 2;
+    gf->partial = realloc(gf->partial, gf->partial_size);
+  }
+  memcpy(gf->partial + gf->partial_len, data, len);
+  gf->partial_len += len;
+  gf->partial[gf->partial_len] = '\0';
+}
+
+/* Read one block and hand each complete line to the match blocks.
+ * Returns the number of bytes read. */
+static int _glob_read_block(struct grok_glob_state *gs,
+                            struct grok_glob_file *gf) {
+  grok_input_t *ginput = gs->ginput;
+  char *buf = gs->readbuffer;
+  char *line, *eol, *end;
+  int bytes;
+
+  if (_glob_file_open(gs, gf) != 0) {
+    return 0;
+  }
+
+  bytes = read(gf->fd, buf, GLOB_READSIZE);
+  if (bytes < 0) {
+    grok_log(ginput, LOG_PROGRAMINPUT, "Error reading '%s': %s",
+             gf->path, strerror(errno));
+    return 0;
+  }
+  grok_log(ginput, LOG_PROGRAMINPUT, "%s: read %d bytes", gf->path, bytes);
+
+  if (bytes == 0) {
+    struct stat st;
+    /* At EOF. When reading once, the last line may lack a newline */
+    if (!ginput->source.glob.file.follow && gf->partial_len > 0) {
+      gf->partial_len = 0;
+      grok_matchconfig_exec(ginput->gprog, ginput, gf->partial);
+    }
+
+    /* Truncated since we last read; start over rather than wait for the
+     * next sweep */
+    if (fstat(gf->fd, &st) == 0 && st.st_size < gf->offset) {
+      grok_log(ginput, LOG_PROGRAMINPUT,
+               "File size shrank. Seeking to beginning of file '%s'", gf->path);
+      gf->offset = 0;
+      gf->partial_len = 0;
+      lseek(gf->fd, 0, SEEK_SET);
+      return 1; /* read again */
+    }
+    return 0;
+  }
+  gf->offset += bytes;
+
+  /* Terminate lines in place; only a line split across reads is copied */
+  end = buf + bytes;
+  for (line = buf; line < end && !ginput->done; line = eol + 1) {
+    eol = memchr(line, '\n', end - line);
+    if (eol == NULL) {
+      _glob_partial_add(gf, line, end - line);
+      break;
+    }
+    *eol = '\0';
+    if (gf->partial_len > 0) {
+      _glob_partial_add(gf, line, eol - line);
+      gf->partial_len = 0;
+      grok_matchconfig_exec(ginput->gprog, ginput, gf->partial);
+    } else {
+      grok_matchconfig_exec(ginput->gprog, ginput, line);
+    }
+  }
+
+  return bytes;
+}
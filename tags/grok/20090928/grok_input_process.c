@@ -0,0 +1,388 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <event.h>
+
+#include "grok.h"
+#include "grok_program.h"
+#include "grok_input.h"
+#include "grok_logging.h"
+#include "stringhelper.h"
+
+/* Starting 'exec' commands.
+ *
+ * Commands are started with posix_spawnp(3), which does not copy our
+ * (possibly large) address space the way fork(2) does. Commands given as
+ * an argv list, or with 'shell: no', are exec'd directly instead of
+ * through 'sh -c'.
+ *
+ * With 'spawn-helper: yes', a small helper process is forked once, when
+ * the input is added, and runs the command each time we ask it to. The
+ * helper reports the pid and then the exit status of every run, so its
+ * children never show up in our SIGCHLD handling. */
+
+extern char **environ;
+
+#define SPAWN_STARTED 1
+#define SPAWN_EXITED 2
+
+struct spawn_report {
+  int what; /* SPAWN_STARTED or SPAWN_EXITED */
+  int pid;
+  int status; /* errno of a failed spawn, or the wait(2) status */
+};
+
+static int _process_spawn(grok_input_process_t *gipt, pid_t *pid);
+static void _process_started(grok_input_t *ginput);
+static void _helper_main(grok_input_process_t *gipt, int fd);
+static void _helper_report(int fd, short what, void *data);
+
+int grok_input_process_spawn(grok_input_t *ginput) {
+  grok_input_process_t *gipt = &(ginput->source.process);
+  pid_t pid;
+  int ret;
+
+  gettimeofday(&(gipt->start_time), NULL);
+
+  if (gipt->helper_pid > 0) {
+    if (send(gipt->helper_fd, "r", 1, MSG_NOSIGNAL) == 1) {
+      gipt->helper_busy = 1;
+      grok_log(ginput, LOG_PROGRAMINPUT, "Asked spawn helper %d to start: %s",
+               gipt->helper_pid, gipt->cmd);
+      return 0;
+    }
+    grok_log(ginput, LOG_PROGRAM, "Lost spawn helper %d (%s), "
+             "starting '%s' directly", gipt->helper_pid, strerror(errno),
+             gipt->cmd);
+    grok_input_process_helper_stop(ginput);
+  }
+
+  ret = _process_spawn(gipt, &pid);
+  if (ret != 0) {
+    grok_log(ginput, LOG_PROGRAM, "Failed to start '%s': %s",
+             gipt->cmd, strerror(ret));
+    return ret;
+  }
+
+  gipt->pid = pid;
+  gipt->pgid = getpgid(pid);
+  _process_started(ginput);
+  return 0;
+}
+
+/* Called once the command has finished (or failed to start): schedule the
+ * restart, if any, and let the eof handler decide what happens next. */
+void grok_input_process_exited(grok_input_t *ginput) {
+  grok_input_process_t *gipt = &(ginput->source.process);
+  struct timeval nodelay = { 0, 0 };
+
+  gipt->pid = 0;
+
+  if (PROCESS_SHOULD_RESTART(gipt)) {
+    /* Calculate the restart delay */
+    struct timeval restart_delay = { 0, 0 };
+    if (gipt->run_interval > 0) {
+      struct timeval interval = { gipt->run_interval, 0 };
+      struct timeval duration;
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      timersub(&now, &(gipt->start_time), &duration);
+      if (timercmp(&duration, &interval, <)) {
+        timersub(&interval, &duration, &restart_delay);
+      }
+    }
+
+    if (gipt->min_restart_delay > 0) {
+      struct timeval fixed_delay = { gipt->min_restart_delay, 0 };
+
+      if (timercmp(&restart_delay, &fixed_delay, <)) {
+        restart_delay.tv_sec = fixed_delay.tv_sec;
+        restart_delay.tv_usec = fixed_delay.tv_usec;
+      }
+    }
+
+    grok_log(ginput, LOG_PROGRAM,
+             "Scheduling process restart in %d.%06d seconds: %s",
+             restart_delay.tv_sec, restart_delay.tv_usec, gipt->cmd);
+    ginput->restart_delay.tv_sec = restart_delay.tv_sec;
+    ginput->restart_delay.tv_usec = restart_delay.tv_usec;
+  } else {
+    grok_log(ginput, LOG_PROGRAM, "Not restarting process '%s'", gipt->cmd);
+  }
+
+  event_once(-1, EV_TIMEOUT, grok_input_eof_handler, ginput, &nodelay);
+}
+
+void grok_input_process_helper_start(grok_input_t *ginput) {
+  grok_input_process_t *gipt = &(ginput->source.process);
+  int sv[2];
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+    grok_log(ginput, LOG_PROGRAM, "socketpair() failed, not using a spawn "
+             "helper for '%s': %s", gipt->cmd, strerror(errno));
+    return;
+  }
+
+  /* Keep commands we spawn directly from inheriting the helper socket */
+  fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+  fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+  pid = fork();
+  if (pid == -1) {
+    grok_log(ginput, LOG_PROGRAM, "fork() failed, not using a spawn "
+             "helper for '%s': %s", gipt->cmd, strerror(errno));
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+
+  if (pid == 0) {
+    close(sv[0]);
+    _helper_main(gipt, sv[1]);
+    /* not reached */
+  }
+
+  close(sv[1]);
+  gipt->helper_pid = pid;
+  gipt->helper_fd = sv[0];
+  gipt->helper_busy = 0;
+  event_set(&gipt->helper_ev, gipt->helper_fd, EV_READ | EV_PERSIST,
+            _helper_report, ginput);
+  event_add(&gipt->helper_ev, NULL);
+  grok_log(ginput, LOG_PROGRAMINPUT, "Started spawn helper %d for: %s",
+           pid, gipt->cmd);
+}
+
+/* The helper exits once it sees its socket close. */
+void grok_input_process_helper_stop(grok_input_t *ginput) {
+  grok_input_process_t *gipt = &(ginput->source.process);
+
+  if (gipt->helper_pid <= 0) {
+    return;
+  }
+
+  grok_log(ginput, LOG_PROGRAMINPUT, "Stopping spawn helper %d",
+           gipt->helper_pid);
+  event_del(&gipt->helper_ev);
+  close(gipt->helper_fd);
+  gipt->helper_fd = -1;
+  gipt->helper_pid = 0;
+  gipt->helper_busy = 0;
+}
+
+/* Split a command line into an argv, the way a shell would split a simple
+ * command: words are separated by whitespace, 'single quotes' keep
+ * everything literally, "double quotes" allow \" and \\, and a backslash
+ * outside quotes escapes the next character. Nothing else (variables,
+ * globs, redirection, pipes) is special.
+ *
+ * Returns a NULL-terminated, malloc'd vector, or NULL if the command is
+ * empty or has an unterminated quote. */
+char **grok_process_argv_parse(const char *cmd) {
+  int argc = 0;
+  int argv_size = 8;
+  char **argv = malloc(argv_size * sizeof(char *));
+  char *word = malloc(strlen(cmd) + 1);
+  const char *p = cmd;
+
+  for (;;) {
+    int len = 0;
+
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == '\0') {
+      break;
+    }
+
+    while (*p != '\0' && !isspace((unsigned char)*p)) {
+      if (*p == '\'') {
+        const char *end = strchr(p + 1, '\'');
+        if (end == NULL) {
+          goto unterminated;
+        }
+        memcpy(word + len, p + 1, end - p - 1);
+        len += end - p - 1;
+        p = end + 1;
+      } else if (*p == '"') {
+        p++;
+        while (*p != '"') {
+          if (*p == '\0') {
+            goto unterminated;
+          }
+          if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+            p++;
+          }
+          word[len++] = *p++;
+        }
+        p++;
+      } else if (*p == '\\' && p[1] != '\0') {
+        word[len++] = p[1];
+        p += 2;
+      } else {
+        word[len++] = *p++;
+      }
+    }
+
+    if (argc + 1 == argv_size) {
+      argv_size *= 2;
+      argv = realloc(argv, argv_size * sizeof(char *));
+    }
+    argv[argc++] = string_ndup(word, len);
+  }
+
+  free(word);
+  if (argc == 0) {
+    free(argv);
+    return NULL;
+  }
+  argv[argc] = NULL;
+  return argv;
+
+unterminated:
+  free(word);
+  argv[argc] = NULL;
+  grok_process_argv_free(argv);
+  return NULL;
+}
+
+void grok_process_argv_free(char **argv) {
+  char **arg;
+
+  if (argv == NULL) {
+    return;
+  }
+  for (arg = argv; *arg != NULL; arg++) {
+    free(*arg);
+  }
+  free(argv);
+}
+
+/* Returns 0 or an errno value, like posix_spawn itself. */
+static int _process_spawn(grok_input_process_t *gipt, pid_t *pid) {
+  posix_spawn_file_actions_t actions;
+  char *shell_argv[] = { "sh", "-c", gipt->cmd, NULL };
+  char **argv = (gipt->argv != NULL) ? gipt->argv : shell_argv;
+  int ret;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, gipt->c_stdin, 0);
+  posix_spawn_file_actions_adddup2(&actions, gipt->c_stdout, 1);
+  if (gipt->read_stderr) {
+    posix_spawn_file_actions_adddup2(&actions, gipt->c_stderr, 2);
+  }
+  ret = posix_spawnp(pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  return ret;
+}
+
+static void _process_started(grok_input_t *ginput) {
+  grok_input_process_t *gipt = &(ginput->source.process);
+  struct timeval now, elapsed;
+  long usec;
+
+  gettimeofday(&now, NULL);
+  timersub(&now, &(gipt->start_time), &elapsed);
+  usec = elapsed.tv_sec * 1000000L + elapsed.tv_usec;
+
+  gipt->spawn_count++;
+  gipt->spawn_usec_total += usec;
+  if (usec > gipt->spawn_usec_max) {
+    gipt->spawn_usec_max = usec;
+  }
+
+  grok_log(ginput, LOG_PROGRAMINPUT,
+           "Started process %d in %ldus (%d spawns, avg %ldus, max %ldus): %s",
+           gipt->pid, usec, gipt->spawn_count,
+           gipt->spawn_usec_total / gipt->spawn_count, gipt->spawn_usec_max,
+           gipt->cmd);
+}
+
+static void _helper_main(grok_input_process_t *gipt, int fd) {
+  struct spawn_report report;
+  pid_t pid;
+  int status;
+  int i, maxfd;
+  char c;
+
+  /* Our copies of grok's handlers would wake grok's event loop */
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+
+  /* Drop everything else we inherited (other helpers' sockets, libevent's
+   * descriptors, ...) so nobody waits on us for an EOF. */
+  maxfd = sysconf(_SC_OPEN_MAX);
+  for (i = 3; i < maxfd; i++) {
+    if (i != fd && i != gipt->c_stdin && i != gipt->c_stdout
+        && i != gipt->c_stderr) {
+      close(i);
+    }
+  }
+
+  while (recv(fd, &c, 1, 0) == 1) {
+    report.what = SPAWN_STARTED;
+    report.status = _process_spawn(gipt, &pid);
+    report.pid = (report.status == 0) ? pid : 0;
+    send(fd, &report, sizeof(report), MSG_NOSIGNAL);
+    if (report.status != 0) {
+      continue;
+    }
+
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+      ;
+    report.what = SPAWN_EXITED;
+    report.status = status;
+    send(fd, &report, sizeof(report), MSG_NOSIGNAL);
+  }
+  _exit(0);
+}
+
+static void _helper_report(int fd, short what, void *data) {
+  grok_input_t *ginput = (grok_input_t *)data;
+  grok_input_process_t *gipt = &(ginput->source.process);
+  struct spawn_report report;
+  int busy;
+
+  if (recv(fd, &report, sizeof(report), MSG_WAITALL) != sizeof(report)) {
+    grok_log(ginput, LOG_PROGRAM, "Spawn helper %d went away, starting '%s' "
+             "directly from now on", gipt->helper_pid, gipt->cmd);
+    busy = gipt->helper_busy;
+    grok_input_process_helper_stop(ginput);
+    if (busy) {
+      grok_input_process_exited(ginput);
+    }
+    return;
+  }
+
+  switch (report.what) {
+    case SPAWN_STARTED:
+      if (report.status != 0) {
+        grok_log(ginput, LOG_PROGRAM, "Spawn helper failed to start '%s': %s",
+                 gipt->cmd, strerror(report.status));
+        gipt->helper_busy = 0;
+        grok_input_process_exited(ginput);
+        break;
+      }
+      gipt->pid = report.pid;
+      gipt->pgid = getpgid(report.pid);
+      _process_started(ginput);
+      break;
+    case SPAWN_EXITED:
+      grok_log(ginput, LOG_PROGRAM, "Process %d exited with status %d: %s",
+               report.pid, WEXITSTATUS(report.status), gipt->cmd);
+      gipt->helper_busy = 0;
+      grok_input_process_exited(ginput);
+      break;
+  }
+}
@@ -0,0 +1,431 @@
+#define _GNU_SOURCE /* for recvmmsg(2) */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <event.h>
+
+#include "grok.h"
+#include "grok_program.h"
+#include "grok_input.h"
+#include "grok_matchconf.h"
+#include "grok_logging.h"
+
+/* Receive syslog messages directly, instead of having a syslog daemon
+ * write them to disk for us to tail.
+ *
+ * UDP datagrams are received SYSLOG_BATCH at a time with recvmmsg(2). TCP
+ * streams accept both newline-terminated and octet-counted ('123 <PRI>...',
+ * RFC6587) framing. Each message has its RFC3164 header parsed once; the
+ * <PRI> is dropped and the rest handed to the match blocks, so the text
+ * looks just like a line syslogd would have written to a file. */
+
+struct grok_syslog_conn {
+  int fd;
+  struct bufferevent *bev;
+  grok_input_t *ginput;
+  char peer[NI_MAXHOST];
+  int discarding; /* skipping the rest of an overlong line */
+  struct grok_syslog_conn *next;
+};
+
+static const char *syslog_months[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static int _syslog_bind(grok_input_t *ginput);
+static void _syslog_udp_read(int fd, short what, void *data);
+static void _syslog_tcp_accept(int fd, short what, void *data);
+static void _syslog_tcp_read(struct bufferevent *bev, void *data);
+static void _syslog_tcp_error(struct bufferevent *bev, short what, void *data);
+static void _syslog_conn_close(struct grok_syslog_conn *conn);
+static void _syslog_message(grok_input_t *ginput, const char *msg, int len,
+                            const char *peer);
+
+void grok_program_add_input_syslog(grok_program_t *gprog,
+                                   grok_input_t *ginput) {
+  grok_input_syslog_t *gisl = &(ginput->source.syslog);
+  grok_log(ginput, LOG_PROGRAMINPUT, "Adding syslog input (%s): %s",
+           (gisl->protocol == SYSLOG_TCP) ? "tcp" : "udp", gisl->address);
+
+  /* fd is already set if we took over the socket of a reloaded input */
+  if (gisl->fd < 0 && _syslog_bind(ginput) != 0) {
+    ginput->done = 1;
+    return;
+  }
+
+  gisl->conns = NULL;
+  if (gisl->protocol == SYSLOG_TCP) {
+    event_set(&gisl->ev, gisl->fd, EV_READ | EV_PERSIST,
+              _syslog_tcp_accept, ginput);
+  } else {
+    gisl->recvbuffer = malloc(SYSLOG_BATCH * SYSLOG_MAXMSG);
+    event_set(&gisl->ev, gisl->fd, EV_READ | EV_PERSIST,
+              _syslog_udp_read, ginput);
+  }
+  event_add(&gisl->ev, NULL);
+}
+
+void grok_input_syslog_stop(grok_input_t *ginput) {
+  grok_input_syslog_t *gisl = &(ginput->source.syslog);
+
+  while (gisl->conns != NULL) {
+    _syslog_conn_close(gisl->conns);
+  }
+
+  /* fd is -1 if a new input took over our socket */
+  if (gisl->fd >= 0) {
+    event_del(&gisl->ev);
+    close(gisl->fd);
+    gisl->fd = -1;
+  }
+  free(gisl->recvbuffer);
+  gisl->recvbuffer = NULL;
+}
+
+static int _syslog_bind(grok_input_t *ginput) {
+  grok_input_syslog_t *gisl = &(ginput->source.syslog);
+  struct addrinfo hints, *res;
+  char *host, *port, *copy;
+  int ret, on = 1;
+
+  /* Split "host:port", "[v6host]:port", ":port" or "port" */
+  copy = strdup(gisl->address);
+  port = strrchr(copy, ':');
+  if (port == NULL) {
+    host = NULL;
+    port = copy;
+  } else {
+    *port++ = '\0';
+    host = copy;
+    if (*host == '[') {
+      host++;
+      host[strlen(host) - 1] = '\0';
+    }
+    if (*host == '\0')
+      host = NULL;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = (gisl->protocol == SYSLOG_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  ret = getaddrinfo(host, port, &hints, &res);
+  free(copy);
+  if (ret != 0) {
+    grok_log(ginput, LOG_PROGRAM, "Unable to resolve syslog address '%s': %s",
+             gisl->address, gai_strerror(ret));
+    return -1;
+  }
+
+  gisl->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (gisl->fd < 0) {
+    grok_log(ginput, LOG_PROGRAM, "socket(2) failed for '%s': %s",
+             gisl->address, strerror(errno));
+    freeaddrinfo(res);
+    return -1;
+  }
+  setsockopt(gisl->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (bind(gisl->fd, res->ai_addr, res->ai_addrlen) != 0
+      || (gisl->protocol == SYSLOG_TCP && listen(gisl->fd, 128) != 0)) {
+    grok_log(ginput, LOG_PROGRAM, "Unable to listen on '%s': %s",
+             gisl->address, strerror(errno));
+    close(gisl->fd);
+    gisl->fd = -1;
+    freeaddrinfo(res);
+    return -1;
+  }
+  freeaddrinfo(res);
+
+  fcntl(gisl->fd, F_SETFL, fcntl(gisl->fd, F_GETFL) | O_NONBLOCK);
+  return 0;
+}
+
+static void _syslog_udp_read(int fd, short what, void *data) {
+  grok_input_t *ginput = (grok_input_t *)data;
+  grok_input_syslog_t *gisl = &(ginput->source.syslog);
+  struct sockaddr_storage from[SYSLOG_BATCH];
+  char peer[NI_MAXHOST];
+  int i, n;
+#ifdef __linux__
+  struct mmsghdr msgs[SYSLOG_BATCH];
+  struct iovec iov[SYSLOG_BATCH];
+#else
+  int lens[SYSLOG_BATCH];
+#endif
+
+  if (ginput->done) {
+    return;
+  }
+
+  /* One batch per wakeup; libevent will call us again if there is more,
+   * which keeps a busy socket from starving other inputs. */
+#ifdef __linux__
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0; i < SYSLOG_BATCH; i++) {
+    iov[i].iov_base = gisl->recvbuffer + i * SYSLOG_MAXMSG;
+    iov[i].iov_len = SYSLOG_MAXMSG;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &from[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+  }
+  n = recvmmsg(fd, msgs, SYSLOG_BATCH, MSG_DONTWAIT, NULL);
+#else
+  for (n = 0; n < SYSLOG_BATCH; n++) {
+    socklen_t fromlen = sizeof(from[n]);
+    lens[n] = recvfrom(fd, gisl->recvbuffer + n * SYSLOG_MAXMSG,
+                       SYSLOG_MAXMSG, MSG_DONTWAIT,
+                       (struct sockaddr *)&from[n], &fromlen);
+    if (lens[n] < 0)
+      break;
+  }
+  if (n == 0)
+    n = -1;
+#endif
+
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      grok_log(ginput, LOG_PROGRAMINPUT, "Error receiving on '%s': %s",
+               gisl->address, strerror(errno));
+    }
+    return;
+  }
+
+  grok_log(ginput, LOG_PROGRAMINPUT, "%s: received %d messages",
+           gisl->address, n);
+  for (i = 0; i < n && !ginput->done; i++) {
+#ifdef __linux__
+    int len = msgs[i].msg_len;
+#else
+    int len = lens[i];
+#endif
+    if (getnameinfo((struct sockaddr *)&from[i], sizeof(from[i]),
+                    peer, sizeof(peer), NULL, 0, NI_NUMERICHOST) != 0) {
+      strcpy(peer, "unknown");
+    }
+    _syslog_message(ginput, gisl->recvbuffer + i * SYSLOG_MAXMSG, len, peer);
+  }
+}
+
+static void _syslog_tcp_accept(int fd, short what, void *data) {
+  grok_input_t *ginput = (grok_input_t *)data;
+  grok_input_syslog_t *gisl = &(ginput->source.syslog);
+  struct grok_syslog_conn *conn;
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+  int cfd;
+
+  if (ginput->done) {
+    return;
+  }
+
+  cfd = accept(fd, (struct sockaddr *)&addr, &addrlen);
+  if (cfd < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      grok_log(ginput, LOG_PROGRAMINPUT, "accept(2) on '%s' failed: %s",
+               gisl->address, strerror(errno));
+    }
+    return;
+  }
+
+  conn = calloc(1, sizeof(struct grok_syslog_conn));
+  conn->fd = cfd;
+  conn->ginput = ginput;
+  if (getnameinfo((struct sockaddr *)&addr, addrlen, conn->peer,
+                  sizeof(conn->peer), NULL, 0, NI_NUMERICHOST) != 0) {
+    strcpy(conn->peer, "unknown");
+  }
+  grok_log(ginput, LOG_PROGRAMINPUT, "Accepted syslog connection from %s",
+           conn->peer);
+
+  conn->bev = bufferevent_new(cfd, _syslog_tcp_read, NULL,
+                              _syslog_tcp_error, conn);
+  bufferevent_enable(conn->bev, EV_READ);
+  conn->next = gisl->conns;
+  gisl->conns = conn;
+}
+
+static void _syslog_tcp_read(struct bufferevent *bev, void *data) {
+  struct grok_syslog_conn *conn = (struct grok_syslog_conn *)data;
+  grok_input_t *ginput = conn->ginput;
+  struct evbuffer *input = EVBUFFER_INPUT(bev);
+
+  while (!ginput->done && EVBUFFER_LENGTH(input) > 0) {
+    const char *buf = (const char *)EVBUFFER_DATA(input);
+    int len = EVBUFFER_LENGTH(input);
+    int msglen, skip;
+
+    if (conn->discarding) {
+      /* The rest of a line we already truncated */
+      const char *eol = memchr(buf, '\n', len);
+      conn->discarding = (eol == NULL);
+      evbuffer_drain(input, (eol == NULL) ? len : eol - buf + 1);
+    } else if (isdigit(buf[0])) {
+      /* Octet counting: "<length> <message>" */
+      int i;
+      msglen = 0;
+      for (i = 0; i < len && isdigit(buf[i]); i++) {
+        msglen = msglen * 10 + (buf[i] - '0');
+      }
+      if (i == len)
+        break; /* need more data */
+      if (buf[i] != ' ' || msglen > SYSLOG_MAXMSG) {
+        grok_log(ginput, LOG_PROGRAMINPUT,
+                 "Bad syslog framing from %s; closing", conn->peer);
+        _syslog_conn_close(conn);
+        return;
+      }
+      skip = i + 1;
+      if (len < skip + msglen)
+        break; /* need more data */
+      _syslog_message(ginput, buf + skip, msglen, conn->peer);
+      evbuffer_drain(input, skip + msglen);
+    } else {
+      /* Non-transparent framing: one message per line */
+      const char *eol = memchr(buf, '\n', len);
+      if (eol == NULL) {
+        if (len < SYSLOG_MAXMSG)
+          break; /* need more data */
+        msglen = skip = len;
+        conn->discarding = 1; /* drop the rest of the line when it comes */
+      } else {
+        msglen = eol - buf;
+        skip = msglen + 1;
+      }
+      if (msglen > SYSLOG_MAXMSG) {
+        grok_log(ginput, LOG_PROGRAMINPUT,
+                 "Truncating %d byte syslog message from %s", msglen,
+                 conn->peer);
+        msglen = SYSLOG_MAXMSG;
+      }
+      _syslog_message(ginput, buf, msglen, conn->peer);
+      evbuffer_drain(input, skip);
+    }
+  }
+}
+
+static void _syslog_tcp_error(struct bufferevent *bev, short what,
+                              void *data) {
+  struct grok_syslog_conn *conn = (struct grok_syslog_conn *)data;
+  grok_log(conn->ginput, LOG_PROGRAMINPUT,
+           "Syslog connection from %s closed (%d)", conn->peer, what);
+  _syslog_conn_close(conn);
+}
+
+static void _syslog_conn_close(struct grok_syslog_conn *conn) {
+  grok_input_syslog_t *gisl = &(conn->ginput->source.syslog);
+  struct grok_syslog_conn **p;
+
+  for (p = &gisl->conns; *p != NULL; p = &(*p)->next) {
+    if (*p == conn) {
+      *p = conn->next;
+      break;
+    }
+  }
+  bufferevent_free(conn->bev);
+  close(conn->fd);
+  free(conn);
+}
+
+/* "Mmm dd hh:mm:ss " where dd is space-padded */
+static int _syslog_is_timestamp(const char *p) {
+  int i;
+  for (i = 0; i < 12; i++) {
+    if (!strncmp(p, syslog_months[i], 3))
+      break;
+  }
+  return i < 12 && p[3] == ' '
+         && (p[4] == ' ' || isdigit(p[4])) && isdigit(p[5]) && p[6] == ' '
+         && isdigit(p[7]) && isdigit(p[8]) && p[9] == ':'
+         && isdigit(p[10]) && isdigit(p[11]) && p[12] == ':'
+         && isdigit(p[13]) && isdigit(p[14]) && p[15] == ' ';
+}
+
+int grok_syslog_parse(const char *msg, int len, grok_syslog_header_t *hdr) {
+  const char *p = msg;
+  const char *end = msg + len;
+
+  hdr->pri = -1;
+  hdr->facility = -1;
+  hdr->severity = -1;
+  hdr->timestamp = NULL;
+  hdr->host = NULL;
+  hdr->host_len = 0;
+
+  /* <PRI> is 1 to 3 digits, at most 191 */
+  if (len >= 3 && *p == '<') {
+    const char *q = p + 1;
+    int pri = 0;
+    while (q < end && q - p <= 3 && isdigit(*q)) {
+      pri = pri * 10 + (*q - '0');
+      q++;
+    }
+    if (q < end && *q == '>' && q > p + 1 && pri <= 191) {
+      hdr->pri = pri;
+      hdr->facility = pri >> 3;
+      hdr->severity = pri & 7;
+      p = q + 1;
+    }
+  }
+
+  hdr->text = p;
+  hdr->text_len = end - p;
+
+  if (end - p >= 16 && _syslog_is_timestamp(p)) {
+    hdr->timestamp = p;
+    p += 16;
+    hdr->host = p;
+    while (p < end && *p != ' ')
+      p++;
+    hdr->host_len = p - hdr->host;
+  }
+
+  return (hdr->pri >= 0) ? 0 : -1;
+}
+
+static void _syslog_message(grok_input_t *ginput, const char *msg, int len,
+                            const char *peer) {
+  grok_syslog_header_t hdr;
+  char line[SYSLOG_MAXMSG + NI_MAXHOST + 32];
+
+  /* Senders commonly terminate messages with newlines or NULs */
+  while (len > 0 && (msg[len - 1] == '\n' || msg[len - 1] == '\r'
+                     || msg[len - 1] == '\0')) {
+    len--;
+  }
+  if (len == 0) {
+    return;
+  }
+
+  grok_syslog_parse(msg, len, &hdr);
+  grok_log(ginput, LOG_PROGRAMINPUT, "syslog from %s: pri=%d host=%.*s",
+           peer, hdr.pri, hdr.host_len, hdr.host);
+
+  if (hdr.timestamp != NULL) {
+    snprintf(line, sizeof(line), "%.*s", hdr.text_len, hdr.text);
+  } else {
+    /* No TIMESTAMP and HOSTNAME; add them as a relay (or syslogd writing
+     * to a file) would, so patterns like SYSLOGBASE still match. */
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S", &tm);
+    snprintf(line, sizeof(line), "%s %s %.*s", stamp, peer,
+             hdr.text_len, hdr.text);
+  }
+
+  grok_matchconfig_exec(ginput->gprog, ginput, line);
+}
@@ -1,34 +1,233 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "grok.h"
 
 #ifndef NOLOGGING
-inline void _grok_log(int level, int indent, const char *format, ...) {
-  va_list args;
-  FILE *out;
 
-  out = stderr;
+/* Asynchronous logging.
+ *
+ * Writing each log line to unbuffered stderr costs several write(2) calls
+ * (plus a getpid(2)) per event, which is ruinous inside pcre callouts. Once
+ * grok_logging_async_start() is called, _grok_log instead formats the event
+ * into a fixed-size slot of a per-thread ring buffer and returns. Each ring
+ * has exactly one writer (its thread) and one reader (the flush thread), so
+ * no locks are needed. The flush thread drains every ring into one buffered
+ * stream. If a ring is full, the event is dropped and counted rather than
+ * blocking the matcher.
+ *
+ * With nothing to write, the flush thread sleeps on a condition variable.
+ * It sets log_waiting first, and a writer only takes the lock to wake it
+ * if it sees that flag, so while the flusher is busy, logging stays
+ * lock-free. */
 
-  va_start(args, format);
-  char *prefix;
+#define LOG_RING_SLOTS 4096 /* must be a power of two */
+#define LOG_EVENT_SIZE 256
+
+struct log_event {
+  int level;
+  int indent;
+  int len;
+  char msg[LOG_EVENT_SIZE - 3 * sizeof(int)];
+};
+
+struct log_ring {
+  struct log_event events[LOG_RING_SLOTS];
+  volatile unsigned int head; /* next slot to write; only the owner moves it */
+  volatile unsigned int tail; /* next slot to read; only the flusher moves it */
+  volatile unsigned int dropped;
+  struct log_ring *next;
+};
 
+static struct log_ring *volatile log_rings = NULL;
+static __thread struct log_ring *log_ring = NULL;
+static volatile int log_async = 0;
+static volatile int log_waiting = 0; /* the flush thread is (about to be) asleep */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t log_thread;
+static pid_t log_pid;
+static FILE *log_out;
+
+static const char *_log_prefix(int level) {
   /* TODO(sissel): use gperf instead of this silly switch */
   switch (level) {
-    case LOG_CAPTURE: prefix = "[capture] "; break;
-    case LOG_COMPILE: prefix = "[compile] "; break;
-    case LOG_EXEC: prefix = "[exec] "; break;
-    case LOG_MATCH: prefix = "[match] "; break;
-    case LOG_PATTERNS: prefix = "[patterns] "; break;
-    case LOG_PREDICATE: prefix = "[predicate] "; break;
-    case LOG_PROGRAM: prefix = "[program] "; break;
-    case LOG_PROGRAMINPUT: prefix = "[programinput] "; break;
-    case LOG_REACTION: prefix = "[reaction] "; break;
-    case LOG_REGEXPAND: prefix = "[regexpand] "; break;
-    default: prefix = "[unknown] ";
-  }
-  fprintf(out, "[%d] %*s%s", getpid(), indent * 2, "", prefix);
-  vfprintf(out, format, args);
-  fprintf(out, "\n");
+    case LOG_CAPTURE: return "[capture] ";
+    case LOG_COMPILE: return "[compile] ";
+    case LOG_EXEC: return "[exec] ";
+    case LOG_MATCH: return "[match] ";
+    case LOG_PATTERNS: return "[patterns] ";
+    case LOG_PREDICATE: return "[predicate] ";
+    case LOG_PROGRAM: return "[program] ";
+    case LOG_PROGRAMINPUT: return "[programinput] ";
+    case LOG_REACTION: return "[reaction] ";
+    case LOG_REGEXPAND: return "[regexpand] ";
+    default: return "[unknown] ";
+  }
+}
+
+static struct log_ring *_log_ring_get(void) {
+  struct log_ring *ring;
+
+  if (log_ring != NULL)
+    return log_ring;
+
+  ring = calloc(1, sizeof(struct log_ring));
+  do {
+    ring->next = log_rings;
+  } while (!__sync_bool_compare_and_swap(&log_rings, ring->next, ring));
+  log_ring = ring;
+  return ring;
+}
+
+/* Drain one ring; returns the number of events written */
+static int _log_ring_flush(struct log_ring *ring) {
+  unsigned int head, dropped;
+  int count = 0;
+
+  head = ring->head;
+  __sync_synchronize(); /* read events only after seeing head */
+  while (ring->tail != head) {
+    struct log_event *ev = &ring->events[ring->tail & (LOG_RING_SLOTS - 1)];
+    fprintf(log_out, "[%d] %*s%s%.*s\n", log_pid, ev->indent * 2, "",
+            _log_prefix(ev->level), ev->len, ev->msg);
+    __sync_synchronize(); /* finish reading before releasing the slot */
+    ring->tail++;
+    count++;
+  }
+
+  dropped = ring->dropped;
+  if (dropped > 0) {
+    __sync_fetch_and_sub(&ring->dropped, dropped);
+    fprintf(log_out, "[%d] [logging] ring full, dropped %u events\n",
+            log_pid, dropped);
+  }
+  return count;
+}
+
+static int _log_flush_all(void) {
+  struct log_ring *ring;
+  int count = 0;
+
+  for (ring = log_rings; ring != NULL; ring = ring->next)
+    count += _log_ring_flush(ring);
+  if (count > 0)
+    fflush(log_out);
+  return count;
+}
+
+static int _log_pending(void) {
+  struct log_ring *ring;
+
+  for (ring = log_rings; ring != NULL; ring = ring->next) {
+    if (ring->head != ring->tail || ring->dropped > 0)
+      return 1;
+  }
+  return 0;
+}
+
+static void _log_wake(void) {
+  pthread_mutex_lock(&log_lock);
+  log_waiting = 0;
+  pthread_cond_signal(&log_cond);
+  pthread_mutex_unlock(&log_lock);
+}
+
+static void *_log_flush_thread(void *arg) {
+  while (log_async) {
+    if (_log_flush_all() > 0)
+      continue;
+
+    pthread_mutex_lock(&log_lock);
+    log_waiting = 1;
+    __sync_synchronize(); /* set log_waiting before looking at the rings */
+    while (log_waiting && log_async && !_log_pending())
+      pthread_cond_wait(&log_cond, &log_lock);
+    log_waiting = 0;
+    pthread_mutex_unlock(&log_lock);
+  }
+  return NULL;
+}
+
+/* A forked child has rings but no flush thread; log synchronously there */
+static void _log_atfork_child(void) {
+  log_async = 0;
+}
+
+void grok_logging_async_start(FILE *out) {
+  static int atfork_registered = 0;
+
+  if (log_async)
+    return;
+
+  log_out = out;
+  log_pid = getpid();
+  if (!atfork_registered) {
+    pthread_atfork(NULL, NULL, _log_atfork_child);
+    atexit(grok_logging_async_stop);
+    atfork_registered = 1;
+  }
+
+  log_async = 1;
+  if (pthread_create(&log_thread, NULL, _log_flush_thread, NULL) != 0) {
+    fprintf(stderr, "Unable to start logging thread; logging synchronously\n");
+    log_async = 0;
+  }
+}
+
+void grok_logging_async_stop(void) {
+  if (!log_async || getpid() != log_pid)
+    return;
+
+  log_async = 0;
+  _log_wake();
+  pthread_join(log_thread, NULL);
+  _log_flush_all();
+}
+
+void _grok_log(int level, int indent, const char *format, ...) {
+  va_list args;
+  struct log_ring *ring;
+  struct log_event *ev;
+  int len;
+
+  va_start(args, format);
+
+  if (!log_async) {
+    FILE *out = stderr;
+    fprintf(out, "[%d] %*s%s", getpid(), indent * 2, "", _log_prefix(level));
+    vfprintf(out, format, args);
+    fprintf(out, "\n");
+    va_end(args);
+    return;
+  }
+
+  ring = _log_ring_get();
+  if (ring->head - ring->tail == LOG_RING_SLOTS) {
+    __sync_fetch_and_add(&ring->dropped, 1);
+    va_end(args);
+    return;
+  }
+
+  ev = &ring->events[ring->head & (LOG_RING_SLOTS - 1)];
+  ev->level = level;
+  ev->indent = indent;
+  len = vsnprintf(ev->msg, sizeof(ev->msg), format, args);
+  /* Long messages are truncated to fit the slot */
+  if (len < 0 || len >= sizeof(ev->msg))
+    len = sizeof(ev->msg) - 1;
+  ev->len = len;
   va_end(args);
+
+  __sync_synchronize(); /* publish the event before moving head */
+  ring->head++;
+
+  __sync_synchronize(); /* move head before looking at log_waiting */
+  if (log_waiting)
+    _log_wake();
 }
 #endif
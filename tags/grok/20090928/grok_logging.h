@@ -1,6 +1,7 @@
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
 
+#include <stdio.h>
 #include "grok.h"
 
 #define LOG_PREDICATE (1 << 0)
@@ -19,10 +20,17 @@
 #ifdef NOLOGGING
 /* this 'args...' requires GNU C */
 #  define grok_log(obj, level, format, args...) { }
+#  define grok_logging_async_start(out) { }
+#  define grok_logging_async_stop() { }
 #else
 
 void _grok_log(int level, int indent, const char *format, ...);
 
+/* Hand log events to a background thread that writes them to 'out'.
+ * Until this is called, events are written to stderr synchronously. */
+void grok_logging_async_start(FILE *out);
+void grok_logging_async_stop(void);
+
 /* let us log anything that has both a 'logmask' and 'logdepth' member */
 #  define grok_log(obj, level, format, args...) \
   if ((obj)->logmask & level) \
@@ -1,6 +1,7 @@
 
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include "grok.h"
 #include "grok_matchconf.h"
 #include "grok_matchconf_macro.h"
@@ -17,6 +18,7 @@ static grok_t matchconfig_grok;
 
 void grok_matchconfig_init(grok_program_t *gprog, grok_matchconf_t *gmc) {
   grok_init(&gmc->grok);
+  gmc->pattern = NULL;
   gmc->shell = NULL;
   gmc->reaction = NULL;
   gmc->shellinput = NULL;
@@ -26,12 +28,49 @@ void grok_matchconfig_init(grok_program_t *gprog, grok_matchconf_t *gmc) {
     grok_patterns_import_from_string(&matchconfig_grok, 
                                      "PATTERN \\%\\{%{NAME}(?:%{FILTER})?}");
     grok_patterns_import_from_string(&matchconfig_grok, "NAME @?\\w+(?::\\w+)?(?:|\\w+)*");
-    grok_patterns_import_from_string(&matchconfig_grok, "FILTER (?:\\|\\w+)+");
+    /* filters may take an argument: %{FOO|lookup(table)} */
+    grok_patterns_import_from_string(&matchconfig_grok,
+                                     "FILTER (?:\\|\\w+(?:\\([^|)]*\\))?)+");
     grok_compile(&matchconfig_grok, "%{PATTERN}");
     mcgrok_init = 1;
   }
 }
 
+int grok_matchconfig_compile(grok_program_t *gprog, grok_matchconf_t *gmc) {
+  int ret;
+
+  /* no-match blocks have no pattern; already compiled blocks are kept */
+  if (gmc->pattern == NULL || gmc->grok.re != NULL) {
+    return GROK_OK;
+  }
+
+  ret = grok_compile(&gmc->grok, gmc->pattern);
+  if (ret != GROK_OK) {
+    grok_log(gprog, LOG_PROGRAM, "Failure compiling pattern '%s': %s",
+             gmc->pattern, gmc->grok.errstr);
+  }
+  return ret;
+}
+
+#define _STREQ(a, b) \
+  ((a) == (b) || ((a) != NULL && (b) != NULL && !strcmp((a), (b))))
+
+/* Two match blocks are equal if they would compile to the same thing and
+ * react the same way. Pattern libraries are shared per file set, so
+ * comparing the library pointer catches changed pattern files. */
+int grok_matchconfig_equal(const grok_matchconf_t *a,
+                           const grok_matchconf_t *b) {
+  return _STREQ(a->pattern, b->pattern)
+         && _STREQ(a->reaction, b->reaction)
+         && _STREQ(a->shell, b->shell)
+         && a->grok.patterns == b->grok.patterns
+         && a->grok.logmask == b->grok.logmask
+         && a->flush == b->flush
+         && a->is_nomatch == b->is_nomatch
+         && a->break_if_match == b->break_if_match
+         && a->low_priority == b->low_priority;
+}
+
 void grok_matchconfig_global_cleanup(void) {
   if (mcgrok_init) {
     grok_free(&matchconfig_grok);
@@ -53,6 +92,29 @@ void grok_matchconfig_close(grok_program_t *gprog, grok_matchconf_t  *gmc) {
 
 void grok_matchconfig_exec(grok_program_t *gprog, grok_input_t *ginput,
                            const char *text) {
+  struct timespec start;
+
+  if (gprog->budget.cpu_ms <= 0) {
+    grok_matchconfig_exec_blocks(gprog, ginput, text, 0);
+    return;
+  }
+
+  switch (grok_program_budget_admit(gprog, ginput, text)) {
+    case BUDGET_MATCH_ALL:
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      grok_matchconfig_exec_blocks(gprog, ginput, text, 0);
+      grok_program_budget_charge(gprog, &start);
+      break;
+    case BUDGET_MATCH_NORMAL:
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      grok_matchconfig_exec_blocks(gprog, ginput, text, 1);
+      grok_program_budget_charge(gprog, &start);
+      break;
+  }
+}
+
+void grok_matchconfig_exec_blocks(grok_program_t *gprog, grok_input_t *ginput,
+                                  const char *text, int skip_low_priority) {
   grok_t *grok;
   grok_match_t gm;
   grok_matchconf_t *gmc;
@@ -62,7 +124,7 @@ void grok_matchconfig_exec(grok_program_t *gprog, grok_input_t *ginput,
     int ret;
     gmc = &gprog->matchconfigs[i];
     grok = &gmc->grok;
-    if (gmc->is_nomatch) {
+    if (gmc->is_nomatch || (skip_low_priority && gmc->low_priority)) {
       continue;
     }
 
@@ -208,7 +270,7 @@ char *grok_matchconfig_filter_reaction(const char *str, grok_match_t *gm) {
             /* Push @FOO values first */
             substr_replace(&tmp, &tmp_len, &tmp_size, 0, 0,
                            gm->subject, strlen(gm->subject));
-            filter_jsonencode(gm, &tmp, &tmp_len, &tmp_size);
+            filter_jsonencode(gm, &tmp, &tmp_len, &tmp_size, NULL, 0);
 
             if (patmacro->code == VALUE_JSON_SIMPLE) {
               entry_len = asprintf(&entry, 
@@ -227,7 +289,7 @@ char *grok_matchconfig_filter_reaction(const char *str, grok_match_t *gm) {
 
             substr_replace(&tmp, &tmp_len, &tmp_size, 0, tmp_len,
                            gm->subject + gm->start, gm->end - gm->start);
-            filter_jsonencode(gm, &tmp, &tmp_len, &tmp_size);
+            filter_jsonencode(gm, &tmp, &tmp_len, &tmp_size, NULL, 0);
             if (patmacro->code == VALUE_JSON_SIMPLE) {
               entry_len = asprintf(&entry, "\"@MATCH\": \"%.*s\", ", tmp_len, tmp);
             } else { /* VALUE_JSON_COMPLEX */
@@ -256,7 +318,7 @@ char *grok_matchconfig_filter_reaction(const char *str, grok_match_t *gm) {
 
               substr_replace(&tmp, &tmp_len, &tmp_size, 0, tmp_len,
                              pdata, pdata_len);
-              filter_jsonencode(gm, &tmp, &tmp_len, &tmp_size);
+              filter_jsonencode(gm, &tmp, &tmp_len, &tmp_size, NULL, 0);
 
               if (patmacro->code == VALUE_JSON_SIMPLE) {
                 entry_len = asprintf(&entry, "\"%.*s\": \"%.*s\", ",
@@ -399,13 +461,44 @@ void grok_matchconfig_start_shell(grok_program_t *gprog,
   }
 }
 
+/* Apply one 'name' or 'name(args)' filter */
+static void _apply_one_filter(grok_match_t *gm, char **value, int *value_len,
+                              int *value_size, const char *filter, int len) {
+  struct filter *filterobj;
+  const char *args = NULL;
+  int name_len = len, args_len = 0;
+  int ret;
+
+  if (len > 0 && filter[len - 1] == ')') {
+    const char *paren = memchr(filter, '(', len);
+    if (paren != NULL) {
+      name_len = paren - filter;
+      args = paren + 1;
+      args_len = len - name_len - 2;
+    }
+  }
+
+  grok_log(gm->grok, LOG_REACTION, "ApplyFilter code: %.*s", len, filter);
+  filterobj = string_filter_lookup(filter, name_len);
+  if (filterobj == NULL) {
+    grok_log(gm->grok, LOG_REACTION,
+             "Can't apply filter '%.*s'; it's unknown.", name_len, filter);
+    return;
+  }
+
+  ret = filterobj->func(gm, value, value_len, value_size, args, args_len);
+  if (ret != 0) {
+    grok_log(gm->grok, LOG_REACTION,
+             "Applying filter '%.*s' returned error %d for string '%.*s'.",
+             len, filter, ret, *value_len, *value);
+  }
+}
+
 char *grok_match_reaction_apply_filter(grok_match_t *gm,
                                        char **value, int *value_len,
                                        const char *filter, int filter_len) {
   int offset = 0, len = 0;
   int value_size;
-  int ret;
-  struct filter *filterobj;
 
   if (filter_len == 0) {
     return *value;
@@ -420,22 +513,8 @@ char *grok_match_reaction_apply_filter(grok_match_t *gm,
 
   while (offset + len < filter_len) {
     if (filter[offset + len] == '|') {
-      /* Apply the filter */
-      grok_log(gm->grok, LOG_REACTION, "ApplyFilter code: %.*s",
-               len, filter + offset);
-      filterobj = string_filter_lookup(filter + offset, len);
-      if (filterobj == NULL) {
-        grok_log(gm->grok, LOG_REACTION, 
-                 "Can't apply filter '%.*s'; it's unknown.",
-                 len, filter + offset);
-      } else {
-        ret = filterobj->func(gm, value, value_len, &value_size);
-        if (ret != 0) {
-          grok_log(gm->grok, LOG_REACTION,
-                   "Applying filter '%.*s' returned error %d for string '%.*s'.",
-                   len, filter + offset, *value_len, *value);
-        }
-      }
+      _apply_one_filter(gm, value, value_len, &value_size,
+                        filter + offset, len);
       offset += len + 1;
       len = 0;
     }
@@ -444,21 +523,7 @@ char *grok_match_reaction_apply_filter(grok_match_t *gm,
   }
 
   /* We'll always have one filter left over */
-  grok_log(gm->grok, LOG_REACTION, "Filter code: %.*s", len, filter + offset);
-  filterobj = string_filter_lookup(filter + offset, len);
-  if (filterobj == NULL) {
-    grok_log(gm->grok, LOG_REACTION, 
-             "Can't apply filter '%.*s'; it's unknown.",
-             len, filter + offset);
-  } else {
-    ret = filterobj->func(gm, value, value_len, &value_size);
-    if (ret != 0) {
-      grok_log(gm->grok, LOG_REACTION,
-               "Applying filter '%.*s' returned error %d for string '%.*s'.",
-               len, filter + offset, *value_len, *value);
-    }
-  }
+  _apply_one_filter(gm, value, value_len, &value_size, filter + offset, len);
 
   return *value;
-
 }
@@ -15,6 +15,7 @@ struct grok_reaction {
 
 struct grok_matchconf {
   grok_t grok; /* The grok pattern to match */
+  char *pattern; /* compiled into 'grok' by grok_matchconfig_compile */
   char *reaction;
   char *shell;
   int flush; /* flush on every write to the shell? */
@@ -23,15 +24,20 @@ struct grok_matchconf {
   FILE *shellinput; /* fd to write reactions to */
   int pid; /* pid of shell */
   int break_if_match; /* break if we match */
+  int low_priority; /* skipped while the program is over its cpu budget */
 };
 
 void grok_matchconfig_init(grok_program_t *gprog, grok_matchconf_t  *gmc);
+int grok_matchconfig_compile(grok_program_t *gprog, grok_matchconf_t *gmc);
+int grok_matchconfig_equal(const grok_matchconf_t *a, const grok_matchconf_t *b);
 void grok_matchconfig_close(grok_program_t *gprog, grok_matchconf_t  *gmc);
 void grok_matchconfig_global_cleanup(void);
 
 
 void grok_matchconfig_exec(grok_program_t *gprog, grok_input_t *ginput,
                            const char *text);
+void grok_matchconfig_exec_blocks(grok_program_t *gprog, grok_input_t *ginput,
+                                  const char *text, int skip_low_priority);
 void grok_matchconfig_exec_nomatch(grok_program_t *gprog, grok_input_t *ginput);
 void grok_matchconfig_react(grok_program_t *gprog, grok_input_t *ginput,
                             grok_matchconf_t *gmc, grok_match_t *gm);
@@ -1,63 +1,271 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "grok.h"
 #include "grok_pattern.h"
+#include "stringhelper.h"
+
+struct grok_pattern_entry {
+  const char *name; /* interned */
+  size_t name_len;
+  const char *regexp; /* interned */
+  size_t regexp_len;
+  unsigned int hash;
+};
+
+struct grok_patternlib {
+  int refcount;
+  int sealed; /* nonzero if this library must not be modified */
+
+  /* open-addressed hash table, size is always a power of two */
+  struct grok_pattern_entry *table;
+  size_t size;
+  size_t count;
+};
+
+/* Interned strings. Pattern names and regexps are stored once per process
+ * no matter how many libraries reference them. They are never freed. */
+struct intern_entry {
+  char *str;
+  size_t len;
+  unsigned int hash;
+};
+
+static struct intern_entry *intern_table = NULL;
+static size_t intern_size = 0;
+static size_t intern_count = 0;
+
+/* Sealed libraries keyed by the ordered list of files they were loaded from */
+struct patternlib_cache {
+  char **filenames;
+  time_t *mtimes;
+  int nfiles;
+  grok_patternlib_t *lib;
+  struct patternlib_cache *next;
+};
+
+static struct patternlib_cache *patternlib_cache = NULL;
+
+#define PATTERNLIB_INITIAL_SIZE 64
+#define INTERN_INITIAL_SIZE 256
+
+static const char *_intern(const char *str, size_t len);
+static struct grok_pattern_entry *_patternlib_slot(grok_patternlib_t *lib,
+                                                   const char *name,
+                                                   size_t name_len,
+                                                   unsigned int hash);
+static void _patternlib_grow(grok_patternlib_t *lib);
+static void _patternlib_put(grok_patternlib_t *lib,
+                            const char *name, size_t name_len,
+                            const char *regexp, size_t regexp_len);
+static grok_patternlib_t *_patternlib_copy(const grok_patternlib_t *src);
+static grok_patternlib_t *_grok_patterns_writable(grok_t *grok);
+static int _patterns_read_file(grok_t *grok, const char *filename,
+                               char **buffer, size_t *len);
+static void _patternlib_import_buffer(grok_t *grok, grok_patternlib_t *lib,
+                                      const char *buffer, size_t len);
+static void _pattern_parse_stringn(const char *line, size_t line_len,
+                                   const char **name, size_t *name_len,
+                                   const char **regexp, size_t *regexp_len);
+
+static const char *_intern(const char *str, size_t len) {
+  unsigned int hash = string_hash(str, len);
+  size_t i;
+
+  if (intern_count * 2 >= intern_size) {
+    struct intern_entry *old = intern_table;
+    size_t old_size = intern_size;
+
+    intern_size = (old_size == 0) ? INTERN_INITIAL_SIZE : old_size * 2;
+    intern_table = calloc(intern_size, sizeof(struct intern_entry));
+    for (i = 0; i < old_size; i++) {
+      size_t j;
+      if (old[i].str == NULL)
+        continue;
+      j = old[i].hash & (intern_size - 1);
+      while (intern_table[j].str != NULL)
+        j = (j + 1) & (intern_size - 1);
+      intern_table[j] = old[i];
+    }
+    free(old);
+  }
+
+  i = hash & (intern_size - 1);
+  while (intern_table[i].str != NULL) {
+    if (intern_table[i].hash == hash && intern_table[i].len == len
+        && !memcmp(intern_table[i].str, str, len)) {
+      return intern_table[i].str;
+    }
+    i = (i + 1) & (intern_size - 1);
+  }
+
+  intern_table[i].str = malloc(len + 1);
+  memcpy(intern_table[i].str, str, len);
+  intern_table[i].str[len] = '\0';
+  intern_table[i].len = len;
+  intern_table[i].hash = hash;
+  intern_count++;
+  return intern_table[i].str;
+}
+
+grok_patternlib_t *grok_patternlib_new(void) {
+  grok_patternlib_t *lib;
+  lib = calloc(1, sizeof(grok_patternlib_t));
+  lib->refcount = 1;
+  lib->size = PATTERNLIB_INITIAL_SIZE;
+  lib->table = calloc(lib->size, sizeof(struct grok_pattern_entry));
+  return lib;
+}
+
+grok_patternlib_t *grok_patternlib_acquire(grok_patternlib_t *lib) {
+  if (lib != NULL)
+    lib->refcount++;
+  return lib;
+}
+
+void grok_patternlib_release(grok_patternlib_t *lib) {
+  if (lib == NULL)
+    return;
+
+  lib->refcount--;
+  if (lib->refcount > 0)
+    return;
+
+  free(lib->table);
+  free(lib);
+}
+
+/* Find the slot holding 'name', or the empty slot where it belongs */
+static struct grok_pattern_entry *_patternlib_slot(grok_patternlib_t *lib,
+                                                   const char *name,
+                                                   size_t name_len,
+                                                   unsigned int hash) {
+  size_t i = hash & (lib->size - 1);
+  while (lib->table[i].name != NULL) {
+    struct grok_pattern_entry *entry = &lib->table[i];
+    if (entry->hash == hash && entry->name_len == name_len
+        && !memcmp(entry->name, name, name_len)) {
+      break;
+    }
+    i = (i + 1) & (lib->size - 1);
+  }
+  return &lib->table[i];
+}
+
+static void _patternlib_grow(grok_patternlib_t *lib) {
+  struct grok_pattern_entry *old = lib->table;
+  size_t old_size = lib->size;
+  size_t i;
+
+  lib->size *= 2;
+  lib->table = calloc(lib->size, sizeof(struct grok_pattern_entry));
+  for (i = 0; i < old_size; i++) {
+    if (old[i].name == NULL)
+      continue;
+    *_patternlib_slot(lib, old[i].name, old[i].name_len, old[i].hash) = old[i];
+  }
+  free(old);
+}
+
+static void _patternlib_put(grok_patternlib_t *lib,
+                            const char *name, size_t name_len,
+                            const char *regexp, size_t regexp_len) {
+  struct grok_pattern_entry *entry;
+  unsigned int hash;
+
+  assert(!lib->sealed);
+
+  /* keep the load factor at or below 1/2 */
+  if ((lib->count + 1) * 2 > lib->size)
+    _patternlib_grow(lib);
+
+  hash = string_hash(name, name_len);
+  entry = _patternlib_slot(lib, name, name_len, hash);
+  if (entry->name == NULL) {
+    entry->name = _intern(name, name_len);
+    entry->name_len = name_len;
+    entry->hash = hash;
+    lib->count++;
+  }
+
+  /* Later definitions override earlier ones */
+  entry->regexp = _intern(regexp, regexp_len);
+  entry->regexp_len = regexp_len;
+}
+
+static grok_patternlib_t *_patternlib_copy(const grok_patternlib_t *src) {
+  grok_patternlib_t *lib;
+  lib = calloc(1, sizeof(grok_patternlib_t));
+  lib->refcount = 1;
+  lib->size = src->size;
+  lib->count = src->count;
+  lib->table = malloc(lib->size * sizeof(struct grok_pattern_entry));
+  memcpy(lib->table, src->table, lib->size * sizeof(struct grok_pattern_entry));
+  return lib;
+}
+
+/* Make sure grok has a library it may modify, copying a shared one */
+static grok_patternlib_t *_grok_patterns_writable(grok_t *grok) {
+  grok_patternlib_t *lib = grok->patterns;
+
+  if (lib == NULL) {
+    grok->patterns = grok_patternlib_new();
+  } else if (lib->sealed || lib->refcount > 1) {
+    grok_log(grok, LOG_PATTERNS,
+             "Pattern library is shared (refcount %d), copying before write",
+             lib->refcount);
+    grok->patterns = _patternlib_copy(lib);
+    grok_patternlib_release(lib);
+  }
+
+  return grok->patterns;
+}
 
 int grok_pattern_add(grok_t *grok, const char *name, size_t name_len,
                       const char *regexp, size_t regexp_len) {
-  DB *patterns = grok->patterns;
-  DBT key, value;
-  memset(&key, 0, sizeof(DBT));
-  memset(&value, 0, sizeof(DBT));
-
   grok_log(grok, LOG_PATTERNS, "Adding new pattern '%.*s' => '%.*s'",
            name_len, name, regexp_len, regexp);
 
-  key.data = (void *)name;
-  key.size = name_len;
-  value.data = (void *)regexp;
-  value.size = regexp_len;
-
-  patterns->put(patterns, NULL, &key, &value, 0);
-
+  _patternlib_put(_grok_patterns_writable(grok), name, name_len,
+                  regexp, regexp_len);
   return GROK_OK;
 }
 
-int grok_pattern_find(grok_t *grok, const char *name, size_t name_len,
-                      char **regexp, size_t *regexp_len) {
-  DB *patterns = grok->patterns;
-  DBT key, value;
-  int ret;
-  memset(&key, 0, sizeof(DBT));
-  memset(&value, 0, sizeof(DBT));
-
-  key.data = (void *)name;
-  key.size = name_len;
-  ret = patterns->get(patterns, NULL, &key, &value, 0);
-  if (ret != 0) {
-    grok_log(grok, LOG_PATTERNS, "Searching for pattern '%s': not found", name);
+int grok_pattern_find(const grok_t *grok, const char *name, size_t name_len,
+                      const char **regexp, size_t *regexp_len) {
+  struct grok_pattern_entry *entry = NULL;
+
+  if (grok->patterns != NULL) {
+    entry = _patternlib_slot(grok->patterns, name, name_len,
+                             string_hash(name, name_len));
+  }
+
+  if (entry == NULL || entry->name == NULL) {
+    grok_log(grok, LOG_PATTERNS, "Searching for pattern '%.*s': not found",
+             name_len, name);
     *regexp = NULL;
     *regexp_len = 0;
     return GROK_ERROR_PATTERN_NOT_FOUND;
   }
 
-  grok_log(grok, LOG_PATTERNS, "Searching for pattern '%s': %.*s",
-           name, value.size, value.data);
-  *regexp = malloc(value.size);
-  memcpy(*regexp, value.data, value.size);
-  *regexp_len = value.size;
+  grok_log(grok, LOG_PATTERNS, "Searching for pattern '%.*s': %.*s",
+           name_len, name, entry->regexp_len, entry->regexp);
+  *regexp = entry->regexp;
+  *regexp_len = entry->regexp_len;
   return GROK_OK;
 }
 
-int grok_patterns_import_from_file(grok_t *grok, const char *filename) {
+static int _patterns_read_file(grok_t *grok, const char *filename,
+                               char **buffer, size_t *len) {
   FILE *patfile = NULL;
   size_t filesize = 0;
   size_t bytes = 0;
-  char *buffer = NULL;
 
-  grok_log(grok, LOG_PATTERNS, "Importing pattern file: '%s'", filename);
+  *buffer = NULL;
+  *len = 0;
 
   patfile = fopen(filename, "r");
   if (patfile == NULL) {
@@ -65,76 +273,186 @@ int grok_patterns_import_from_file(grok_t *grok, const char *filename) {
              filename, strerror(errno));
     return GROK_ERROR_FILE_NOT_ACCESSIBLE;
   }
-  
+
   fseek(patfile, 0, SEEK_END);
   filesize = ftell(patfile);
   fseek(patfile, 0, SEEK_SET);
-  buffer = calloc(1, filesize + 1);
-  if (buffer == NULL) {
+  *buffer = calloc(1, filesize + 1);
+  if (*buffer == NULL) {
     fprintf(stderr, "Fatal: calloc(1, %zd) failed while trying to read '%s'",
             filesize, filename);
     abort();
   }
-  memset(buffer, 0, filesize);
-  bytes = fread(buffer, 1, filesize, patfile);
+  bytes = fread(*buffer, 1, filesize, patfile);
+  fclose(patfile);
   if (bytes != filesize) {
     grok_log(grok, LOG_PATTERNS, "Unable to open '%s' for reading: %s",
              filename, strerror(errno));
     fprintf(stderr, "Expected %zd bytes, but read %zd.", filesize, bytes);
+    free(*buffer);
+    *buffer = NULL;
     return GROK_ERROR_UNEXPECTED_READ_SIZE;
   }
 
-  grok_patterns_import_from_string(grok, buffer);
+  *len = filesize;
+  return GROK_OK;
+}
+
+int grok_patterns_import_from_file(grok_t *grok, const char *filename) {
+  char *buffer = NULL;
+  size_t len = 0;
+  int ret;
+
+  grok_log(grok, LOG_PATTERNS, "Importing pattern file: '%s'", filename);
+
+  ret = _patterns_read_file(grok, filename, &buffer, &len);
+  if (ret != GROK_OK)
+    return ret;
+
+  _patternlib_import_buffer(grok, _grok_patterns_writable(grok), buffer, len);
 
   free(buffer);
-  fclose(patfile);
   return GROK_OK;
 }
 
 int grok_patterns_import_from_string(grok_t *grok, const char *buffer) {
-  char *tokctx = NULL;
-  char *tok = NULL;
-  char *strptr = NULL;
-  char *dupbuf = NULL;
-
   grok_log(grok, LOG_PATTERNS, "Importing patterns from string");
 
-  dupbuf = strdup(buffer);
-  strptr = dupbuf;
+  _patternlib_import_buffer(grok, _grok_patterns_writable(grok),
+                            buffer, strlen(buffer));
+  return GROK_OK;
+}
 
-  while ((tok = strtok_r(strptr, "\n", &tokctx)) != NULL) {
-    const char *name, *regexp;
-    size_t name_len, regexp_len;
-    strptr = NULL;
+/* Use the shared, sealed library for this set of files. Any patterns
+ * previously added to this grok_t are dropped. */
+int grok_patterns_use_files(grok_t *grok, char **filenames, int nfiles) {
+  grok_patternlib_t *lib;
+
+  lib = grok_patternlib_load_files(grok, filenames, nfiles);
+  grok_patternlib_release(grok->patterns);
+  grok->patterns = lib;
+  return GROK_OK;
+}
 
-    /* skip leading whitespace */
-    tok += strspn(tok, " \t");
+/* Return a sealed library for the ordered list of pattern files, loading
+ * it only if no library for the same files (with the same mtimes) has been
+ * loaded yet. The caller owns one reference to the returned library. */
+grok_patternlib_t *grok_patternlib_load_files(grok_t *grok, char **filenames,
+                                              int nfiles) {
+  struct patternlib_cache *cache;
+  time_t *mtimes;
+  int i;
 
-    /* If first non-whitespace is a '#', then this is a comment. */
-    if (*tok == '#') continue;
+  mtimes = calloc(nfiles, sizeof(time_t));
+  for (i = 0; i < nfiles; i++) {
+    struct stat st;
+    if (stat(filenames[i], &st) == 0)
+      mtimes[i] = st.st_mtime;
+  }
 
-    _pattern_parse_string(tok, &name, &name_len, &regexp, &regexp_len);
-    (void) grok_pattern_add(grok, name, name_len, regexp, regexp_len);
+  for (cache = patternlib_cache; cache != NULL; cache = cache->next) {
+    if (cache->nfiles != nfiles)
+      continue;
+    for (i = 0; i < nfiles; i++) {
+      if (strcmp(cache->filenames[i], filenames[i]))
+        break;
+    }
+    if (i == nfiles)
+      break;
   }
 
-  free(dupbuf);
-  return GROK_OK;
+  if (cache != NULL) {
+    if (!memcmp(cache->mtimes, mtimes, nfiles * sizeof(time_t))) {
+      grok_log(grok, LOG_PATTERNS, "Reusing shared pattern library (%d files)",
+               nfiles);
+      free(mtimes);
+      return grok_patternlib_acquire(cache->lib);
+    }
+
+    /* Files changed on disk. Existing users keep their old library. */
+    grok_log(grok, LOG_PATTERNS, "Pattern files changed, reloading library");
+    grok_patternlib_release(cache->lib);
+    free(cache->mtimes);
+  } else {
+    cache = calloc(1, sizeof(struct patternlib_cache));
+    cache->nfiles = nfiles;
+    cache->filenames = calloc(nfiles, sizeof(char *));
+    for (i = 0; i < nfiles; i++)
+      cache->filenames[i] = strdup(filenames[i]);
+    cache->next = patternlib_cache;
+    patternlib_cache = cache;
+  }
+
+  cache->mtimes = mtimes;
+  cache->lib = grok_patternlib_new();
+  for (i = 0; i < nfiles; i++) {
+    char *buffer = NULL;
+    size_t len = 0;
+
+    grok_log(grok, LOG_PATTERNS, "Importing pattern file: '%s'", filenames[i]);
+    if (_patterns_read_file(grok, filenames[i], &buffer, &len) != GROK_OK)
+      continue;
+    _patternlib_import_buffer(grok, cache->lib, buffer, len);
+    free(buffer);
+  }
+  cache->lib->sealed = 1;
+
+  return grok_patternlib_acquire(cache->lib);
+}
+
+static void _patternlib_import_buffer(grok_t *grok, grok_patternlib_t *lib,
+                                      const char *buffer, size_t len) {
+  const char *line = buffer;
+  const char *end = buffer + len;
+
+  while (line < end) {
+    const char *name, *regexp;
+    size_t name_len, regexp_len, line_len;
+    const char *eol;
+
+    eol = memchr(line, '\n', end - line);
+    if (eol == NULL)
+      eol = end;
+    line_len = eol - line;
+
+    _pattern_parse_stringn(line, line_len, &name, &name_len,
+                           &regexp, &regexp_len);
+
+    /* Skip blank lines, and comments (first non-whitespace is a '#') */
+    if (name_len > 0 && *name != '#') {
+      grok_log(grok, LOG_PATTERNS, "Adding new pattern '%.*s' => '%.*s'",
+               name_len, name, regexp_len, regexp);
+      _patternlib_put(lib, name, name_len, regexp, regexp_len);
+    }
+
+    line = eol + 1;
+  }
 }
 
 void _pattern_parse_string(const char *line,
                            const char **name, size_t *name_len,
                            const char **regexp, size_t *regexp_len) {
-  size_t offset;
+  _pattern_parse_stringn(line, strlen(line), name, name_len,
+                         regexp, regexp_len);
+}
+
+static void _pattern_parse_stringn(const char *line, size_t line_len,
+                                   const char **name, size_t *name_len,
+                                   const char **regexp, size_t *regexp_len) {
+  size_t offset = 0;
 
   /* Skip leading whitespace */
-  offset = strspn(line, " \t");
+  while (offset < line_len && (line[offset] == ' ' || line[offset] == '\t'))
+    offset++;
   *name = line + offset;
 
   /* Find the first whitespace */
-  offset += strcspn(line + offset, " \t");
+  while (offset < line_len && line[offset] != ' ' && line[offset] != '\t')
+    offset++;
   *name_len = offset - (*name - line);
 
-  offset += strspn(line + offset, " \t");
+  while (offset < line_len && (line[offset] == ' ' || line[offset] == '\t'))
+    offset++;
   *regexp = line + offset;
-  *regexp_len = strlen(line) - (*regexp - line);
+  *regexp_len = line_len - offset;
 }
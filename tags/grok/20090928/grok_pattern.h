@@ -1,12 +1,28 @@
 #ifndef _GROK_PATTERN_H_
 #define _GROK_PATTERN_H_
 
+/* A pattern library is a refcounted, hashed table of name => regexp.
+ * Names and regexps are interned process-wide, so identical pattern files
+ * loaded into several libraries share storage.
+ *
+ * Libraries loaded through grok_patterns_use_files() are sealed (immutable)
+ * and shared by every grok_t using the same set of pattern files. Adding a
+ * pattern to a grok_t whose library is shared makes a private copy first. */
+typedef struct grok_patternlib grok_patternlib_t;
+
+grok_patternlib_t *grok_patternlib_new(void);
+grok_patternlib_t *grok_patternlib_acquire(grok_patternlib_t *lib);
+void grok_patternlib_release(grok_patternlib_t *lib);
+grok_patternlib_t *grok_patternlib_load_files(grok_t *grok, char **filenames,
+                                              int nfiles);
+
 int grok_pattern_add(grok_t *grok, const char *name, size_t name_len,
                       const char *regexp, size_t regexp_len);
-int grok_pattern_find(grok_t *grok, const char *name, size_t name_len,
-                      char **regexp, size_t *regexp_len);
+int grok_pattern_find(const grok_t *grok, const char *name, size_t name_len,
+                      const char **regexp, size_t *regexp_len);
 int grok_patterns_import_from_file(grok_t *grok, const char *filename);
 int grok_patterns_import_from_string(grok_t *grok, const char *buffer);
+int grok_patterns_use_files(grok_t *grok, char **filenames, int nfiles);
 
 /* Exposed only for testing */
 void _pattern_parse_string(const char *line,
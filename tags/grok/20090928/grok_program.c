@@ -12,9 +12,21 @@
 #include <event.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <string.h>
 
 static void *_event_init = NULL;
 void _collection_sigchld(int sig, short what, void *data);
+static void _collection_append(grok_collection_t *gcol, grok_program_t *gprog);
+static int _program_inputs_equal(const grok_program_t *a,
+                                 const grok_program_t *b);
+static void _program_reload_matchconfs(grok_program_t *gprog,
+                                       grok_program_t *newprog);
+static void _program_resume_inputs(grok_program_t *gprog,
+                                   grok_program_t **old, int nold, int *kept);
+static void _program_resume_shared(grok_input_t *ginput,
+                                   grok_program_t **old, int nold, int *kept);
+static void _program_stop(grok_program_t *gprog);
+static void _program_free_inputs(grok_program_t *gprog);
 
 grok_collection_t *grok_collection_init() {
   grok_collection_t *gcol;
@@ -59,6 +71,11 @@ void grok_collection_check_end_state(grok_collection_t *gcol) {
 
 void grok_collection_add(grok_collection_t *gcol, grok_program_t *gprog) {
   int i = 0;
+
+  for (i = 0; i < gprog->nmatchconfigs; i++) {
+    grok_matchconfig_compile(gprog, &gprog->matchconfigs[i]);
+  }
+
   grok_log(gcol, LOG_PROGRAM, "Adding %d inputs", gprog->ninputs);
 
   for (i = 0; i < gprog->ninputs; i++) {
@@ -67,6 +84,11 @@ void grok_collection_add(grok_collection_t *gcol, grok_program_t *gprog) {
     grok_program_add_input(gprog, gprog->inputs + i);
   }
 
+  _collection_append(gcol, gprog);
+}
+
+static void _collection_append(grok_collection_t *gcol,
+                               grok_program_t *gprog) {
   gcol->nprograms++;
   if (gcol->nprograms == gcol->program_size) {
     gcol->program_size *= 2;
@@ -78,9 +100,256 @@ void grok_collection_add(grok_collection_t *gcol, grok_program_t *gprog) {
   gprog->gcol = gcol;
 }
 
+/* Replace the running programs with a newly parsed set.
+ *
+ * A running program whose inputs are identical to a new program's keeps its
+ * inputs (open files, offsets, bufferevents, child processes) and only
+ * recompiles the match blocks that changed. Other new programs are started
+ * fresh; file inputs among them resume at the offset the old program had
+ * reached. Running programs with no counterpart are stopped.
+ *
+ * The 'programs' array is consumed: new programs are copied out of it
+ * before they start, and it is freed along with whatever parsed state the
+ * running programs did not take over.
+ *
+ * This runs from a libevent callback, so no line is being matched while
+ * programs are swapped. */
+void grok_collection_reload(grok_collection_t *gcol,
+                            grok_program_t *programs, int nprograms) {
+  grok_program_t **old = gcol->programs;
+  int nold = gcol->nprograms;
+  int *kept;
+  int i, j;
+
+  grok_log(gcol, LOG_PROGRAM, "Reloading: %d running programs, %d new",
+           nold, nprograms);
+
+  kept = calloc(nold, sizeof(int));
+  gcol->nprograms = 0;
+  gcol->programs = calloc(gcol->program_size, sizeof(grok_program_t *));
+
+  for (i = 0; i < nprograms; i++) {
+    grok_program_t *gprog = &programs[i];
+    for (j = 0; j < nold; j++) {
+      if (!kept[j] && _program_inputs_equal(old[j], gprog)) {
+        break;
+      }
+    }
+
+    if (j < nold) {
+      kept[j] = 1;
+      _program_reload_matchconfs(old[j], gprog);
+      _program_free_inputs(gprog);
+      _collection_append(gcol, old[j]);
+    } else {
+      /* Inputs and events point back at the program, so it needs a home
+       * that outlives 'programs' */
+      grok_program_t *copy = malloc(sizeof(grok_program_t));
+      memcpy(copy, gprog, sizeof(grok_program_t));
+      _program_resume_inputs(copy, old, nold, kept);
+      grok_collection_add(gcol, copy);
+    }
+  }
+
+  for (j = 0; j < nold; j++) {
+    if (!kept[j]) {
+      _program_stop(old[j]);
+    }
+  }
+
+  free(kept);
+  free(old);
+  free(programs);
+  grok_collection_check_end_state(gcol);
+}
+
+static int _program_inputs_equal(const grok_program_t *a,
+                                 const grok_program_t *b) {
+  int i;
+  if (a->ninputs != b->ninputs) {
+    return 0;
+  }
+  for (i = 0; i < a->ninputs; i++) {
+    if (!grok_input_equal(&a->inputs[i], &b->inputs[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Give gprog the match blocks of newprog, reusing the already compiled
+ * (and already running shell of) any unchanged block. */
+static void _program_reload_matchconfs(grok_program_t *gprog,
+                                       grok_program_t *newprog) {
+  grok_matchconf_t *matchconfigs;
+  int *reused;
+  int recompiled = 0;
+  int i, j;
+
+  matchconfigs = calloc(newprog->matchconfig_size, sizeof(grok_matchconf_t));
+  reused = calloc(gprog->nmatchconfigs, sizeof(int));
+
+  for (i = 0; i < newprog->nmatchconfigs; i++) {
+    grok_matchconf_t *gmc = &newprog->matchconfigs[i];
+    for (j = 0; j < gprog->nmatchconfigs; j++) {
+      if (!reused[j] && grok_matchconfig_equal(&gprog->matchconfigs[j], gmc)) {
+        break;
+      }
+    }
+
+    if (j < gprog->nmatchconfigs) {
+      reused[j] = 1;
+      memcpy(&matchconfigs[i], &gprog->matchconfigs[j], sizeof(grok_matchconf_t));
+      grok_free(&gmc->grok);
+      free(gmc->pattern);
+      free(gmc->reaction);
+      free(gmc->shell);
+    } else {
+      memcpy(&matchconfigs[i], gmc, sizeof(grok_matchconf_t));
+      grok_matchconfig_compile(gprog, &matchconfigs[i]);
+      recompiled++;
+    }
+  }
+
+  for (j = 0; j < gprog->nmatchconfigs; j++) {
+    if (!reused[j]) {
+      grok_matchconfig_close(gprog, &gprog->matchconfigs[j]);
+      free(gprog->matchconfigs[j].pattern);
+      free(gprog->matchconfigs[j].reaction);
+      free(gprog->matchconfigs[j].shell);
+    }
+  }
+
+  grok_log(gprog, LOG_PROGRAM, "Reloaded program: %d match blocks, %d recompiled",
+           newprog->nmatchconfigs, recompiled);
+
+  free(reused);
+  free(gprog->matchconfigs);
+  free(newprog->matchconfigs);
+  gprog->matchconfigs = matchconfigs;
+  gprog->nmatchconfigs = newprog->nmatchconfigs;
+  gprog->matchconfig_size = newprog->matchconfig_size;
+
+  for (i = 0; i < gprog->npatternfiles; i++) {
+    free(gprog->patternfiles[i]);
+  }
+  free(gprog->patternfiles);
+  gprog->patternfiles = newprog->patternfiles;
+  gprog->npatternfiles = newprog->npatternfiles;
+  gprog->patternfile_size = newprog->patternfile_size;
+  gprog->logmask = newprog->logmask;
+  grok_program_budget_options(gprog, newprog);
+}
+
+/* For each file input in gprog, pick up the offset of a running input on
+ * the same file in a program that is about to be stopped. Syslog inputs
+ * take over the socket of such an input instead, since the old socket
+ * still holds the address, and glob inputs take over its whole set of
+ * files and offsets. */
+static void _program_resume_inputs(grok_program_t *gprog,
+                                   grok_program_t **old, int nold, int *kept) {
+  int i, j, k;
+  for (i = 0; i < gprog->ninputs; i++) {
+    grok_input_file_t *gift = &(gprog->inputs[i].source.file);
+    if (gprog->inputs[i].type == I_SYSLOG
+        || gprog->inputs[i].type == I_GLOB) {
+      _program_resume_shared(&gprog->inputs[i], old, nold, kept);
+      continue;
+    }
+    if (gprog->inputs[i].type != I_FILE) {
+      continue;
+    }
+
+    for (j = 0; j < nold; j++) {
+      if (kept[j]) {
+        continue;
+      }
+      for (k = 0; k < old[j]->ninputs; k++) {
+        grok_input_t *oldinput = &old[j]->inputs[k];
+        if (oldinput->type != I_FILE || oldinput->done
+            || strcmp(oldinput->source.file.filename, gift->filename)) {
+          continue;
+        }
+        gift->offset = grok_input_file_consumed_offset(oldinput);
+        gift->st.st_ino = oldinput->source.file.st.st_ino;
+      }
+    }
+  }
+}
+
+static void _program_resume_shared(grok_input_t *ginput,
+                                   grok_program_t **old, int nold, int *kept) {
+  int j, k;
+  for (j = 0; j < nold; j++) {
+    if (kept[j]) {
+      continue;
+    }
+    for (k = 0; k < old[j]->ninputs; k++) {
+      grok_input_t *oldinput = &old[j]->inputs[k];
+      if (oldinput->done || !grok_input_equal(oldinput, ginput)) {
+        continue;
+      }
+
+      if (ginput->type == I_GLOB) {
+        if (oldinput->source.glob.state == NULL) {
+          continue;
+        }
+        grok_input_glob_takeover(ginput, oldinput);
+      } else {
+        grok_input_syslog_t *oldsl = &(oldinput->source.syslog);
+        if (oldsl->fd < 0) {
+          continue;
+        }
+        event_del(&oldsl->ev);
+        ginput->source.syslog.fd = oldsl->fd;
+        oldsl->fd = -1;
+      }
+      return;
+    }
+  }
+}
+
+/* Free the parsed inputs of a new program whose identical inputs are
+ * already running in the program it was matched with. */
+static void _program_free_inputs(grok_program_t *gprog) {
+  int i;
+  for (i = 0; i < gprog->ninputs; i++) {
+    grok_input_t *ginput = &gprog->inputs[i];
+    switch (ginput->type) {
+      case I_FILE:
+        free(ginput->source.file.filename);
+        break;
+      case I_GLOB:
+        free(ginput->source.glob.file.filename);
+        break;
+      case I_PROCESS:
+        free(ginput->source.process.cmd);
+        grok_process_argv_free(ginput->source.process.argv);
+        break;
+      case I_SYSLOG:
+        free(ginput->source.syslog.address);
+        break;
+    }
+  }
+  free(gprog->inputs);
+}
+
+static void _program_stop(grok_program_t *gprog) {
+  int i;
+  grok_log(gprog, LOG_PROGRAM, "Stopping program with %d inputs",
+           gprog->ninputs);
+
+  for (i = 0; i < gprog->ninputs; i++) {
+    grok_input_stop(&gprog->inputs[i]);
+  }
+  grok_program_budget_stop(gprog);
+  for (i = 0; i < gprog->nmatchconfigs; i++) {
+    grok_matchconfig_close(gprog, &gprog->matchconfigs[i]);
+  }
+}
+
 void _collection_sigchld(int sig, short what, void *data) {
   grok_collection_t *gcol = (grok_collection_t*)data;
-  struct timeval nodelay = { 0, 0 };
 
   int i = 0;
   int prognum;
@@ -119,38 +388,7 @@ void _collection_sigchld(int sig, short what, void *data) {
         grok_log(ginput, LOG_PROGRAM, "Reaped child pid %d. Was process '%s'",
                  pid, gipt->cmd);
 
-        if (PROCESS_SHOULD_RESTART(gipt)) {
-          /* Calculate the restart delay */
-          /* XXX: This code should go in the eof handler */
-          struct timeval restart_delay = { 0, 0 };
-          if (gipt->run_interval > 0) {
-            struct timeval interval = { gipt->run_interval, 0 };
-            struct timeval duration;
-            struct timeval now;
-            gettimeofday(&now, NULL);
-            timersub(&now, &(gipt->start_time), &duration);
-            timersub(&interval, &duration, &restart_delay);
-          }
-
-          if (gipt->min_restart_delay > 0) {
-            struct timeval fixed_delay = { gipt->min_restart_delay, 0 };
-
-            if (timercmp(&restart_delay, &fixed_delay, <)) {
-              restart_delay.tv_sec = fixed_delay.tv_sec;
-              restart_delay.tv_usec = fixed_delay.tv_usec;
-            }
-          }
-
-          grok_log(ginput, LOG_PROGRAM, 
-                   "Scheduling process restart in %d.%d seconds: %s",
-                   restart_delay.tv_sec, restart_delay.tv_usec, gipt->cmd);
-          ginput->restart_delay.tv_sec = restart_delay.tv_sec;
-          ginput->restart_delay.tv_usec = restart_delay.tv_usec;
-        } else {
-          grok_log(gprog, LOG_PROGRAM, "Not restarting process '%s'", gipt->cmd);
-        }
-
-        event_once(-1, EV_TIMEOUT, grok_input_eof_handler, ginput, &nodelay);
+        grok_input_process_exited(ginput);
       } /* end for looping over gprog's inputs */
     } /* end for looping over gcol's programs */
   } /* while waitpid */
@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <event.h>
 
 //include "grok_input.h"
@@ -10,8 +11,49 @@
 
 typedef struct grok_program grok_program_t;
 typedef struct grok_collection grok_collection_t;
+typedef struct grok_program_budget grok_program_budget_t;
 struct grok_input;
 struct grok_matchconfig;
+struct grok_budget_line;
+
+/* What a program does with lines once it used up its cpu-budget for the
+ * current second. See grok_budget.c */
+#define BUDGET_SAMPLE 0 /* match only 1 in 'sample-rate' lines */
+#define BUDGET_SKIP_LOW_PRIORITY 1 /* skip 'low-priority' match blocks */
+#define BUDGET_DEFER 2 /* queue lines and match them in later seconds */
+
+/* grok_program_budget_admit results */
+#define BUDGET_MATCH_ALL 0
+#define BUDGET_MATCH_NORMAL 1 /* skip low-priority match blocks */
+#define BUDGET_MATCH_NONE 2 /* sampled out, queued or dropped */
+
+#define BUDGET_DEFAULT_SAMPLE_RATE 10
+#define BUDGET_DEFAULT_CATCHUP_MAX 100000
+
+struct grok_program_budget {
+  /* Options */
+  int cpu_ms; /* matching time allowed per second; 0 means no limit */
+  int over_budget; /* BUDGET_SAMPLE, BUDGET_SKIP_LOW_PRIORITY, BUDGET_DEFER */
+  int sample_rate;
+  int catchup_max; /* most lines to queue; more are dropped */
+
+  /* State information */
+  struct timespec window; /* start of the current second */
+  long used_usec; /* time spent matching in this second */
+  unsigned int sample_count;
+  struct grok_budget_line *queue_head;
+  struct grok_budget_line *queue_tail;
+  int queued;
+  struct event drain_ev;
+  int drain_pending;
+
+  /* Counters */
+  unsigned long over_seconds;
+  unsigned long sampled_out; /* lines not matched at all */
+  unsigned long low_skipped; /* lines only matched by normal blocks */
+  unsigned long deferred; /* lines matched late */
+  unsigned long dropped; /* lines lost because the queue was full */
+};
 
 struct grok_program {
   char *name; /* optional program name */
@@ -31,6 +73,8 @@ struct grok_program {
   int logmask;
   int logdepth;
 
+  grok_program_budget_t budget;
+
   grok_collection_t *gcol; /* if we are using this program in a collection */
 };
 
@@ -49,9 +93,20 @@ struct grok_collection {
 
 grok_collection_t *grok_collection_init();
 void grok_collection_add(grok_collection_t *gcol, grok_program_t *gprog);
+void grok_collection_reload(grok_collection_t *gcol,
+                            grok_program_t *programs, int nprograms);
 void grok_collection_loop(grok_collection_t *gcol);
 void grok_collection_check_end_state(grok_collection_t *gcol);
 
+int grok_program_budget_admit(grok_program_t *gprog, struct grok_input *ginput,
+                              const char *text);
+void grok_program_budget_charge(grok_program_t *gprog,
+                                const struct timespec *start);
+void grok_program_budget_options(grok_program_t *gprog,
+                                 const grok_program_t *newprog);
+void grok_program_budget_flush(grok_program_t *gprog);
+void grok_program_budget_stop(grok_program_t *gprog);
+
 
 
 #endif /* _GROK_PROGRAM_H_ */
@@ -0,0 +1,949 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "grok_regexopt.h"
+
+/* The regex is parsed into a tree of alternations (groups of branches) and
+ * sequences (branches of nodes), optimized in place, then printed again.
+ * Anything we don't fully understand is kept as an opaque node and printed
+ * exactly as it was written. */
+
+#define RN_CHAR 1   /* one literal byte */
+#define RN_SET 2    /* any other one-byte atom: . \d [a-z] */
+#define RN_ATOM 3   /* consumes input in ways we don't model: \1 (?R) \X */
+#define RN_ASSERT 4 /* zero-width or opaque: ^ $ \b (?=...) (?C1) (?#...) */
+#define RN_GROUP 5  /* ( ) (?: ) (?> ) (?<name> ) */
+
+#define RG_CAPTURE 1
+#define RG_PLAIN 2
+#define RG_ATOMIC 3
+
+#define QMAX_INFINITE -1
+
+typedef struct rnode rnode_t;
+typedef struct rseq rseq_t;
+
+struct rseq {
+  rnode_t *nodes;
+  int nnodes;
+  int size;
+};
+
+struct rnode {
+  int type;
+  const char *text; /* the atom as written; for groups, the opening '(?:' */
+  int len;
+  unsigned char set[32]; /* RN_CHAR, RN_SET: the bytes this can match */
+
+  int gtype;
+  rseq_t *branches;
+  int nbranches;
+
+  const char *quant; /* the quantifier as written, without any added '+' */
+  int quant_len;
+  int qmin;
+  int qmax;
+  int qgreedy; /* neither lazy nor already possessive */
+  int possessive; /* we made it possessive */
+};
+
+struct ropt {
+  const char *p;
+  const char *end;
+  grok_regexopt_stats_t stats;
+};
+
+struct rbuf {
+  char *data;
+  int len;
+  int size;
+};
+
+static int _parse_alternation(struct ropt *o, rnode_t *group, int nested);
+static void _opt_group(struct ropt *o, rnode_t *group);
+
+/* Byte sets */
+
+static void _set_add(unsigned char *set, int c) {
+  set[(c & 0xff) >> 3] |= 1 << (c & 7);
+}
+
+static void _set_range(unsigned char *set, int from, int to) {
+  int c;
+  for (c = from; c <= to; c++) {
+    _set_add(set, c);
+  }
+}
+
+static void _set_fill(unsigned char *set) {
+  memset(set, 0xff, 32);
+}
+
+static void _set_invert(unsigned char *set) {
+  int i;
+  for (i = 0; i < 32; i++) {
+    set[i] = ~set[i];
+  }
+}
+
+static int _set_disjoint(const unsigned char *a, const unsigned char *b) {
+  int i;
+  for (i = 0; i < 32; i++) {
+    if (a[i] & b[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* \d \w \s and their negations. These are supersets of what pcre's default
+ * tables match (\s and \S both include \v), which is the safe direction
+ * for proving two sets disjoint. Returns 0 if 'c' is not a class escape. */
+static int _set_class_escape(unsigned char *set, int c) {
+  unsigned char tmp[32];
+
+  memset(tmp, 0, sizeof(tmp));
+  switch (tolower(c)) {
+    case 'd':
+      _set_range(tmp, '0', '9');
+      break;
+    case 'w':
+      _set_range(tmp, '0', '9');
+      _set_range(tmp, 'A', 'Z');
+      _set_range(tmp, 'a', 'z');
+      _set_add(tmp, '_');
+      break;
+    case 's':
+      _set_range(tmp, '\t', '\r');
+      _set_add(tmp, ' ');
+      break;
+    default:
+      return 0;
+  }
+
+  if (isupper(c)) {
+    _set_invert(tmp);
+    if (c == 'S') {
+      _set_add(tmp, '\v');
+    }
+  }
+
+  for (c = 0; c < 32; c++) {
+    set[c] |= tmp[c];
+  }
+  return 1;
+}
+
+/* Single-character escapes: \t \n \xhh ... Returns the byte, or -1 */
+static int _char_escape(const char **pp, const char *end) {
+  const char *p = *pp;
+  int c = -1;
+
+  switch (*p) {
+    case 't': c = '\t'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 'f': c = '\f'; break;
+    case 'e': c = 0x1b; break;
+    case 'a': c = 0x07; break;
+    case 'x':
+      if (p + 1 < end && isxdigit(p[1])) {
+        int n = 0;
+        c = 0;
+        while (n < 2 && p + 1 < end && isxdigit(p[1])) {
+          p++;
+          c = c * 16 + (isdigit(*p) ? *p - '0' : tolower(*p) - 'a' + 10);
+          n++;
+        }
+      }
+      break;
+    default:
+      if (!isalnum(*p)) {
+        c = (unsigned char)*p;
+      }
+  }
+
+  if (c >= 0) {
+    *pp = p + 1;
+  }
+  return c;
+}
+
+/* Parsing */
+
+static rseq_t *_alternation_add_branch(rnode_t *group) {
+  rseq_t *seq;
+
+  group->branches = realloc(group->branches,
+                            (group->nbranches + 1) * sizeof(rseq_t));
+  seq = &group->branches[group->nbranches++];
+  memset(seq, 0, sizeof(rseq_t));
+  return seq;
+}
+
+static rnode_t *_seq_add(rseq_t *seq) {
+  rnode_t *node;
+
+  if (seq->nnodes == seq->size) {
+    seq->size = seq->size ? seq->size * 2 : 8;
+    seq->nodes = realloc(seq->nodes, seq->size * sizeof(rnode_t));
+  }
+  node = &seq->nodes[seq->nnodes++];
+  memset(node, 0, sizeof(rnode_t));
+  node->qmin = node->qmax = 1;
+  return node;
+}
+
+static void _node_free(rnode_t *node);
+
+static void _seq_free(rseq_t *seq) {
+  int i;
+  for (i = 0; i < seq->nnodes; i++) {
+    _node_free(&seq->nodes[i]);
+  }
+  free(seq->nodes);
+}
+
+static void _node_free(rnode_t *node) {
+  int i;
+  if (node->type != RN_GROUP) {
+    return;
+  }
+  for (i = 0; i < node->nbranches; i++) {
+    _seq_free(&node->branches[i]);
+  }
+  free(node->branches);
+}
+
+/* Skip over a parenthesized expression we won't look into. 'p' points at
+ * its '('. Returns 0 on success, -1 if the parens don't balance. */
+static int _skip_group(struct ropt *o) {
+  int depth = 0;
+  int comment = (o->end - o->p > 2 && o->p[1] == '?' && o->p[2] == '#');
+
+  for (; o->p < o->end; o->p++) {
+    if (comment) {
+      if (*o->p == ')') {
+        o->p++;
+        return 0;
+      }
+      continue;
+    }
+
+    switch (*o->p) {
+      case '\\':
+        o->p++;
+        break;
+      case '[':
+        o->p++;
+        if (o->p < o->end && *o->p == '^') o->p++;
+        if (o->p < o->end && *o->p == ']') o->p++;
+        while (o->p < o->end && *o->p != ']') {
+          if (*o->p == '\\') o->p++;
+          o->p++;
+        }
+        break;
+      case '(':
+        depth++;
+        break;
+      case ')':
+        if (--depth == 0) {
+          o->p++;
+          return 0;
+        }
+        break;
+    }
+  }
+  return -1;
+}
+
+/* Read one member of a character class. Returns its byte, -1 for \d and
+ * friends (added to 'set' directly), or -2 for things we don't model. */
+static int _class_member(struct ropt *o, unsigned char *set) {
+  int c;
+
+  if (*o->p != '\\') {
+    return (unsigned char)*o->p++;
+  }
+
+  o->p++;
+  if (o->p >= o->end) {
+    return -2;
+  }
+  if (*o->p == 'b') {
+    o->p++;
+    return '\b';
+  }
+  if (_set_class_escape(set, *o->p)) {
+    o->p++;
+    return -1;
+  }
+  c = _char_escape(&o->p, o->end);
+  if (c >= 0) {
+    return c;
+  }
+
+  /* \p{..}, \x{...}, octal, ... */
+  o->p++;
+  if (o->p < o->end && *o->p == '{') {
+    while (o->p < o->end && *o->p != '}') o->p++;
+    o->p++;
+  }
+  return -2;
+}
+
+static int _parse_class(struct ropt *o, rnode_t *node) {
+  int negate = 0, unknown = 0;
+  int prev = -1; /* last single byte seen, for ranges */
+  int c;
+
+  o->p++; /* '[' */
+  if (o->p < o->end && *o->p == '^') {
+    negate = 1;
+    o->p++;
+  }
+
+  if (o->p < o->end && *o->p == ']') {
+    _set_add(node->set, ']');
+    prev = ']';
+    o->p++;
+  }
+
+  while (o->p < o->end && *o->p != ']') {
+    int range = 0;
+
+    if (*o->p == '[' && o->p + 1 < o->end && strchr(":.=", o->p[1])) {
+      /* POSIX [:alpha:] and friends */
+      const char *close = o->p + 2;
+      while (close + 1 < o->end && !(close[0] == o->p[1] && close[1] == ']')) {
+        close++;
+      }
+      if (close + 1 >= o->end) {
+        return -1;
+      }
+      unknown = 1;
+      prev = -1;
+      o->p = close + 2;
+      continue;
+    }
+
+    if (*o->p == '-' && prev >= 0 && o->p + 1 < o->end && o->p[1] != ']') {
+      range = 1;
+      o->p++;
+    }
+
+    c = _class_member(o, node->set);
+    if (c == -2) {
+      unknown = 1;
+    } else if (c == -1) {
+      if (range) {
+        _set_add(node->set, '-'); /* [a-\d] is 'a', '-' or a digit */
+      }
+    } else if (range) {
+      if (c < prev) {
+        return -1;
+      }
+      _set_range(node->set, prev, c);
+    } else {
+      _set_add(node->set, c);
+      prev = c;
+      continue;
+    }
+    prev = -1;
+    if (o->p > o->end) {
+      return -1;
+    }
+  }
+
+  if (o->p >= o->end) {
+    return -1;
+  }
+  o->p++; /* ']' */
+
+  if (unknown) {
+    _set_fill(node->set);
+  } else if (negate) {
+    _set_invert(node->set);
+  }
+  return 0;
+}
+
+/* Parse an escape outside a character class; 'p' points after the '\' */
+static int _parse_escape(struct ropt *o, rnode_t *node) {
+  int c = (unsigned char)*o->p;
+
+  if (strchr("bBAzZGK", c)) {
+    node->type = RN_ASSERT;
+    o->p++;
+    return 0;
+  }
+
+  if (c == 'Q' || c == 'E') {
+    return -1;
+  }
+
+  if (_set_class_escape(node->set, c)) {
+    node->type = RN_SET;
+    o->p++;
+    return 0;
+  }
+
+  c = _char_escape(&o->p, o->end);
+  if (c >= 0) {
+    node->type = RN_CHAR;
+    _set_add(node->set, c);
+    return 0;
+  }
+
+  /* Backreferences, octal, \p{..}, \x{..}, \g{..}, \k<..>, \cX, \X, \R,
+   * and so on. They consume input but we don't model how. */
+  node->type = RN_ATOM;
+  c = *o->p++;
+  if (isdigit(c)) {
+    while (o->p < o->end && isdigit(*o->p)) o->p++;
+  } else if (c == 'c') {
+    o->p++;
+  } else if (o->p < o->end && strchr("{<'", *o->p)) {
+    char close = (*o->p == '{') ? '}' : (*o->p == '<') ? '>' : '\'';
+    while (o->p < o->end && *o->p != close) o->p++;
+    o->p++;
+  } else if (c == 'g' || ((c == 'p' || c == 'P') && o->p < o->end)) {
+    if (c == 'g' && o->p < o->end && *o->p == '-') o->p++;
+    if (c == 'g') {
+      while (o->p < o->end && isdigit(*o->p)) o->p++;
+    } else {
+      o->p++; /* \pL */
+    }
+  }
+  return (o->p <= o->end) ? 0 : -1;
+}
+
+static int _parse_group(struct ropt *o, rnode_t *node) {
+  const char *p = o->p;
+  int n = o->end - p;
+
+  node->type = RN_GROUP;
+  if (n > 1 && p[1] == '*') {
+    return -1; /* (*UTF8), (*PRUNE) and friends */
+  }
+
+  if (n < 2 || p[1] != '?') {
+    node->gtype = RG_CAPTURE;
+    node->len = 1;
+  } else if (n > 2 && p[2] == ':') {
+    node->gtype = RG_PLAIN;
+    node->len = 3;
+  } else if (n > 2 && p[2] == '>') {
+    node->gtype = RG_ATOMIC;
+    node->len = 3;
+  } else if (n > 3 && ((p[2] == '<' && p[3] != '=' && p[3] != '!')
+                       || (p[2] == 'P' && p[3] == '<') || p[2] == '\'')) {
+    const char *close = p + 3;
+    char closech = (p[2] == '\'') ? '\'' : '>';
+    while (close < o->end && *close != closech) close++;
+    if (close >= o->end) {
+      return -1;
+    }
+    node->gtype = RG_CAPTURE;
+    node->len = close - p + 1;
+  } else {
+    /* Inline options change how everything after them is read */
+    const char *q = p + 2;
+    while (q < o->end && strchr("imsxXUJ-", *q) && *q != '\0') q++;
+    if (q > p + 2 && q < o->end && (*q == ')' || *q == ':')) {
+      return -1;
+    }
+
+    /* Lookarounds, callouts and comments match nothing; recursion,
+     * conditionals and the rest do, in ways we don't model */
+    if (n > 2 && (strchr("=!#C", p[2])
+                  || (p[2] == '<' && n > 3 && strchr("=!", p[3])))) {
+      node->type = RN_ASSERT;
+    } else {
+      node->type = RN_ATOM;
+    }
+    if (_skip_group(o) != 0) {
+      return -1;
+    }
+    node->len = o->p - node->text;
+    return 0;
+  }
+
+  o->p += node->len;
+  return _parse_alternation(o, node, 1);
+}
+
+static void _parse_quantifier(struct ropt *o, rnode_t *node) {
+  const char *start = o->p;
+
+  if (o->p >= o->end) {
+    return;
+  }
+
+  switch (*o->p) {
+    case '*': node->qmin = 0; node->qmax = QMAX_INFINITE; o->p++; break;
+    case '+': node->qmin = 1; node->qmax = QMAX_INFINITE; o->p++; break;
+    case '?': node->qmin = 0; node->qmax = 1; o->p++; break;
+    case '{': {
+      /* Only {n}, {n,} and {n,m} are quantifiers; anything else is literal */
+      const char *q = o->p + 1;
+      int min = 0, max;
+      if (q >= o->end || !isdigit(*q)) return;
+      while (q < o->end && isdigit(*q)) min = min * 10 + (*q++ - '0');
+      max = min;
+      if (q < o->end && *q == ',') {
+        q++;
+        if (q < o->end && isdigit(*q)) {
+          max = 0;
+          while (q < o->end && isdigit(*q)) max = max * 10 + (*q++ - '0');
+        } else {
+          max = QMAX_INFINITE;
+        }
+      }
+      if (q >= o->end || *q != '}') return;
+      node->qmin = min;
+      node->qmax = max;
+      o->p = q + 1;
+      break;
+    }
+    default:
+      return;
+  }
+
+  node->qgreedy = 1;
+  if (o->p < o->end && (*o->p == '?' || *o->p == '+')) {
+    node->qgreedy = 0;
+    o->p++;
+  }
+  node->quant = start;
+  node->quant_len = o->p - start;
+}
+
+/* Parse branches up to the closing ')' (if nested) or the end of input */
+static int _parse_alternation(struct ropt *o, rnode_t *group, int nested) {
+  rseq_t *seq = _alternation_add_branch(group);
+
+  while (o->p < o->end) {
+    rnode_t *node;
+    int c = (unsigned char)*o->p;
+
+    if (c == '|') {
+      seq = _alternation_add_branch(group);
+      o->p++;
+      continue;
+    }
+
+    if (c == ')') {
+      if (!nested) {
+        return -1;
+      }
+      o->p++;
+      return 0;
+    }
+
+    node = _seq_add(seq);
+    node->text = o->p;
+
+    switch (c) {
+      case '(':
+        if (_parse_group(o, node) != 0) {
+          return -1;
+        }
+        /* _parse_alternation may have moved seq->nodes */
+        node = &seq->nodes[seq->nnodes - 1];
+        break;
+      case '[':
+        node->type = RN_SET;
+        if (_parse_class(o, node) != 0) {
+          return -1;
+        }
+        node->len = o->p - node->text;
+        break;
+      case '\\':
+        o->p++;
+        if (o->p >= o->end || _parse_escape(o, node) != 0) {
+          return -1;
+        }
+        node->len = o->p - node->text;
+        break;
+      case '.':
+        node->type = RN_SET;
+        _set_fill(node->set);
+        node->set['\n' >> 3] &= ~(1 << ('\n' & 7));
+        node->len = 1;
+        o->p++;
+        break;
+      case '^':
+      case '$':
+        node->type = RN_ASSERT;
+        node->len = 1;
+        o->p++;
+        break;
+      case '*':
+      case '+':
+      case '?':
+        return -1; /* nothing to repeat */
+      case '{': {
+        /* A quantifier with nothing to repeat, eg; a{2}{3}; bail rather
+         * than guess */
+        rnode_t tmp;
+        _parse_quantifier(o, &tmp);
+        if (o->p != node->text) {
+          return -1;
+        }
+      }
+      /* fall through: it's a literal '{' */
+      default:
+        node->type = RN_CHAR;
+        _set_add(node->set, c);
+        node->len = 1;
+        o->p++;
+    }
+
+    _parse_quantifier(o, node);
+  }
+
+  return nested ? -1 : 0;
+}
+
+/* Optimization */
+
+/* Would printing 'a' right before 'b' change how either is read? eg; a
+ * backreference '\1' followed by a literal '0' */
+static int _adjacent_unsafe(const rnode_t *a, const rnode_t *b) {
+  if (a == NULL || b == NULL || a->quant_len > 0) {
+    return 0;
+  }
+  return (a->text[0] == '\\' && isalnum(a->text[a->len - 1])
+          && isalnum(b->text[0]));
+}
+
+/* Replace nodes[i] with the nodes of 'branch' */
+static void _seq_splice(rseq_t *seq, int i, rseq_t *branch) {
+  int newcount = seq->nnodes - 1 + branch->nnodes;
+
+  if (newcount > seq->size) {
+    seq->size = newcount;
+    seq->nodes = realloc(seq->nodes, seq->size * sizeof(rnode_t));
+  }
+  memmove(&seq->nodes[i + branch->nnodes], &seq->nodes[i + 1],
+          (seq->nnodes - i - 1) * sizeof(rnode_t));
+  if (branch->nnodes > 0) {
+    memcpy(&seq->nodes[i], branch->nodes, branch->nnodes * sizeof(rnode_t));
+  }
+  seq->nnodes = newcount;
+}
+
+static int _is_plain_group(const rnode_t *node) {
+  return node->type == RN_GROUP && node->gtype == RG_PLAIN;
+}
+
+static void _opt_seq(struct ropt *o, rseq_t *seq) {
+  int i = 0;
+
+  while (i < seq->nnodes) {
+    rnode_t *node = &seq->nodes[i];
+    rseq_t *branches, *branch;
+
+    if (node->type != RN_GROUP) {
+      i++;
+      continue;
+    }
+
+    _opt_group(o, node);
+    if (!_is_plain_group(node) || node->nbranches != 1) {
+      i++;
+      continue;
+    }
+
+    branches = node->branches;
+    branch = &branches[0];
+    if (node->quant_len == 0) {
+      /* (?:abc) -> abc */
+      const rnode_t *prev = (i > 0) ? &seq->nodes[i - 1] : NULL;
+      const rnode_t *next = (i + 1 < seq->nnodes) ? &seq->nodes[i + 1] : NULL;
+      const rnode_t *first = branch->nnodes ? &branch->nodes[0] : next;
+      const rnode_t *last = branch->nnodes
+                            ? &branch->nodes[branch->nnodes - 1] : prev;
+      if (_adjacent_unsafe(prev, first) || _adjacent_unsafe(last, next)) {
+        i++;
+        continue;
+      }
+      _seq_splice(seq, i, branch);
+      i += branch->nnodes;
+      free(branch->nodes);
+      free(branches);
+      o->stats.groups_collapsed++;
+    } else if (branch->nnodes == 1 && branch->nodes[0].quant_len == 0
+               && branch->nodes[0].type != RN_ASSERT) {
+      /* (?:a)+ -> a+ */
+      rnode_t inner = branch->nodes[0];
+      inner.quant = node->quant;
+      inner.quant_len = node->quant_len;
+      inner.qmin = node->qmin;
+      inner.qmax = node->qmax;
+      inner.qgreedy = node->qgreedy;
+      free(branch->nodes);
+      free(node->branches);
+      *node = inner;
+      o->stats.groups_collapsed++;
+      /* look at the inner node again; it may be a group itself */
+    } else {
+      i++;
+    }
+  }
+}
+
+static int _is_literal(const rseq_t *seq, int i) {
+  return i < seq->nnodes && seq->nodes[i].type == RN_CHAR
+         && seq->nodes[i].quant_len == 0;
+}
+
+static int _same_literal(const rseq_t *a, const rseq_t *b, int i) {
+  return _is_literal(a, i) && _is_literal(b, i)
+         && !memcmp(a->nodes[i].set, b->nodes[i].set, 32);
+}
+
+/* ab|ac|d -> a(?:b|c)|d, for adjacent branches only; reordering
+ * alternatives would change which one matches first */
+static void _factor_prefixes(struct ropt *o, rnode_t *group) {
+  int i = 0;
+
+  while (i < group->nbranches) {
+    rseq_t *first = &group->branches[i];
+    rseq_t factored;
+    rnode_t *rest;
+    int run = 1, prefix, j;
+
+    while (i + run < group->nbranches
+           && _same_literal(first, &group->branches[i + run], 0)) {
+      run++;
+    }
+    if (run < 2) {
+      i++;
+      continue;
+    }
+
+    prefix = 1;
+    for (;;) {
+      for (j = 1; j < run; j++) {
+        if (!_same_literal(first, &group->branches[i + j], prefix)) break;
+      }
+      if (j < run) break;
+      prefix++;
+    }
+
+    /* The new branch is the shared prefix plus a group of what's left */
+    memset(&factored, 0, sizeof(factored));
+    for (j = 0; j < prefix; j++) {
+      *_seq_add(&factored) = first->nodes[j];
+    }
+    rest = _seq_add(&factored);
+    rest->type = RN_GROUP;
+    rest->gtype = RG_PLAIN;
+    rest->text = "(?:";
+    rest->len = 3;
+    rest->nbranches = run;
+    rest->branches = calloc(run, sizeof(rseq_t));
+    for (j = 0; j < run; j++) {
+      rseq_t *src = &group->branches[i + j];
+      rseq_t *dst = &rest->branches[j];
+      int k;
+      for (k = prefix; k < src->nnodes; k++) {
+        *_seq_add(dst) = src->nodes[k];
+      }
+      free(src->nodes);
+    }
+
+    group->branches[i] = factored;
+    memmove(&group->branches[i + 1], &group->branches[i + run],
+            (group->nbranches - i - run) * sizeof(rseq_t));
+    group->nbranches -= run - 1;
+    o->stats.prefixes_factored++;
+
+    /* The remainders may share prefixes too, and may simplify */
+    _opt_seq(o, &group->branches[i]);
+    i++;
+  }
+}
+
+static void _opt_group(struct ropt *o, rnode_t *group) {
+  int i;
+
+  for (i = 0; i < group->nbranches; i++) {
+    _opt_seq(o, &group->branches[i]);
+  }
+
+  _factor_prefixes(o, group);
+
+  /* (?<name>(?:a|b)) -> (?<name>a|b) */
+  if (group->nbranches == 1 && group->branches[0].nnodes == 1
+      && _is_plain_group(&group->branches[0].nodes[0])
+      && group->branches[0].nodes[0].quant_len == 0) {
+    rseq_t *outer = group->branches;
+    rnode_t *inner = &outer->nodes[0];
+    group->branches = inner->branches;
+    group->nbranches = inner->nbranches;
+    free(outer->nodes);
+    free(outer);
+    o->stats.groups_collapsed++;
+  }
+}
+
+/* The set of bytes 'node' must start by consuming. Returns 0 if it might
+ * not consume anything or we can't tell. */
+static int _first_set(const rnode_t *node, unsigned char *set) {
+  int i;
+
+  if (node->qmin == 0) {
+    return 0;
+  }
+
+  switch (node->type) {
+    case RN_CHAR:
+    case RN_SET:
+      memcpy(set, node->set, 32);
+      return 1;
+    case RN_GROUP:
+      memset(set, 0, 32);
+      for (i = 0; i < node->nbranches; i++) {
+        unsigned char branchset[32];
+        int j;
+        if (node->branches[i].nnodes == 0
+            || !_first_set(&node->branches[i].nodes[0], branchset)) {
+          return 0;
+        }
+        for (j = 0; j < 32; j++) {
+          set[j] |= branchset[j];
+        }
+      }
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* 'follow' is the set of bytes whatever comes after 'seq' must start
+ * with, or NULL if unknown. */
+static void _possessify_seq(struct ropt *o, rseq_t *seq,
+                            const unsigned char *follow) {
+  int i, j;
+
+  for (i = 0; i < seq->nnodes; i++) {
+    rnode_t *node = &seq->nodes[i];
+    unsigned char nextset[32];
+    const unsigned char *next = follow;
+
+    if (i + 1 < seq->nnodes) {
+      next = _first_set(&seq->nodes[i + 1], nextset) ? nextset : NULL;
+    }
+
+    if (node->type == RN_GROUP) {
+      /* Only plain, unrepeated groups are transparent; after a repeated
+       * group we might go around again instead */
+      const unsigned char *inner = NULL;
+      if (node->quant_len == 0 && node->gtype != RG_ATOMIC) {
+        inner = next;
+      }
+      for (j = 0; j < node->nbranches; j++) {
+        _possessify_seq(o, &node->branches[j], inner);
+      }
+      continue;
+    }
+
+    if ((node->type == RN_CHAR || node->type == RN_SET)
+        && node->quant_len > 0 && node->qgreedy && node->qmin != node->qmax
+        && next != NULL && _set_disjoint(node->set, next)) {
+      node->possessive = 1;
+      o->stats.quantifiers_possessive++;
+    }
+  }
+}
+
+/* Printing */
+
+static void _buf_append(struct rbuf *buf, const char *str, int len) {
+  if (buf->len + len + 1 > buf->size) {
+    buf->size = (buf->len + len + 1) * 2;
+    buf->data = realloc(buf->data, buf->size);
+  }
+  if (len > 0) {
+    memcpy(buf->data + buf->len, str, len);
+  }
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+}
+
+static void _print_alternation(struct rbuf *buf, const rnode_t *group);
+
+static void _print_node(struct rbuf *buf, const rnode_t *node) {
+  if (node->type == RN_GROUP) {
+    _buf_append(buf, node->text, node->len);
+    _print_alternation(buf, node);
+    _buf_append(buf, ")", 1);
+  } else if (node->type == RN_CHAR && node->len == 1 && node->text[0] == '{') {
+    /* A bare '{' is literal only when it doesn't look like a quantifier,
+     * which might change once things move around it */
+    _buf_append(buf, "\\{", 2);
+  } else {
+    _buf_append(buf, node->text, node->len);
+  }
+
+  _buf_append(buf, node->quant, node->quant_len);
+  if (node->possessive) {
+    _buf_append(buf, "+", 1);
+  }
+}
+
+static void _print_alternation(struct rbuf *buf, const rnode_t *group) {
+  int i, j;
+
+  for (i = 0; i < group->nbranches; i++) {
+    if (i > 0) {
+      _buf_append(buf, "|", 1);
+    }
+    for (j = 0; j < group->branches[i].nnodes; j++) {
+      _print_node(buf, &group->branches[i].nodes[j]);
+    }
+  }
+}
+
+char *grok_regex_optimize(const char *regex, int len,
+                          grok_regexopt_stats_t *stats) {
+  struct ropt o;
+  struct rbuf buf;
+  rnode_t top;
+  int i;
+
+  memset(&o, 0, sizeof(o));
+  memset(&top, 0, sizeof(top));
+  o.p = regex;
+  o.end = regex + len;
+  top.type = RN_GROUP;
+  top.gtype = RG_PLAIN;
+
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(grok_regexopt_stats_t));
+  }
+
+  if (_parse_alternation(&o, &top, 0) != 0) {
+    _node_free(&top);
+    return NULL;
+  }
+
+  _opt_group(&o, &top);
+  for (i = 0; i < top.nbranches; i++) {
+    _possessify_seq(&o, &top.branches[i], NULL);
+  }
+
+  memset(&buf, 0, sizeof(buf));
+  _buf_append(&buf, "", 0);
+  _print_alternation(&buf, &top);
+  _node_free(&top);
+
+  if (stats != NULL) {
+    *stats = o.stats;
+  }
+  return buf.data;
+}
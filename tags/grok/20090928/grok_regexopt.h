@@ -0,0 +1,34 @@
+#ifndef _GROK_REGEXOPT_H_
+#define _GROK_REGEXOPT_H_
+
+/* Optimizer for expanded grok patterns.
+ *
+ * grok_pattern_expand pastes grok-patterns entries together verbatim, which
+ * leaves lots of nested groups and alternations that pcre has to walk on
+ * every exec. grok_regex_optimize rewrites the expanded regex, keeping its
+ * meaning and the order of its capture groups, by:
+ *
+ *  - collapsing redundant groups: '(?:[0-9]+)' -> '[0-9]+',
+ *    '(?:a)?' -> 'a?', '(?:(?:a|b))' -> '(?:a|b)'
+ *  - factoring literal prefixes out of adjacent alternatives:
+ *    'Jan|Jun|Jul' -> 'J(?:an|u(?:n|l))'
+ *  - making quantifiers possessive when what follows can never match a
+ *    character the quantified atom matched: '[0-9]+\.' -> '[0-9]++\.'
+ *
+ * Callouts (predicates) and assertions are never optimized across, since
+ * predicates rely on backtracking. Patterns using inline options, \Q..\E
+ * or (*VERB)s are not optimized at all.
+ *
+ * Returns a malloc'd string, or NULL if the regex could not be optimized;
+ * in that case, use the regex as-is. 'stats' may be NULL. */
+
+typedef struct grok_regexopt_stats {
+  int groups_collapsed;
+  int prefixes_factored;
+  int quantifiers_possessive;
+} grok_regexopt_stats_t;
+
+char *grok_regex_optimize(const char *regex, int len,
+                          grok_regexopt_stats_t *stats);
+
+#endif /* _GROK_REGEXOPT_H_ */
@@ -0,0 +1,574 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "grok_table.h"
+#include "stringhelper.h"
+
+struct grok_table_entry {
+  const char *key; /* points into the table's copy of the file */
+  const char *value;
+  int key_len;
+  int value_len;
+  unsigned int hash;
+};
+
+struct grok_table {
+  char *filename;
+  int type;
+
+  char *data; /* file contents, read once per (re)load */
+  size_t data_len;
+  time_t mtime;
+  ino_t inode;
+  time_t checked; /* last time grok_table_refresh looked at the file */
+  char *errstr; /* why the file couldn't be loaded, or NULL if it was */
+
+  /* open-addressed hash table, size is always a power of two */
+  struct grok_table_entry *entries;
+  size_t size;
+  size_t count;
+
+  struct grok_table *next; /* cache list */
+};
+
+struct cidr_node {
+  unsigned int child[2]; /* index into nodes, 0 means none */
+  int terminal; /* a network ends here; everything below it matches */
+};
+
+struct grok_cidrtable {
+  char *filename;
+  time_t mtime;
+  ino_t inode;
+  off_t file_size;
+  time_t checked; /* last time grok_cidrtable_refresh looked at the file */
+
+  struct cidr_node *nodes;
+  size_t nnodes;
+  size_t size;
+  size_t count;
+
+  struct grok_cidrtable *next; /* cache list */
+};
+
+/* Node 0 is unused so that a 0 child means 'no child' */
+#define CIDR_ROOT_V4 1
+#define CIDR_ROOT_V6 2
+
+struct grok_table_name {
+  char *name;
+  char *filename;
+  struct grok_table_name *next;
+};
+
+static grok_table_t *table_cache = NULL;
+static grok_cidrtable_t *cidrtable_cache = NULL;
+static struct grok_table_name *table_names = NULL;
+static char table_error[1024] = "";
+
+static int _table_read_file(const char *filename, char **data, size_t *len,
+                            struct stat *st);
+static void _table_build(grok_table_t *table);
+static const char *_table_next_line(const char *p, const char *end,
+                                    const char **line, int *line_len);
+static struct grok_table_entry *_table_slot(const grok_table_t *table,
+                                            const char *key, int key_len,
+                                            unsigned int hash);
+static unsigned int _cidr_node_new(grok_cidrtable_t *table);
+static int _cidr_parse(const char *str, int len, unsigned char *addr,
+                       int *family, int *prefixlen);
+static void _cidr_insert(grok_cidrtable_t *table, int family,
+                         const unsigned char *addr, int prefixlen);
+static void _cidr_build(grok_cidrtable_t *table, const char *data,
+                        size_t data_len);
+
+/* Read all of 'filename' into a malloc'd buffer. Entries point into our
+ * own copy, so a file rewritten in place (rather than renamed over) can't
+ * change them under us; we just see the new contents on the next refresh. */
+static int _table_read_file(const char *filename, char **data, size_t *len,
+                            struct stat *st) {
+  ssize_t bytes;
+  int fd;
+
+  *data = NULL;
+  *len = 0;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    snprintf(table_error, sizeof(table_error),
+             "Unable to open '%s' for reading: %s", filename, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(fd, st) != 0) {
+    snprintf(table_error, sizeof(table_error), "Unable to stat '%s': %s",
+             filename, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  /* If the file is being rewritten, we get however much is there now */
+  *data = malloc(st->st_size + 1);
+  while (*len < (size_t)st->st_size) {
+    bytes = read(fd, *data + *len, st->st_size - *len);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes < 0) {
+      snprintf(table_error, sizeof(table_error), "Unable to read '%s': %s",
+               filename, strerror(errno));
+      free(*data);
+      *data = NULL;
+      *len = 0;
+      close(fd);
+      return -1;
+    }
+    if (bytes == 0)
+      break;
+    *len += bytes;
+  }
+
+  close(fd);
+  return 0;
+}
+
+/* Find the next non-blank, non-comment line at or after p. Leading and
+ * trailing whitespace is trimmed. Returns where to continue, or NULL when
+ * there are no more lines. */
+static const char *_table_next_line(const char *p, const char *end,
+                                    const char **line, int *line_len) {
+  while (p < end) {
+    const char *eol = memchr(p, '\n', end - p);
+    const char *next;
+    if (eol == NULL)
+      eol = end;
+    next = eol + 1;
+
+    while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+    while (eol > p && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r'))
+      eol--;
+
+    if (p < eol && *p != '#') {
+      *line = p;
+      *line_len = eol - p;
+      return next;
+    }
+    p = next;
+  }
+  return NULL;
+}
+
+/* Files that couldn't be loaded are cached too, and retried by
+ * grok_table_refresh at most once a second; until then we return NULL
+ * without touching the filesystem. */
+grok_table_t *grok_table_load(const char *filename, int type) {
+  grok_table_t *table;
+  struct stat st;
+
+  for (table = table_cache; table != NULL; table = table->next) {
+    if (table->type == type && !strcmp(table->filename, filename)) {
+      if (table->errstr != NULL && grok_table_refresh(table) < 0)
+        return NULL;
+      return table;
+    }
+  }
+
+  table = calloc(1, sizeof(grok_table_t));
+  table->filename = strdup(filename);
+  table->type = type;
+  table->checked = time(NULL);
+  table->next = table_cache;
+  table_cache = table;
+
+  if (_table_read_file(filename, &table->data, &table->data_len, &st) != 0) {
+    table->errstr = strdup(table_error);
+    return NULL;
+  }
+
+  table->mtime = st.st_mtime;
+  table->inode = st.st_ino;
+  _table_build(table);
+  return table;
+}
+
+const char *grok_table_error(void) {
+  return table_error;
+}
+
+/* Hash every line of table->data into a fresh table->entries */
+static void _table_build(grok_table_t *table) {
+  const char *p, *end, *line;
+  int line_len;
+  size_t lines = 0;
+
+  /* Count lines first so the table never has to grow */
+  end = table->data + table->data_len;
+  for (p = table->data; p != NULL && p < end; ) {
+    p = _table_next_line(p, end, &line, &line_len);
+    if (p != NULL)
+      lines++;
+  }
+
+  table->size = 16;
+  while (table->size < lines * 2)
+    table->size *= 2;
+  table->entries = calloc(table->size, sizeof(struct grok_table_entry));
+
+  for (p = table->data; p != NULL && p < end; ) {
+    struct grok_table_entry *entry;
+    const char *value = NULL;
+    int key_len = 0, value_len = 0;
+    unsigned int hash;
+
+    p = _table_next_line(p, end, &line, &line_len);
+    if (p == NULL)
+      break;
+
+    key_len = line_len;
+    if (table->type == GROK_TABLE_KEYVALUE) {
+      key_len = 0;
+      while (key_len < line_len && line[key_len] != ' '
+             && line[key_len] != '\t')
+        key_len++;
+      value = line + key_len;
+      value_len = line_len - key_len;
+      while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        value_len--;
+      }
+    }
+
+    /* Later lines override earlier ones */
+    hash = string_hash(line, key_len);
+    entry = _table_slot(table, line, key_len, hash);
+    if (entry->key == NULL) {
+      entry->key = line;
+      entry->key_len = key_len;
+      entry->hash = hash;
+      table->count++;
+    }
+    entry->value = value;
+    entry->value_len = value_len;
+  }
+}
+
+int grok_table_refresh(grok_table_t *table) {
+  struct stat st;
+  char *old_data;
+  size_t old_data_len;
+  struct grok_table_entry *old_entries;
+  time_t now = time(NULL);
+
+  /* This is called per match; only go to the filesystem once a second */
+  if (now == table->checked) {
+    if (table->errstr != NULL) {
+      snprintf(table_error, sizeof(table_error), "%s", table->errstr);
+      return -1;
+    }
+    return 0;
+  }
+  table->checked = now;
+
+  if (table->errstr == NULL) {
+    if (stat(table->filename, &st) != 0)
+      return -1; /* keep serving what we have */
+    if (st.st_mtime == table->mtime && st.st_ino == table->inode
+        && (size_t)st.st_size == table->data_len)
+      return 0;
+  }
+
+  old_data = table->data;
+  old_data_len = table->data_len;
+  old_entries = table->entries;
+
+  if (_table_read_file(table->filename, &table->data, &table->data_len,
+                      &st) != 0) {
+    table->data = old_data;
+    table->data_len = old_data_len;
+    if (table->errstr != NULL) {
+      free(table->errstr);
+      table->errstr = strdup(table_error);
+    }
+    return -1;
+  }
+
+  free(table->errstr);
+  table->errstr = NULL;
+  table->mtime = st.st_mtime;
+  table->inode = st.st_ino;
+  table->count = 0;
+  _table_build(table);
+
+  free(old_entries);
+  free(old_data);
+  return 1;
+}
+
+void grok_table_name(const char *name, const char *filename) {
+  struct grok_table_name *tn;
+
+  for (tn = table_names; tn != NULL; tn = tn->next) {
+    if (!strcmp(tn->name, name))
+      break;
+  }
+
+  if (tn == NULL) {
+    tn = calloc(1, sizeof(struct grok_table_name));
+    tn->name = strdup(name);
+    tn->next = table_names;
+    table_names = tn;
+  } else {
+    free(tn->filename);
+  }
+  tn->filename = strdup(filename);
+}
+
+grok_table_t *grok_table_load_named(const char *name, int name_len, int type) {
+  struct grok_table_name *tn;
+  grok_table_t *table;
+  char *filename;
+
+  for (tn = table_names; tn != NULL; tn = tn->next) {
+    if (!strncmp(tn->name, name, name_len) && tn->name[name_len] == '\0')
+      return grok_table_load(tn->filename, type);
+  }
+
+  /* Not a declared table; treat the name as a path */
+  filename = malloc(name_len + 1);
+  memcpy(filename, name, name_len);
+  filename[name_len] = '\0';
+  table = grok_table_load(filename, type);
+  free(filename);
+  return table;
+}
+
+static struct grok_table_entry *_table_slot(const grok_table_t *table,
+                                            const char *key, int key_len,
+                                            unsigned int hash) {
+  size_t i = hash & (table->size - 1);
+  while (table->entries[i].key != NULL) {
+    struct grok_table_entry *entry = &table->entries[i];
+    if (entry->hash == hash && entry->key_len == key_len
+        && !memcmp(entry->key, key, key_len)) {
+      break;
+    }
+    i = (i + 1) & (table->size - 1);
+  }
+  return &table->entries[i];
+}
+
+int grok_table_contains(const grok_table_t *table,
+                        const char *key, int key_len) {
+  return _table_slot(table, key, key_len,
+                     string_hash(key, key_len))->key != NULL;
+}
+
+int grok_table_lookup(const grok_table_t *table, const char *key, int key_len,
+                      const char **value, int *value_len) {
+  struct grok_table_entry *entry;
+  entry = _table_slot(table, key, key_len, string_hash(key, key_len));
+  if (entry->key == NULL) {
+    *value = NULL;
+    *value_len = 0;
+    return 0;
+  }
+  *value = entry->value;
+  *value_len = entry->value_len;
+  return 1;
+}
+
+int grok_table_count(const grok_table_t *table) {
+  return table->count;
+}
+
+static unsigned int _cidr_node_new(grok_cidrtable_t *table) {
+  if (table->nnodes == table->size) {
+    table->size *= 2;
+    table->nodes = realloc(table->nodes, table->size * sizeof(struct cidr_node));
+  }
+  memset(&table->nodes[table->nnodes], 0, sizeof(struct cidr_node));
+  return table->nnodes++;
+}
+
+/* Parse 'address[/prefixlen]' into a network-order address */
+static int _cidr_parse(const char *str, int len, unsigned char *addr,
+                       int *family, int *prefixlen) {
+  char buf[INET6_ADDRSTRLEN + 4];
+  char *slash;
+  int maxlen;
+
+  if (len <= 0 || len >= sizeof(buf))
+    return -1;
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+
+  slash = strchr(buf, '/');
+  if (slash != NULL)
+    *slash = '\0';
+
+  *family = (strchr(buf, ':') != NULL) ? AF_INET6 : AF_INET;
+  maxlen = (*family == AF_INET6) ? 128 : 32;
+  if (inet_pton(*family, buf, addr) != 1)
+    return -1;
+
+  *prefixlen = maxlen;
+  if (slash != NULL) {
+    char *endp;
+    long bits = strtol(slash + 1, &endp, 10);
+    if (endp == slash + 1 || *endp != '\0' || bits < 0 || bits > maxlen)
+      return -1;
+    *prefixlen = bits;
+  }
+  return 0;
+}
+
+#define CIDR_BIT(addr, i) (((addr)[(i) / 8] >> (7 - ((i) % 8))) & 1)
+
+static void _cidr_insert(grok_cidrtable_t *table, int family,
+                         const unsigned char *addr, int prefixlen) {
+  unsigned int node = (family == AF_INET6) ? CIDR_ROOT_V6 : CIDR_ROOT_V4;
+  int i;
+
+  for (i = 0; i < prefixlen; i++) {
+    int bit = CIDR_BIT(addr, i);
+    /* A shorter network already covers this one */
+    if (table->nodes[node].terminal)
+      return;
+    if (table->nodes[node].child[bit] == 0) {
+      unsigned int child = _cidr_node_new(table);
+      table->nodes[node].child[bit] = child;
+    }
+    node = table->nodes[node].child[bit];
+  }
+  table->nodes[node].terminal = 1;
+}
+
+/* Build a fresh trie in table->nodes from the file contents in 'data' */
+static void _cidr_build(grok_cidrtable_t *table, const char *data,
+                        size_t data_len) {
+  const char *p, *end, *line;
+  int line_len;
+
+  table->size = 1024;
+  table->nodes = calloc(table->size, sizeof(struct cidr_node));
+  table->nnodes = 3; /* unused, ipv4 root, ipv6 root */
+  table->count = 0;
+
+  end = data + data_len;
+  for (p = data; p != NULL && p < end; ) {
+    unsigned char addr[16];
+    int family, prefixlen;
+
+    p = _table_next_line(p, end, &line, &line_len);
+    if (p == NULL)
+      break;
+
+    if (_cidr_parse(line, line_len, addr, &family, &prefixlen) != 0) {
+      fprintf(stderr, "Invalid network in '%s': '%.*s'\n",
+              table->filename, line_len, line);
+      continue;
+    }
+    _cidr_insert(table, family, addr, prefixlen);
+    table->count++;
+  }
+}
+
+grok_cidrtable_t *grok_cidrtable_load(const char *filename) {
+  grok_cidrtable_t *table;
+  char *data;
+  size_t data_len;
+  struct stat st;
+
+  for (table = cidrtable_cache; table != NULL; table = table->next) {
+    if (!strcmp(table->filename, filename))
+      return table;
+  }
+
+  if (_table_read_file(filename, &data, &data_len, &st) != 0)
+    return NULL;
+
+  table = calloc(1, sizeof(grok_cidrtable_t));
+  table->filename = strdup(filename);
+  table->mtime = st.st_mtime;
+  table->inode = st.st_ino;
+  table->file_size = data_len;
+  table->checked = time(NULL);
+
+  /* The trie holds everything we need; the file contents can go */
+  _cidr_build(table, data, data_len);
+  free(data);
+
+  table->next = cidrtable_cache;
+  cidrtable_cache = table;
+  return table;
+}
+
+/* Like grok_table_refresh: rebuild the trie if the file changed */
+int grok_cidrtable_refresh(grok_cidrtable_t *table) {
+  grok_cidrtable_t fresh;
+  struct stat st;
+  char *data;
+  size_t data_len;
+  time_t now = time(NULL);
+
+  if (now == table->checked)
+    return 0;
+  table->checked = now;
+
+  if (stat(table->filename, &st) != 0)
+    return -1; /* keep serving what we have */
+  if (st.st_mtime == table->mtime && st.st_ino == table->inode
+      && st.st_size == table->file_size)
+    return 0;
+
+  if (_table_read_file(table->filename, &data, &data_len, &st) != 0)
+    return -1;
+
+  fresh = *table;
+  _cidr_build(&fresh, data, data_len);
+  free(data);
+
+  free(table->nodes);
+  table->nodes = fresh.nodes;
+  table->nnodes = fresh.nnodes;
+  table->size = fresh.size;
+  table->count = fresh.count;
+  table->mtime = st.st_mtime;
+  table->inode = st.st_ino;
+  table->file_size = data_len;
+  return 1;
+}
+
+/* Walk at most 32 (or 128) bits; stop at the first covering network */
+int grok_cidrtable_contains(const grok_cidrtable_t *table,
+                            const char *addr, int addr_len) {
+  unsigned char bytes[16];
+  unsigned int node;
+  int family, prefixlen, i;
+
+  if (_cidr_parse(addr, addr_len, bytes, &family, &prefixlen) != 0)
+    return 0;
+
+  node = (family == AF_INET6) ? CIDR_ROOT_V6 : CIDR_ROOT_V4;
+  for (i = 0; i < prefixlen; i++) {
+    if (table->nodes[node].terminal)
+      return 1;
+    node = table->nodes[node].child[CIDR_BIT(bytes, i)];
+    if (node == 0)
+      return 0;
+  }
+  return table->nodes[node].terminal;
+}
+
+int grok_cidrtable_count(const grok_cidrtable_t *table) {
+  return table->count;
+}
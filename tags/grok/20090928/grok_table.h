@@ -0,0 +1,55 @@
+#ifndef _GROK_TABLE_H_
+#define _GROK_TABLE_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+/* Lookup tables loaded from local files.
+ *
+ * grok_table_t is a hash of the lines of a file. The file is read into
+ * memory once and entries point into that copy, so loading costs one pass
+ * and no per-entry allocations, and editing the file in place is safe.
+ * With GROK_TABLE_KEYVALUE, each line is 'key<whitespace>value'; otherwise
+ * the whole (trimmed) line is the key. Blank lines and lines starting with
+ * '#' are ignored.
+ *
+ * grok_cidrtable_t is a binary radix trie of IPv4 and IPv6 networks, one
+ * 'address[/prefixlen]' per line. grok_cidrtable_refresh() rebuilds it the
+ * same way grok_table_refresh() reloads a table.
+ *
+ * Loaded tables are cached by filename; loading the same file again returns
+ * the cached table. grok_table_refresh() reloads a table in place if its
+ * file has changed (by mtime, inode or size, at most once a second), so
+ * pointers to the table stay valid. A file that can't be loaded is
+ * retried at most once a second; grok_table_error() says why it failed. No
+ * errors are printed, so callers can grok_log them.
+ *
+ * grok_table_name() gives a file a short name, such as one declared with
+ * 'table "hostowners" "/etc/grok/hostowners"' in the config, for
+ * grok_table_load_named(). */
+
+#define GROK_TABLE_SET 0
+#define GROK_TABLE_KEYVALUE 1
+
+typedef struct grok_table grok_table_t;
+typedef struct grok_cidrtable grok_cidrtable_t;
+
+grok_table_t *grok_table_load(const char *filename, int type);
+int grok_table_contains(const grok_table_t *table,
+                        const char *key, int key_len);
+int grok_table_lookup(const grok_table_t *table, const char *key, int key_len,
+                      const char **value, int *value_len);
+int grok_table_count(const grok_table_t *table);
+int grok_table_refresh(grok_table_t *table);
+const char *grok_table_error(void);
+
+void grok_table_name(const char *name, const char *filename);
+grok_table_t *grok_table_load_named(const char *name, int name_len, int type);
+
+grok_cidrtable_t *grok_cidrtable_load(const char *filename);
+int grok_cidrtable_contains(const grok_cidrtable_t *table,
+                            const char *addr, int addr_len);
+int grok_cidrtable_count(const grok_cidrtable_t *table);
+int grok_cidrtable_refresh(grok_cidrtable_t *table);
+
+#endif /* _GROK_TABLE_H_ */
@@ -9,6 +9,7 @@
 #include "grok.h"
 #include "predicates.h"
 #include "stringhelper.h"
+#include "grok_regexopt.h"
 
 /* global, static variables */
 
@@ -16,7 +17,6 @@
 #define CAPTURE_FORMAT "%04x"
 
 /* internal functions */
-static char *grok_pattern_expand(grok_t *grok); //, int offset, int length);
 static void grok_study_capture_map(grok_t *grok);
 
 static void grok_capture_add_predicate(grok_t *grok, int capture_id,
@@ -26,6 +26,9 @@ void grok_free(grok_t *grok) {
   if (grok->re != NULL)
     pcre_free(grok->re);
 
+  if (grok->re_extra != NULL)
+    pcre_free(grok->re_extra);
+
   if (grok->full_pattern != NULL)
     free(grok->full_pattern);
 
@@ -33,7 +36,7 @@ void grok_free(grok_t *grok) {
     free(grok->pcre_capture_vector);
 
   if (grok->patterns != NULL)
-    grok->patterns->close(grok->patterns, 0);
+    grok_patternlib_release(grok->patterns);
 
   if (grok->captures_by_id != NULL)
     grok->captures_by_id->close(grok->captures_by_id, 0);
@@ -53,9 +56,30 @@ int grok_compile(grok_t *grok, const char *pattern) {
 }
 
 int grok_compilen(grok_t *grok, const char *pattern, int length) {
+  char *expanded, *optimized;
+  grok_regexopt_stats_t stats;
+
   grok_log(grok, LOG_COMPILE, "Compiling '%s'", pattern);
   grok->pattern = pattern;
-  grok->full_pattern = grok_pattern_expand(grok); //, 0, strlen(pattern));
+  expanded = grok_pattern_expand(grok); //, 0, strlen(pattern));
+  if (expanded == NULL) {
+    grok->errstr = "Failed to expand pattern";
+    return GROK_ERROR_COMPILE_FAILED;
+  }
+
+  /* Expanded patterns are naive concatenations; tidy them up for pcre */
+  optimized = grok_regex_optimize(expanded, strlen(expanded), &stats);
+  if (optimized == NULL) {
+    grok_log(grok, LOG_COMPILE, "Regex not optimized (unsupported syntax)");
+    grok->full_pattern = expanded;
+  } else {
+    grok_log(grok, LOG_COMPILE, "Optimized: %s", optimized);
+    grok_log(grok, LOG_COMPILE, "Collapsed %d groups, factored %d prefixes, "
+             "made %d quantifiers possessive", stats.groups_collapsed,
+             stats.prefixes_factored, stats.quantifiers_possessive);
+    free(expanded);
+    grok->full_pattern = optimized;
+  }
 
   grok->re = pcre_compile(grok->full_pattern, 0, 
                           &grok->pcre_errptr, &grok->pcre_erroffset,
@@ -66,6 +90,16 @@ int grok_compilen(grok_t *grok, const char *pattern, int length) {
     return GROK_ERROR_COMPILE_FAILED;
   }
 
+  /* Study once here rather than paying for it in every exec. pcre_study
+   * returns NULL when there is nothing to learn, but we want a pcre_extra
+   * anyway to pass callout data. */
+  grok->re_extra = pcre_study(grok->re, 0, &grok->pcre_errptr);
+  if (grok->re_extra == NULL) {
+    grok->re_extra = pcre_malloc(sizeof(pcre_extra));
+    memset(grok->re_extra, 0, sizeof(pcre_extra));
+  }
+  grok->re_extra->flags |= PCRE_EXTRA_CALLOUT_DATA;
+
   pcre_fullinfo(grok->re, NULL, PCRE_INFO_CAPTURECOUNT, &grok->pcre_num_captures);
   grok->pcre_num_captures++; /* include the 0th group */
   grok->pcre_capture_vector = calloc(3 * grok->pcre_num_captures, sizeof(int));
@@ -87,9 +121,6 @@ int grok_exec(grok_t *grok, const char *text, grok_match_t *gm) {
 
 int grok_execn(grok_t *grok, const char *text, int textlen, grok_match_t *gm) {
   int ret;
-  pcre_extra pce;
-  pce.flags = PCRE_EXTRA_CALLOUT_DATA;
-  pce.callout_data = grok;
 
   if (grok->re == NULL) {
     grok_log(grok, LOG_EXEC, "Error: pcre re is null, meaning you haven't called grok_compile yet");
@@ -97,7 +128,9 @@ int grok_execn(grok_t *grok, const char *text, int textlen, grok_match_t *gm) {
     return GROK_ERROR_UNINITIALIZED;
   }
 
-  ret = pcre_exec(grok->re, &pce, text, textlen, 0, 0,
+  /* grok_t can be copied around (see grok_matchconf), so set this here */
+  grok->re_extra->callout_data = grok;
+  ret = pcre_exec(grok->re, grok->re_extra, text, textlen, 0, 0,
                   grok->pcre_capture_vector, grok->pcre_num_captures * 3);
   grok_log(grok, LOG_EXEC, "%.*s =~ /%s/ => %d",
            textlen, text, grok->pattern, ret);
@@ -131,6 +164,87 @@ int grok_execn(grok_t *grok, const char *text, int textlen, grok_match_t *gm) {
   return GROK_OK;
 }
 
+int grok_batch_captures_per_line(const grok_t *grok) {
+  return grok->pcre_num_captures * 2;
+}
+
+int grok_batch_capture_index(const grok_t *grok, const char *name) {
+  grok_match_t gm;
+  grok_capture gct;
+  int index;
+
+  gm.grok = (grok_t *)grok;
+  if (grok_match_get_named_capture(&gm, name, &gct) != 0) {
+    return -1;
+  }
+  index = gct.pcre_capture_number * 2;
+  grok_capture_free(&gct);
+  return index;
+}
+
+int grok_has_callouts(const grok_t *grok) {
+  /* Predicates add (?C1); a pattern may also have its own callouts */
+  return grok->full_pattern != NULL && strstr(grok->full_pattern, "(?C") != NULL;
+}
+
+int grok_execn_batch(grok_t *grok, const grok_line_t *lines, int nlines,
+                     grok_batch_match_t *results, int *captures) {
+  int *ovector;
+  pcre_extra extra;
+  int ovecsize = grok->pcre_num_captures * 3;
+  int ncap = grok->pcre_num_captures * 2;
+  int log_exec = grok->logmask & LOG_EXEC;
+  int i, j, ret;
+
+  if (grok->re == NULL) {
+    grok_log(grok, LOG_EXEC, "Error: pcre re is null, meaning you haven't called grok_compile yet");
+    fprintf(stderr, "ERROR: grok_execn_batch called on an object that has not pattern compiled. Did you call grok_compile yet?\n");
+    return GROK_ERROR_UNINITIALIZED;
+  }
+
+  /* Nothing here writes to 'grok': the ovector and pcre_extra are our own,
+   * so batches without callouts may share it (see grokre.h) */
+  ovector = malloc(ovecsize * sizeof(int));
+  extra = *grok->re_extra;
+  extra.callout_data = grok;
+  for (i = 0; i < nlines; i++) {
+    ret = pcre_exec(grok->re, &extra, lines[i].text, lines[i].len,
+                    0, 0, ovector, ovecsize);
+    if (log_exec) {
+      grok_log(grok, LOG_EXEC, "%.*s =~ /%s/ => %d",
+               lines[i].len, lines[i].text, grok->pattern, ret);
+    }
+
+    if (ret < 0) {
+      if (ret == PCRE_ERROR_NOMATCH) {
+        results[i].status = GROK_ERROR_NOMATCH;
+      } else {
+        results[i].status = GROK_ERROR_PCRE_ERROR;
+      }
+      results[i].start = results[i].end = -1;
+      if (captures != NULL) {
+        memset(captures + i * ncap, 0xff, ncap * sizeof(int)); /* all -1 */
+      }
+      continue;
+    }
+
+    results[i].status = GROK_OK;
+    results[i].start = ovector[0];
+    results[i].end = ovector[1];
+    if (captures != NULL) {
+      /* pcre only fills pairs below its return value */
+      int *cap = captures + i * ncap;
+      memcpy(cap, ovector, ret * 2 * sizeof(int));
+      for (j = ret * 2; j < ncap; j++) {
+        cap[j] = -1;
+      }
+    }
+  }
+
+  free(ovector);
+  return GROK_OK;
+}
+
 /* XXX: This method is pretty long; split it up? */
 char *grok_pattern_expand(grok_t *grok) {
   int capture_id = 0; /* Starting capture_id, doesn't really matter what this is */
@@ -155,7 +269,7 @@ char *grok_pattern_expand(grok_t *grok) {
   while (pcre_exec(g_pattern_re, NULL, full_pattern, full_len, offset, 
                    0, capture_vector, g_pattern_num_captures * 3) >= 0) {
     int start, end, matchlen;
-    char *pattern_regex;
+    const char *pattern_regex;
     int patname_len;
     size_t regexp_len;
 
@@ -256,7 +370,6 @@ char *grok_pattern_expand(grok_t *grok) {
       pcre_free_substring(patname);
       patname = NULL;
     }
-    free(pattern_regex);
   }
 
   /* Unescape any "\%" strings found */
@@ -280,6 +393,7 @@ static void grok_capture_add_predicate(grok_t *grok, int capture_id,
   grok_capture gct;
   grok_capture_init(grok, &gct);
   int offset = 0;
+  int negated;
 
   grok_log(grok, LOG_PREDICATE, "Adding predicate '%.*s' to capture %d",
            predicate_len, predicate, capture_id);
@@ -300,6 +414,18 @@ static void grok_capture_add_predicate(grok_t *grok, int capture_id,
   predicate += offset;
   predicate_len -= offset;
 
+  /* Lookup predicates: [!]in_cidr "file" and [!]in_set "file" */
+  negated = (predicate_len > 0 && predicate[0] == '!');
+  if (predicate_len - negated > 7
+      && !strncmp(predicate + negated, "in_cidr", 7)) {
+    grok_predicate_cidr_init(grok, &gct, predicate, predicate_len);
+    return;
+  } else if (predicate_len - negated > 6
+             && !strncmp(predicate + negated, "in_set", 6)) {
+    grok_predicate_set_init(grok, &gct, predicate, predicate_len);
+    return;
+  }
+
   if (predicate_len > 2) {
     if (!strncmp(predicate, "=~", 2) || !strncmp(predicate, "!~", 2)) {
       grok_predicate_regexp_init(grok, &gct, predicate, predicate_len);
@@ -10,6 +10,41 @@ int grok_compilen(grok_t *grok, const char *pattern, int length);
 int grok_exec(grok_t *grok, const char *text, grok_match_t *gm);
 int grok_execn(grok_t *grok, const char *text, int textlen, grok_match_t *gm);
 
+/* Expand %{FOO} references in grok->pattern, recording the captures.
+ * grok_compile does this for you; returns a malloc'd regex. */
+char *grok_pattern_expand(grok_t *grok);
+
+/* Match many lines in one call. results[i] gets the status (GROK_OK or
+ * GROK_ERROR_NOMATCH) and match bounds of lines[i]. If captures is not
+ * NULL, it must hold nlines * grok_batch_captures_per_line(grok) ints; line
+ * i's capture offsets start at captures[i * grok_batch_captures_per_line()],
+ * as (start, end) pairs that are -1 for unset captures.
+ * grok_batch_capture_index() gives the offset of a named capture's pair
+ * within a line's block, so names only need to be looked up once.
+ * Unlike grok_execn, this does not write to 'grok' at all, so it does not
+ * touch grok->pcre_capture_vector or set grok->pcre_errno.
+ *
+ * Several threads may run batches on one grok_t at once, provided nothing
+ * compiles it meanwhile and grok_has_callouts() is false. Callouts run
+ * predicates, which read the capture DBs; those handles are not opened for
+ * use from several threads. */
+typedef struct grok_line {
+  const char *text;
+  int len;
+} grok_line_t;
+
+typedef struct grok_batch_match {
+  int status;
+  int start;
+  int end;
+} grok_batch_match_t;
+
+int grok_execn_batch(grok_t *grok, const grok_line_t *lines, int nlines,
+                     grok_batch_match_t *results, int *captures);
+int grok_batch_captures_per_line(const grok_t *grok);
+int grok_batch_capture_index(const grok_t *grok, const char *name);
+int grok_has_callouts(const grok_t *grok);
+
 int grok_match_get_named_substring(const grok_match_t *gm, const char *name,
                                    const char **substr, int *len);
 
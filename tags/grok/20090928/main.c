@@ -1,28 +1,179 @@
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <getopt.h>
+#include <event.h>
+
 #include "grok.h"
 #include "grok_program.h"
 #include "grok_config.h"
+#include "grok_logging.h"
+#include "grok_matchconf.h"
+#include "grok_regexopt.h"
 
 #include "conf.tab.h"
 
 extern FILE *yyin; /* from conf.lex (flex provides this) */
+extern void yyrestart(FILE *input_file);
+
+static const char *config_file = "grok.conf";
+
+static int load_config(struct config *conf) {
+  int ret;
+
+  yyin = fopen(config_file, "r");
+  if (yyin == NULL) {
+    fprintf(stderr, "Unable to open '%s': %s\n", config_file, strerror(errno));
+    return 1;
+  }
+
+  yyrestart(yyin);
+  conf_init(conf);
+  ret = yyparse(conf);
+  fclose(yyin);
+  return ret;
+}
+
+/* Whether anything in the config has a 'debug' mask set */
+static int config_logs(struct config *conf) {
+  int i, j;
+
+  if (conf->logmask)
+    return 1;
+  for (i = 0; i < conf->nprograms; i++) {
+    grok_program_t *gprog = &conf->programs[i];
+    if (gprog->logmask)
+      return 1;
+    for (j = 0; j < gprog->ninputs; j++) {
+      if (gprog->inputs[j].logmask)
+        return 1;
+    }
+    for (j = 0; j < gprog->nmatchconfigs; j++) {
+      if (gprog->matchconfigs[j].grok.logmask)
+        return 1;
+    }
+  }
+  return 0;
+}
 
-int main() {
+/* SIGHUP: reparse the config and apply only what changed */
+static void reload_config(int sig, short what, void *data) {
+  grok_collection_t *gcol = (grok_collection_t *)data;
+  struct config c;
+
+  if (load_config(&c) != 0) {
+    fprintf(stderr, "Parsing error in config file, keeping current config\n");
+    return;
+  }
+
+  if (config_logs(&c)) {
+    grok_logging_async_start(stderr);
+  }
+
+  grok_collection_reload(gcol, c.programs, c.nprograms);
+}
+
+/* --explain: show each match pattern in the config as expanded, and as
+ * rewritten by the regex optimizer */
+static void explain_config(struct config *conf) {
+  int i, j;
+
+  for (i = 0; i < conf->nprograms; i++) {
+    grok_program_t *gprog = &conf->programs[i];
+    for (j = 0; j < gprog->nmatchconfigs; j++) {
+      grok_matchconf_t *gmc = &gprog->matchconfigs[j];
+      grok_regexopt_stats_t stats;
+      char *expanded, *optimized;
+      grok_t grok;
+
+      if (gmc->pattern == NULL) {
+        continue;
+      }
+
+      grok_clone(&grok, &gmc->grok);
+      grok.pattern = gmc->pattern;
+      expanded = grok_pattern_expand(&grok);
+      printf("program %s, match %d\n",
+             gprog->name ? gprog->name : "(unnamed)", j + 1);
+      printf("  pattern:   %s\n", gmc->pattern);
+      if (expanded == NULL) {
+        printf("  (failed to expand)\n\n");
+        grok_free(&grok);
+        continue;
+      }
+
+      printf("  expanded:  %s\n", expanded);
+      optimized = grok_regex_optimize(expanded, strlen(expanded), &stats);
+      if (optimized == NULL) {
+        printf("  optimized: (unchanged; unsupported syntax)\n\n");
+      } else {
+        printf("  optimized: %s\n", optimized);
+        printf("  %d -> %d bytes; collapsed %d groups, factored %d prefixes, "
+               "made %d quantifiers possessive\n\n",
+               (int)strlen(expanded), (int)strlen(optimized),
+               stats.groups_collapsed, stats.prefixes_factored,
+               stats.quantifiers_possessive);
+        free(optimized);
+      }
+      free(expanded);
+      grok_free(&grok);
+    }
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [--explain]\n", prog);
+  fprintf(stderr, "  --explain  print each pattern in %s before and after "
+          "regex optimization, then exit\n", config_file);
+}
+
+int main(int argc, char **argv) {
   struct config c;
   grok_collection_t *gcol;
-  int i;
+  struct event ev_sighup;
+  int explain = 0;
+  int opt, i;
+  struct option options[] = {
+    { "explain", no_argument, NULL, 'e' },
+    { "help", no_argument, NULL, 'h' },
+    { 0, 0, 0, 0 }
+  };
+
+  while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+    switch (opt) {
+      case 'e':
+        explain = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? 0 : 1;
+    }
+  }
 
-  yyin = fopen("grok.conf", "r");
-  conf_init(&c);
-  i = yyparse(&c);
-  if (i != 0) {
+  if (load_config(&c) != 0) {
     fprintf(stderr, "Parsing error in config file\n");
     return 1;
   }
 
+  /* Without any debug masks there is nothing to log, and no need for the
+   * logging thread */
+  if (!explain && config_logs(&c)) {
+    grok_logging_async_start(stderr);
+  }
+
+  if (explain) {
+    explain_config(&c);
+    return 0;
+  }
+
   gcol = grok_collection_init();
   for (i = 0; i < c.nprograms; i++) {
     grok_collection_add(gcol, &(c.programs[i]));
   }
+
+  signal_set(&ev_sighup, SIGHUP, reload_config, gcol);
+  signal_add(&ev_sighup, NULL);
+
   grok_collection_loop(gcol);
 
   return 0;
@@ -1,9 +1,12 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "grok_logging.h"
+#include "grok_table.h"
 #include "predicates.h"
+#include "stringhelper.h"
 
 static pcre *regexp_predicate_op = NULL;
 #define REGEXP_PREDICATE_RE \
@@ -59,12 +62,27 @@ typedef struct grok_predicate_strcompare {
   int len;
 } grok_predicate_strcompare_t;
 
+typedef struct grok_predicate_lookup {
+  char *filename;
+  grok_table_t *set;
+  grok_cidrtable_t *cidr;
+  int negative_match;
+} grok_predicate_lookup_t;
+
+static grok_predicate_lookup_t *grok_predicate_lookup_parse(
+    grok_t *grok, const char *keyword, const char *args, int args_len);
+static void grok_predicate_lookup_free(grok_predicate_lookup_t *gplt);
+
 int grok_predicate_regexp(grok_t *grok, grok_capture *gct,
                           const char *subject, int start, int end);
 int grok_predicate_numcompare(grok_t *grok, grok_capture *gct,
                               const char *subject, int start, int end);
 int grok_predicate_strcompare(grok_t *grok, grok_capture *gct,
                               const char *subject, int start, int end);
+int grok_predicate_cidr(grok_t *grok, grok_capture *gct,
+                        const char *subject, int start, int end);
+int grok_predicate_set(grok_t *grok, grok_capture *gct,
+                       const char *subject, int start, int end);
 
 int grok_predicate_regexp(grok_t *grok, grok_capture *gct,
                           const char *subject, int start, int end) {
@@ -279,6 +297,152 @@ int grok_predicate_strcompare(grok_t *grok, grok_capture *gct,
   return ret;
 }
 
+/* Parse '[!]keyword "filename"' (quotes optional) */
+static grok_predicate_lookup_t *grok_predicate_lookup_parse(
+    grok_t *grok, const char *keyword, const char *args, int args_len) {
+  grok_predicate_lookup_t *gplt;
+  int keyword_len = strlen(keyword);
+  int pos = 0, len = 0;
+
+  gplt = calloc(1, sizeof(grok_predicate_lookup_t));
+  if (args_len > 0 && args[0] == '!') {
+    gplt->negative_match = 1;
+    pos++;
+  }
+  pos += keyword_len;
+
+  while (pos < args_len && isspace(args[pos])) {
+    pos++;
+  }
+
+  if (pos < args_len && args[pos] == '"') {
+    pos++;
+    while (pos + len < args_len && args[pos + len] != '"') {
+      len++;
+    }
+  } else {
+    while (pos + len < args_len && !isspace(args[pos + len])) {
+      len++;
+    }
+  }
+
+  if (len == 0) {
+    fprintf(stderr, "Missing filename in predicate: '%.*s'\n", args_len, args);
+    free(gplt);
+    return NULL;
+  }
+
+  gplt->filename = string_ndup(args + pos, len);
+  grok_log(grok, LOG_PREDICATE, "%s%s predicate using file '%s'",
+           gplt->negative_match ? "!" : "", keyword, gplt->filename);
+  return gplt;
+}
+
+static void grok_predicate_lookup_free(grok_predicate_lookup_t *gplt) {
+  free(gplt->filename);
+  free(gplt);
+}
+
+/* The set and network files are checked for changes (at most once a
+ * second) each time the predicate runs, like lookup tables, so they can be
+ * edited while grok runs. */
+
+int grok_predicate_cidr_init(grok_t *grok, grok_capture *gct,
+                             const char *args, int args_len) {
+  grok_predicate_lookup_t *gplt;
+
+  grok_log(grok, LOG_PREDICATE, "CIDR predicate found: '%.*s'",
+           args_len, args);
+
+  gplt = grok_predicate_lookup_parse(grok, "in_cidr", args, args_len);
+  if (gplt == NULL) {
+    return -1;
+  }
+
+  gplt->cidr = grok_cidrtable_load(gplt->filename);
+  if (gplt->cidr == NULL) {
+    fprintf(stderr, "Unable to load networks for predicate on %s (%s); "
+            "ignoring the predicate\n", gct->name, grok_table_error());
+    grok_log(grok, LOG_PREDICATE, "in_cidr predicate on %s dropped: %s",
+             gct->name, grok_table_error());
+    grok_predicate_lookup_free(gplt);
+    return -1;
+  }
+  grok_log(grok, LOG_PREDICATE, "Loaded %d networks from '%s'",
+           grok_cidrtable_count(gplt->cidr), gplt->filename);
+
+  gct->predicate_func_name = strdup("grok_predicate_cidr");
+  gct->predicate_func_name_len = strlen("grok_predicate_cidr");
+  grok_capture_set_extra(grok, gct, gplt);
+  grok_capture_add(grok, gct);
+  return 0;
+}
+
+int grok_predicate_cidr(grok_t *grok, grok_capture *gct,
+                        const char *subject, int start, int end) {
+  grok_predicate_lookup_t *gplt;
+  int found;
+
+  gplt = *(grok_predicate_lookup_t **)(gct->extra.extra_val);
+  grok_cidrtable_refresh(gplt->cidr);
+  found = grok_cidrtable_contains(gplt->cidr, subject + start, end - start);
+
+  grok_log(grok, LOG_PREDICATE, "CIDR: '%.*s' %sin '%s'",
+           (end - start), subject + start, found ? "" : "not ",
+           gplt->filename);
+
+  /* grok predicates should return 0 for success */
+  return !(found ^ gplt->negative_match);
+}
+
+int grok_predicate_set_init(grok_t *grok, grok_capture *gct,
+                            const char *args, int args_len) {
+  grok_predicate_lookup_t *gplt;
+
+  grok_log(grok, LOG_PREDICATE, "Set predicate found: '%.*s'",
+           args_len, args);
+
+  gplt = grok_predicate_lookup_parse(grok, "in_set", args, args_len);
+  if (gplt == NULL) {
+    return -1;
+  }
+
+  gplt->set = grok_table_load(gplt->filename, GROK_TABLE_SET);
+  if (gplt->set == NULL) {
+    fprintf(stderr, "Unable to load set for predicate on %s (%s); "
+            "ignoring the predicate\n", gct->name, grok_table_error());
+    grok_log(grok, LOG_PREDICATE, "in_set predicate on %s dropped: %s",
+             gct->name, grok_table_error());
+    grok_predicate_lookup_free(gplt);
+    return -1;
+  }
+  grok_log(grok, LOG_PREDICATE, "Loaded %d set members from '%s'",
+           grok_table_count(gplt->set), gplt->filename);
+
+  gct->predicate_func_name = strdup("grok_predicate_set");
+  gct->predicate_func_name_len = strlen("grok_predicate_set");
+  grok_capture_set_extra(grok, gct, gplt);
+  grok_capture_add(grok, gct);
+  return 0;
+}
+
+int grok_predicate_set(grok_t *grok, grok_capture *gct,
+                       const char *subject, int start, int end) {
+  grok_predicate_lookup_t *gplt;
+  int found;
+
+  gplt = *(grok_predicate_lookup_t **)(gct->extra.extra_val);
+  grok_table_refresh(gplt->set);
+  found = grok_table_contains(gplt->set, subject + start, end - start);
+
+  grok_log(grok, LOG_PREDICATE, "Set: '%.*s' %sin '%s'",
+           (end - start), subject + start, found ? "" : "not ",
+           gplt->filename);
+
+  /* grok predicates should return 0 for success */
+  return !(found ^ gplt->negative_match);
+}
+
 int strop(const char * const args, int args_len) {
   if (args_len == 0)
     return -1;
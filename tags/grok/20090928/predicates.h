@@ -15,5 +15,12 @@ int grok_predicate_numcompare_init(grok_t *grok, grok_capture *gct,
 int grok_predicate_strcompare_init(grok_t *grok, grok_capture *gct,
                                    const char *args, int args_len);
 
+/* Lookup predicates, backed by tables loaded once per file (grok_table.h)
+ * Activate with '[!]in_cidr "file"' or '[!]in_set "file"' */
+int grok_predicate_cidr_init(grok_t *grok, grok_capture *gct,
+                             const char *args, int args_len);
+int grok_predicate_set_init(grok_t *grok, grok_capture *gct,
+                            const char *args, int args_len);
+
 
 #endif /* _PREDICATES_H_ */
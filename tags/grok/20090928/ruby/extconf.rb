@@ -2,4 +2,9 @@ require "mkmf"
 find_header("grok.h", "/usr/local/include")
 find_library("grok", "grok_init", "/usr/local/lib")
 
+# Grok#match_all and #each_match release the GVL while matching if they can
+have_header("ruby/thread.h")
+have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_thread_blocking_region")
+
 create_makefile("Grok")
@@ -6,4 +6,5 @@
 //VALUE cGrokMatch = Qnil;
 
 extern VALUE rGrok_new(VALUE klass);
+extern VALUE rGrok_capture_names(VALUE self);
 #endif /* _RGROK_H_ */
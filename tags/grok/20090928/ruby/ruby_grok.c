@@ -1,14 +1,53 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <ruby.h>
 #include <grok.h>
 #include "rgrok.h"
 #include "ruby_grokmatch.h"
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
 
 VALUE cGrok; /* Grok class object */
 
+/* How many lines match_all and each_match hand to grok_execn_batch at once */
+#define RGROK_BATCH_LINES 256
+
+/* How much of a file scan_file reads at once (it grows for longer lines) */
+#define RGROK_SCAN_BUFSIZE (1 << 20)
+
+/* Threads: match_all, each_match and scan_file match without the GVL, so
+ * other ruby threads run meanwhile, and may match with the same Grok since
+ * grok_execn_batch writes nothing to it. compile and add_pattern* raise
+ * while any such batch is in flight, rather than change the pattern under
+ * it. Patterns with predicates keep the GVL, because predicates read the
+ * capture DBs, which threads can't share; their batches run one at a
+ * time. */
+
+static ID id_atcapture_names;
+static ID id_atbatches_running;
+static ID id_gets;
+
 
 extern VALUE cGrokMatch;
 extern void Init_GrokMatch();
 
+/* Raise if another thread is matching with this Grok */
+static void _rgrok_check_idle(VALUE self) {
+  VALUE running = rb_ivar_get(self, id_atbatches_running);
+  if (!NIL_P(running) && FIX2INT(running) > 0) {
+    rb_raise(rb_eRuntimeError, "Grok is busy matching in another thread");
+  }
+}
+
+static void _rgrok_batches_add(VALUE self, int n) {
+  VALUE running = rb_ivar_get(self, id_atbatches_running);
+  int count = NIL_P(running) ? 0 : FIX2INT(running);
+  rb_ivar_set(self, id_atbatches_running, INT2FIX(count + n));
+}
+
 static VALUE rGrok_initialize(VALUE self) {
   /* empty */
   return Qnil;
@@ -35,6 +74,7 @@ VALUE rGrok_compile(VALUE self, VALUE pattern) {
   char *c_pattern;
   long len;
   int ret;
+  _rgrok_check_idle(self);
   Data_Get_Struct(self, grok_t, grok);
   c_pattern = rb_str2cstr(pattern, &len);
   ret = grok_compilen(grok, c_pattern, (int)len);
@@ -42,37 +82,395 @@ VALUE rGrok_compile(VALUE self, VALUE pattern) {
     rb_raise(rb_eArgError, "Compile failed: %s", grok->errstr);
   }
 
+  /* The capture names belong to the old pattern */
+  rb_ivar_set(self, id_atcapture_names, Qnil);
   return Qnil;
 }
 
-VALUE rGrok_match(VALUE self, VALUE input) {
-  grok_t *grok = NULL;
-  grok_match_t gm;
-  char *c_input = NULL;
-  long len = 0;
-  int ret = 0;
-  VALUE match = Qnil;
+/* Returns [[name, index], ...] for every capture in the compiled pattern,
+ * where index is the capture's offset from grok_batch_capture_index. This
+ * walks the capture db once per compile instead of once per match. */
+VALUE rGrok_capture_names(VALUE self) {
+  grok_t *grok;
+  grok_capture gct;
+  void *handle;
+  VALUE names;
+
+  names = rb_ivar_get(self, id_atcapture_names);
+  if (names != Qnil) {
+    return names;
+  }
 
   Data_Get_Struct(self, grok_t, grok);
-  c_input = rb_str2cstr(input, &len);
-  ret = grok_execn(grok, c_input, (int)len, &gm);
-
-  VALUE rgm = Qnil;
-  
-  //fprintf(stderr, "%d\n", ret);
-  switch (ret) {
-    case GROK_ERROR_NOMATCH:
-      rgm = Qfalse;
-      break;
-    case GROK_OK:
-      rgm = rGrokMatch_new_from_grok_match(&gm);
+  names = rb_ary_new();
+  handle = grok_capture_walk_init(grok);
+  grok_capture_init(grok, &gct);
+  while (grok_capture_walk_next(grok, handle, &gct) == 0) {
+    VALUE name = rb_str_new(gct.name, gct.name_len);
+    rb_obj_freeze(name);
+    rb_ary_push(names, rb_ary_new3(2, name,
+                                   INT2FIX(gct.pcre_capture_number * 2)));
+    grok_capture_free(&gct);
+    grok_capture_init(grok, &gct);
+  }
+  grok_capture_walk_end(grok, handle);
+
+  rb_ivar_set(self, id_atcapture_names, names);
+  return names;
+}
+
+struct rgrok_batch {
+  VALUE self;
+  grok_t *grok;
+  grok_line_t *lines;
+  int nlines;
+  grok_batch_match_t *results;
+  int *captures;
+  int ret;
+};
+
+static void *_rgrok_batch_exec(void *arg) {
+  struct rgrok_batch *batch = arg;
+  batch->ret = grok_execn_batch(batch->grok, batch->lines, batch->nlines,
+                                batch->results, batch->captures);
+  return NULL;
+}
+
+#if defined(HAVE_RB_THREAD_BLOCKING_REGION) \
+    && !defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+static VALUE _rgrok_batch_exec_blocking(void *arg) {
+  _rgrok_batch_exec(arg);
+  return Qnil;
+}
+#endif
+
+static VALUE _rgrok_batch_exec_nogvl(VALUE arg) {
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+  rb_thread_call_without_gvl(_rgrok_batch_exec, (void *)arg, RUBY_UBF_IO,
+                             NULL);
+#elif defined(HAVE_RB_THREAD_BLOCKING_REGION)
+  rb_thread_blocking_region(_rgrok_batch_exec_blocking, (void *)arg,
+                            RUBY_UBF_IO, NULL);
+#else
+  _rgrok_batch_exec((void *)arg);
+#endif
+  return Qnil;
+}
+
+/* Runs even if we are interrupted while waiting for the GVL again */
+static VALUE _rgrok_batch_done(VALUE arg) {
+  struct rgrok_batch *batch = (struct rgrok_batch *)arg;
+  _rgrok_batches_add(batch->self, -1);
+  return Qnil;
+}
+
+/* Run grok_execn_batch on 'nlines' lines. With 'nogvl' set, other ruby
+ * threads may run while we match, unless the pattern has callouts (see
+ * the top of this file). */
+static void _rgrok_exec_lines(VALUE self, grok_t *grok, grok_line_t *lines,
+                              int nlines, grok_batch_match_t *results,
+                              int *captures, int nogvl) {
+  struct rgrok_batch batch;
+
+  batch.self = self;
+  batch.grok = grok;
+  batch.lines = lines;
+  batch.nlines = nlines;
+  batch.results = results;
+  batch.captures = captures;
+
+  if (!nogvl || grok_has_callouts(grok)) {
+    _rgrok_batch_exec(&batch);
+    return;
+  }
+
+  _rgrok_batches_add(self, 1);
+  rb_ensure(_rgrok_batch_exec_nogvl, (VALUE)&batch,
+            _rgrok_batch_done, (VALUE)&batch);
+}
+
+static grok_t *_rgrok_compiled(VALUE self) {
+  grok_t *grok;
+
+  Data_Get_Struct(self, grok_t, grok);
+  if (grok->re == NULL) {
+    rb_raise(rb_eArgError, "No pattern compiled; call compile first");
+  }
+  return grok;
+}
+
+/* Match every string in 'subjects' (at most RGROK_BATCH_LINES) and push a
+ * GrokMatch, or false, for each onto 'matches'. Subjects must be frozen so
+ * their bytes can't change under us. */
+static void _rgrok_match_batch(VALUE self, VALUE subjects, VALUE matches,
+                               int nogvl) {
+  grok_t *grok = _rgrok_compiled(self);
+  grok_line_t lines[RGROK_BATCH_LINES];
+  grok_batch_match_t results[RGROK_BATCH_LINES];
+  int *captures;
+  VALUE names;
+  int nlines;
+  int ncap;
+  int i;
+
+  nlines = (int)RARRAY_LEN(subjects);
+  for (i = 0; i < nlines; i++) {
+    VALUE subject = rb_ary_entry(subjects, i);
+    lines[i].text = RSTRING_PTR(subject);
+    lines[i].len = (int)RSTRING_LEN(subject);
+  }
+
+  names = rGrok_capture_names(self);
+  ncap = grok_batch_captures_per_line(grok);
+  captures = ALLOC_N(int, nlines * ncap);
+  _rgrok_exec_lines(self, grok, lines, nlines, results, captures, nogvl);
+
+  for (i = 0; i < nlines; i++) {
+    switch (results[i].status) {
+      case GROK_OK:
+        rb_ary_push(matches,
+                    rGrokMatch_new_from_batch(self, names,
+                                              rb_ary_entry(subjects, i),
+                                              &results[i],
+                                              captures + i * ncap));
+        break;
+      case GROK_ERROR_NOMATCH:
+        rb_ary_push(matches, Qfalse);
+        break;
+      default:
+        xfree(captures);
+        rb_raise(rb_eArgError, "Error from grok_execn_batch: %d",
+                 results[i].status);
+    }
+  }
+  xfree(captures);
+}
+
+VALUE rGrok_match(VALUE self, VALUE input) {
+  VALUE subjects, matches;
+
+  /* A single line isn't worth giving up the GVL for */
+  StringValue(input);
+  subjects = rb_ary_new3(1, rb_str_new_frozen(input));
+  matches = rb_ary_new2(1);
+  _rgrok_match_batch(self, subjects, matches, 0);
+  return rb_ary_entry(matches, 0);
+}
+
+/* Grok#match_all(array) => [GrokMatch or false, ...]
+ * Matches a whole array of strings, releasing the GVL for each batch
+ * (see "Threads" above). */
+VALUE rGrok_match_all(VALUE self, VALUE input) {
+  VALUE subjects, matches;
+  long i, len;
+
+  Check_Type(input, T_ARRAY);
+  len = RARRAY_LEN(input);
+  matches = rb_ary_new2(len);
+  subjects = rb_ary_new2(RGROK_BATCH_LINES);
+  for (i = 0; i < len; i++) {
+    VALUE str = rb_ary_entry(input, i);
+    StringValue(str);
+    rb_ary_push(subjects, rb_str_new_frozen(str));
+    if (RARRAY_LEN(subjects) == RGROK_BATCH_LINES || i == len - 1) {
+      _rgrok_match_batch(self, subjects, matches, 1);
+      rb_ary_clear(subjects);
+    }
+  }
+
+  return matches;
+}
+
+/* Grok#each_match(io) { |match| ... }
+ * Reads lines from io with 'gets' and yields a GrokMatch for every line
+ * that matches. As with scan_file, a line's newline is not part of its
+ * subject. Lines are matched in batches without the GVL. */
+VALUE rGrok_each_match(VALUE self, VALUE io) {
+  VALUE subjects, matches, line;
+  long i, len;
+  int eof = 0;
+
+  subjects = rb_ary_new2(RGROK_BATCH_LINES);
+  matches = rb_ary_new2(RGROK_BATCH_LINES);
+  while (!eof) {
+    while (RARRAY_LEN(subjects) < RGROK_BATCH_LINES) {
+      line = rb_funcall(io, id_gets, 0);
+      if (NIL_P(line)) {
+        eof = 1;
+        break;
+      }
+      StringValue(line);
+      len = RSTRING_LEN(line);
+      if (len > 0 && RSTRING_PTR(line)[len - 1] == '\n') {
+        line = rb_str_new(RSTRING_PTR(line), len - 1);
+        rb_obj_freeze(line);
+      } else {
+        line = rb_str_new_frozen(line);
+      }
+      rb_ary_push(subjects, line);
+    }
+
+    if (RARRAY_LEN(subjects) == 0) {
       break;
-    default:
-      rb_raise(rb_eArgError, "Error from grok_execn: %d", ret);
-      rgm = Qnil;
+    }
+
+    _rgrok_match_batch(self, subjects, matches, 1);
+    for (i = 0; i < RARRAY_LEN(matches); i++) {
+      VALUE match = rb_ary_entry(matches, i);
+      if (match != Qfalse) {
+        rb_yield(match);
+      }
+    }
+    rb_ary_clear(subjects);
+    rb_ary_clear(matches);
+  }
+
+  return self;
+}
+
+struct rgrok_scan {
+  VALUE self;
+  VALUE path;
+  int fd;
+  char *buf;
+  long size;
+};
+
+/* Match 'nlines' lines of the file being scanned and push a GrokMatch for
+ * each one that matched onto 'matches'. Only matching lines become ruby
+ * strings. */
+static void _rgrok_scan_batch(VALUE self, grok_line_t *lines, int nlines,
+                              VALUE matches) {
+  grok_t *grok = _rgrok_compiled(self);
+  grok_batch_match_t results[RGROK_BATCH_LINES];
+  int *captures;
+  VALUE names;
+  int ncap;
+  int i;
+
+  names = rGrok_capture_names(self);
+  ncap = grok_batch_captures_per_line(grok);
+  captures = ALLOC_N(int, nlines * ncap);
+  _rgrok_exec_lines(self, grok, lines, nlines, results, captures, 1);
+
+  for (i = 0; i < nlines; i++) {
+    VALUE subject;
+    switch (results[i].status) {
+      case GROK_OK:
+        subject = rb_str_new(lines[i].text, lines[i].len);
+        rb_obj_freeze(subject);
+        rb_ary_push(matches,
+                    rGrokMatch_new_from_batch(self, names, subject,
+                                              &results[i],
+                                              captures + i * ncap));
+        break;
+      case GROK_ERROR_NOMATCH:
+        break;
+      default:
+        xfree(captures);
+        rb_raise(rb_eArgError, "Error from grok_execn_batch: %d",
+                 results[i].status);
+    }
+  }
+  xfree(captures);
+}
+
+static VALUE _rgrok_scan_file(VALUE arg) {
+  struct rgrok_scan *scan = (struct rgrok_scan *)arg;
+  grok_line_t lines[RGROK_BATCH_LINES];
+  VALUE matches = rb_ary_new2(RGROK_BATCH_LINES);
+  long fill = 0, start, end, next;
+  ssize_t bytes;
+  int nlines;
+  int eof = 0;
+  long i;
+
+  while (!eof) {
+    /* A line longer than the buffer; make room for more of it */
+    if (fill == scan->size) {
+      scan->size *= 2;
+      REALLOC_N(scan->buf, char, scan->size);
+    }
+
+    bytes = read(scan->fd, scan->buf + fill, scan->size - fill);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      rb_sys_fail(RSTRING_PTR(scan->path));
+    }
+    eof = (bytes == 0);
+    fill += bytes;
+
+    /* Match every complete line; at eof, an unterminated last line too */
+    start = 0;
+    for (;;) {
+      nlines = 0;
+      while (nlines < RGROK_BATCH_LINES && start < fill) {
+        char *nl = memchr(scan->buf + start, '\n', fill - start);
+        if (nl != NULL) {
+          end = nl - scan->buf;
+          next = end + 1;
+        } else if (eof) {
+          end = next = fill;
+        } else {
+          break;
+        }
+        lines[nlines].text = scan->buf + start;
+        lines[nlines].len = (int)(end - start);
+        nlines++;
+        start = next;
+      }
+
+      if (nlines == 0) {
+        break;
+      }
+
+      /* All of the batch is matched before yielding, so the block may do
+       * anything (even recompile) without pulling the lines from under us */
+      _rgrok_scan_batch(scan->self, lines, nlines, matches);
+      for (i = 0; i < RARRAY_LEN(matches); i++) {
+        rb_yield(rb_ary_entry(matches, i));
+      }
+      rb_ary_clear(matches);
+    }
+
+    memmove(scan->buf, scan->buf + start, fill - start);
+    fill -= start;
+  }
+
+  return scan->self;
+}
+
+static VALUE _rgrok_scan_file_close(VALUE arg) {
+  struct rgrok_scan *scan = (struct rgrok_scan *)arg;
+  close(scan->fd);
+  xfree(scan->buf);
+  return Qnil;
+}
+
+/* Grok#scan_file(path) { |match| ... }
+ * Reads the file at path in large blocks, splits it into lines (without
+ * their newlines, like each_match) and yields a GrokMatch for every line
+ * that matches. Lines that don't match never become ruby objects. Lines
+ * are matched in batches without the GVL, like each_match (see "Threads"
+ * above). */
+VALUE rGrok_scan_file(VALUE self, VALUE path) {
+  struct rgrok_scan scan;
+
+  _rgrok_compiled(self);
+  FilePathValue(path);
+  scan.self = self;
+  scan.path = path;
+  scan.fd = open(RSTRING_PTR(path), O_RDONLY);
+  if (scan.fd < 0) {
+    rb_sys_fail(RSTRING_PTR(path));
   }
+  scan.size = RGROK_SCAN_BUFSIZE;
+  scan.buf = ALLOC_N(char, scan.size);
 
-  return rgm;
+  return rb_ensure(_rgrok_scan_file, (VALUE)&scan,
+                   _rgrok_scan_file_close, (VALUE)&scan);
 }
 
 VALUE rGrok_add_pattern(VALUE self, VALUE name, VALUE pattern) {
@@ -82,6 +480,7 @@ VALUE rGrok_add_pattern(VALUE self, VALUE name, VALUE pattern) {
 
   c_name = rb_str2cstr(name, &namelen);
   c_pattern = rb_str2cstr(pattern, &patternlen);
+  _rgrok_check_idle(self);
   Data_Get_Struct(self, grok_t, grok);
 
   grok_pattern_add(grok, c_name, namelen, c_pattern, patternlen);
@@ -95,6 +494,7 @@ VALUE rGrok_add_patterns_from_file(VALUE self, VALUE path) {
   long pathlen = 0;
 
   c_path = rb_str2cstr(path, &pathlen);
+  _rgrok_check_idle(self);
   Data_Get_Struct(self, grok_t, grok);
 
   ret = grok_patterns_import_from_file(grok, c_path);
@@ -112,9 +512,15 @@ void Init_Grok() {
   rb_define_method(cGrok, "initialize", rGrok_initialize, 0);
   rb_define_method(cGrok, "compile", rGrok_compile, 1);
   rb_define_method(cGrok, "match", rGrok_match, 1);
+  rb_define_method(cGrok, "match_all", rGrok_match_all, 1);
+  rb_define_method(cGrok, "each_match", rGrok_each_match, 1);
+  rb_define_method(cGrok, "scan_file", rGrok_scan_file, 1);
   rb_define_method(cGrok, "add_pattern", rGrok_add_pattern, 2);
   rb_define_method(cGrok, "add_patterns_from_file",
                    rGrok_add_patterns_from_file, 1);
+  id_atcapture_names = rb_intern("@capture_names");
+  id_atbatches_running = rb_intern("@batches_running");
+  id_gets = rb_intern("gets");
 
   Init_GrokMatch();
 }
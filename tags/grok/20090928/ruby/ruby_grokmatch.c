@@ -1,4 +1,6 @@
+#define _IS_RUBY_GROKMATCH_
 #include "rgrok.h"
+#include "ruby_grokmatch.h"
 #include <grok.h>
 
 VALUE cGrokMatch;
@@ -9,6 +11,7 @@ static ID id_atstart;
 static ID id_atcaptures;
 static ID id_atsubject;
 
+static void rGrokMatch_mark(void *p);
 static void rGrokMatch_free(void *p);
 
 VALUE rGrokMatch_new(VALUE klass) {
@@ -18,51 +21,62 @@ VALUE rGrokMatch_new(VALUE klass) {
   return (VALUE)rgm;
 }
 
-VALUE rGrokMatch_new_from_grok_match(grok_match_t *gm) {
+VALUE rGrokMatch_new_from_batch(VALUE rgrok, VALUE names, VALUE subject,
+                                const grok_batch_match_t *result,
+                                const int *captures) {
   VALUE rgrokmatch;
-  grok_match_t *my_gm = NULL;
-  rgrokmatch = Data_Make_Struct(cGrokMatch, grok_match_t, 0,
-                                rGrokMatch_free, my_gm);
-  memcpy(my_gm, gm, sizeof(grok_match_t));
-  rb_obj_call_init(rgrokmatch, 0, 0);
+  rgrok_match_t *rgm = NULL;
+  int ncap;
+
+  rgrokmatch = Data_Make_Struct(cGrokMatch, rgrok_match_t, rGrokMatch_mark,
+                                rGrokMatch_free, rgm);
+  Data_Get_Struct(rgrok, grok_t, rgm->gm.grok);
+  rgm->gm.subject = RSTRING_PTR(subject);
+  rgm->gm.start = result->start;
+  rgm->gm.end = result->end;
+  rgm->rgrok = rgrok;
+  rgm->names = names;
+  rgm->subject = subject;
+
+  ncap = grok_batch_captures_per_line(rgm->gm.grok);
+  rgm->captures = ALLOC_N(int, ncap);
+  memcpy(rgm->captures, captures, ncap * sizeof(int));
   return rgrokmatch;
 }
 
 VALUE rGrokMatch_initialize(VALUE self) {
-  grok_match_t *gm;
-  VALUE captures;
-  
-  Data_Get_Struct(self, grok_match_t, gm);
+  /* empty; captures are built on demand */
+  return Qtrue;
+}
 
-  /* Set the @captures variable to a hash of array of strings */
-  captures = rb_hash_new();
-  //captures = rb_eval_string("Hash.new { |h,k| h[k] = Array.new }");
-  rb_iv_set(self, "@captures", captures);
+/* Returns the value of the capture at 'index', or nil if it didn't match */
+static VALUE _rgrokmatch_capture(rgrok_match_t *rgm, VALUE index) {
+  int start = rgm->captures[FIX2INT(index)];
+  int end = rgm->captures[FIX2INT(index) + 1];
 
-  return Qtrue;
+  if (start < 0) {
+    return Qnil;
+  }
+  return rb_str_substr(rgm->subject, start, end - start);
 }
 
 VALUE rGrokMatch_each_capture(VALUE self) {
-  char *name;
-  const char *data;
-  int namelen, datalen;
-  void *handle;
-  grok_match_t *gm;
-  VALUE captures;
-  ID pred_include;
-
-  Data_Get_Struct(self, grok_match_t, gm);
-  captures = rb_iv_get(self, "@captures");
-  pred_include = rb_intern("include?");
-  handle = grok_match_walk_init(gm);
-  while (grok_match_walk_next(gm, handle, &name, &namelen,
-                              &data, &datalen) == 0) {
-    VALUE key, value;
+  rgrok_match_t *rgm;
+  VALUE names;
+  long i;
+
+  Data_Get_Struct(self, rgrok_match_t, rgm);
+  names = rgm->names;
+  for (i = 0; i < RARRAY_LEN(names); i++) {
+    VALUE pair = rb_ary_entry(names, i);
+    VALUE key = rb_ary_entry(pair, 0);
 
 #ifdef _TRIM_KEY_EXCESS_IN_C_
   /* This section will skip captures of %{FOO} and rename captures of
    * %{FOO:bar} to just 'bar' */
-    size_t koff = 0;
+    const char *name = RSTRING_PTR(key);
+    long namelen = RSTRING_LEN(key);
+    long koff = 0;
     /* there is no 'strcspn' that takes a length, so do it ourselves */
     while (koff < namelen && name[koff] != ':' && name[koff] != '\0') {
       koff++;
@@ -70,7 +84,6 @@ VALUE rGrokMatch_each_capture(VALUE self) {
 
     /* Skip captures that aren't named specially */
     if (koff == namelen) {
-      //printf("Skipping %.*s\n", namelen, name);
       continue;
     }
 
@@ -79,100 +92,94 @@ VALUE rGrokMatch_each_capture(VALUE self) {
     key = rb_str_new(name + koff, namelen - koff);
 #endif
 
-    key = rb_str_new(name, namelen);
-    value = rb_str_new(data, datalen);
-
     // Yield [key, value]
-    rb_yield(rb_ary_new3(2, key, value));
-    //rb_ary_push(ary, value);
+    rb_yield(rb_ary_new3(2, key,
+                         _rgrokmatch_capture(rgm, rb_ary_entry(pair, 1))));
   }
 
-  grok_match_walk_end(gm, handle);
+  return self;
 }
 
-VALUE rGrokMatch_to_hash(VALUE self) {
-  char *name;
-  const char *data;
-  int namelen, datalen;
-  void *handle;
-  grok_match_t *gm;
-  VALUE captures;
-  ID pred_include;
-
-  captures = rb_iv_get(self, "@captures");
-
-  pred_include = rb_intern("include?");
-  handle = grok_match_walk_init(gm);
-  while (grok_match_walk_next(gm, handle, &name, &namelen,
-                              &data, &datalen) == 0) {
-    VALUE key, value;
-    VALUE ary;
+/* Returns a hash of capture name => array of values. The hash is built on
+ * the first call and cached. */
+VALUE rGrokMatch_captures(VALUE self) {
+  rgrok_match_t *rgm;
+  VALUE captures, names;
+  long i;
 
-#ifdef _TRIM_KEY_EXCESS_IN_C_
-  /* This section will skip captures of %{FOO} and rename captures of
-   * %{FOO:bar} to just 'bar' */
-    size_t koff = 0;
-    /* there is no 'strcspn' that takes a length, so do it ourselves */
-    while (koff < namelen && name[koff] != ':' && name[koff] != '\0') {
-      koff++;
-    }
+  captures = rb_ivar_get(self, id_atcaptures);
+  if (captures != Qnil) {
+    return captures;
+  }
 
-    /* Skip captures that aren't named specially */
-    if (koff == namelen) {
-      //printf("Skipping %.*s\n", namelen, name);
-      continue;
+  Data_Get_Struct(self, rgrok_match_t, rgm);
+  captures = rb_hash_new();
+  names = rgm->names;
+  for (i = 0; i < RARRAY_LEN(names); i++) {
+    VALUE pair = rb_ary_entry(names, i);
+    VALUE key = rb_ary_entry(pair, 0);
+    VALUE ary = rb_hash_aref(captures, key);
+
+    if (ary == Qnil) {
+      ary = rb_ary_new();
+      rb_hash_aset(captures, key, ary);
     }
+    rb_ary_push(ary, _rgrokmatch_capture(rgm, rb_ary_entry(pair, 1)));
+  }
 
-    koff++;
-
-    key = rb_str_new(name + koff, namelen - koff);
-#endif
+  rb_ivar_set(self, id_atcaptures, captures);
+  return captures;
+}
 
-    key = rb_str_new(name, namelen);
-    value = rb_str_new(data, datalen);
-    if (rb_funcall(captures, pred_include, 1, key) == Qfalse) {
-      rb_hash_aset(captures, key, rb_ary_new());
+/* match[name] => the first value captured as 'name', or nil. Only that one
+ * string is created. */
+VALUE rGrokMatch_aref(VALUE self, VALUE name) {
+  rgrok_match_t *rgm;
+  VALUE names;
+  long i;
+
+  StringValue(name);
+  Data_Get_Struct(self, rgrok_match_t, rgm);
+  names = rgm->names;
+  for (i = 0; i < RARRAY_LEN(names); i++) {
+    VALUE pair = rb_ary_entry(names, i);
+    if (rb_str_equal(rb_ary_entry(pair, 0), name) == Qtrue) {
+      return _rgrokmatch_capture(rgm, rb_ary_entry(pair, 1));
     }
-
-    //ary = rb_hash_aref(captures, key);
-    ary = rb_hash_lookup(captures, key);
-    rb_ary_push(ary, value);
   }
 
-  grok_match_walk_end(gm, handle);
-
-  return Qtrue;
-}
-
-VALUE rGrokMatch_captures(VALUE self) {
-  return rb_iv_get(self, "@captures");
+  return Qnil;
 }
 
 VALUE rGrokMatch_start(VALUE self) {
-  grok_match_t *gm;
-  Data_Get_Struct(self, grok_match_t, gm);
-  return INT2FIX(gm->start);
+  rgrok_match_t *rgm;
+  Data_Get_Struct(self, rgrok_match_t, rgm);
+  return INT2FIX(rgm->gm.start);
 }
 
 VALUE rGrokMatch_end(VALUE self) {
-  grok_match_t *gm;
-  Data_Get_Struct(self, grok_match_t, gm);
-  VALUE ret = Qnil;
-  ret = rb_iv_get(self, "@end");
-  if (ret == Qnil) {
-    ret = rb_iv_set(self, "@end", INT2FIX(gm->end));
-  }
-  return INT2FIX(gm->end);
+  rgrok_match_t *rgm;
+  Data_Get_Struct(self, rgrok_match_t, rgm);
+  return INT2FIX(rgm->gm.end);
 }
 
 VALUE rGrokMatch_subject(VALUE self) {
-  grok_match_t *gm;
-  Data_Get_Struct(self, grok_match_t, gm);
-  return rb_str_new2(gm->subject);
+  rgrok_match_t *rgm;
+  Data_Get_Struct(self, rgrok_match_t, rgm);
+  return rgm->subject;
+}
+
+static void rGrokMatch_mark(void *p) {
+  rgrok_match_t *rgm = (rgrok_match_t *)p;
+  rb_gc_mark(rgm->rgrok);
+  rb_gc_mark(rgm->names);
+  rb_gc_mark(rgm->subject);
 }
 
-void rGrokMatch_free(void *p) {
-  /* empty */
+static void rGrokMatch_free(void *p) {
+  rgrok_match_t *rgm = (rgrok_match_t *)p;
+  xfree(rgm->captures);
+  xfree(rgm);
 }
 
 void Init_GrokMatch() {
@@ -184,6 +191,7 @@ void Init_GrokMatch() {
   rb_define_method(cGrokMatch, "end", rGrokMatch_end, 0);
   rb_define_method(cGrokMatch, "subject", rGrokMatch_subject, 0);
   rb_define_method(cGrokMatch, "each_capture", rGrokMatch_each_capture, 0);
+  rb_define_method(cGrokMatch, "[]", rGrokMatch_aref, 1);
   id_atend = rb_intern("@end");
   id_atstart = rb_intern("@start");
   id_atcaptures = rb_intern("@captures");
@@ -10,5 +10,19 @@
   #define CONDEXTERN extern
 #endif
 
-CONDEXTERN VALUE rGrokMatch_new_from_grok_match(grok_match_t *gm);
+/* A GrokMatch owns a copy of its capture offsets, so it stays valid after
+ * later matches on the same Grok. Capture strings are only created when
+ * they are asked for. */
+typedef struct rgrok_match {
+  grok_match_t gm;
+  VALUE rgrok;   /* the Grok that matched */
+  VALUE names;   /* its rGrok_capture_names when it matched */
+  VALUE subject; /* the (frozen) string that was matched */
+  int *captures; /* (start, end) pairs indexed by grok_batch_capture_index */
+} rgrok_match_t;
+
+CONDEXTERN VALUE rGrokMatch_new_from_batch(VALUE rgrok, VALUE names,
+                                           VALUE subject,
+                                           const grok_batch_match_t *result,
+                                           const int *captures);
 #endif /*  _RUBY_GROKMATCH_H_ */
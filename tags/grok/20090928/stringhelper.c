@@ -1,11 +1,12 @@
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "stringhelper.h"
 
-void string_escape_like_c(char c, char *replstr, int *replstr_len, int *op);
-void string_escape_hex(char c, char *replstr, int *replstr_len, int *op);
-void string_escape_unicode(char c, char *replstr, int *replstr_len, int *op);
+void string_escape_like_c(unsigned char c, char *replstr, int *replstr_len);
+void string_escape_hex(unsigned char c, char *replstr, int *replstr_len);
+void string_escape_unicode(unsigned char c, char *replstr, int *replstr_len);
 
 static char all_chars[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
             16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
@@ -60,22 +61,33 @@ void substr_replace(char **strp,
   (*strp)[*strp_len] = '\0';
 }
 
-#define ESCAPE_INSERT 1
-#define ESCAPE_REPLACE 2
+/* Escaping is table driven. Each escape kernel has a table saying, for
+ * every byte value, how many extra bytes escaping it adds (0 if the byte is
+ * copied as-is) and what to write instead. Escaping a string is then two
+ * linear passes: sum the extra bytes to get the output size, and, if there
+ * were any, grow the buffer once and rewrite the string in place from the
+ * back, so nothing is moved more than once. */
+typedef struct escape_table {
+  unsigned char extra[256];
+  char repl[256][7]; /* longest is \uXXXX */
+} escape_table_t;
 
-/* Escape a set of characters in a string */
-void string_escape(char **strp, int *strp_len, int *strp_alloc_size,
-                   const char *chars, int chars_len, int options) {
-  int i = 0, j = 0, op = 0, replstr_len = 0;
-  char replstr[8]; /* 7 should be enough (covers \uXXXX + null) */
-  unsigned char c;
-  //int hits_total = 0;
-  unsigned char hits[256]; /* track chars found in the string */
-  memset(hits, 0, 256);
+static void _escape_table_init(escape_table_t *table);
+static void _escape_table_add(escape_table_t *table, const char *chars,
+                              int chars_len, int options);
+static void _escape_apply(const escape_table_t *table, char **strp,
+                          int *strp_len, int *strp_alloc_size);
 
-  //printf("string_escape(\"%.*s\", %d, %d, \"%.*s\", %d, %d)\n",
-         //*strp_len, *strp, *strp_len, *strp_alloc_size, chars_len, chars, 
-         //chars_len, options);
+static void _escape_table_init(escape_table_t *table) {
+  memset(table->extra, 0, sizeof(table->extra));
+}
+
+/* Set up the escapes for 'chars' the way string_escape documents them.
+ * Bytes some earlier call already escapes are left alone. */
+static void _escape_table_add(escape_table_t *table, const char *chars,
+                              int chars_len, int options) {
+  int i, replstr_len;
+  unsigned char c;
 
   if (chars_len < 0) {
     chars_len = strlen(chars);
@@ -86,105 +98,164 @@ void string_escape(char **strp, int *strp_len, int *strp_alloc_size,
     chars = all_chars;
   }
 
-  /* Make a map of characters found in the string */
-  for (i = 0; i < *strp_len; i++) {
-    c = (*strp)[i];
-    hits[c] = 1;
-  }
-
-
   for (i = 0; i < chars_len; i++) {
     c = chars[i];
-    if (hits[c] == 0) {
-      /* If this char is not in the string, skip it */
+    if (table->extra[c] > 0) {
       continue;
     }
 
     if (options & ESCAPE_NONPRINTABLE && isprint(c)) {
       continue;
     }
-    
-    for (j = 0; j < *strp_len; j++) {
-      //printf("%d / %c: %d\n", c, c, hits[(unsigned char)c]);
-      /* chars are signed, so > 127 == -128 and such, which is an
-       * invalid array offset in this case; cast to unsigned.  */
-      if ((*strp)[j] != c) {
-        continue;
-      }
 
-      //printf("Str: %.*s\n", strp_len, *strp);
-      //printf("     %*s^\n", j, "");
-      
-      replstr_len = 0;
-      op = ESCAPE_REPLACE; /* default operation */
-      if (replstr_len == 0 && options & ESCAPE_LIKE_C) {
-        string_escape_like_c(c, replstr, &replstr_len, &op);
-      } 
-      if (replstr_len == 0 && options & ESCAPE_UNICODE) {
-        string_escape_unicode(c, replstr, &replstr_len, &op);
-      }
-      if (replstr_len == 0 && options & ESCAPE_HEX) {
-        string_escape_hex(c, replstr, &replstr_len, &op);
-      }
+    replstr_len = 0;
+    if (replstr_len == 0 && options & ESCAPE_LIKE_C) {
+      string_escape_like_c(c, table->repl[c], &replstr_len);
+    }
+    if (replstr_len == 0 && options & ESCAPE_UNICODE) {
+      string_escape_unicode(c, table->repl[c], &replstr_len);
+    }
+    if (replstr_len == 0 && options & ESCAPE_HEX) {
+      string_escape_hex(c, table->repl[c], &replstr_len);
+    }
 
-      if (replstr_len > 0) {
-        switch (op) {
-          case ESCAPE_INSERT:
-            substr_replace(strp, strp_len, strp_alloc_size, j, j,
-                           replstr, replstr_len);
-            break;
-          case ESCAPE_REPLACE:
-            substr_replace(strp, strp_len, strp_alloc_size, j, j + replstr_len - 1,
-                           replstr, replstr_len);
-            break;
-        }
-      }
+    if (replstr_len > 0) {
+      table->extra[c] = replstr_len - 1;
+    }
+  }
+}
+
+static void _escape_apply(const escape_table_t *table, char **strp,
+                          int *strp_len, int *strp_alloc_size) {
+  const unsigned char *extra = table->extra;
+  unsigned char *s = (unsigned char *)*strp;
+  int len = *strp_len;
+  int grow = 0;
+  int in, out;
+
+  /* Pass 1: output size. Eight bytes per step, no branches. */
+  for (in = 0; in + 8 <= len; in += 8) {
+    grow += extra[s[in]] + extra[s[in + 1]] + extra[s[in + 2]]
+            + extra[s[in + 3]] + extra[s[in + 4]] + extra[s[in + 5]]
+            + extra[s[in + 6]] + extra[s[in + 7]];
+  }
+  for (; in < len; in++) {
+    grow += extra[s[in]];
+  }
+
+  if (grow == 0) {
+    return;
+  }
+
+  if (len + grow >= *strp_alloc_size) {
+    *strp_alloc_size = len + grow + 1;
+    *strp = realloc(*strp, *strp_alloc_size);
+    s = (unsigned char *)*strp;
+  }
 
-      j += replstr_len;
+  /* Pass 2: write back to front. Once 'out' catches up with 'in', the rest
+   * of the string needs no escaping and is already where it belongs. */
+  out = len + grow;
+  s[out] = '\0';
+  for (in = len - 1; out > in + 1; in--) {
+    unsigned char c = s[in];
+    if (extra[c] == 0) {
+      s[--out] = c;
+    } else {
+      out -= extra[c] + 1;
+      memcpy(s + out, table->repl[c], extra[c] + 1);
     }
   }
+  *strp_len = len + grow;
+}
+
+/* Escape a set of characters in a string */
+void string_escape(char **strp, int *strp_len, int *strp_alloc_size,
+                   const char *chars, int chars_len, int options) {
+  escape_table_t table;
+
+  _escape_table_init(&table);
+  _escape_table_add(&table, chars, chars_len, options);
+  _escape_apply(&table, strp, strp_len, strp_alloc_size);
 }
 
-void string_escape_like_c(char c, char *replstr, int *replstr_len, int *op) {
+/* \, " and / get a backslash; every other nonprintable byte is written
+ * as \u00XX. */
+void string_escape_json(char **strp, int *strp_len, int *strp_alloc_size) {
+  static escape_table_t table;
+  static int ready = 0;
+
+  if (!ready) {
+    _escape_table_init(&table);
+    _escape_table_add(&table, "\\\"/", 3, ESCAPE_LIKE_C);
+    _escape_table_add(&table, "", 0, ESCAPE_NONPRINTABLE | ESCAPE_UNICODE);
+    ready = 1;
+  }
+  _escape_apply(&table, strp, strp_len, strp_alloc_size);
+}
+
+void string_escape_shell(char **strp, int *strp_len, int *strp_alloc_size) {
+  static escape_table_t table;
+  static int ready = 0;
+
+  if (!ready) {
+    _escape_table_init(&table);
+    _escape_table_add(&table, "`^()&{}[]$*?!|;'\"\\", -1, ESCAPE_LIKE_C);
+    ready = 1;
+  }
+  _escape_apply(&table, strp, strp_len, strp_alloc_size);
+}
+
+/* Only what is special inside "double quotes" */
+void string_escape_shell_dq(char **strp, int *strp_len,
+                            int *strp_alloc_size) {
+  static escape_table_t table;
+  static int ready = 0;
+
+  if (!ready) {
+    _escape_table_init(&table);
+    _escape_table_add(&table, "\\`$\"", -1, ESCAPE_LIKE_C);
+    ready = 1;
+  }
+  _escape_apply(&table, strp, strp_len, strp_alloc_size);
+}
+
+void string_escape_like_c(unsigned char c, char *replstr, int *replstr_len) {
   char *r = NULL;
 
   /* XXX: This should check iscntrl, instead, probably... */
   if (isprint(c)) {
-    *op = ESCAPE_INSERT;
-    r = "\\";
-    *replstr_len = 1;
+    replstr[0] = '\\';
+    replstr[1] = c;
+    *replstr_len = 2;
+    return;
+  }
+
+  switch (c) {
+    case '\n': r = "\\n"; break;
+    case '\r': r = "\\r"; break;
+    case '\b': r = "\\b"; break;
+    case '\f': r = "\\f"; break;
+    case '\t': r = "\\t"; break;
+    case '\a': r = "\\a"; break;
+  }
+  if (r) {
+    *replstr_len = 2;
+    memcpy(replstr, r, 2);
   } else {
-    *op = ESCAPE_REPLACE;
-    switch (c) {
-      case '\n': r = "\\n"; break;
-      case '\r': r = "\\r"; break;
-      case '\b': r = "\\b"; break;
-      case '\f': r = "\\f"; break;
-      case '\t': r = "\\t"; break;
-      case '\a': r = "\\a"; break;
-    }
-    if (r) {
-      *replstr_len = 2;
-    } else {
-      *replstr_len = 0;
-    }
+    *replstr_len = 0;
   }
-  memcpy(replstr, r, *replstr_len);
 }
 
-void string_escape_hex(char c, char *replstr, int *replstr_len, int *op) { 
-  *op = ESCAPE_REPLACE;
-  *replstr_len = sprintf(replstr, "\\x%x", (unsigned char) c);
-  //printf("Unicode: %.*s\n", *replstr_len, replstr);
+void string_escape_hex(unsigned char c, char *replstr, int *replstr_len) {
+  *replstr_len = sprintf(replstr, "\\x%x", c);
 }
 
-void string_escape_unicode(char c, char *replstr, int *replstr_len, int *op) { 
+void string_escape_unicode(unsigned char c, char *replstr, int *replstr_len) {
   /* XXX: We should check the options to see if we should only convert
    * nonprintables */
   if (!isprint(c)) {
-    *op = ESCAPE_REPLACE;
-    *replstr_len = sprintf(replstr, "\\u00%02x",(unsigned char) c);
-    //printf("Unicode: %.*s\n", *replstr_len, replstr);
+    *replstr_len = sprintf(replstr, "\\u00%02x", c);
   }
 }
 
@@ -237,3 +308,13 @@ char *string_ndup(const char *src, size_t size) {
 
   return dup;
 }
+
+unsigned int string_hash(const char *str, size_t len) {
+  unsigned int hash = 2166136261U;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
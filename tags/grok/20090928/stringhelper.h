@@ -10,8 +10,18 @@ void substr_replace(char **strp, int *strp_len, int *strp_alloc_size,
 
 void string_escape(char **strp, int *strp_len, int *strp_alloc_size,
                    const char *chars, int chars_len, int options);
+
+/* Fixed escapes used by the reaction filters. Like string_escape, these
+ * run in time linear in the length of the string and reallocate at most
+ * once. */
+void string_escape_json(char **strp, int *strp_len, int *strp_alloc_size);
+void string_escape_shell(char **strp, int *strp_len, int *strp_alloc_size);
+void string_escape_shell_dq(char **strp, int *strp_len, int *strp_alloc_size);
 void string_unescape(char **strp, int *strp_len, int *strp_size);
 
 /* libc doesn't often have strndup, so let's make our own */
 char *string_ndup(const char *src, size_t size);
 
+/* FNV-1a hash of 'len' bytes of 'str' */
+unsigned int string_hash(const char *str, size_t len);
+
@@ -0,0 +1,129 @@
+#include <time.h>
+
+#include "test_program.h"
+
+/* A program with a 1ms budget and no input; lines are handed to the
+ * budget directly */
+static void _budget_init(test_program_t *tp, int over_budget) {
+  test_program_init(tp);
+  grok_matchconfig_compile(&tp->gprog, &tp->gmc);
+  tp->gprog.budget.cpu_ms = 1;
+  tp->gprog.budget.over_budget = over_budget;
+  tp->gprog.budget.sample_rate = 3;
+  tp->gprog.budget.catchup_max = 2;
+}
+
+/* Charge 2ms, using up this second's budget */
+static void _budget_overspend(test_program_t *tp) {
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (start.tv_nsec >= 2000000) {
+    start.tv_nsec -= 2000000;
+  } else {
+    start.tv_sec--;
+    start.tv_nsec += 1000000000 - 2000000;
+  }
+  grok_program_budget_charge(&tp->gprog, &start);
+}
+
+static int _budget_admit(test_program_t *tp, const char *text) {
+  return grok_program_budget_admit(&tp->gprog, &tp->input, text);
+}
+
+void test_grok_budget_under_budget_matches_all(void) {
+  test_program_t tp;
+
+  _budget_init(&tp, BUDGET_SAMPLE);
+  CU_ASSERT(_budget_admit(&tp, "one") == BUDGET_MATCH_ALL);
+  CU_ASSERT(_budget_admit(&tp, "two") == BUDGET_MATCH_ALL);
+  CU_ASSERT(tp.gprog.budget.sampled_out == 0);
+
+  /* No budget at all */
+  tp.gprog.budget.cpu_ms = 0;
+  _budget_overspend(&tp);
+  CU_ASSERT(_budget_admit(&tp, "three") == BUDGET_MATCH_ALL);
+  test_program_free(&tp);
+}
+
+void test_grok_budget_sample(void) {
+  test_program_t tp;
+
+  _budget_init(&tp, BUDGET_SAMPLE);
+  CU_ASSERT(_budget_admit(&tp, "first") == BUDGET_MATCH_ALL);
+  _budget_overspend(&tp);
+
+  /* 1 in sample_rate (3) lines still gets matched */
+  CU_ASSERT(_budget_admit(&tp, "a") == BUDGET_MATCH_ALL);
+  CU_ASSERT(_budget_admit(&tp, "b") == BUDGET_MATCH_NONE);
+  CU_ASSERT(_budget_admit(&tp, "c") == BUDGET_MATCH_NONE);
+  CU_ASSERT(_budget_admit(&tp, "d") == BUDGET_MATCH_ALL);
+  CU_ASSERT(tp.gprog.budget.sampled_out == 2);
+  CU_ASSERT(tp.gprog.budget.low_skipped == 0);
+  CU_ASSERT(tp.gprog.budget.deferred == 0);
+  test_program_free(&tp);
+}
+
+void test_grok_budget_skip_low_priority(void) {
+  test_program_t tp;
+
+  _budget_init(&tp, BUDGET_SKIP_LOW_PRIORITY);
+  CU_ASSERT(_budget_admit(&tp, "first") == BUDGET_MATCH_ALL);
+  _budget_overspend(&tp);
+
+  CU_ASSERT(_budget_admit(&tp, "a") == BUDGET_MATCH_NORMAL);
+  CU_ASSERT(_budget_admit(&tp, "b") == BUDGET_MATCH_NORMAL);
+  CU_ASSERT(tp.gprog.budget.low_skipped == 2);
+  CU_ASSERT(tp.gprog.budget.sampled_out == 0);
+  test_program_free(&tp);
+}
+
+void test_grok_budget_defer_and_flush(void) {
+  test_program_t tp;
+  char *output;
+
+  _budget_init(&tp, BUDGET_DEFER);
+  CU_ASSERT(_budget_admit(&tp, "first") == BUDGET_MATCH_ALL);
+  _budget_overspend(&tp);
+
+  /* catchup_max (2) lines are queued, the rest dropped */
+  CU_ASSERT(_budget_admit(&tp, "queued 1") == BUDGET_MATCH_NONE);
+  CU_ASSERT(_budget_admit(&tp, "queued 2") == BUDGET_MATCH_NONE);
+  CU_ASSERT(_budget_admit(&tp, "dropped") == BUDGET_MATCH_NONE);
+  CU_ASSERT(tp.gprog.budget.deferred == 2);
+  CU_ASSERT(tp.gprog.budget.dropped == 1);
+  CU_ASSERT(tp.gprog.budget.queued == 2);
+
+  output = test_program_output(&tp);
+  CU_ASSERT(!strcmp(output, ""));
+  free(output);
+
+  grok_program_budget_flush(&tp.gprog);
+  output = test_program_output(&tp);
+  CU_ASSERT(!strcmp(output, "queued 1\nqueued 2\n"));
+  free(output);
+  CU_ASSERT(tp.gprog.budget.queued == 0);
+  CU_ASSERT(tp.gprog.budget.queue_head == NULL);
+  CU_ASSERT(tp.gprog.budget.drain_pending == 0);
+  test_program_free(&tp);
+}
+
+void test_grok_budget_defer_drains_next_second(void) {
+  test_program_t tp;
+  char *output;
+
+  _budget_init(&tp, BUDGET_DEFER);
+  CU_ASSERT(_budget_admit(&tp, "first") == BUDGET_MATCH_ALL);
+  _budget_overspend(&tp);
+  CU_ASSERT(_budget_admit(&tp, "queued 1") == BUDGET_MATCH_NONE);
+  CU_ASSERT(_budget_admit(&tp, "queued 2") == BUDGET_MATCH_NONE);
+
+  /* The queue drains when the next second starts */
+  test_program_run(&tp, 1100);
+  output = test_program_output(&tp);
+  CU_ASSERT(!strcmp(output, "queued 1\nqueued 2\n"));
+  free(output);
+  CU_ASSERT(tp.gprog.budget.queued == 0);
+  CU_ASSERT(_budget_admit(&tp, "after") == BUDGET_MATCH_ALL);
+  test_program_free(&tp);
+}
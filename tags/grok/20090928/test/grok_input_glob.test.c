@@ -0,0 +1,142 @@
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_program.h"
+
+static void _write_file(const char *dir, const char *name, const char *mode,
+                        const char *data) {
+  char path[256];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fp = fopen(path, mode);
+  fputs(data, fp);
+  fclose(fp);
+}
+
+static void _glob_input(test_program_t *tp, char *pattern, const char *dir,
+                        int max_open) {
+  sprintf(pattern, "%s/*.log", dir);
+  tp->input.type = I_GLOB;
+  tp->input.source.glob.file.filename = pattern;
+  tp->input.source.glob.file.follow = 1;
+  tp->input.source.glob.max_open = max_open;
+}
+
+static int _count_fds(void) {
+  int fd, count = 0;
+  for (fd = 0; fd < 1024; fd++) {
+    count += (fcntl(fd, F_GETFD) != -1);
+  }
+  return count;
+}
+
+/* Start with the descriptor limit at the lowest free descriptor, so
+ * inotify_init() fails and the glob falls back to polling. Nothing else
+ * can be opened then either; the first sweep finds the files. */
+static void _start_polling(test_program_t *tp) {
+  struct rlimit rl, tight;
+  int lowest = open("/dev/null", O_RDONLY);
+
+  close(lowest);
+  getrlimit(RLIMIT_NOFILE, &rl);
+  tight = rl;
+  tight.rlim_cur = lowest;
+  setrlimit(RLIMIT_NOFILE, &tight);
+  test_program_start(tp);
+  setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+void test_grok_input_glob_poll_sweeps_repeatedly(void) {
+  test_program_t tp;
+  char dir[] = "/tmp/grok_glob_test.XXXXXX";
+  char pattern[64], path[64];
+
+  mkdtemp(dir);
+  _write_file(dir, "a.log", "w", "a1\n");
+  test_program_init(&tp);
+  _glob_input(&tp, pattern, dir, GLOB_DEFAULT_MAX_OPEN);
+  _start_polling(&tp);
+
+  /* The sweep every second finds the file, */
+  test_program_run(&tp, 1500);
+  CU_ASSERT(test_program_count(&tp, "a1") == 1);
+
+  /* then a new file and new data, */
+  _write_file(dir, "b.log", "w", "b1\n");
+  _write_file(dir, "a.log", "a", "a2\n");
+  test_program_run(&tp, 1000);
+  CU_ASSERT(test_program_count(&tp, "b1") == 1);
+  CU_ASSERT(test_program_count(&tp, "a2") == 1);
+
+  /* then a truncated file, read again from the start */
+  snprintf(path, sizeof(path), "%s/a.log", dir);
+  truncate(path, 0);
+  _write_file(dir, "a.log", "a", "a3\n");
+  test_program_run(&tp, 1000);
+  CU_ASSERT(test_program_count(&tp, "a3") == 1);
+  CU_ASSERT(test_program_count(&tp, "a1") == 1);
+
+  test_program_free(&tp);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/b.log", dir);
+  unlink(path);
+  rmdir(dir);
+}
+
+void test_grok_input_glob_max_open_keeps_offsets(void) {
+  test_program_t tp;
+  char dir[] = "/tmp/grok_glob_test.XXXXXX";
+  char pattern[64], name[16], line[32];
+  char *output, *p;
+  int next[4] = { 0, 0, 0, 0 };
+  int i, j, fds, in_order = 1;
+
+  /* Each file takes two reads, and with two open at a time every file is
+   * closed between them and reopened at its offset */
+  mkdtemp(dir);
+  for (i = 0; i < 4; i++) {
+    snprintf(name, sizeof(name), "%d.log", i);
+    _write_file(dir, name, "w", "");
+    for (j = 0; j < 5000; j++) {
+      snprintf(line, sizeof(line), "file %d line %d\n", i, j);
+      _write_file(dir, name, "a", line);
+    }
+  }
+
+  test_program_init(&tp);
+  _glob_input(&tp, pattern, dir, 2);
+  fds = _count_fds();
+  test_program_start(&tp);
+  test_program_run(&tp, 500);
+
+  /* Two files, and maybe an inotify descriptor */
+  CU_ASSERT(_count_fds() - fds <= 3);
+
+  output = test_program_output(&tp);
+  for (p = output; *p != '\0'; p = strchr(p, '\n') + 1) {
+    if (sscanf(p, "file %d line %d", &i, &j) != 2 || i < 0 || i > 3
+        || j != next[i]) {
+      in_order = 0;
+      break;
+    }
+    next[i]++;
+  }
+  free(output);
+  CU_ASSERT(in_order);
+  for (i = 0; i < 4; i++) {
+    CU_ASSERT(next[i] == 5000);
+  }
+
+  test_program_free(&tp);
+  for (i = 0; i < 4; i++) {
+    snprintf(line, sizeof(line), "%s/%d.log", dir, i);
+    unlink(line);
+  }
+  rmdir(dir);
+}
@@ -0,0 +1,46 @@
+#include <string.h>
+
+#include "grok.h"
+#include "grok_input.h"
+
+void test_grok_process_argv_parse_words(void) {
+  char **argv = grok_process_argv_parse("  ping -c 1\twww.google.com ");
+
+  CU_ASSERT(argv != NULL);
+  CU_ASSERT(!strcmp(argv[0], "ping"));
+  CU_ASSERT(!strcmp(argv[1], "-c"));
+  CU_ASSERT(!strcmp(argv[2], "1"));
+  CU_ASSERT(!strcmp(argv[3], "www.google.com"));
+  CU_ASSERT(argv[4] == NULL);
+  grok_process_argv_free(argv);
+}
+
+void test_grok_process_argv_parse_quotes(void) {
+  char **argv = grok_process_argv_parse(
+      "grep 'a  \"b' \"c\\\"d\\\\\" e\\ f ''");
+
+  CU_ASSERT(argv != NULL);
+  CU_ASSERT(!strcmp(argv[0], "grep"));
+  CU_ASSERT(!strcmp(argv[1], "a  \"b"));
+  CU_ASSERT(!strcmp(argv[2], "c\"d\\"));
+  CU_ASSERT(!strcmp(argv[3], "e f"));
+  CU_ASSERT(!strcmp(argv[4], ""));
+  CU_ASSERT(argv[5] == NULL);
+  grok_process_argv_free(argv);
+}
+
+void test_grok_process_argv_parse_nothing_special(void) {
+  char **argv = grok_process_argv_parse("echo $HOME *.log > out");
+
+  CU_ASSERT(!strcmp(argv[1], "$HOME"));
+  CU_ASSERT(!strcmp(argv[2], "*.log"));
+  CU_ASSERT(!strcmp(argv[3], ">"));
+  grok_process_argv_free(argv);
+}
+
+void test_grok_process_argv_parse_invalid(void) {
+  CU_ASSERT(grok_process_argv_parse("") == NULL);
+  CU_ASSERT(grok_process_argv_parse("   ") == NULL);
+  CU_ASSERT(grok_process_argv_parse("echo 'oops") == NULL);
+  CU_ASSERT(grok_process_argv_parse("echo \"oops\\\"") == NULL);
+}
@@ -0,0 +1,260 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grok.h"
+#include "grok_input.h"
+#include "test_program.h"
+
+void test_grok_syslog_parse_full_header(void) {
+  grok_syslog_header_t hdr;
+  const char *msg = "<34>Oct 11 22:14:15 mymachine su: 'su root' failed";
+
+  CU_ASSERT(grok_syslog_parse(msg, strlen(msg), &hdr) == 0);
+  CU_ASSERT(hdr.pri == 34);
+  CU_ASSERT(hdr.facility == 4);
+  CU_ASSERT(hdr.severity == 2);
+  CU_ASSERT(hdr.timestamp == msg + 4);
+  CU_ASSERT(hdr.host_len == 9 && !strncmp(hdr.host, "mymachine", 9));
+  CU_ASSERT(hdr.text == msg + 4);
+  CU_ASSERT(hdr.text_len == strlen(msg) - 4);
+}
+
+void test_grok_syslog_parse_padded_day(void) {
+  grok_syslog_header_t hdr;
+  const char *msg = "<13>Feb  5 17:32:18 10.0.0.99 Use the BFG!";
+
+  CU_ASSERT(grok_syslog_parse(msg, strlen(msg), &hdr) == 0);
+  CU_ASSERT(hdr.pri == 13);
+  CU_ASSERT(hdr.timestamp != NULL);
+  CU_ASSERT(hdr.host_len == 9 && !strncmp(hdr.host, "10.0.0.99", 9));
+}
+
+void test_grok_syslog_parse_no_header(void) {
+  grok_syslog_header_t hdr;
+  const char *msg = "<13>hello world";
+
+  /* PRI without a TIMESTAMP: the text is everything after the PRI */
+  CU_ASSERT(grok_syslog_parse(msg, strlen(msg), &hdr) == 0);
+  CU_ASSERT(hdr.pri == 13);
+  CU_ASSERT(hdr.timestamp == NULL);
+  CU_ASSERT(hdr.host == NULL);
+  CU_ASSERT(hdr.text_len == 11 && !strncmp(hdr.text, "hello world", 11));
+}
+
+void test_grok_syslog_parse_bad_pri(void) {
+  grok_syslog_header_t hdr;
+
+  CU_ASSERT(grok_syslog_parse("<192>foo", 8, &hdr) == -1);
+  CU_ASSERT(hdr.text_len == 8);
+  CU_ASSERT(grok_syslog_parse("<1234>foo", 9, &hdr) == -1);
+  CU_ASSERT(grok_syslog_parse("<>foo", 5, &hdr) == -1);
+  CU_ASSERT(grok_syslog_parse("foo", 3, &hdr) == -1);
+  CU_ASSERT(hdr.text_len == 3 && hdr.pri == -1);
+}
+
+/* Listen on an ephemeral loopback port; returns the port */
+static int _syslog_start(test_program_t *tp, int protocol) {
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+
+  tp->input.type = I_SYSLOG;
+  tp->input.source.syslog.address = "127.0.0.1:0";
+  tp->input.source.syslog.protocol = protocol;
+  tp->input.source.syslog.fd = -1;
+  test_program_start(tp);
+
+  getsockname(tp->input.source.syslog.fd, (struct sockaddr *)&addr,
+              &addrlen);
+  return ntohs(addr.sin_port);
+}
+
+static int _syslog_connect(int type, int port) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, type, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+  return fd;
+}
+
+static void _syslog_send(int fd, const char *data) {
+  send(fd, data, strlen(data), 0);
+}
+
+void test_grok_input_syslog_udp_batches(void) {
+  test_program_t tp;
+  char msg[64];
+  char *output, *p;
+  int fd, i, in_order = 1;
+
+  test_program_init(&tp);
+  fd = _syslog_connect(SOCK_DGRAM, _syslog_start(&tp, SYSLOG_UDP));
+
+  /* More than one recvmmsg(2) batch is waiting by the time we read */
+  for (i = 0; i < SYSLOG_BATCH + 8; i++) {
+    snprintf(msg, sizeof(msg), "<34>Oct 11 22:14:15 host app: udp %d%s", i,
+             (i % 2) ? "\n" : "");
+    _syslog_send(fd, msg);
+  }
+  _syslog_send(fd, "<13>no header here");
+  test_program_run(&tp, 200);
+
+  output = test_program_output(&tp);
+  for (i = 0, p = output; i < SYSLOG_BATCH + 8; i++) {
+    snprintf(msg, sizeof(msg), "Oct 11 22:14:15 host app: udp %d\n", i);
+    if (strncmp(p, msg, strlen(msg))) {
+      in_order = 0;
+      break;
+    }
+    p += strlen(msg);
+  }
+  CU_ASSERT(in_order);
+
+  /* The header is made up, with the sender as the host */
+  CU_ASSERT(strstr(output, " 127.0.0.1 no header here\n") != NULL);
+  free(output);
+
+  close(fd);
+  test_program_free(&tp);
+}
+
+void test_grok_input_syslog_tcp_framing(void) {
+  test_program_t tp;
+  int fd;
+
+  test_program_init(&tp);
+  fd = _syslog_connect(SOCK_STREAM, _syslog_start(&tp, SYSLOG_TCP));
+
+  /* Both framings may be mixed on one connection */
+  _syslog_send(fd, "<34>Oct 11 22:14:15 host app: by newline\n"
+                   "37 <34>Oct 11 22:14:15 host app: counted"
+                   "<34>Oct 11 22:14:15 host app: crlf\r\n");
+  test_program_run(&tp, 200);
+
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: by newline")
+            == 1);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: counted")
+            == 1);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: crlf") == 1);
+
+  close(fd);
+  test_program_free(&tp);
+}
+
+void test_grok_input_syslog_tcp_split_frames(void) {
+  test_program_t tp;
+  int fd;
+
+  test_program_init(&tp);
+  fd = _syslog_connect(SOCK_STREAM, _syslog_start(&tp, SYSLOG_TCP));
+
+  /* Only part of the length, */
+  _syslog_send(fd, "3");
+  test_program_run(&tp, 100);
+
+  /* then only part of the message, */
+  _syslog_send(fd, "5 <34>Oct 11 22:14:15 host ");
+  test_program_run(&tp, 100);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: split") == 0);
+
+  /* then the rest, and half of a newline-framed message */
+  _syslog_send(fd, "app: split<34>Oct 11 22:14:15 host app: ");
+  test_program_run(&tp, 100);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: split") == 1);
+
+  _syslog_send(fd, "other half\n");
+  test_program_run(&tp, 100);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: other half")
+            == 1);
+
+  close(fd);
+  test_program_free(&tp);
+}
+
+void test_grok_input_syslog_tcp_oversize_closes(void) {
+  test_program_t tp;
+  char buf[16];
+  int port, fd;
+
+  test_program_init(&tp);
+  port = _syslog_start(&tp, SYSLOG_TCP);
+  fd = _syslog_connect(SOCK_STREAM, port);
+
+  /* A length over SYSLOG_MAXMSG gets the connection closed, and nothing
+   * after it is read */
+  _syslog_send(fd, "9000 <34>Oct 11 22:14:15 host app: too long\n"
+                   "<34>Oct 11 22:14:15 host app: after\n");
+  test_program_run(&tp, 100);
+  CU_ASSERT(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) == 0);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: after") == 0);
+  close(fd);
+
+  /* Other connections still work */
+  fd = _syslog_connect(SOCK_STREAM, port);
+  _syslog_send(fd, "<34>Oct 11 22:14:15 host app: next\n");
+  test_program_run(&tp, 100);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: next") == 1);
+
+  close(fd);
+  test_program_free(&tp);
+}
+
+void test_grok_input_syslog_tcp_overlong_lines(void) {
+  test_program_t tp;
+  const char *header = "<34>Oct 11 22:14:15 host app: ";
+  char *msg, *expect, *output;
+  int fd, i;
+
+  test_program_init(&tp);
+  fd = _syslog_connect(SOCK_STREAM, _syslog_start(&tp, SYSLOG_TCP));
+
+  /* An 11K line, the first 8000 bytes of it on their own */
+  msg = malloc(11000 + 1);
+  strcpy(msg, header);
+  memset(msg + strlen(header), 'x', 11000 - strlen(header));
+  msg[11000] = '\0';
+  send(fd, msg, 8000, 0);
+  test_program_run(&tp, 100);
+  _syslog_send(fd, msg + 8000);
+  _syslog_send(fd, "\n<34>Oct 11 22:14:15 host app: after newline\n");
+  test_program_run(&tp, 100);
+
+  /* It is cut to SYSLOG_MAXMSG, less the <PRI> */
+  expect = strndup(msg + 4, SYSLOG_MAXMSG - 4);
+  CU_ASSERT(test_program_count(&tp, expect) == 1);
+  CU_ASSERT(test_program_count(&tp,
+                               "Oct 11 22:14:15 host app: after newline") == 1);
+
+  /* Without a newline in sight, what we have is matched and the rest of
+   * the line is dropped when it arrives */
+  msg[strlen(header)] = 'y';
+  send(fd, msg, SYSLOG_MAXMSG + 100, 0);
+  test_program_run(&tp, 100);
+  _syslog_send(fd, "rest of it\n<34>Oct 11 22:14:15 host app: next\n");
+  test_program_run(&tp, 100);
+
+  expect[strlen(header) - 4] = 'y';
+  CU_ASSERT(test_program_count(&tp, expect) == 1);
+  CU_ASSERT(test_program_count(&tp, "Oct 11 22:14:15 host app: next") == 1);
+
+  /* Nothing else got through */
+  output = test_program_output(&tp);
+  for (i = 0; output[i] != '\0'; i += strcspn(output + i, "\n") + 1) {
+    CU_ASSERT(!strncmp(output + i, "Oct 11 22:14:15 host app: ", 26));
+  }
+  CU_ASSERT(strstr(output, "rest of it") == NULL);
+  free(output);
+
+  free(expect);
+  free(msg);
+  close(fd);
+  test_program_free(&tp);
+}
@@ -3,7 +3,7 @@
 
 void test_grok_pattern_add_and_find_work(void) {
   INIT;
-  char *regexp;
+  const char *regexp;
   size_t len;
 
   grok_pattern_add(&grok, "WORD", 5, "\\w+", 3);
@@ -12,12 +12,14 @@ void test_grok_pattern_add_and_find_work(void) {
   grok_pattern_find(&grok, "WORD", 5, &regexp, &len);
   CU_ASSERT(len == 3);
   CU_ASSERT(!strncmp(regexp, "\\w+", len));
-  free(regexp);
 
   grok_pattern_find(&grok, "TEST", 5, &regexp, &len);
   CU_ASSERT(len == 4);
   CU_ASSERT(!strncmp(regexp, "TEST", len));
-  free(regexp);
+
+  CU_ASSERT(grok_pattern_find(&grok, "NOTFOUND", 8, &regexp, &len)
+            == GROK_ERROR_PATTERN_NOT_FOUND);
+  CU_ASSERT(regexp == NULL);
 
   CLEANUP;
 }
@@ -54,13 +56,51 @@ void test_pattern_import_from_string(void) {
      "# This is a comment\n"
      "FOO bar\n";
 
+  const char *regexp;
+  size_t len;
+
   buf = strdup(buf);
   grok_patterns_import_from_string(&grok, buf);
 
-  //CU_ASSERT(!strcmp(grok_pattern_find(&grok, "WORD", 5), "\\w+"));
-  //CU_ASSERT(!strcmp(grok_pattern_find(&grok, "TEST", 5), "test"));
-  //CU_ASSERT(!strcmp(grok_pattern_find(&grok, "FOO", 4), "bar"));
+  CU_ASSERT(grok_pattern_find(&grok, "WORD", 4, &regexp, &len) == GROK_OK);
+  CU_ASSERT(len == 3 && !strncmp(regexp, "\\w+", len));
+  CU_ASSERT(grok_pattern_find(&grok, "TEST", 4, &regexp, &len) == GROK_OK);
+  CU_ASSERT(len == 4 && !strncmp(regexp, "test", len));
+  CU_ASSERT(grok_pattern_find(&grok, "FOO", 3, &regexp, &len) == GROK_OK);
+  CU_ASSERT(len == 3 && !strncmp(regexp, "bar", len));
 
   free(buf);
   CLEANUP;
 }
+
+void test_pattern_use_files_is_shared(void) {
+  grok_t a, b;
+  char *files[] = { "../grok-patterns" };
+  const char *regexp_a, *regexp_b;
+  size_t len_a, len_b;
+
+  grok_init(&a);
+  grok_init(&b);
+
+  grok_patterns_use_files(&a, files, 1);
+  grok_patterns_use_files(&b, files, 1);
+
+  /* Same file set means the same library */
+  CU_ASSERT(a.patterns != NULL);
+  CU_ASSERT(a.patterns == b.patterns);
+
+  CU_ASSERT(grok_pattern_find(&a, "WORD", 4, &regexp_a, &len_a) == GROK_OK);
+  CU_ASSERT(grok_pattern_find(&b, "WORD", 4, &regexp_b, &len_b) == GROK_OK);
+  CU_ASSERT(regexp_a == regexp_b);
+
+  /* Adding to a shared library copies it first */
+  grok_pattern_add(&a, "WORD", 4, "changed", 7);
+  CU_ASSERT(a.patterns != b.patterns);
+  CU_ASSERT(grok_pattern_find(&a, "WORD", 4, &regexp_a, &len_a) == GROK_OK);
+  CU_ASSERT(len_a == 7 && !strncmp(regexp_a, "changed", len_a));
+  CU_ASSERT(grok_pattern_find(&b, "WORD", 4, &regexp_b, &len_b) == GROK_OK);
+  CU_ASSERT(regexp_b != regexp_a);
+
+  grok_free(&a);
+  grok_free(&b);
+}
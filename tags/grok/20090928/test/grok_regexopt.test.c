@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "grok_regexopt.h"
+
+struct optcase {
+  char *input;
+  char *output; /* NULL means 'not optimized' */
+};
+
+static void _check_cases(const struct optcase *data) {
+  int i;
+
+  for (i = 0; data[i].input != NULL; i++) {
+    char *out = grok_regex_optimize(data[i].input, strlen(data[i].input),
+                                    NULL);
+    if (data[i].output == NULL) {
+      CU_ASSERT(out == NULL);
+    } else {
+      if (out == NULL || strcmp(out, data[i].output)) {
+        printf("\n'%s' => '%s' (expected '%s')\n", data[i].input,
+               out ? out : "(null)", data[i].output);
+      }
+      CU_ASSERT(out != NULL && !strcmp(out, data[i].output));
+    }
+    free(out);
+  }
+}
+
+void test_grok_regex_optimize_collapse_groups(void) {
+  struct optcase data[] = {
+    { "abc", "abc" },
+    { "(?:[+-]?(?:[0-9]+))", "[+-]?+[0-9]+" },
+    { "(?:a)*b", "a*+b" },
+    { "(?:(?:a|b))c", "(?:a|b)c" },
+    { "(?<0001>(?:a|b))", "(?<0001>a|b)" },
+    { "(?:ab)+", "(?:ab)+" },
+    { "x(?:)y", "xy" },
+    /* '\1' followed by '0' would read as '\10' */
+    { "(a)(?:\\1)0", "(a)(?:\\1)0" },
+    { NULL, NULL },
+  };
+  _check_cases(data);
+}
+
+void test_grok_regex_optimize_factor_prefixes(void) {
+  struct optcase data[] = {
+    { "Jan|Jun|Jul", "J(?:an|u(?:n|l))" },
+    { "(?:ab|ac|d)", "a(?:b|c)|d" },
+    /* only adjacent alternatives; order decides which one matches */
+    { "ab|d|ac", "ab|d|ac" },
+    { "a|ab", "a(?:|b)" },
+    /* lookbehind alternatives must stay fixed-length */
+    { "(?<!ab|ac)x", "(?<!ab|ac)x" },
+    { NULL, NULL },
+  };
+  _check_cases(data);
+}
+
+void test_grok_regex_optimize_possessive(void) {
+  struct optcase data[] = {
+    { "[0-9]+\\.", "[0-9]++\\." },
+    { "\\S+ \\d+", "\\S++ \\d+" },
+    { "(?<0001>\\d+) ", "(?<0001>\\d++) " },
+    { "\\d+\\w", "\\d+\\w" },
+    { "\\d+?x", "\\d+?x" },
+    { "\\d{3}x", "\\d{3}x" },
+    /* b? may match nothing, so what follows a+ is unknown */
+    { "a+b?c", "a+b?+c" },
+    /* predicates need to backtrack into the capture */
+    { "(?<0001>\\d+)(?C1) ", "(?<0001>\\d+)(?C1) " },
+    { "(?:\\d+x)+", "(?:\\d++x)+" },
+    { "(?:x\\d+)+y", "(?:x\\d+)+y" },
+    { "\\d+(?=x)", "\\d+(?=x)" },
+    { NULL, NULL },
+  };
+  _check_cases(data);
+}
+
+void test_grok_regex_optimize_unsupported(void) {
+  struct optcase data[] = {
+    { "(?i)abc", NULL },
+    { "a(?x: b )", NULL },
+    { "\\Qa.b\\E", NULL },
+    { "(*UTF8)abc", NULL },
+    { "(abc", NULL },
+    { "abc)", NULL },
+    { "[abc", NULL },
+    { NULL, NULL },
+  };
+  _check_cases(data);
+}
+
+void test_grok_regex_optimize_stats(void) {
+  grok_regexopt_stats_t stats;
+  const char *re = "(?:[0-9]+)\\.(?:ab|ac)";
+  char *out;
+
+  out = grok_regex_optimize(re, strlen(re), &stats);
+  CU_ASSERT(!strcmp(out, "[0-9]++\\.a(?:b|c)"));
+  CU_ASSERT(stats.groups_collapsed == 2);
+  CU_ASSERT(stats.prefixes_factored == 1);
+  CU_ASSERT(stats.quantifiers_possessive == 1);
+  free(out);
+}
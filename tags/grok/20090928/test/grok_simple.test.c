@@ -95,3 +95,52 @@ void test_grok_match_get_named_substring(void) {
 
   CLEANUP;
 }
+
+void test_grok_execn_batch(void) {
+  INIT;
+  grok_line_t lines[4] = {
+    { "user root from 10.0.0.1", 23 },
+    { "nothing to see", 14 },
+    { "user joe from 192.168.1.5 trailing", 34 },
+    { "user joe from 192.168.1.5", 8 }, /* only "user joe" is examined */
+  };
+  grok_batch_match_t results[4];
+  int *captures;
+  int ncap, user, ip;
+
+  grok_patterns_import_from_string(&grok, "WORD \\b\\w+\\b");
+  grok_patterns_import_from_string(&grok, "IP \\d+\\.\\d+\\.\\d+\\.\\d+");
+  ASSERT_COMPILEOK("user %{WORD:user} from %{IP:ip}");
+  CU_ASSERT(!grok_has_callouts(&grok));
+
+  ncap = grok_batch_captures_per_line(&grok);
+  captures = calloc(4 * ncap, sizeof(int));
+  user = grok_batch_capture_index(&grok, "WORD:user");
+  ip = grok_batch_capture_index(&grok, "IP:ip");
+  CU_ASSERT(user >= 0);
+  CU_ASSERT(ip >= 0);
+  CU_ASSERT(grok_batch_capture_index(&grok, "NOSUCH") == -1);
+
+  CU_ASSERT(grok_execn_batch(&grok, lines, 4, results, captures) == GROK_OK);
+
+  CU_ASSERT(results[0].status == GROK_OK);
+  CU_ASSERT(results[0].start == 0 && results[0].end == 23);
+  CU_ASSERT(captures[user] == 5 && captures[user + 1] == 9);
+  CU_ASSERT(captures[ip] == 15 && captures[ip + 1] == 23);
+
+  CU_ASSERT(results[1].status == GROK_ERROR_NOMATCH);
+  CU_ASSERT(captures[ncap + user] == -1);
+
+  CU_ASSERT(results[2].status == GROK_OK);
+  CU_ASSERT(captures[2 * ncap + ip] == 14);
+  CU_ASSERT(captures[2 * ncap + ip + 1] == 25);
+
+  CU_ASSERT(results[3].status == GROK_ERROR_NOMATCH);
+
+  /* captures are optional */
+  CU_ASSERT(grok_execn_batch(&grok, lines, 2, results, NULL) == GROK_OK);
+  CU_ASSERT(results[0].status == GROK_OK);
+
+  free(captures);
+  CLEANUP;
+}
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grok_table.h"
+
+static void write_file(const char *path, const char *data) {
+  FILE *fp = fopen(path, "w");
+  fputs(data, fp);
+  fclose(fp);
+}
+
+void test_grok_table_set(void) {
+  grok_table_t *table;
+  write_file("table_set.txt",
+             "# users\n"
+             "alice\n"
+             "  bob  \n"
+             "\n"
+             "carol");
+
+  table = grok_table_load("table_set.txt", GROK_TABLE_SET);
+  CU_ASSERT(table != NULL);
+  CU_ASSERT(grok_table_count(table) == 3);
+  CU_ASSERT(grok_table_contains(table, "alice", 5));
+  CU_ASSERT(grok_table_contains(table, "bob", 3));
+  CU_ASSERT(grok_table_contains(table, "carol", 5));
+  CU_ASSERT(!grok_table_contains(table, "# users", 7));
+  CU_ASSERT(!grok_table_contains(table, "ali", 3));
+  CU_ASSERT(!grok_table_contains(table, "dave", 4));
+
+  /* Loading the same file again returns the cached table */
+  CU_ASSERT(grok_table_load("table_set.txt", GROK_TABLE_SET) == table);
+  unlink("table_set.txt");
+}
+
+void test_grok_table_keyvalue(void) {
+  grok_table_t *table;
+  const char *value;
+  int len;
+
+  write_file("table_kv.txt",
+             "web1 alice\n"
+             "web2\t  bob smith\n"
+             "web1 carol\n");
+
+  table = grok_table_load("table_kv.txt", GROK_TABLE_KEYVALUE);
+  CU_ASSERT(table != NULL);
+  CU_ASSERT(grok_table_count(table) == 2);
+
+  /* later lines override earlier ones */
+  CU_ASSERT(grok_table_lookup(table, "web1", 4, &value, &len));
+  CU_ASSERT(len == 5 && !strncmp(value, "carol", len));
+  CU_ASSERT(grok_table_lookup(table, "web2", 4, &value, &len));
+  CU_ASSERT(len == 9 && !strncmp(value, "bob smith", len));
+  CU_ASSERT(!grok_table_lookup(table, "web3", 4, &value, &len));
+  CU_ASSERT(value == NULL);
+  unlink("table_kv.txt");
+}
+
+void test_grok_cidrtable(void) {
+  grok_cidrtable_t *table;
+  write_file("table_cidr.txt",
+             "10.0.0.0/8\n"
+             "192.168.1.17\n"
+             "172.16.0.0/12\n"
+             "10.1.0.0/16\n"
+             "2001:db8::/32\n"
+             "not-a-network\n");
+
+  table = grok_cidrtable_load("table_cidr.txt");
+  CU_ASSERT(table != NULL);
+  CU_ASSERT(grok_cidrtable_count(table) == 5);
+
+  CU_ASSERT(grok_cidrtable_contains(table, "10.0.0.1", 8));
+  CU_ASSERT(grok_cidrtable_contains(table, "10.255.255.255", 14));
+  CU_ASSERT(grok_cidrtable_contains(table, "10.1.2.3", 8));
+  CU_ASSERT(grok_cidrtable_contains(table, "192.168.1.17", 12));
+  CU_ASSERT(grok_cidrtable_contains(table, "172.31.0.1", 10));
+  CU_ASSERT(grok_cidrtable_contains(table, "2001:db8::1", 11));
+
+  CU_ASSERT(!grok_cidrtable_contains(table, "11.0.0.1", 8));
+  CU_ASSERT(!grok_cidrtable_contains(table, "192.168.1.18", 12));
+  CU_ASSERT(!grok_cidrtable_contains(table, "172.32.0.1", 10));
+  CU_ASSERT(!grok_cidrtable_contains(table, "2001:db9::1", 11));
+  CU_ASSERT(!grok_cidrtable_contains(table, "hello", 5));
+
+  /* Only the given length is examined */
+  CU_ASSERT(grok_cidrtable_contains(table, "10.0.0.1 trailing", 8));
+  unlink("table_cidr.txt");
+}
+
+void test_grok_table_refresh(void) {
+  grok_table_t *table;
+  const char *value, *old_value;
+  int len;
+
+  write_file("table_refresh.txt", "web1 alice\n");
+  grok_table_name("refreshowners", "table_refresh.txt");
+  table = grok_table_load_named("refreshowners", 13, GROK_TABLE_KEYVALUE);
+  CU_ASSERT(table != NULL);
+  CU_ASSERT(table == grok_table_load("table_refresh.txt",
+                                     GROK_TABLE_KEYVALUE));
+
+  /* refresh only looks at the file once a second; in the next one, an
+   * unchanged file is still not reloaded */
+  CU_ASSERT(grok_table_lookup(table, "web1", 4, &value, &len));
+  sleep(1);
+  CU_ASSERT(grok_table_refresh(table) == 0);
+  CU_ASSERT(grok_table_lookup(table, "web1", 4, &old_value, &len));
+  CU_ASSERT(old_value == value);
+
+  /* Rewriting the file in place doesn't change what we have until the
+   * next refresh */
+  write_file("table_refresh.txt", "web1 bob\nweb2 carol\n");
+  CU_ASSERT(grok_table_lookup(table, "web1", 4, &value, &len));
+  CU_ASSERT(len == 5 && !strncmp(value, "alice", len));
+  CU_ASSERT(grok_table_refresh(table) == 0); /* not this second */
+
+  sleep(1);
+  CU_ASSERT(grok_table_refresh(table) == 1);
+  CU_ASSERT(grok_table_count(table) == 2);
+  CU_ASSERT(grok_table_lookup(table, "web1", 4, &value, &len));
+  CU_ASSERT(len == 3 && !strncmp(value, "bob", len));
+  CU_ASSERT(grok_table_lookup(table, "web2", 4, &value, &len));
+  CU_ASSERT(len == 5 && !strncmp(value, "carol", len));
+  unlink("table_refresh.txt");
+}
+
+void test_grok_table_missing_file(void) {
+  grok_table_t *table;
+
+  unlink("table_missing.txt");
+  CU_ASSERT(grok_table_load("table_missing.txt", GROK_TABLE_SET) == NULL);
+  CU_ASSERT(strstr(grok_table_error(), "table_missing.txt") != NULL);
+
+  /* The failure is remembered for the rest of the second */
+  write_file("table_missing.txt", "alice\n");
+  CU_ASSERT(grok_table_load("table_missing.txt", GROK_TABLE_SET) == NULL);
+  CU_ASSERT(strstr(grok_table_error(), "table_missing.txt") != NULL);
+
+  sleep(1);
+  table = grok_table_load("table_missing.txt", GROK_TABLE_SET);
+  CU_ASSERT(table != NULL);
+  CU_ASSERT(grok_table_contains(table, "alice", 5));
+  CU_ASSERT(grok_table_load("table_missing.txt", GROK_TABLE_SET) == table);
+  unlink("table_missing.txt");
+}
+
+void test_grok_cidrtable_refresh(void) {
+  grok_cidrtable_t *table;
+
+  write_file("table_cidr_refresh.txt", "10.0.0.0/8\n");
+  table = grok_cidrtable_load("table_cidr_refresh.txt");
+  CU_ASSERT(table != NULL);
+  CU_ASSERT(grok_cidrtable_contains(table, "10.0.0.1", 8));
+
+  write_file("table_cidr_refresh.txt", "192.168.0.0/16\n172.16.0.0/12\n");
+  sleep(1);
+  CU_ASSERT(grok_cidrtable_refresh(table) == 1);
+  CU_ASSERT(grok_cidrtable_count(table) == 2);
+  CU_ASSERT(!grok_cidrtable_contains(table, "10.0.0.1", 8));
+  CU_ASSERT(grok_cidrtable_contains(table, "192.168.3.4", 11));
+  CU_ASSERT(grok_cidrtable_load("table_cidr_refresh.txt") == table);
+
+  sleep(1);
+  CU_ASSERT(grok_cidrtable_refresh(table) == 0);
+  unlink("table_cidr_refresh.txt");
+}
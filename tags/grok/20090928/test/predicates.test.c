@@ -13,6 +13,7 @@ void test_grok_with_predicate_compile_succeeds(void) {
   ASSERT_COMPILEOK("%{WORD<=30}");
   ASSERT_COMPILEOK("%{WORD==30}");
   ASSERT_COMPILEOK("%{WORD!=30}");
+  CU_ASSERT(grok_has_callouts(&grok));
 
   CLEANUP;
 }
@@ -130,3 +131,44 @@ void test_grok_numcompare_le(void) {
 
   CLEANUP;
 }
+
+void test_grok_predicate_in_cidr(void) {
+  INIT;
+  IMPORT_PATTERNS_FILE;
+  FILE *fp = fopen("predicate_cidr.txt", "w");
+  fputs("10.0.0.0/8\n192.168.0.0/16\n", fp);
+  fclose(fp);
+
+  ASSERT_COMPILEOK("^%{IP:src in_cidr \"predicate_cidr.txt\"}$");
+  ASSERT_MATCHOK("10.1.2.3");
+  ASSERT_MATCHOK("192.168.44.1");
+  ASSERT_MATCHFAIL("11.1.2.3");
+  ASSERT_MATCHFAIL("172.16.0.1");
+  CLEANUP;
+
+  grok_init(&grok);
+  IMPORT_PATTERNS_FILE;
+  ASSERT_COMPILEOK("^%{IP:src !in_cidr predicate_cidr.txt}$");
+  ASSERT_MATCHFAIL("10.1.2.3");
+  ASSERT_MATCHOK("172.16.0.1");
+  CLEANUP;
+
+  unlink("predicate_cidr.txt");
+}
+
+void test_grok_predicate_in_set(void) {
+  INIT;
+  IMPORT_PATTERNS_FILE;
+  FILE *fp = fopen("predicate_set.txt", "w");
+  fputs("root\nadmin\n", fp);
+  fclose(fp);
+
+  ASSERT_COMPILEOK("user %{WORD:user in_set \"predicate_set.txt\"} failed");
+  ASSERT_MATCHOK("user root failed");
+  ASSERT_MATCHOK("user admin failed");
+  ASSERT_MATCHFAIL("user jls failed");
+  ASSERT_MATCHFAIL("user roots failed");
+  CLEANUP;
+
+  unlink("predicate_set.txt");
+}
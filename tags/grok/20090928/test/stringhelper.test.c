@@ -96,6 +96,84 @@ void test_string_escape_c(void) {
   }
 }
 
+struct escape_case {
+  char *input;
+  char *output;
+};
+
+static void _check_escape(void (*escape)(char **, int *, int *),
+                          const struct escape_case *data) {
+  int i;
+
+  for (i = 0; data[i].input != NULL; i++) {
+    char *s = strdup(data[i].input);
+    int len = strlen(s);
+    int size = len + 1;
+
+    escape(&s, &len, &size);
+    if (strcmp(s, data[i].output)) {
+      printf("\n'%s' vs '%s' ('%s')\n", data[i].input, s, data[i].output);
+    }
+    CU_ASSERT(!strcmp(s, data[i].output));
+    CU_ASSERT(len == strlen(data[i].output));
+    CU_ASSERT(size > len);
+    free(s);
+  }
+}
+
+void test_string_escape_json(void) {
+  struct escape_case data[] = {
+    { "", "" },
+    { "no change at all, long enough to fill a few words",
+      "no change at all, long enough to fill a few words" },
+    { "\"a\\b/c\"", "\\\"a\\\\b\\/c\\\"" },
+    { "tab\tnl\n", "tab\\u0009nl\\u000a" },
+    /* each nonprintable becomes exactly one \u00XX */
+    { "\001abcdef", "\\u0001abcdef" },
+    { "\377", "\\u00ff" },
+    { NULL, NULL },
+  };
+  _check_escape(string_escape_json, data);
+}
+
+void test_string_escape_shell(void) {
+  struct escape_case data[] = {
+    { "plain words", "plain words" },
+    { "$(rm -rf /)", "\\$\\(rm -rf /\\)" },
+    /* the backslash added for " is not escaped again */
+    { "say \"hi\"", "say \\\"hi\\\"" },
+    { "a\\b", "a\\\\b" },
+    { NULL, NULL },
+  };
+  _check_escape(string_escape_shell, data);
+}
+
+void test_string_escape_shell_dq(void) {
+  struct escape_case data[] = {
+    { "(not special)", "(not special)" },
+    { "`id` $HOME \"\\", "\\`id\\` \\$HOME \\\"\\\\" },
+    { NULL, NULL },
+  };
+  _check_escape(string_escape_shell_dq, data);
+}
+
+void test_string_escape_many_quotes(void) {
+  int len = 100000, size = len + 1, i;
+  char *s = malloc(size);
+
+  memset(s, '"', len);
+  s[len] = '\0';
+  string_escape_shell(&s, &len, &size);
+  CU_ASSERT(len == 200000);
+  for (i = 0; i < len; i += 2) {
+    if (s[i] != '\\' || s[i + 1] != '"')
+      break;
+  }
+  CU_ASSERT(i == len);
+  CU_ASSERT(s[len] == '\0');
+  free(s);
+}
+
 void test_string_ndup(void) {
   char data[] = "hello there";
   char *p;
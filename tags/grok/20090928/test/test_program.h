@@ -0,0 +1,107 @@
+#ifndef _TEST_PROGRAM_H_
+#define _TEST_PROGRAM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <event.h>
+
+#include "grok.h"
+#include "grok_program.h"
+#include "grok_input.h"
+#include "grok_matchconf.h"
+
+/* Helpers for tests that feed an input through a real program and
+ * collection. The program has one match block that matches every line;
+ * its reaction (%{@LINE}) is written to a temporary file the test reads
+ * back, instead of to a shell. */
+
+typedef struct test_program {
+  grok_collection_t *gcol;
+  grok_program_t gprog;
+  grok_input_t input; /* fill in before test_program_start */
+  grok_matchconf_t gmc;
+  char output[64];
+  int started;
+} test_program_t;
+
+static void test_program_init(test_program_t *tp) {
+  int fd;
+
+  memset(tp, 0, sizeof(*tp));
+  tp->gcol = grok_collection_init();
+  grok_matchconfig_init(&tp->gprog, &tp->gmc);
+  tp->gmc.pattern = ".*";
+  tp->gmc.reaction = "%{@LINE}";
+  tp->gmc.flush = 1;
+
+  strcpy(tp->output, "/tmp/grok_test_output.XXXXXX");
+  fd = mkstemp(tp->output);
+  tp->gmc.shellinput = fdopen(fd, "w");
+
+  tp->gprog.matchconfigs = &tp->gmc;
+  tp->gprog.nmatchconfigs = 1;
+  tp->gprog.inputs = &tp->input;
+  tp->gprog.ninputs = 1;
+}
+
+static void test_program_start(test_program_t *tp) {
+  grok_collection_add(tp->gcol, &tp->gprog);
+  tp->started = 1;
+}
+
+/* Run the event loop for 'msec' milliseconds */
+static void test_program_run(test_program_t *tp, int msec) {
+  struct timeval tv = { msec / 1000, (msec % 1000) * 1000 };
+
+  event_base_loopexit(tp->gcol->ebase, &tv);
+  event_base_dispatch(tp->gcol->ebase);
+}
+
+/* Everything the match block wrote so far. Free it when done. */
+static char *test_program_output(test_program_t *tp) {
+  FILE *fp = fopen(tp->output, "r");
+  char *buf;
+  long len;
+
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  rewind(fp);
+  buf = malloc(len + 1);
+  len = fread(buf, 1, len, fp);
+  buf[len] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+/* How many times 'line' reached the match block */
+static int test_program_count(test_program_t *tp, const char *line) {
+  char *output = test_program_output(tp);
+  char *p;
+  int len = strlen(line);
+  int count = 0;
+
+  for (p = output; *p != '\0'; p = strchr(p, '\n') + 1) {
+    if (!strncmp(p, line, len) && p[len] == '\n') {
+      count++;
+    }
+  }
+  free(output);
+  return count;
+}
+
+static void test_program_free(test_program_t *tp) {
+  if (tp->started) {
+    grok_input_stop(&tp->input);
+  }
+  grok_matchconfig_close(&tp->gprog, &tp->gmc); /* closes the output */
+  unlink(tp->output);
+  event_del(tp->gcol->ev_sigchld);
+  event_base_free(tp->gcol->ebase);
+  free(tp->gcol->ev_sigchld);
+  free(tp->gcol->programs);
+  free(tp->gcol);
+}
+
+#endif /* _TEST_PROGRAM_H_ */